@@ -0,0 +1,34 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL2/SDL.h>
+#include "bench.h"
+#include "../src/display.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Microbenchmarks for the renderer, run with 'make bench'
+// They draw into an offscreen color buffer, no window is opened
+///////////////////////////////////////////////////////////////////////////////
+
+double bench_seconds(void) {
+	return (double)SDL_GetPerformanceCounter() / (double)SDL_GetPerformanceFrequency();
+}
+
+void bench_report(const char* name, double items, double seconds, const char* unit) {
+	printf("%-44s %9.1f M%s/s  (%.3f s)\n", name, items / seconds / 1e6, unit, seconds);
+}
+
+int main(void) {
+	window_width = 800;
+	window_height = 600;
+	color_buffer = (uint32_t*) malloc(sizeof(uint32_t) * window_width * window_height);
+
+	bench_texture();
+	bench_matrix();
+	bench_bvh();
+	bench_compress();
+	bench_depth_sort();
+	bench_points();
+
+	free(color_buffer);
+	return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+// seconds from the high resolution counter
+double bench_seconds(void);
+
+// print one result line, rate is in millions of items per second
+void bench_report(const char* name, double items, double seconds, const char* unit);
+
+void bench_texture(void);
+void bench_matrix(void);
+void bench_bvh(void);
+void bench_compress(void);
+void bench_depth_sort(void);
+void bench_points(void);
+
+#endif
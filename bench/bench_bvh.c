@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+#include <SDL2/SDL.h>
+#include "bench.h"
+#include "../src/array.h"
+#include "../src/bvh.h"
+#include "../src/mesh.h"
+#include "../src/light.h"
+#include "../src/raycast.h"
+#include "../src/stats.h"
+#include "../src/display.h"
+
+// a bumpy sphere of about 200k triangles, many more than the sample models
+#define SPHERE_RINGS 256
+#define SPHERE_SEGMENTS 400
+#define BUILD_PASSES 5
+#define TRACE_PASSES 5
+
+// keeps the compiler from dropping the loops
+static volatile float sink;
+
+static void make_bumpy_sphere(vec3_t** vertices, face_t** faces) {
+	for (int ring = 0; ring <= SPHERE_RINGS; ring++) {
+		float theta = M_PI * ring / SPHERE_RINGS;
+		for (int segment = 0; segment < SPHERE_SEGMENTS; segment++) {
+			float phi = 2 * M_PI * segment / SPHERE_SEGMENTS;
+			float radius = 1 + 0.05f * sinf(9 * theta) * sinf(7 * phi);
+			vec3_t v = { radius * sinf(theta) * cosf(phi), radius * cosf(theta), radius * sinf(theta) * sinf(phi) };
+			array_push(*vertices, v);
+		}
+	}
+	for (int ring = 0; ring < SPHERE_RINGS; ring++) {
+		for (int segment = 0; segment < SPHERE_SEGMENTS; segment++) {
+			// 1-based like the faces loaded from .obj files
+			int a = ring * SPHERE_SEGMENTS + segment + 1;
+			int b = ring * SPHERE_SEGMENTS + (segment + 1) % SPHERE_SEGMENTS + 1;
+			int c = a + SPHERE_SEGMENTS;
+			int d = b + SPHERE_SEGMENTS;
+			face_t first = { a, b, c, 0xFFFFFFFF };
+			face_t second = { b, d, c, 0xFFFFFFFF };
+			array_push(*faces, first);
+			array_push(*faces, second);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Building the hierarchy, then one ray per pixel of an 800x600 view of the
+// sphere: single rays, 2x2 packets on one thread, and the whole ray cast
+// render mode (shadow rays included) on the thread pool
+///////////////////////////////////////////////////////////////////////////////
+void bench_bvh(void) {
+	vec3_t* vertices = NULL;
+	face_t* faces = NULL;
+	make_bumpy_sphere(&vertices, &faces);
+	int num_faces = array_length(faces);
+
+	bvh_t* bvh = NULL;
+	double start = bench_seconds();
+	for (int pass = 0; pass < BUILD_PASSES; pass++) {
+		free_bvh(bvh);
+		bvh = build_bvh(vertices, faces);
+	}
+	double seconds = bench_seconds() - start;
+	bench_report("build_bvh, binned SAH", (double)BUILD_PASSES * num_faces, seconds, "triangles");
+	printf("%-44s %9.1f ms for %d triangles, %d nodes\n", "", seconds / BUILD_PASSES * 1000, num_faces, bvh->num_nodes);
+
+	// the camera 3 units in front of the sphere, 60 degrees of vertical field of view
+	vec3_t origin = { 0, 0, -3 };
+	float scale_y = tanf(M_PI / 6);
+	float scale_x = scale_y * window_width / window_height;
+	double num_rays = (double)TRACE_PASSES * window_width * window_height;
+	float sum;
+
+	sum = 0;
+	start = bench_seconds();
+	for (int pass = 0; pass < TRACE_PASSES; pass++) {
+		for (int y = 0; y < window_height; y++) {
+			for (int x = 0; x < window_width; x++) {
+				ray_t ray = { origin, {
+					((x + 0.5f) / (window_width / 2.0f) - 1) * scale_x,
+					(1 - (y + 0.5f) / (window_height / 2.0f)) * scale_y,
+					1
+				} };
+				ray_hit_t hit = bvh_intersect(bvh, ray, FLT_MAX);
+				sum += hit.face >= 0 ? hit.t : 0;
+			}
+		}
+	}
+	bench_report("bvh_intersect, single rays", num_rays, bench_seconds() - start, "rays");
+	sink = sum;
+
+	sum = 0;
+	start = bench_seconds();
+	for (int pass = 0; pass < TRACE_PASSES; pass++) {
+		for (int y = 0; y < window_height; y += 2) {
+			for (int x = 0; x < window_width; x += 2) {
+				ray_packet_t packet = { .origin = origin };
+				for (int i = 0; i < BVH_PACKET_SIZE; i++) {
+					packet.dx[i] = ((x + (i & 1) + 0.5f) / (window_width / 2.0f) - 1) * scale_x;
+					packet.dy[i] = (1 - (y + (i >> 1) + 0.5f) / (window_height / 2.0f)) * scale_y;
+					packet.dz[i] = 1;
+				}
+				ray_hit_t hits[BVH_PACKET_SIZE];
+				bvh_intersect_packet(bvh, &packet, FLT_MAX, hits);
+				for (int i = 0; i < BVH_PACKET_SIZE; i++) {
+					sum += hits[i].face >= 0 ? hits[i].t : 0;
+				}
+			}
+		}
+	}
+	bench_report("bvh_intersect_packet, 2x2 packets", num_rays, bench_seconds() - start, "rays");
+	sink = sum;
+
+	// the render mode needs the sphere as the mesh, with the view matrix moving it 3 units away
+	mesh.vertices = vertices;
+	mesh.faces = faces;
+	mesh.bvh = bvh;
+	mesh.face_normals = (vec3_t*) malloc(sizeof(vec3_t) * num_faces);
+	for (int i = 0; i < num_faces; i++) {
+		vec3_t a = vertices[faces[i].a - 1];
+		vec3_t normal = vec3_cross(vec3_subtract(vertices[faces[i].b - 1], a), vec3_subtract(vertices[faces[i].c - 1], a));
+		vec3_normalize(&normal);
+		mesh.face_normals[i] = normal;
+	}
+	mat4_t view_matrix = mat4_make_translation(0, 0, 3);
+	mat3x4_t world_view_matrix = mat3x4_from_mat4(&view_matrix);
+	mat4_t proj_matrix = mat4_make_perspective(M_PI / 3, (float)window_height / window_width, 0.1, 100);
+	light_set_view_matrix(view_matrix);
+	raycast_set_camera(&world_view_matrix, &proj_matrix);
+
+	double rays_cast = 0;
+	start = bench_seconds();
+	for (int pass = 0; pass < TRACE_PASSES; pass++) {
+		render_raycast();
+		rays_cast += frame_stats.rays_cast;
+	}
+	char name[64];
+	snprintf(name, sizeof(name), "render_raycast, %d threads", SDL_GetCPUCount());
+	bench_report(name, rays_cast, bench_seconds() - start, "rays");
+	raycast_shutdown_thread_pool();
+
+	free(mesh.face_normals);
+	mesh.face_normals = NULL;
+	mesh.vertices = NULL;
+	mesh.faces = NULL;
+	mesh.bvh = NULL;
+	free_bvh(bvh);
+	array_free(faces);
+	array_free(vertices);
+}
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "../src/array.h"
+#include "../src/mesh.h"
+#include "../src/compress.h"
+
+#define COMPRESS_PASSES 2000
+
+// keeps the compiler from dropping the loops
+static volatile float sink;
+
+static const char* assets[] = { "./assets/f22.obj", "./assets/dog.obj", "./assets/cube2.obj" };
+
+static void free_mesh(void) {
+	array_free(mesh.vertices);
+	array_free(mesh.normals);
+	array_free(mesh.texcoords);
+	array_free(mesh.faces);
+	array_free(mesh.face_normals);
+	array_free(mesh.edges);
+	array_free(mesh.face_edges);
+	array_free(mesh.clusters);
+	array_free(mesh.cluster_vertices);
+	free_bvh(mesh.bvh);
+	free_compressed_mesh(mesh.compressed);
+	mesh.vertices = mesh.normals = mesh.face_normals = NULL;
+	mesh.texcoords = NULL;
+	mesh.faces = NULL;
+	mesh.edges = NULL;
+	mesh.face_edges = mesh.cluster_vertices = NULL;
+	mesh.clusters = NULL;
+	mesh.bvh = NULL;
+	mesh.compressed = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// What the compressed mesh saves on every asset, then the positions and
+// normals of every cluster of the last large one read the way the vertex
+// stage reads them, from the float arrays and decoded from the compressed ones
+///////////////////////////////////////////////////////////////////////////////
+void bench_compress(void) {
+	int num_assets = sizeof(assets) / sizeof(assets[0]);
+	for (int a = 0; a < num_assets; a++) {
+		load_obj_file_data((char*)assets[a]);
+		compress_loaded_mesh(false);
+		if (mesh.compressed) {
+			print_compression_savings(stdout, assets[a], mesh.compressed, array_length(mesh.vertices), vertex_stage_float_bytes());
+		}
+		free_mesh();
+	}
+
+	load_obj_file_data((char*)assets[1]);
+	compress_loaded_mesh(false);
+	if (!mesh.compressed) {
+		free_mesh();
+		return;
+	}
+
+	mat3x4_t matrix = mat3x4_make_trs((vec3_t){ 1, 1, 1 }, (vec3_t){ 0.3f, 0.5f, 0.7f }, (vec3_t){ 0, 0, 5 });
+	mat3x4_t dequantized_matrix = dequantize_matrix(mesh.compressed, &matrix);
+	int num_clusters = array_length(mesh.clusters);
+	double num_vertices = (double)COMPRESS_PASSES * array_length(mesh.cluster_vertices);
+	float x[CLUSTER_MAX_VERTICES], y[CLUSTER_MAX_VERTICES], z[CLUSTER_MAX_VERTICES];
+	float sum;
+
+	sum = 0;
+	double start = bench_seconds();
+	for (int pass = 0; pass < COMPRESS_PASSES; pass++) {
+		for (int k = 0; k < num_clusters; k++) {
+			cluster_t* cluster = &mesh.clusters[k];
+			int* cluster_vertices = &mesh.cluster_vertices[cluster->first_vertex];
+			for (int j = 0; j < cluster->num_vertices; j++) {
+				vec4_t p = mat3x4_mul_point(&matrix, mesh.vertices[cluster_vertices[j]]);
+				vec3_t n = mesh.normals[cluster_vertices[j]];
+				sum += p.x + p.y + p.z + n.x + n.y + n.z;
+			}
+		}
+	}
+	bench_report("cluster vertices, float arrays", num_vertices, bench_seconds() - start, "vertices");
+	sink = sum;
+
+	sum = 0;
+	start = bench_seconds();
+	for (int pass = 0; pass < COMPRESS_PASSES; pass++) {
+		for (int k = 0; k < num_clusters; k++) {
+			cluster_t* cluster = &mesh.clusters[k];
+			decode_positions(&mesh.compressed->positions[cluster->first_vertex], cluster->num_vertices, x, y, z);
+			for (int j = 0; j < cluster->num_vertices; j++) {
+				vec4_t p = mat3x4_mul_point(&dequantized_matrix, (vec3_t){ x[j], y[j], z[j] });
+				sum += p.x + p.y + p.z;
+			}
+			decode_normals(&mesh.compressed->normals[cluster->first_vertex], cluster->num_vertices, x, y, z);
+			for (int j = 0; j < cluster->num_vertices; j++) {
+				sum += x[j] + y[j] + z[j];
+			}
+		}
+	}
+	bench_report("cluster vertices, decoded", num_vertices, bench_seconds() - start, "vertices");
+	sink = sum;
+
+	free_mesh();
+}
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "bench.h"
+#include "../src/array.h"
+#include "../src/triangle.h"
+#include "../src/matrix.h"
+#include "../src/depth_sort.h"
+
+// triangles scattered through a cube, as many as a small model and far more than the sample models
+#define SMALL_CLOUD_TRIANGLES 2000
+#define LARGE_CLOUD_TRIANGLES 50000
+#define SORT_FRAMES 200
+// the turn of the mesh per frame in the window
+#define SLOW_TURN 0.01f
+
+static float random_unit(void) {
+	return (float)rand() / RAND_MAX * 2 - 1;
+}
+
+static void make_triangle_cloud(vec3_t** vertices, face_t** faces, int num_triangles) {
+	for (int i = 0; i < num_triangles; i++) {
+		vec3_t center = { random_unit(), random_unit(), random_unit() };
+		for (int j = 0; j < 3; j++) {
+			vec3_t v = { center.x + 0.02f * random_unit(), center.y + 0.02f * random_unit(), center.z + 0.02f * random_unit() };
+			array_push(*vertices, v);
+		}
+		// 1-based like the faces loaded from .obj files
+		face_t face = { 3 * i + 1, 3 * i + 2, 3 * i + 3, 0xFFFFFFFF };
+		array_push(*faces, face);
+	}
+}
+
+// the triangles of every face at this rotation, in mesh order like prepare_triangles() makes them
+static void make_triangles(triangle_t* triangles, vec3_t* vertices, face_t* faces, int num_faces, vec3_t rotation) {
+	mat3x4_t matrix = mat3x4_make_trs((vec3_t){ 1, 1, 1 }, rotation, (vec3_t){ 0, 0, 5 });
+	for (int i = 0; i < num_faces; i++) {
+		vec4_t a = mat3x4_mul_point(&matrix, vertices[faces[i].a - 1]);
+		vec4_t b = mat3x4_mul_point(&matrix, vertices[faces[i].b - 1]);
+		vec4_t c = mat3x4_mul_point(&matrix, vertices[faces[i].c - 1]);
+		triangles[i].avg_depth = (a.z + b.z + c.z) / 3;
+		triangles[i].face_index = i;
+	}
+}
+
+static void bench_scenario(const char* name, vec3_t* vertices, face_t* faces, bool random_turns, bool coherent) {
+	int num_faces = array_length(faces);
+	triangle_t* triangles = (triangle_t*) calloc(num_faces, sizeof(triangle_t));
+	coherent_depth_sort = coherent;
+	allocate_depth_sort_buffer(num_faces);
+	srand(1);
+
+	double seconds = 0;
+	vec3_t rotation = { 0, 0, 0 };
+	for (int frame = 0; frame < SORT_FRAMES; frame++) {
+		if (random_turns) {
+			rotation = (vec3_t){ 3.14159265f * random_unit(), 3.14159265f * random_unit(), 3.14159265f * random_unit() };
+		} else {
+			rotation.x += SLOW_TURN;
+			rotation.y += SLOW_TURN;
+			rotation.z += SLOW_TURN;
+		}
+		make_triangles(triangles, vertices, faces, num_faces, rotation);
+		double start = bench_seconds();
+		sort_triangles_by_depth(triangles, num_faces);
+		seconds += bench_seconds() - start;
+	}
+	bench_report(name, (double)SORT_FRAMES * num_faces, seconds, "triangles");
+
+	free_depth_sort_buffer();
+	free(triangles);
+	coherent_depth_sort = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Depth sort of a model turning as slowly as in the window and of one seen
+// from a random orientation every frame, where the order of the last frame
+// is of no use, each sorted from scratch and starting from the last order
+///////////////////////////////////////////////////////////////////////////////
+void bench_depth_sort(void) {
+	static const int sizes[] = { SMALL_CLOUD_TRIANGLES, LARGE_CLOUD_TRIANGLES };
+	for (int i = 0; i < 2; i++) {
+		vec3_t* vertices = NULL;
+		face_t* faces = NULL;
+		make_triangle_cloud(&vertices, &faces, sizes[i]);
+		char name[64];
+		snprintf(name, sizeof(name), "depth sort %dk, slow turn, from scratch", sizes[i] / 1000);
+		bench_scenario(name, vertices, faces, false, false);
+		snprintf(name, sizeof(name), "depth sort %dk, slow turn, coherent", sizes[i] / 1000);
+		bench_scenario(name, vertices, faces, false, true);
+		snprintf(name, sizeof(name), "depth sort %dk, random turns, from scratch", sizes[i] / 1000);
+		bench_scenario(name, vertices, faces, true, false);
+		snprintf(name, sizeof(name), "depth sort %dk, random turns, coherent", sizes[i] / 1000);
+		bench_scenario(name, vertices, faces, true, true);
+		array_free(vertices);
+		array_free(faces);
+	}
+}
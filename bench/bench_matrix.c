@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "../src/matrix.h"
+
+// about the vertex count of a detailed model, small enough to stay in L2
+#define NUM_POINTS 16384
+#define PASSES 1000
+#define NUM_MATRICES 1024
+#define MATRIX_PASSES 1000
+
+// keeps the compiler from dropping the loops
+static volatile float sink;
+
+///////////////////////////////////////////////////////////////////////////////
+// The math as it was before the header versions: full 4x4 products taking
+// the matrices by value, out of line as if they were in another translation unit
+///////////////////////////////////////////////////////////////////////////////
+
+__attribute__((noinline)) static vec4_t old_mat4_mul_vec4(mat4_t m, vec4_t v) {
+	vec4_t result;
+	result.x = m.m[0][0] * v.x + m.m[0][1] * v.y + m.m[0][2] * v.z + m.m[0][3] * v.w;
+	result.y = m.m[1][0] * v.x + m.m[1][1] * v.y + m.m[1][2] * v.z + m.m[1][3] * v.w;
+	result.z = m.m[2][0] * v.x + m.m[2][1] * v.y + m.m[2][2] * v.z + m.m[2][3] * v.w;
+	result.w = m.m[3][0] * v.x + m.m[3][1] * v.y + m.m[3][2] * v.z + m.m[3][3] * v.w;
+	return result;
+}
+
+__attribute__((noinline)) static mat4_t old_mat4_mul_mat4(mat4_t a, mat4_t b) {
+	mat4_t m;
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 4; j++) {
+			m.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+		}
+	}
+	return m;
+}
+
+// the world matrix the way prepare_triangles used to build it, five matrices and five products
+static mat4_t old_world_matrix(vec3_t scale, vec3_t rotation, vec3_t translation) {
+	mat4_t world_matrix = mat4_identity();
+	world_matrix = old_mat4_mul_mat4(mat4_make_scale(scale.x, scale.y, scale.z), world_matrix);
+	world_matrix = old_mat4_mul_mat4(mat4_make_rotation_z(rotation.z), world_matrix);
+	world_matrix = old_mat4_mul_mat4(mat4_make_rotation_y(rotation.y), world_matrix);
+	world_matrix = old_mat4_mul_mat4(mat4_make_rotation_x(rotation.x), world_matrix);
+	world_matrix = old_mat4_mul_mat4(mat4_make_translation(translation.x, translation.y, translation.z), world_matrix);
+	return world_matrix;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Transforming points with the old by value 4x4 product against the inlined
+// affine one, composing matrices, and building the world matrix of a mesh
+///////////////////////////////////////////////////////////////////////////////
+void bench_matrix(void) {
+	vec3_t* points = (vec3_t*) malloc(sizeof(vec3_t) * NUM_POINTS);
+	vec4_t* transformed = (vec4_t*) malloc(sizeof(vec4_t) * NUM_POINTS);
+	uint32_t seed = 12345;
+	for (int i = 0; i < NUM_POINTS; i++) {
+		seed = seed * 1664525 + 1013904223;
+		points[i].x = (float)(seed >> 8) / (1 << 24) - 0.5f;
+		seed = seed * 1664525 + 1013904223;
+		points[i].y = (float)(seed >> 8) / (1 << 24) - 0.5f;
+		seed = seed * 1664525 + 1013904223;
+		points[i].z = (float)(seed >> 8) / (1 << 24) - 0.5f;
+	}
+
+	// one world matrix per object, all rotated differently
+	vec3_t scale = { 1.5, 1.5, 1.5 };
+	vec3_t translation = { 0, 0, 5 };
+	mat4_t* world_matrices = (mat4_t*) malloc(sizeof(mat4_t) * NUM_MATRICES);
+	mat3x4_t* affine_world_matrices = (mat3x4_t*) malloc(sizeof(mat3x4_t) * NUM_MATRICES);
+	vec3_t* rotations = (vec3_t*) malloc(sizeof(vec3_t) * NUM_MATRICES);
+	for (int i = 0; i < NUM_MATRICES; i++) {
+		rotations[i] = (vec3_t){ i * 0.01f, i * 0.02f, i * 0.03f };
+		world_matrices[i] = old_world_matrix(scale, rotations[i], translation);
+		affine_world_matrices[i] = mat3x4_make_trs(scale, rotations[i], translation);
+	}
+
+	double num_points = (double)PASSES * NUM_POINTS;
+	double num_matrices = (double)MATRIX_PASSES * NUM_MATRICES;
+	float sum;
+	double start;
+
+	// the vertex stage, every pass transforms the points with another matrix
+	sum = 0;
+	start = bench_seconds();
+	for (int pass = 0; pass < PASSES; pass++) {
+		mat4_t world_matrix = world_matrices[pass % NUM_MATRICES];
+		for (int i = 0; i < NUM_POINTS; i++)
+			transformed[i] = old_mat4_mul_vec4(world_matrix, vec4_from_vec3(points[i]));
+		sum += transformed[pass % NUM_POINTS].z;
+	}
+	bench_report("mat4_mul_vec4, by value", num_points, bench_seconds() - start, "points");
+	sink = sum;
+
+	sum = 0;
+	start = bench_seconds();
+	for (int pass = 0; pass < PASSES; pass++) {
+		const mat3x4_t* world_matrix = &affine_world_matrices[pass % NUM_MATRICES];
+		for (int i = 0; i < NUM_POINTS; i++)
+			transformed[i] = mat3x4_mul_point(world_matrix, points[i]);
+		sum += transformed[pass % NUM_POINTS].z;
+	}
+	bench_report("mat3x4_mul_point, inlined", num_points, bench_seconds() - start, "points");
+	sink = sum;
+
+	// composing transforms, the world-view matrix of every object
+	mat4_t view_matrix = mat4_look_at((vec3_t){ 1, 2, -3 }, (vec3_t){ 0, 0, 5 }, (vec3_t){ 0, 1, 0 });
+	mat3x4_t affine_view_matrix = mat3x4_from_mat4(&view_matrix);
+	sum = 0;
+	start = bench_seconds();
+	for (int pass = 0; pass < MATRIX_PASSES; pass++) {
+		for (int i = 0; i < NUM_MATRICES; i++) {
+			mat4_t world_view_matrix = old_mat4_mul_mat4(view_matrix, world_matrices[i]);
+			for (int row = 0; row < 3; row++)
+				for (int col = 0; col < 4; col++)
+					sum += world_view_matrix.m[row][col];
+		}
+		view_matrix.m[0][3] += 0.001f;
+	}
+	bench_report("mat4_mul_mat4, by value", num_matrices, bench_seconds() - start, "matrices");
+	sink = sum;
+
+	sum = 0;
+	start = bench_seconds();
+	for (int pass = 0; pass < MATRIX_PASSES; pass++) {
+		for (int i = 0; i < NUM_MATRICES; i++) {
+			mat3x4_t world_view_matrix;
+			mat3x4_mul_mat3x4_into(&world_view_matrix, &affine_view_matrix, &affine_world_matrices[i]);
+			for (int row = 0; row < 3; row++)
+				for (int col = 0; col < 4; col++)
+					sum += world_view_matrix.m[row][col];
+		}
+		affine_view_matrix.m[0][3] += 0.001f;
+	}
+	bench_report("mat3x4_mul_mat3x4_into, inlined", num_matrices, bench_seconds() - start, "matrices");
+	sink = sum;
+
+	// the world matrix of a mesh from its scale, rotation and translation
+	sum = 0;
+	start = bench_seconds();
+	for (int i = 0; i < NUM_MATRICES * 100; i++) {
+		mat4_t world_matrix = old_world_matrix(scale, rotations[i % NUM_MATRICES], translation);
+		sum += world_matrix.m[0][0] + world_matrix.m[1][1] + world_matrix.m[2][2];
+	}
+	bench_report("world matrix, five mat4 products", NUM_MATRICES * 100, bench_seconds() - start, "matrices");
+	sink = sum;
+
+	sum = 0;
+	start = bench_seconds();
+	for (int i = 0; i < NUM_MATRICES * 100; i++) {
+		mat3x4_t world_matrix = mat3x4_make_trs(scale, rotations[i % NUM_MATRICES], translation);
+		sum += world_matrix.m[0][0] + world_matrix.m[1][1] + world_matrix.m[2][2];
+	}
+	bench_report("world matrix, mat3x4_make_trs", NUM_MATRICES * 100, bench_seconds() - start, "matrices");
+	sink = sum;
+
+	free(rotations);
+	free(affine_world_matrices);
+	free(world_matrices);
+	free(transformed);
+	free(points);
+}
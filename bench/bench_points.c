@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <SDL2/SDL.h>
+#include "bench.h"
+#include "../src/array.h"
+#include "../src/mesh.h"
+#include "../src/matrix.h"
+#include "../src/points.h"
+#include "../src/stats.h"
+#include "../src/display.h"
+
+// a scan of ten million points, as dense as a lidar capture of a room
+#define CLOUD_POINTS 10000000
+#define SPLAT_PASSES 5
+
+static float random_unit(void) {
+	return (float)rand() / RAND_MAX * 2 - 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Point splats of a cloud filling the view, on the calling thread alone and
+// on the thread pool
+///////////////////////////////////////////////////////////////////////////////
+void bench_points(void) {
+	srand(1);
+	vec3_t* vertices = array_hold(NULL, CLOUD_POINTS, sizeof(vec3_t));
+	for (int i = 0; i < CLOUD_POINTS; i++) {
+		vertices[i] = (vec3_t){ random_unit(), random_unit(), random_unit() };
+	}
+	mesh.vertices = vertices;
+	mesh.bounds_min = (vec3_t){ -1, -1, -1 };
+	mesh.bounds_max = (vec3_t){ 1, 1, 1 };
+
+	mat4_t view_matrix = mat4_make_translation(0, 0, 3);
+	mat3x4_t world_view_matrix = mat3x4_from_mat4(&view_matrix);
+	mat4_t proj_matrix = mat4_make_perspective(3.14159265f / 3, (float)window_height / window_width, 0.1, 100);
+	mat4_t world_view_projection_matrix;
+	mat4_mul_mat3x4_into(&world_view_projection_matrix, &proj_matrix, &world_view_matrix);
+
+	for (int pool = 0; pool < 2; pool++) {
+		points_use_thread_pool = pool;
+		double points_drawn = 0;
+		double start = bench_seconds();
+		for (int pass = 0; pass < SPLAT_PASSES; pass++) {
+			render_points(&world_view_projection_matrix);
+			points_drawn += frame_stats.points_drawn;
+		}
+		char name[64];
+		snprintf(name, sizeof(name), "render_points 10M, %d threads", pool ? SDL_GetCPUCount() : 1);
+		bench_report(name, points_drawn, bench_seconds() - start, "points");
+	}
+	points_shutdown_thread_pool();
+	points_use_thread_pool = true;
+	free_point_buffers();
+
+	mesh.vertices = NULL;
+	array_free(vertices);
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "../src/texture.h"
+#include "../src/triangle.h"
+#include "../src/display.h"
+
+// 64 MB, bigger than the caches, so the layout decides how many lines are fetched
+#define TEXTURE_SIZE 4096
+#define PASSES 2
+
+// keeps the compiler from dropping the sampling loops
+static volatile uint32_t sink;
+
+// the same repeat wrapping as texture_fetch(), on a plain row major image
+static inline uint32_t row_major_fetch(const uint32_t* pixels, int x, int y) {
+	return pixels[(y & (TEXTURE_SIZE - 1)) * TEXTURE_SIZE + (x & (TEXTURE_SIZE - 1))];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Texel throughput: the same access patterns against a plain row major image
+// and against the tiled texture, then minified sampling with and without
+// mipmaps, then the fill rate of the perspective correct triangle filler
+///////////////////////////////////////////////////////////////////////////////
+void bench_texture(void) {
+	uint32_t* pixels = (uint32_t*) malloc(sizeof(uint32_t) * TEXTURE_SIZE * TEXTURE_SIZE);
+	uint32_t seed = 12345;
+	for (int i = 0; i < TEXTURE_SIZE * TEXTURE_SIZE; i++) {
+		seed = seed * 1664525 + 1013904223;
+		pixels[i] = 0xFF000000 | (seed >> 8);
+	}
+	texture_t* texture = make_texture(pixels, TEXTURE_SIZE, TEXTURE_SIZE);
+	const texture_level_t* level = &texture->levels[0];
+	double texels = (double)PASSES * TEXTURE_SIZE * TEXTURE_SIZE;
+	uint32_t sum;
+	double start;
+
+	printf("texture %dx%d, %d levels\n", TEXTURE_SIZE, TEXTURE_SIZE, texture->num_levels);
+
+	// along rows, the best case for the row major layout
+	sum = 0;
+	start = bench_seconds();
+	for (int pass = 0; pass < PASSES; pass++)
+		for (int y = 0; y < TEXTURE_SIZE; y++)
+			for (int x = 0; x < TEXTURE_SIZE; x++)
+				sum += row_major_fetch(pixels, x, y);
+	bench_report("row major, along rows", texels, bench_seconds() - start, "texels");
+	sink = sum;
+
+	sum = 0;
+	start = bench_seconds();
+	for (int pass = 0; pass < PASSES; pass++)
+		for (int y = 0; y < TEXTURE_SIZE; y++)
+			for (int x = 0; x < TEXTURE_SIZE; x++)
+				sum += texture_fetch(level, x, y);
+	bench_report("tiled, along rows", texels, bench_seconds() - start, "texels");
+	sink = sum;
+
+	// along columns, what a surface rotated by 90 degrees on screen reads
+	sum = 0;
+	start = bench_seconds();
+	for (int pass = 0; pass < PASSES; pass++)
+		for (int x = 0; x < TEXTURE_SIZE; x++)
+			for (int y = 0; y < TEXTURE_SIZE; y++)
+				sum += row_major_fetch(pixels, x, y);
+	bench_report("row major, along columns", texels, bench_seconds() - start, "texels");
+	sink = sum;
+
+	sum = 0;
+	start = bench_seconds();
+	for (int pass = 0; pass < PASSES; pass++)
+		for (int x = 0; x < TEXTURE_SIZE; x++)
+			for (int y = 0; y < TEXTURE_SIZE; y++)
+				sum += texture_fetch(level, x, y);
+	bench_report("tiled, along columns", texels, bench_seconds() - start, "texels");
+	sink = sum;
+
+	// along diagonals, a surface rotated by 45 degrees
+	sum = 0;
+	start = bench_seconds();
+	for (int pass = 0; pass < PASSES; pass++)
+		for (int d = 0; d < TEXTURE_SIZE; d++)
+			for (int i = 0; i < TEXTURE_SIZE; i++)
+				sum += row_major_fetch(pixels, i, d + i);
+	bench_report("row major, along diagonals", texels, bench_seconds() - start, "texels");
+	sink = sum;
+
+	sum = 0;
+	start = bench_seconds();
+	for (int pass = 0; pass < PASSES; pass++)
+		for (int d = 0; d < TEXTURE_SIZE; d++)
+			for (int i = 0; i < TEXTURE_SIZE; i++)
+				sum += texture_fetch(level, i, d + i);
+	bench_report("tiled, along diagonals", texels, bench_seconds() - start, "texels");
+	sink = sum;
+
+	// minified 8x: a screen area an eighth of the texture size covering all of it
+	const int minified = TEXTURE_SIZE / 8;
+	double samples = (double)PASSES * 64 * minified * minified;
+	sum = 0;
+	start = bench_seconds();
+	for (int pass = 0; pass < PASSES * 64; pass++)
+		for (int y = 0; y < minified; y++)
+			for (int x = 0; x < minified; x++)
+				sum += texture_fetch(level, x * 8, y * 8);
+	bench_report("minified 8x, level 0", samples, bench_seconds() - start, "samples");
+	sink = sum;
+
+	sum = 0;
+	start = bench_seconds();
+	for (int pass = 0; pass < PASSES * 64; pass++)
+		for (int y = 0; y < minified; y++)
+			for (int x = 0; x < minified; x++)
+				sum += texture_fetch(&texture->levels[3], x, y);
+	bench_report("minified 8x, level 3", samples, bench_seconds() - start, "samples");
+	sink = sum;
+
+	// perspective correct fill rate, a quad receding in depth split in two triangles
+	triangle_t triangles[2] = {
+		{
+			.points = { { 100, 500, 0, 1 }, { 700, 500, 0, 1 }, { 500, 100, 0, 4 } },
+			.texcoords = { { 0, 1 }, { 1, 1 }, { 1, 0 } },
+			.intensities = { 1, 0.8, 0.5 }
+		},
+		{
+			.points = { { 100, 500, 0, 1 }, { 500, 100, 0, 4 }, { 300, 100, 0, 4 } },
+			.texcoords = { { 0, 1 }, { 1, 0 }, { 0, 0 } },
+			.intensities = { 1, 0.5, 0.5 }
+		}
+	};
+	const int frames = 200;
+	start = bench_seconds();
+	for (int frame = 0; frame < frames; frame++) {
+		draw_textured_triangle(&triangles[0], texture);
+		draw_textured_triangle(&triangles[1], texture);
+	}
+	// the quad covers (600 + 200) / 2 * 400 pixels
+	bench_report("textured triangle fill", (double)frames * 800 / 2 * 400, bench_seconds() - start, "pixels");
+
+	free_texture(texture);
+	free(pixels);
+}
@@ -1,15 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <SDL2/SDL.h>
 #include "array.h"
 
 #define ARRAY_RAW_DATA(array) ((int*)(array) - 2)
 #define ARRAY_CAPACITY(array) (ARRAY_RAW_DATA(array)[0])
 #define ARRAY_OCCUPIED(array) (ARRAY_RAW_DATA(array)[1])
 
+SDL_atomic_t array_allocation_count;
+
 void* array_hold(void* array, int count, int item_size) {
     if (array == NULL) {
         int raw_size = (sizeof(int) * 2) + (item_size * count);
         int* base = (int*)malloc(raw_size);
+        SDL_AtomicAdd(&array_allocation_count, 1);
         base[0] = count;  // capacity
         base[1] = count;  // occupied
         return base + 2;
@@ -23,6 +27,7 @@ void* array_hold(void* array, int count, int item_size) {
         int occupied = needed_size;
         int raw_size = sizeof(int) * 2 + item_size * capacity;
         int* base = (int*)realloc(ARRAY_RAW_DATA(array), raw_size);
+        SDL_AtomicAdd(&array_allocation_count, 1);
         base[0] = capacity;
         base[1] = occupied;
         return base + 2;
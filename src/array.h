@@ -1,12 +1,18 @@
 #ifndef ARRAY_H
 #define ARRAY_H
 
+#include <SDL2/SDL.h>
+
 #define array_push(array, value)                                              \
     do {                                                                      \
         (array) = array_hold((array), 1, sizeof(*(array)));                   \
         (array)[array_length(array) - 1] = (value);                           \
     } while (0);
 
+// number of mallocs and reallocs made by array_hold on all threads, the worker
+// and loader threads allocate too so one counter is shared and added to atomically
+extern SDL_atomic_t array_allocation_count;
+
 void* array_hold(void* array, int count, int item_size);
 int array_length(void* array);
 void array_free(void* array);
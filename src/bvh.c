@@ -0,0 +1,514 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <float.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "bvh.h"
+#include "array.h"
+
+#define BVH_NUM_BINS 16
+// cost of visiting a node in triangle tests, what a split has to save to be worth it
+#define BVH_TRAVERSAL_COST 1.0f
+
+// a triangle while the tree is built, its box and the centroid the splits sort by
+typedef struct {
+	vec3_t min;
+	vec3_t max;
+	vec3_t centroid;
+} bvh_primitive_t;
+
+typedef struct {
+	vec3_t min;
+	vec3_t max;
+	int count;
+} bvh_bin_t;
+
+// plain compares instead of fmin and fmax, which have to care about NaNs and end up as calls
+static inline float min_float(float a, float b) {
+	return a < b ? a : b;
+}
+
+static inline float max_float(float a, float b) {
+	return a > b ? a : b;
+}
+
+static void grow_bounds(vec3_t* min, vec3_t* max, vec3_t v) {
+	min->x = min_float(min->x, v.x); max->x = max_float(max->x, v.x);
+	min->y = min_float(min->y, v.y); max->y = max_float(max->y, v.y);
+	min->z = min_float(min->z, v.z); max->z = max_float(max->z, v.z);
+}
+
+static float half_surface_area(vec3_t min, vec3_t max) {
+	float dx = max.x - min.x, dy = max.y - min.y, dz = max.z - min.z;
+	return dx * dy + dy * dz + dz * dx;
+}
+
+static float axis_value(vec3_t v, int axis) {
+	return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+static const vec3_t empty_min = { FLT_MAX, FLT_MAX, FLT_MAX };
+static const vec3_t empty_max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+///////////////////////////////////////////////////////////////////////////////
+// Make a node for the primitives order[first..first+count), splitting it in two
+// where the surface area heuristic says it is cheapest to trace, over 16 bins
+// of the centroids on every axis; the children go to the next free pair of nodes
+///////////////////////////////////////////////////////////////////////////////
+static void build_node(bvh_t* bvh, bvh_primitive_t* primitives, int* order, int node_index, int first, int count, int depth) {
+	bvh_node_t* node = &bvh->nodes[node_index];
+	vec3_t min = empty_min, max = empty_max;
+	vec3_t centroid_min = empty_min, centroid_max = empty_max;
+	for (int i = first; i < first + count; i++) {
+		bvh_primitive_t* primitive = &primitives[order[i]];
+		grow_bounds(&min, &max, primitive->min);
+		grow_bounds(&min, &max, primitive->max);
+		grow_bounds(&centroid_min, &centroid_max, primitive->centroid);
+	}
+	node->min[0] = min.x; node->min[1] = min.y; node->min[2] = min.z;
+	node->max[0] = max.x; node->max[1] = max.y; node->max[2] = max.z;
+	node->first = first;
+	node->count = count;
+
+	if (count <= 1) {
+		return;
+	}
+
+	// the chance of a ray hitting a box is proportional to its area, so the cost of a
+	// leaf is its area times its triangles and a split adds the visit of the node
+	float area = half_surface_area(min, max);
+	float leaf_cost = count * area;
+	float best_cost = FLT_MAX;
+	int best_axis = -1;
+	int best_split = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		float axis_min = axis_value(centroid_min, axis);
+		float extent = axis_value(centroid_max, axis) - axis_min;
+		if (extent <= 0) {
+			continue;
+		}
+		bvh_bin_t bins[BVH_NUM_BINS];
+		for (int b = 0; b < BVH_NUM_BINS; b++) {
+			bins[b] = (bvh_bin_t){ empty_min, empty_max, 0 };
+		}
+		float bin_scale = BVH_NUM_BINS / extent;
+		for (int i = first; i < first + count; i++) {
+			bvh_primitive_t* primitive = &primitives[order[i]];
+			int b = (int)((axis_value(primitive->centroid, axis) - axis_min) * bin_scale);
+			b = b < BVH_NUM_BINS - 1 ? b : BVH_NUM_BINS - 1;
+			bins[b].count++;
+			grow_bounds(&bins[b].min, &bins[b].max, primitive->min);
+			grow_bounds(&bins[b].min, &bins[b].max, primitive->max);
+		}
+
+		// sweep from the right to get the area and count of every right side, then
+		// from the left to evaluate each of the split planes between the bins
+		float right_area[BVH_NUM_BINS];
+		int right_count[BVH_NUM_BINS];
+		vec3_t right_min = empty_min, right_max = empty_max;
+		int count_right = 0;
+		for (int b = BVH_NUM_BINS - 1; b > 0; b--) {
+			if (bins[b].count > 0) {
+				grow_bounds(&right_min, &right_max, bins[b].min);
+				grow_bounds(&right_min, &right_max, bins[b].max);
+			}
+			count_right += bins[b].count;
+			right_area[b] = count_right > 0 ? half_surface_area(right_min, right_max) : 0;
+			right_count[b] = count_right;
+		}
+		vec3_t left_min = empty_min, left_max = empty_max;
+		int count_left = 0;
+		for (int b = 0; b < BVH_NUM_BINS - 1; b++) {
+			if (bins[b].count > 0) {
+				grow_bounds(&left_min, &left_max, bins[b].min);
+				grow_bounds(&left_min, &left_max, bins[b].max);
+			}
+			count_left += bins[b].count;
+			if (count_left == 0 || right_count[b + 1] == 0) {
+				continue;
+			}
+			float cost = count_left * half_surface_area(left_min, left_max) + right_count[b + 1] * right_area[b + 1];
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_axis = axis;
+				best_split = b + 1;
+			}
+		}
+	}
+
+	if (count <= BVH_MAX_LEAF_SIZE && BVH_TRAVERSAL_COST * area + best_cost >= leaf_cost) {
+		return;
+	}
+
+	int middle;
+	if (best_axis >= 0 && depth < BVH_STACK_SIZE / 2) {
+		// move the primitives of the bins left of the split to the front
+		float axis_min = axis_value(centroid_min, best_axis);
+		float bin_scale = BVH_NUM_BINS / (axis_value(centroid_max, best_axis) - axis_min);
+		int i = first, j = first + count - 1;
+		while (i <= j) {
+			int b = (int)((axis_value(primitives[order[i]].centroid, best_axis) - axis_min) * bin_scale);
+			b = b < BVH_NUM_BINS - 1 ? b : BVH_NUM_BINS - 1;
+			if (b < best_split) {
+				i++;
+			} else {
+				int temp = order[i];
+				order[i] = order[j];
+				order[j--] = temp;
+			}
+		}
+		middle = i;
+	} else {
+		// every centroid in the same spot (or a tree about to outgrow the traversal
+		// stack), halving the list keeps the depth logarithmic
+		middle = first + count / 2;
+	}
+
+	int left = bvh->num_nodes;
+	bvh->num_nodes += 2;
+	build_node(bvh, primitives, order, left, first, middle - first, depth + 1);
+	build_node(bvh, primitives, order, left + 1, middle, first + count - middle, depth + 1);
+	node = &bvh->nodes[node_index];
+	node->first = left;
+	node->count = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build the hierarchy over the faces of a mesh, the nodes are flattened into
+// one array and the triangles copied in the order of the leaves
+///////////////////////////////////////////////////////////////////////////////
+bvh_t* build_bvh(vec3_t* vertices, face_t* faces) {
+	int num_faces = array_length(faces);
+	bvh_t* bvh = (bvh_t*) calloc(1, sizeof(bvh_t));
+	bvh->num_triangles = num_faces;
+
+	// at most one leaf per triangle, so 2n - 1 nodes, plus the unused slot after the root
+	int max_nodes = num_faces > 0 ? 2 * num_faces : 1;
+	bvh->node_memory = malloc(sizeof(bvh_node_t) * max_nodes + 63);
+	bvh->nodes = (bvh_node_t*)(((uintptr_t)bvh->node_memory + 63) & ~(uintptr_t)63);
+	bvh->triangles = (bvh_triangle_t*) malloc(sizeof(bvh_triangle_t) * (num_faces > 0 ? num_faces : 1));
+
+	// no nodes at all, the traversals check for it
+	if (num_faces <= 0) {
+		bvh->num_triangles = 0;
+		return bvh;
+	}
+
+	bvh_primitive_t* primitives = (bvh_primitive_t*) malloc(sizeof(bvh_primitive_t) * num_faces);
+	int* order = (int*) malloc(sizeof(int) * num_faces);
+	for (int i = 0; i < num_faces; i++) {
+		vec3_t a = vertices[faces[i].a - 1];
+		vec3_t b = vertices[faces[i].b - 1];
+		vec3_t c = vertices[faces[i].c - 1];
+		bvh_primitive_t* primitive = &primitives[i];
+		primitive->min = primitive->max = a;
+		grow_bounds(&primitive->min, &primitive->max, b);
+		grow_bounds(&primitive->min, &primitive->max, c);
+		primitive->centroid = (vec3_t){ (a.x + b.x + c.x) / 3, (a.y + b.y + c.y) / 3, (a.z + b.z + c.z) / 3 };
+		order[i] = i;
+	}
+
+	// the root is node 0, the first pair of children starts on the next cache line
+	bvh->num_nodes = 2;
+	build_node(bvh, primitives, order, 0, 0, num_faces, 0);
+
+	for (int i = 0; i < num_faces; i++) {
+		face_t face = faces[order[i]];
+		vec3_t a = vertices[face.a - 1];
+		bvh->triangles[i] = (bvh_triangle_t){
+			.v0 = a,
+			.edge1 = vec3_subtract(vertices[face.b - 1], a),
+			.edge2 = vec3_subtract(vertices[face.c - 1], a),
+			.face = order[i]
+		};
+	}
+
+	// secondary rays start this far off the surface, relative to the size of the model
+	bvh_node_t* root = &bvh->nodes[0];
+	vec3_t diagonal = { root->max[0] - root->min[0], root->max[1] - root->min[1], root->max[2] - root->min[2] };
+	bvh->epsilon = 1e-4f * vec3_length(diagonal);
+
+	free(primitives);
+	free(order);
+	return bvh;
+}
+
+void free_bvh(bvh_t* bvh) {
+	if (bvh == NULL) {
+		return;
+	}
+	free(bvh->node_memory);
+	free(bvh->triangles);
+	free(bvh);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Single rays
+///////////////////////////////////////////////////////////////////////////////
+
+// distance where the ray enters the box of a node, FLT_MAX when it misses it
+// or only gets there past t_max
+static float ray_box_distance(const bvh_node_t* node, vec3_t origin, vec3_t inverse_direction, float t_max) {
+	float tx0 = (node->min[0] - origin.x) * inverse_direction.x;
+	float tx1 = (node->max[0] - origin.x) * inverse_direction.x;
+	float ty0 = (node->min[1] - origin.y) * inverse_direction.y;
+	float ty1 = (node->max[1] - origin.y) * inverse_direction.y;
+	float tz0 = (node->min[2] - origin.z) * inverse_direction.z;
+	float tz1 = (node->max[2] - origin.z) * inverse_direction.z;
+	float t_enter = max_float(max_float(min_float(tx0, tx1), min_float(ty0, ty1)), max_float(min_float(tz0, tz1), 0));
+	float t_exit = min_float(min_float(max_float(tx0, tx1), max_float(ty0, ty1)), min_float(max_float(tz0, tz1), t_max));
+	return t_enter <= t_exit ? t_enter : FLT_MAX;
+}
+
+// Moller-Trumbore, the distance to a triangle along the ray or FLT_MAX, both sides count
+static float ray_triangle_distance(const bvh_triangle_t* triangle, vec3_t origin, vec3_t direction) {
+	vec3_t e1 = triangle->edge1, e2 = triangle->edge2;
+	vec3_t p = {
+		direction.y * e2.z - direction.z * e2.y,
+		direction.z * e2.x - direction.x * e2.z,
+		direction.x * e2.y - direction.y * e2.x
+	};
+	float det = e1.x * p.x + e1.y * p.y + e1.z * p.z;
+	if (fabsf(det) < 1e-12f) {
+		return FLT_MAX;
+	}
+	float inverse_det = 1.0f / det;
+	vec3_t s = { origin.x - triangle->v0.x, origin.y - triangle->v0.y, origin.z - triangle->v0.z };
+	float u = (s.x * p.x + s.y * p.y + s.z * p.z) * inverse_det;
+	if (u < 0 || u > 1) {
+		return FLT_MAX;
+	}
+	vec3_t q = { s.y * e1.z - s.z * e1.y, s.z * e1.x - s.x * e1.z, s.x * e1.y - s.y * e1.x };
+	float v = (direction.x * q.x + direction.y * q.y + direction.z * q.z) * inverse_det;
+	if (v < 0 || u + v > 1) {
+		return FLT_MAX;
+	}
+	float t = (e2.x * q.x + e2.y * q.y + e2.z * q.z) * inverse_det;
+	return t > 0 ? t : FLT_MAX;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Walk the tree front to back, the nearer child first and the other one on a
+// stack with the distance where the ray enters it, so it is skipped when a hit
+// closer than that turns up in the meantime; any_hit stops at the first hit
+///////////////////////////////////////////////////////////////////////////////
+static ray_hit_t traverse(const bvh_t* bvh, ray_t ray, float t_max, bool any_hit) {
+	ray_hit_t hit = { t_max, -1 };
+	vec3_t inverse_direction = { 1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z };
+	if (bvh->num_nodes == 0 || ray_box_distance(&bvh->nodes[0], ray.origin, inverse_direction, hit.t) == FLT_MAX) {
+		return hit;
+	}
+
+	int stack_nodes[BVH_STACK_SIZE];
+	float stack_distances[BVH_STACK_SIZE];
+	int stack_size = 0;
+	const bvh_node_t* node = &bvh->nodes[0];
+	while (true) {
+		if (node->count > 0) {
+			for (int i = node->first; i < node->first + node->count; i++) {
+				float t = ray_triangle_distance(&bvh->triangles[i], ray.origin, ray.direction);
+				if (t < hit.t) {
+					hit.t = t;
+					hit.face = bvh->triangles[i].face;
+					if (any_hit) {
+						return hit;
+					}
+				}
+			}
+		} else {
+			const bvh_node_t* near = &bvh->nodes[node->first];
+			const bvh_node_t* far = near + 1;
+			float near_distance = ray_box_distance(near, ray.origin, inverse_direction, hit.t);
+			float far_distance = ray_box_distance(far, ray.origin, inverse_direction, hit.t);
+			if (far_distance < near_distance) {
+				const bvh_node_t* temp = near;
+				near = far;
+				far = temp;
+				float temp_distance = near_distance;
+				near_distance = far_distance;
+				far_distance = temp_distance;
+			}
+			if (near_distance != FLT_MAX) {
+				if (far_distance != FLT_MAX) {
+					stack_nodes[stack_size] = far - bvh->nodes;
+					stack_distances[stack_size++] = far_distance;
+				}
+				node = near;
+				continue;
+			}
+		}
+
+		// next node on the stack that is still in front of the closest hit
+		node = NULL;
+		while (stack_size > 0) {
+			stack_size--;
+			if (stack_distances[stack_size] < hit.t) {
+				node = &bvh->nodes[stack_nodes[stack_size]];
+				break;
+			}
+		}
+		if (node == NULL) {
+			return hit;
+		}
+	}
+}
+
+// closest triangle along the ray, up to t_max
+ray_hit_t bvh_intersect(const bvh_t* bvh, ray_t ray, float t_max) {
+	return traverse(bvh, ray, t_max, false);
+}
+
+// whether anything is on the ray before t_max, for shadows
+bool bvh_occluded(const bvh_t* bvh, ray_t ray, float t_max) {
+	return traverse(bvh, ray, t_max, true).face >= 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Packets of four rays with a shared origin
+// With SSE2 one box or triangle test runs for the four rays at once, a node is
+// entered when any of them hits it and lanes drop out on their own since every
+// lane compares against its own closest hit; the shared origin makes a good
+// part of the triangle test the same for the whole packet
+///////////////////////////////////////////////////////////////////////////////
+#ifdef __SSE2__
+
+// smallest lane of v
+static float horizontal_min(__m128 v) {
+	v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+	v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+	return _mm_cvtss_f32(v);
+}
+
+static float horizontal_max(__m128 v) {
+	v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+	v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+	return _mm_cvtss_f32(v);
+}
+
+// the nearest entry distance of the lanes that hit the box, FLT_MAX when none does
+static float packet_box_distance(const bvh_node_t* node, vec3_t origin, __m128 inverse_dx, __m128 inverse_dy, __m128 inverse_dz, __m128 closest) {
+	__m128 tx0 = _mm_mul_ps(_mm_set1_ps(node->min[0] - origin.x), inverse_dx);
+	__m128 tx1 = _mm_mul_ps(_mm_set1_ps(node->max[0] - origin.x), inverse_dx);
+	__m128 ty0 = _mm_mul_ps(_mm_set1_ps(node->min[1] - origin.y), inverse_dy);
+	__m128 ty1 = _mm_mul_ps(_mm_set1_ps(node->max[1] - origin.y), inverse_dy);
+	__m128 tz0 = _mm_mul_ps(_mm_set1_ps(node->min[2] - origin.z), inverse_dz);
+	__m128 tz1 = _mm_mul_ps(_mm_set1_ps(node->max[2] - origin.z), inverse_dz);
+	__m128 t_enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)), _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_setzero_ps()));
+	__m128 t_exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)), _mm_min_ps(_mm_max_ps(tz0, tz1), closest));
+	__m128 hit = _mm_cmple_ps(t_enter, t_exit);
+	if (_mm_movemask_ps(hit) == 0) {
+		return FLT_MAX;
+	}
+	__m128 misses = _mm_andnot_ps(hit, _mm_set1_ps(FLT_MAX));
+	return horizontal_min(_mm_or_ps(_mm_and_ps(hit, t_enter), misses));
+}
+
+void bvh_intersect_packet(const bvh_t* bvh, const ray_packet_t* packet, float t_max, ray_hit_t hits[BVH_PACKET_SIZE]) {
+	vec3_t origin = packet->origin;
+	__m128 dx = _mm_loadu_ps(packet->dx);
+	__m128 dy = _mm_loadu_ps(packet->dy);
+	__m128 dz = _mm_loadu_ps(packet->dz);
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 inverse_dx = _mm_div_ps(one, dx);
+	__m128 inverse_dy = _mm_div_ps(one, dy);
+	__m128 inverse_dz = _mm_div_ps(one, dz);
+	__m128 closest = _mm_set1_ps(t_max);
+	__m128i faces = _mm_set1_epi32(-1);
+
+	int stack_nodes[BVH_STACK_SIZE];
+	float stack_distances[BVH_STACK_SIZE];
+	int stack_size = 0;
+	const bvh_node_t* node = &bvh->nodes[0];
+	if (bvh->num_nodes == 0 || packet_box_distance(node, origin, inverse_dx, inverse_dy, inverse_dz, closest) == FLT_MAX) {
+		node = NULL;
+	}
+	while (node != NULL) {
+		if (node->count > 0) {
+			for (int i = node->first; i < node->first + node->count; i++) {
+				const bvh_triangle_t* triangle = &bvh->triangles[i];
+				vec3_t e1 = triangle->edge1, e2 = triangle->edge2;
+				// s and q only depend on the origin, once for the four rays
+				vec3_t s = { origin.x - triangle->v0.x, origin.y - triangle->v0.y, origin.z - triangle->v0.z };
+				vec3_t q = { s.y * e1.z - s.z * e1.y, s.z * e1.x - s.x * e1.z, s.x * e1.y - s.y * e1.x };
+				float q_dot_e2 = e2.x * q.x + e2.y * q.y + e2.z * q.z;
+
+				__m128 px = _mm_sub_ps(_mm_mul_ps(dy, _mm_set1_ps(e2.z)), _mm_mul_ps(dz, _mm_set1_ps(e2.y)));
+				__m128 py = _mm_sub_ps(_mm_mul_ps(dz, _mm_set1_ps(e2.x)), _mm_mul_ps(dx, _mm_set1_ps(e2.z)));
+				__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, _mm_set1_ps(e2.y)), _mm_mul_ps(dy, _mm_set1_ps(e2.x)));
+				__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(e1.x)), _mm_mul_ps(py, _mm_set1_ps(e1.y))), _mm_mul_ps(pz, _mm_set1_ps(e1.z)));
+				__m128 inverse_det = _mm_div_ps(one, det);
+				__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(s.x)), _mm_mul_ps(py, _mm_set1_ps(s.y))), _mm_mul_ps(pz, _mm_set1_ps(s.z))), inverse_det);
+				__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_set1_ps(q.x)), _mm_mul_ps(dy, _mm_set1_ps(q.y))), _mm_mul_ps(dz, _mm_set1_ps(q.z))), inverse_det);
+				__m128 t = _mm_mul_ps(_mm_set1_ps(q_dot_e2), inverse_det);
+
+				// a degenerate determinant gives infinities or NaNs, which fail the comparisons
+				__m128 abs_det = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+				__m128 mask = _mm_cmpge_ps(abs_det, _mm_set1_ps(1e-12f));
+				mask = _mm_and_ps(mask, _mm_cmpge_ps(u, _mm_setzero_ps()));
+				mask = _mm_and_ps(mask, _mm_cmpge_ps(v, _mm_setzero_ps()));
+				mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+				mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, _mm_setzero_ps()));
+				mask = _mm_and_ps(mask, _mm_cmplt_ps(t, closest));
+				if (_mm_movemask_ps(mask) == 0) {
+					continue;
+				}
+				closest = _mm_or_ps(_mm_and_ps(mask, t), _mm_andnot_ps(mask, closest));
+				__m128i lanes = _mm_castps_si128(mask);
+				faces = _mm_or_si128(_mm_and_si128(lanes, _mm_set1_epi32(triangle->face)), _mm_andnot_si128(lanes, faces));
+			}
+		} else {
+			const bvh_node_t* near = &bvh->nodes[node->first];
+			const bvh_node_t* far = near + 1;
+			float near_distance = packet_box_distance(near, origin, inverse_dx, inverse_dy, inverse_dz, closest);
+			float far_distance = packet_box_distance(far, origin, inverse_dx, inverse_dy, inverse_dz, closest);
+			if (far_distance < near_distance) {
+				const bvh_node_t* temp = near;
+				near = far;
+				far = temp;
+				float temp_distance = near_distance;
+				near_distance = far_distance;
+				far_distance = temp_distance;
+			}
+			if (near_distance != FLT_MAX) {
+				if (far_distance != FLT_MAX) {
+					stack_nodes[stack_size] = far - bvh->nodes;
+					stack_distances[stack_size++] = far_distance;
+				}
+				node = near;
+				continue;
+			}
+		}
+
+		// a node on the stack is skipped when every lane has a hit in front of it
+		float farthest_closest = horizontal_max(closest);
+		node = NULL;
+		while (stack_size > 0) {
+			stack_size--;
+			if (stack_distances[stack_size] < farthest_closest) {
+				node = &bvh->nodes[stack_nodes[stack_size]];
+				break;
+			}
+		}
+	}
+
+	float t_values[BVH_PACKET_SIZE];
+	int face_values[BVH_PACKET_SIZE];
+	_mm_storeu_ps(t_values, closest);
+	_mm_storeu_si128((__m128i*)face_values, faces);
+	for (int i = 0; i < BVH_PACKET_SIZE; i++) {
+		hits[i] = (ray_hit_t){ t_values[i], face_values[i] };
+	}
+}
+
+#else
+
+void bvh_intersect_packet(const bvh_t* bvh, const ray_packet_t* packet, float t_max, ray_hit_t hits[BVH_PACKET_SIZE]) {
+	for (int i = 0; i < BVH_PACKET_SIZE; i++) {
+		ray_t ray = { packet->origin, { packet->dx[i], packet->dy[i], packet->dz[i] } };
+		hits[i] = bvh_intersect(bvh, ray, t_max);
+	}
+}
+
+#endif
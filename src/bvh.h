@@ -0,0 +1,65 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <stdbool.h>
+#include "vector.h"
+#include "triangle.h"
+
+// leaves hold at most this many triangles, fewer when the SAH says splitting is cheaper
+#define BVH_MAX_LEAF_SIZE 8
+#define BVH_STACK_SIZE 64
+
+// a node is half a 64 byte cache line and the two children of a node are stored
+// next to each other on the same line, the root sits alone on the first one
+typedef struct {
+	float min[3];
+	int first;	// left child of an interior node (the right one is first + 1), first triangle of a leaf
+	float max[3];
+	int count;	// triangles of a leaf, 0 for an interior node
+} bvh_node_t;
+
+// the triangles in leaf order, with the two edges the intersection test needs
+typedef struct {
+	vec3_t v0;
+	vec3_t edge1;
+	vec3_t edge2;
+	int face;	// index into mesh.faces
+} bvh_triangle_t;
+
+// bounding volume hierarchy over the triangles of a mesh, in model space
+typedef struct {
+	bvh_node_t* nodes;
+	int num_nodes;
+	bvh_triangle_t* triangles;
+	int num_triangles;
+	float epsilon;	// offset that keeps secondary rays from hitting the surface they leave
+	void* node_memory;	// allocation behind nodes, which is moved up to a cache line boundary
+} bvh_t;
+
+typedef struct {
+	vec3_t origin;
+	vec3_t direction;
+} ray_t;
+
+// four rays leaving the same point, one direction per lane, split by axis for SSE
+#define BVH_PACKET_SIZE 4
+typedef struct {
+	vec3_t origin;
+	float dx[BVH_PACKET_SIZE];
+	float dy[BVH_PACKET_SIZE];
+	float dz[BVH_PACKET_SIZE];
+} ray_packet_t;
+
+// t is in units of the ray direction, face is -1 when nothing was hit
+typedef struct {
+	float t;
+	int face;
+} ray_hit_t;
+
+bvh_t* build_bvh(vec3_t* vertices, face_t* faces);
+void free_bvh(bvh_t* bvh);
+ray_hit_t bvh_intersect(const bvh_t* bvh, ray_t ray, float t_max);
+bool bvh_occluded(const bvh_t* bvh, ray_t ray, float t_max);
+void bvh_intersect_packet(const bvh_t* bvh, const ray_packet_t* packet, float t_max, ray_hit_t hits[BVH_PACKET_SIZE]);
+
+#endif
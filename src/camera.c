@@ -0,0 +1,75 @@
+#include <math.h>
+#include "camera.h"
+
+// pitch stays just short of straight up or down (pi / 2), where the look at up vector degenerates
+#define CAMERA_MAX_PITCH 1.56f
+
+camera_t camera = {
+	.position = { 0, 0, 0 },
+	.yaw = 0,
+	.pitch = 0,
+	.is_dirty = true
+};
+
+static float clamp_pitch(float pitch) {
+	if (pitch > CAMERA_MAX_PITCH) return CAMERA_MAX_PITCH;
+	if (pitch < -CAMERA_MAX_PITCH) return -CAMERA_MAX_PITCH;
+	return pitch;
+}
+
+void camera_set_position(vec3_t position) {
+	camera.position = position;
+	camera.is_dirty = true;
+}
+
+// turn the camera towards a point, keeping its position
+void camera_look_at(vec3_t target) {
+	vec3_t direction = vec3_subtract(target, camera.position);
+	float horizontal = sqrt(direction.x * direction.x + direction.z * direction.z);
+	if (horizontal == 0 && direction.y == 0) {
+		return;
+	}
+	camera.yaw = atan2(direction.x, direction.z);
+	camera.pitch = clamp_pitch(atan2(direction.y, horizontal));
+	camera.is_dirty = true;
+}
+
+// unit vector the camera looks along
+vec3_t camera_direction(void) {
+	vec3_t direction = {
+		sin(camera.yaw) * cos(camera.pitch),
+		sin(camera.pitch),
+		cos(camera.yaw) * cos(camera.pitch)
+	};
+	return direction;
+}
+
+// move like a first person camera: forward follows the yaw on the ground
+// plane, right is perpendicular to it and up is the world y axis
+void camera_move(float forward, float right, float up) {
+	float s = sin(camera.yaw);
+	float c = cos(camera.yaw);
+	camera.position.x += forward * s + right * c;
+	camera.position.y += up;
+	camera.position.z += forward * c - right * s;
+	camera.is_dirty = true;
+}
+
+void camera_rotate(float yaw, float pitch) {
+	camera.yaw += yaw;
+	camera.pitch = clamp_pitch(camera.pitch + pitch);
+	camera.is_dirty = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The world to view matrix of the camera, rebuilt only after the camera moved
+///////////////////////////////////////////////////////////////////////////////
+mat4_t camera_get_view_matrix(void) {
+	if (camera.is_dirty) {
+		vec3_t target = vec3_add(camera.position, camera_direction());
+		vec3_t up = { 0, 1, 0 };
+		camera.view_matrix = mat4_look_at(camera.position, target, up);
+		camera.is_dirty = false;
+	}
+	return camera.view_matrix;
+}
@@ -0,0 +1,26 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include <stdbool.h>
+#include "vector.h"
+#include "matrix.h"
+
+// a first person camera, y is up and a yaw and pitch of 0 look down +z
+typedef struct {
+	vec3_t position;
+	float yaw;		// radians around the y axis, positive turns right
+	float pitch;		// radians above the xz plane, kept short of straight up or down
+	bool is_dirty;		// position or angles changed since view_matrix was built
+	mat4_t view_matrix;
+} camera_t;
+
+extern camera_t camera;
+
+void camera_set_position(vec3_t position);
+void camera_look_at(vec3_t target);
+void camera_move(float forward, float right, float up);
+void camera_rotate(float yaw, float pitch);
+vec3_t camera_direction(void);
+mat4_t camera_get_view_matrix(void);
+
+#endif
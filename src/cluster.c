@@ -0,0 +1,233 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "cluster.h"
+#include "frustum.h"
+#include "array.h"
+
+// faces are grouped by the dominant axis of their normal (6 buckets, plus one
+// for degenerate faces) so that every cluster gets a narrow normal cone
+#define NUM_NORMAL_BUCKETS 7
+
+typedef struct {
+	uint64_t key;
+	face_t face;
+} face_sort_entry_t;
+
+// spread the lower 10 bits of v so that there are two zero bits between each of them
+static uint32_t morton_expand_bits(uint32_t v) {
+	v &= 0x3FF;
+	v = (v | (v << 16)) & 0x030000FF;
+	v = (v | (v << 8)) & 0x0300F00F;
+	v = (v | (v << 4)) & 0x030C30C3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+static uint32_t morton_code(vec3_t p, vec3_t min, vec3_t extent) {
+	uint32_t x = (uint32_t)(1023.0f * (p.x - min.x) / extent.x);
+	uint32_t y = (uint32_t)(1023.0f * (p.y - min.y) / extent.y);
+	uint32_t z = (uint32_t)(1023.0f * (p.z - min.z) / extent.z);
+	return (morton_expand_bits(x) << 2) | (morton_expand_bits(y) << 1) | morton_expand_bits(z);
+}
+
+static int compare_face_sort_entries(const void* a, const void* b) {
+	uint64_t key_a = ((const face_sort_entry_t*)a)->key;
+	uint64_t key_b = ((const face_sort_entry_t*)b)->key;
+	return (key_a > key_b) - (key_a < key_b);
+}
+
+// unnormalized face normal, same winding as the backface test in update()
+static vec3_t face_normal(vec3_t* vertices, face_t face) {
+	vec3_t a = vertices[face.a - 1];
+	vec3_t b = vertices[face.b - 1];
+	vec3_t c = vertices[face.c - 1];
+	return vec3_cross(vec3_subtract(b, a), vec3_subtract(c, a));
+}
+
+static int normal_bucket(vec3_t n) {
+	float ax = fabs(n.x), ay = fabs(n.y), az = fabs(n.z);
+	if (ax == 0 && ay == 0 && az == 0) return 6;
+	if (ax >= ay && ax >= az) return n.x > 0 ? 0 : 1;
+	if (ay >= az) return n.y > 0 ? 2 : 3;
+	return n.z > 0 ? 4 : 5;
+}
+
+static cluster_t make_cluster(vec3_t* vertices, face_t* faces, int first_face, int num_faces) {
+	cluster_t cluster = { .first_face = first_face, .num_faces = num_faces };
+
+	// bounding sphere centered on the bounding box of the cluster vertices
+	vec3_t min = vertices[faces[first_face].a - 1];
+	vec3_t max = min;
+	for (int i = first_face; i < first_face + num_faces; i++) {
+		int indices[3] = { faces[i].a, faces[i].b, faces[i].c };
+		for (int j = 0; j < 3; j++) {
+			vec3_t v = vertices[indices[j] - 1];
+			min.x = fmin(min.x, v.x); max.x = fmax(max.x, v.x);
+			min.y = fmin(min.y, v.y); max.y = fmax(max.y, v.y);
+			min.z = fmin(min.z, v.z); max.z = fmax(max.z, v.z);
+		}
+	}
+	cluster.center = (vec3_t){ (min.x + max.x) / 2, (min.y + max.y) / 2, (min.z + max.z) / 2 };
+	for (int i = first_face; i < first_face + num_faces; i++) {
+		int indices[3] = { faces[i].a, faces[i].b, faces[i].c };
+		for (int j = 0; j < 3; j++) {
+			float distance = vec3_length(vec3_subtract(vertices[indices[j] - 1], cluster.center));
+			cluster.radius = fmax(cluster.radius, distance);
+		}
+	}
+
+	// normal cone: average the unit normals, then find the widest normal around that axis
+	vec3_t axis = { 0, 0, 0 };
+	for (int i = first_face; i < first_face + num_faces; i++) {
+		vec3_t normal = face_normal(vertices, faces[i]);
+		if (vec3_length(normal) == 0) continue;
+		vec3_normalize(&normal);
+		axis = vec3_add(axis, normal);
+	}
+	cluster.cone_cutoff = 2;
+	if (vec3_length(axis) == 0) {
+		return cluster;
+	}
+	vec3_normalize(&axis);
+	cluster.cone_axis = axis;
+
+	float min_dot = 1;
+	for (int i = first_face; i < first_face + num_faces; i++) {
+		vec3_t normal = face_normal(vertices, faces[i]);
+		if (vec3_length(normal) == 0) continue;
+		vec3_normalize(&normal);
+		min_dot = fmin(min_dot, vec3_dot(normal, axis));
+	}
+
+	// cones of 90 degrees or wider always have some face looking at the camera
+	if (min_dot > 0) {
+		cluster.cone_cutoff = sqrt(1 - min_dot * min_dot);
+	}
+	return cluster;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sort the faces by normal direction and position and cut them into clusters
+// The faces array is reordered in place so each cluster is a contiguous run
+///////////////////////////////////////////////////////////////////////////////
+cluster_t* build_clusters(vec3_t* vertices, face_t* faces) {
+	cluster_t* clusters = NULL;
+	int num_faces = array_length(faces);
+	int num_vertices = array_length(vertices);
+	if (num_faces == 0 || num_vertices == 0) {
+		return NULL;
+	}
+
+	// quantize face centroids inside the mesh bounding box
+	vec3_t min = vertices[0];
+	vec3_t max = vertices[0];
+	for (int i = 1; i < num_vertices; i++) {
+		min.x = fmin(min.x, vertices[i].x); max.x = fmax(max.x, vertices[i].x);
+		min.y = fmin(min.y, vertices[i].y); max.y = fmax(max.y, vertices[i].y);
+		min.z = fmin(min.z, vertices[i].z); max.z = fmax(max.z, vertices[i].z);
+	}
+	vec3_t extent = {
+		fmax(max.x - min.x, 1e-6),
+		fmax(max.y - min.y, 1e-6),
+		fmax(max.z - min.z, 1e-6)
+	};
+
+	face_sort_entry_t* entries = (face_sort_entry_t*) malloc(sizeof(face_sort_entry_t) * num_faces);
+	for (int i = 0; i < num_faces; i++) {
+		vec3_t a = vertices[faces[i].a - 1];
+		vec3_t b = vertices[faces[i].b - 1];
+		vec3_t c = vertices[faces[i].c - 1];
+		vec3_t centroid = { (a.x + b.x + c.x) / 3, (a.y + b.y + c.y) / 3, (a.z + b.z + c.z) / 3 };
+
+		uint64_t bucket = normal_bucket(face_normal(vertices, faces[i]));
+		entries[i].key = (bucket << 32) | morton_code(centroid, min, extent);
+		entries[i].face = faces[i];
+	}
+	qsort(entries, num_faces, sizeof(face_sort_entry_t), compare_face_sort_entries);
+	for (int i = 0; i < num_faces; i++) {
+		faces[i] = entries[i].face;
+	}
+
+	// split every bucket into evenly sized clusters of at most CLUSTER_MAX_FACES
+	int bucket_start = 0;
+	while (bucket_start < num_faces) {
+		int bucket_end = bucket_start;
+		while (bucket_end < num_faces && (entries[bucket_end].key >> 32) == (entries[bucket_start].key >> 32)) {
+			bucket_end++;
+		}
+		int count = bucket_end - bucket_start;
+		int num_chunks = (count + CLUSTER_MAX_FACES - 1) / CLUSTER_MAX_FACES;
+		for (int k = 0; k < num_chunks; k++) {
+			int first = bucket_start + (count * k) / num_chunks;
+			int last = bucket_start + (count * (k + 1)) / num_chunks;
+			cluster_t cluster = make_cluster(vertices, faces, first, last - first);
+			array_push(clusters, cluster);
+		}
+		bucket_start = bucket_end;
+	}
+
+	free(entries);
+	return clusters;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// List the distinct vertices used by each cluster so the vertex stage can
+// transform and light them once per cluster instead of once per face corner
+///////////////////////////////////////////////////////////////////////////////
+int* build_cluster_vertex_lists(cluster_t* clusters, face_t* faces, int num_vertices) {
+	int* cluster_vertices = NULL;
+	int num_clusters = array_length(clusters);
+
+	// remember in which cluster each vertex was last listed
+	int* last_cluster = (int*) malloc(sizeof(int) * num_vertices);
+	for (int i = 0; i < num_vertices; i++) {
+		last_cluster[i] = -1;
+	}
+
+	for (int k = 0; k < num_clusters; k++) {
+		clusters[k].first_vertex = array_length(cluster_vertices);
+		for (int i = clusters[k].first_face; i < clusters[k].first_face + clusters[k].num_faces; i++) {
+			int indices[3] = { faces[i].a - 1, faces[i].b - 1, faces[i].c - 1 };
+			for (int j = 0; j < 3; j++) {
+				if (last_cluster[indices[j]] != k) {
+					last_cluster[indices[j]] = k;
+					array_push(cluster_vertices, indices[j]);
+				}
+			}
+		}
+		clusters[k].num_vertices = array_length(cluster_vertices) - clusters[k].first_vertex;
+	}
+
+	free(last_cluster);
+	return cluster_vertices;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Decide if a whole cluster can be skipped this frame
+// The bounding sphere is tested against the frustum, and the normal cone tells
+// whether every face of the cluster points away from the camera
+// Both tests run in view space, where the camera sits at the origin
+///////////////////////////////////////////////////////////////////////////////
+enum cluster_cull_result cull_cluster(cluster_t* cluster, const mat3x4_t* world_view_matrix, float max_scale, bool test_backface) {
+	vec3_t center = vec3_from_vec4(mat3x4_mul_point(world_view_matrix, cluster->center));
+	float radius = cluster->radius * max_scale;
+
+	if (sphere_outside_frustum(center, radius)) {
+		return CLUSTER_CULLED_FRUSTUM;
+	}
+
+	if (test_backface && cluster->cone_cutoff <= 1) {
+		// directions ignore the translation column
+		vec3_t axis = mat3x4_mul_direction(world_view_matrix, cluster->cone_axis);
+		vec3_normalize(&axis);
+
+		// every point of the sphere has to see the cone from behind,
+		// the center is also the ray from the camera to the cluster
+		if (vec3_dot(center, axis) > cluster->cone_cutoff * vec3_length(center) + radius) {
+			return CLUSTER_CULLED_BACKFACE;
+		}
+	}
+
+	return CLUSTER_VISIBLE;
+}
@@ -0,0 +1,35 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stdbool.h>
+#include "vector.h"
+#include "matrix.h"
+#include "triangle.h"
+
+#define CLUSTER_MAX_FACES 128
+#define CLUSTER_MAX_VERTICES (3 * CLUSTER_MAX_FACES)
+
+// a cluster (meshlet) is a run of spatially close faces in mesh.faces
+// that can be accepted or rejected as a whole before any vertex is transformed
+typedef struct {
+	int first_face;		// index of the first face of the cluster in mesh.faces
+	int num_faces;
+	int first_vertex;	// range of the cluster vertex list (indices of the vertices its faces use)
+	int num_vertices;
+	vec3_t center;		// bounding sphere in model space
+	float radius;
+	vec3_t cone_axis;	// average direction of the face normals
+	float cone_cutoff;	// sine of the cone half angle, > 1 when the cone can't be culled
+} cluster_t;
+
+enum cluster_cull_result {
+	CLUSTER_VISIBLE,
+	CLUSTER_CULLED_BACKFACE,
+	CLUSTER_CULLED_FRUSTUM
+};
+
+cluster_t* build_clusters(vec3_t* vertices, face_t* faces);
+int* build_cluster_vertex_lists(cluster_t* clusters, face_t* faces, int num_vertices);
+enum cluster_cull_result cull_cluster(cluster_t* cluster, const mat3x4_t* world_view_matrix, float max_scale, bool test_backface);
+
+#endif
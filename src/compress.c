@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+#include "compress.h"
+#include "array.h"
+
+bool use_compressed_mesh = false;
+
+///////////////////////////////////////////////////////////////////////////////
+// Encoding, done once after loading
+///////////////////////////////////////////////////////////////////////////////
+
+static uint16_t quantize(float value, float min, float extent) {
+	if (extent <= 0) {
+		return 0;
+	}
+	float q = roundf((value - min) / extent * 65535.0f);
+	return q < 0 ? 0 : (q > 65535 ? 65535 : (uint16_t)q);
+}
+
+static int16_t encode_snorm16(float value) {
+	float q = roundf(value * 32767.0f);
+	return q < -32767 ? -32767 : (q > 32767 ? 32767 : (int16_t)q);
+}
+
+static float sign_not_zero(float value) {
+	return value >= 0 ? 1.0f : -1.0f;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Octahedral normals: the unit vector is scaled onto the octahedron |x|+|y|+|z| = 1,
+// the upper half is projected straight down onto the xy square and the lower
+// half is folded over the diagonals into its corners
+// A zero normal (a degenerate face) comes back as +z
+///////////////////////////////////////////////////////////////////////////////
+static octahedral_normal_t encode_normal(vec3_t n) {
+	float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if (l1 <= 0) {
+		return (octahedral_normal_t){ 0, 0 };
+	}
+	float u = n.x / l1;
+	float v = n.y / l1;
+	if (n.z < 0) {
+		float folded_u = (1 - fabsf(v)) * sign_not_zero(u);
+		float folded_v = (1 - fabsf(u)) * sign_not_zero(v);
+		u = folded_u;
+		v = folded_v;
+	}
+	return (octahedral_normal_t){ encode_snorm16(u), encode_snorm16(v) };
+}
+
+// index of the color in the palette, added when new; the table holds twice the most colors the palette can
+static int palette_index(uint32_t* keys, int* values, int table_size, uint32_t** palette, uint32_t color) {
+	unsigned slot = (color * 2654435761u) & (table_size - 1);
+	while (values[slot] >= 0) {
+		if (keys[slot] == color) {
+			return values[slot];
+		}
+		slot = (slot + 1) & (table_size - 1);
+	}
+	keys[slot] = color;
+	values[slot] = array_length(*palette);
+	array_push(*palette, color);
+	return values[slot];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build the compressed copy of the data the vertex stage reads, returns NULL
+// when the face colors don't fit the palette
+///////////////////////////////////////////////////////////////////////////////
+compressed_mesh_t* compress_mesh(vec3_t* vertices, vec3_t* normals, face_t* faces, vec3_t* face_normals,
+	cluster_t* clusters, int* cluster_vertices, vec3_t bounds_min, vec3_t bounds_max) {
+	int num_faces = array_length(faces);
+	int num_clusters = array_length(clusters);
+	int num_cluster_vertices = array_length(cluster_vertices);
+
+	// the palette, hashed while the faces are encoded
+	int table_size = 1;
+	while (table_size < 2 * (num_faces < COMPRESSED_MAX_COLORS ? num_faces : COMPRESSED_MAX_COLORS)) {
+		table_size *= 2;
+	}
+	uint32_t* keys = (uint32_t*) malloc(sizeof(uint32_t) * table_size);
+	int* values = (int*) malloc(sizeof(int) * table_size);
+	for (int i = 0; i < table_size; i++) {
+		values[i] = -1;
+	}
+
+	compressed_mesh_t* compressed = (compressed_mesh_t*) calloc(1, sizeof(compressed_mesh_t));
+	compressed->num_cluster_vertices = num_cluster_vertices;
+	compressed->num_faces = num_faces;
+	compressed->positions = (quantized_position_t*) malloc(sizeof(quantized_position_t) * (num_cluster_vertices + 1));
+	compressed->normals = (octahedral_normal_t*) malloc(sizeof(octahedral_normal_t) * (num_cluster_vertices + 1));
+	compressed->faces = (compressed_face_t*) malloc(sizeof(compressed_face_t) * (num_faces + 1));
+	compressed->face_normals = (octahedral_normal_t*) malloc(sizeof(octahedral_normal_t) * (num_faces + 1));
+
+	vec3_t extent = vec3_subtract(bounds_max, bounds_min);
+	compressed->quantization_offset = bounds_min;
+	compressed->quantization_scale = (vec3_t){ extent.x / 65535.0f, extent.y / 65535.0f, extent.z / 65535.0f };
+
+	for (int j = 0; j < num_cluster_vertices; j++) {
+		vec3_t p = vertices[cluster_vertices[j]];
+		compressed->positions[j] = (quantized_position_t){
+			quantize(p.x, bounds_min.x, extent.x),
+			quantize(p.y, bounds_min.y, extent.y),
+			quantize(p.z, bounds_min.z, extent.z),
+			0
+		};
+		compressed->normals[j] = encode_normal(normals[cluster_vertices[j]]);
+	}
+
+	// the vertex stage buffers are indexed by mesh vertex, the faces by the position in their cluster's list
+	int* local_index = (int*) malloc(sizeof(int) * (array_length(vertices) + 1));
+	bool too_many_colors = false;
+	for (int k = 0; k < num_clusters && !too_many_colors; k++) {
+		cluster_t* cluster = &clusters[k];
+		for (int j = 0; j < cluster->num_vertices; j++) {
+			local_index[cluster_vertices[cluster->first_vertex + j]] = j;
+		}
+		for (int i = cluster->first_face; i < cluster->first_face + cluster->num_faces; i++) {
+			int color = palette_index(keys, values, table_size, &compressed->palette, faces[i].color);
+			if (color >= COMPRESSED_MAX_COLORS) {
+				too_many_colors = true;
+				break;
+			}
+			compressed->faces[i] = (compressed_face_t){
+				local_index[faces[i].a - 1],
+				local_index[faces[i].b - 1],
+				local_index[faces[i].c - 1],
+				color
+			};
+			compressed->face_normals[i] = encode_normal(face_normals[i]);
+		}
+	}
+	compressed->num_colors = array_length(compressed->palette);
+
+	free(local_index);
+	free(values);
+	free(keys);
+	if (too_many_colors) {
+		fprintf(stderr, "Error: more than %d face colors, the mesh is left uncompressed.\n", COMPRESSED_MAX_COLORS);
+		free_compressed_mesh(compressed);
+		return NULL;
+	}
+	return compressed;
+}
+
+void free_compressed_mesh(compressed_mesh_t* compressed) {
+	if (compressed == NULL) {
+		return;
+	}
+	free(compressed->positions);
+	free(compressed->normals);
+	free(compressed->faces);
+	free(compressed->face_normals);
+	array_free(compressed->palette);
+	free(compressed);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sizes of the arrays the vertex stage reads, as floats and compressed, what
+// of both is actually resident, and the bytes it reads for each cluster
+// vertex and each face it transforms
+///////////////////////////////////////////////////////////////////////////////
+void print_compression_savings(FILE* out, const char* name, const compressed_mesh_t* compressed, int num_vertices, size_t resident_float_bytes) {
+	int num_cluster_vertices = compressed->num_cluster_vertices;
+	int num_faces = compressed->num_faces;
+	size_t float_bytes = (2 * sizeof(vec3_t)) * num_vertices + (sizeof(face_t) + sizeof(vec3_t)) * num_faces;
+	size_t compressed_bytes = (sizeof(quantized_position_t) + sizeof(octahedral_normal_t)) * num_cluster_vertices +
+		(sizeof(compressed_face_t) + sizeof(octahedral_normal_t)) * num_faces + sizeof(uint32_t) * compressed->num_colors;
+	fprintf(out, "%s: %d vertices (%d in clusters), %d faces, %d colors\n", name, num_vertices, num_cluster_vertices, num_faces, compressed->num_colors);
+	fprintf(out, "  memory: %.1f KB as floats, %.1f KB compressed (%.0f%%)\n",
+		float_bytes / 1024.0, compressed_bytes / 1024.0, 100.0 * compressed_bytes / float_bytes);
+	fprintf(out, "  resident: %.1f KB of floats kept and %.1f KB compressed, %.1f KB in all\n",
+		resident_float_bytes / 1024.0, compressed_bytes / 1024.0, (resident_float_bytes + compressed_bytes) / 1024.0);
+	fprintf(out, "  read per cluster vertex: %d bytes, compressed %d; per face: %d bytes, compressed %d\n",
+		(int)(2 * sizeof(vec3_t)), (int)(sizeof(quantized_position_t) + sizeof(octahedral_normal_t)),
+		(int)(sizeof(face_t) + sizeof(vec3_t)), (int)(sizeof(compressed_face_t) + sizeof(octahedral_normal_t)));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Decoding, in the vertex stage
+///////////////////////////////////////////////////////////////////////////////
+
+// m times the matrix that turns quantized positions back into model space
+mat3x4_t dequantize_matrix(const compressed_mesh_t* compressed, const mat3x4_t* m) {
+	vec3_t offset = compressed->quantization_offset;
+	vec3_t scale = compressed->quantization_scale;
+	mat3x4_t result;
+	for (int row = 0; row < 3; row++) {
+		result.m[row][0] = m->m[row][0] * scale.x;
+		result.m[row][1] = m->m[row][1] * scale.y;
+		result.m[row][2] = m->m[row][2] * scale.z;
+		result.m[row][3] = m->m[row][0] * offset.x + m->m[row][1] * offset.y + m->m[row][2] * offset.z + m->m[row][3];
+	}
+	return result;
+}
+
+// the quantized positions as floats, split into x, y and z arrays
+void decode_positions(const quantized_position_t* positions, int count, float* x, float* y, float* z) {
+	int j = 0;
+#ifdef __SSE2__
+	// four positions are two loads, widened to 32 bits, converted and transposed
+	__m128i zero = _mm_setzero_si128();
+	for (; j + 4 <= count; j += 4) {
+		__m128i first = _mm_loadu_si128((const __m128i*)&positions[j]);
+		__m128i second = _mm_loadu_si128((const __m128i*)&positions[j + 2]);
+		__m128 p0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(first, zero));
+		__m128 p1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(first, zero));
+		__m128 p2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(second, zero));
+		__m128 p3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(second, zero));
+		_MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+		_mm_storeu_ps(&x[j], p0);
+		_mm_storeu_ps(&y[j], p1);
+		_mm_storeu_ps(&z[j], p2);
+	}
+#endif
+	for (; j < count; j++) {
+		x[j] = positions[j].x;
+		y[j] = positions[j].y;
+		z[j] = positions[j].z;
+	}
+}
+
+// unit normals split into x, y and z arrays
+void decode_normals(const octahedral_normal_t* normals, int count, float* x, float* y, float* z) {
+	int j = 0;
+#ifdef __SSE2__
+	// four normals are one load, u in the low half of every 32 bits and v in the high half
+	const __m128 snorm_scale = _mm_set1_ps(1.0f / 32767.0f);
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 three = _mm_set1_ps(3.0f);
+	for (; j + 4 <= count; j += 4) {
+		__m128i packed = _mm_loadu_si128((const __m128i*)&normals[j]);
+		__m128 u = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(packed, 16), 16)), snorm_scale);
+		__m128 v = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(packed, 16)), snorm_scale);
+		__m128 w = _mm_sub_ps(_mm_sub_ps(one, _mm_andnot_ps(sign_mask, u)), _mm_andnot_ps(sign_mask, v));
+
+		// unfold the lower half, moving u and v toward zero by how far w is below it
+		__m128 t = _mm_max_ps(_mm_sub_ps(_mm_setzero_ps(), w), _mm_setzero_ps());
+		u = _mm_sub_ps(u, _mm_or_ps(t, _mm_and_ps(u, sign_mask)));
+		v = _mm_sub_ps(v, _mm_or_ps(t, _mm_and_ps(v, sign_mask)));
+
+		// the length is between 1/sqrt(3) and 1, one Newton step on the estimate is plenty
+		__m128 length_squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(v, v)), _mm_mul_ps(w, w));
+		__m128 estimate = _mm_rsqrt_ps(length_squared);
+		__m128 inverse_length = _mm_mul_ps(_mm_mul_ps(half, estimate),
+			_mm_sub_ps(three, _mm_mul_ps(_mm_mul_ps(length_squared, estimate), estimate)));
+		_mm_storeu_ps(&x[j], _mm_mul_ps(u, inverse_length));
+		_mm_storeu_ps(&y[j], _mm_mul_ps(v, inverse_length));
+		_mm_storeu_ps(&z[j], _mm_mul_ps(w, inverse_length));
+	}
+#endif
+	for (; j < count; j++) {
+		float u = normals[j].u / 32767.0f;
+		float v = normals[j].v / 32767.0f;
+		float w = 1 - fabsf(u) - fabsf(v);
+		float t = fmaxf(-w, 0);
+		u -= signbit(u) ? -t : t;
+		v -= signbit(v) ? -t : t;
+		float inverse_length = 1 / sqrtf(u * u + v * v + w * w);
+		x[j] = u * inverse_length;
+		y[j] = v * inverse_length;
+		z[j] = w * inverse_length;
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "vector.h"
+#include "matrix.h"
+#include "triangle.h"
+#include "cluster.h"
+
+// face colors are indices into a palette, meshes with more colors stay uncompressed
+#define COMPRESSED_MAX_COLORS 65536
+
+// a position quantized to 16 bits per axis over the bounding box of the mesh,
+// padded to 8 bytes so two of them fill an SSE register
+typedef struct {
+	uint16_t x;
+	uint16_t y;
+	uint16_t z;
+	uint16_t unused;
+} quantized_position_t;
+
+// a unit vector projected onto an octahedron unfolded into a square, 16 bits per coordinate
+typedef struct {
+	int16_t u;
+	int16_t v;
+} octahedral_normal_t;
+
+// indices into the vertex list of the face's cluster, which fits 16 bits since
+// a cluster never has more than CLUSTER_MAX_VERTICES, and an index into the palette
+typedef struct {
+	uint16_t a;
+	uint16_t b;
+	uint16_t c;
+	uint16_t color;
+} compressed_face_t;
+
+// the data the vertex stage reads, in half the bytes or less; every cluster has
+// its own copy of its vertices so they are read in order, see cluster_t
+typedef struct {
+	quantized_position_t* positions;	// parallel to mesh.cluster_vertices
+	octahedral_normal_t* normals;		// parallel to mesh.cluster_vertices
+	compressed_face_t* faces;		// parallel to mesh.faces
+	octahedral_normal_t* face_normals;	// parallel to mesh.faces
+	uint32_t* palette;
+	int num_cluster_vertices;
+	int num_faces;
+	int num_colors;
+	vec3_t quantization_offset;	// position = offset + quantized position * scale
+	vec3_t quantization_scale;
+} compressed_mesh_t;
+
+// the vertex stage reads the compressed mesh instead of the float arrays, when there is one;
+// it is only built once this is set, see compress_loaded_mesh()
+extern bool use_compressed_mesh;
+
+compressed_mesh_t* compress_mesh(vec3_t* vertices, vec3_t* normals, face_t* faces, vec3_t* face_normals,
+	cluster_t* clusters, int* cluster_vertices, vec3_t bounds_min, vec3_t bounds_max);
+void free_compressed_mesh(compressed_mesh_t* compressed);
+void print_compression_savings(FILE* out, const char* name, const compressed_mesh_t* compressed, int num_vertices, size_t resident_float_bytes);
+
+// decode into the quantized values, dequantize_matrix() folds the rest into the transform
+void decode_positions(const quantized_position_t* positions, int count, float* x, float* y, float* z);
+void decode_normals(const octahedral_normal_t* normals, int count, float* x, float* y, float* z);
+mat3x4_t dequantize_matrix(const compressed_mesh_t* compressed, const mat3x4_t* m);
+
+#endif
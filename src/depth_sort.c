@@ -0,0 +1,210 @@
+#include <stdlib.h>
+#include <string.h>
+#include "depth_sort.h"
+#include "stats.h"
+#include "thread_local.h"
+
+bool coherent_depth_sort = true;
+
+// what is sorted instead of the triangles themselves, ties on depth go by face
+// so the order doesn't depend on the order it was repaired from
+typedef struct {
+	float depth;
+	int face;
+	int triangle;	// index in the array being sorted
+} depth_sort_key_t;
+
+// position of every face in the order of the last frame, -1 when it wasn't drawn, indexed like mesh.faces
+static THREAD_LOCAL int* face_ranks = NULL;
+static THREAD_LOCAL int num_ranked_faces = 0;
+// the faces of the last frame in order, to clear their ranks
+static THREAD_LOCAL int* previous_faces = NULL;
+static THREAD_LOCAL int num_previous_faces = 0;
+// frames left to merge sort before trying to repair again, after a repair gave up
+static THREAD_LOCAL int frames_until_repair = 0;
+
+// scratch space, grown to the largest frame sorted so far
+static THREAD_LOCAL depth_sort_key_t* keys = NULL;
+static THREAD_LOCAL depth_sort_key_t* merge_keys = NULL;
+static THREAD_LOCAL int* rank_triangles = NULL;
+static THREAD_LOCAL triangle_t* sorted_triangles = NULL;
+static THREAD_LOCAL int capacity = 0;
+
+void allocate_depth_sort_buffer(int num_faces) {
+	face_ranks = (int*) malloc(sizeof(int) * num_faces);
+	for (int i = 0; i < num_faces; i++) {
+		face_ranks[i] = -1;
+	}
+	num_ranked_faces = num_faces;
+	previous_faces = (int*) malloc(sizeof(int) * num_faces);
+	rank_triangles = (int*) malloc(sizeof(int) * num_faces);
+	num_previous_faces = 0;
+	frames_until_repair = 0;
+}
+
+void free_depth_sort_buffer(void) {
+	free(face_ranks);
+	free(previous_faces);
+	free(rank_triangles);
+	free(keys);
+	free(merge_keys);
+	free(sorted_triangles);
+	face_ranks = previous_faces = rank_triangles = NULL;
+	keys = merge_keys = NULL;
+	sorted_triangles = NULL;
+	num_ranked_faces = num_previous_faces = capacity = 0;
+	frames_until_repair = 0;
+}
+
+static void reserve(int count) {
+	if (count <= capacity) {
+		return;
+	}
+	capacity = count > 2 * capacity ? count : 2 * capacity;
+	keys = (depth_sort_key_t*) realloc(keys, sizeof(depth_sort_key_t) * capacity);
+	merge_keys = (depth_sort_key_t*) realloc(merge_keys, sizeof(depth_sort_key_t) * capacity);
+	sorted_triangles = (triangle_t*) realloc(sorted_triangles, sizeof(triangle_t) * capacity);
+}
+
+// far to near, the painter's algorithm draws the farthest first
+static bool key_before(const depth_sort_key_t* a, const depth_sort_key_t* b) {
+	return a->depth > b->depth || (a->depth == b->depth && a->face < b->face);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Stable bottom-up merge sort, for frames that share little order with the last one
+///////////////////////////////////////////////////////////////////////////////
+static void merge_sort_keys(int count) {
+	depth_sort_key_t* from = keys;
+	depth_sort_key_t* to = merge_keys;
+	for (int width = 1; width < count; width *= 2) {
+		for (int start = 0; start < count; start += 2 * width) {
+			int middle = start + width < count ? start + width : count;
+			int end = start + 2 * width < count ? start + 2 * width : count;
+			int i = start, j = middle, k = start;
+			while (i < middle && j < end) {
+				to[k++] = key_before(&from[j], &from[i]) ? from[j++] : from[i++];
+			}
+			while (i < middle) to[k++] = from[i++];
+			while (j < end) to[k++] = from[j++];
+		}
+		depth_sort_key_t* temp = from;
+		from = to;
+		to = temp;
+	}
+	if (from != keys) {
+		memcpy(keys, from, sizeof(depth_sort_key_t) * count);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Insertion sort, linear in the number of triangles plus how far they move, so
+// it gives up once they have moved more than max_shifts places in total
+///////////////////////////////////////////////////////////////////////////////
+static bool insertion_sort_keys(int count, int max_shifts, int* shifts) {
+	*shifts = 0;
+	for (int i = 1; i < count; i++) {
+		depth_sort_key_t key = keys[i];
+		int j = i;
+		while (j > 0 && key_before(&key, &keys[j - 1])) {
+			keys[j] = keys[j - 1];
+			j--;
+		}
+		keys[j] = key;
+		*shifts += i - j;
+		if (*shifts > max_shifts) {
+			return false;
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sort triangles far to near for the painter's algorithm
+// A slowly turning mesh or camera barely changes the order from one frame to
+// the next, so the triangles start out in the order their faces had last frame
+// (faces that weren't drawn go at the end) and insertion sort repairs it in
+// close to linear time; when the view jumps and too few faces keep their place,
+// or too many have to move, the frame is merge sorted instead
+///////////////////////////////////////////////////////////////////////////////
+void sort_triangles_by_depth(triangle_t* triangles, int count) {
+	reserve(count);
+
+	int num_kept = 0;
+	if (coherent_depth_sort && face_ranks) {
+		// every face has one rank, so the triangles are put in the last order by
+		// filling in the slots of their ranks, then the new faces follow, along
+		// with the second piece of a face cut in two at the near plane
+		for (int r = 0; r < num_previous_faces; r++) {
+			rank_triangles[r] = -1;
+		}
+		int num_new = count;
+		for (int i = 0; i < count; i++) {
+			int face = triangles[i].face_index;
+			int rank = face < num_ranked_faces ? face_ranks[face] : -1;
+			if (rank >= 0 && rank_triangles[rank] < 0) {
+				rank_triangles[rank] = i;
+				num_kept++;
+			} else {
+				keys[--num_new] = (depth_sort_key_t){ triangles[i].avg_depth, face, i };
+			}
+		}
+		// the new faces were filled in from the end, turn them around to keep them in mesh order
+		for (int a = num_new, b = count - 1; a < b; a++, b--) {
+			depth_sort_key_t temp = keys[a];
+			keys[a] = keys[b];
+			keys[b] = temp;
+		}
+		int k = 0;
+		for (int r = 0; r < num_previous_faces; r++) {
+			int i = rank_triangles[r];
+			if (i >= 0) {
+				keys[k++] = (depth_sort_key_t){ triangles[i].avg_depth, triangles[i].face_index, i };
+			}
+		}
+	} else {
+		for (int i = 0; i < count; i++) {
+			keys[i] = (depth_sort_key_t){ triangles[i].avg_depth, triangles[i].face_index, i };
+		}
+	}
+
+	// a repair that gives up costs as much as the sort after it, so once one has
+	// the next few frames, likely just as far from the last order, skip straight to it
+	bool repaired = false;
+	if (frames_until_repair > 0) {
+		frames_until_repair--;
+	} else if (num_kept >= count / 2 && count > 0) {
+		repaired = insertion_sort_keys(count, DEPTH_SORT_MAX_SHIFTS_PER_TRIANGLE * count, &frame_stats.depth_sort_shifts);
+		if (!repaired) {
+			frames_until_repair = DEPTH_SORT_RETRY_FRAMES;
+		}
+	}
+	if (!repaired) {
+		// the merge sort still starts from the last order, which mispredicts fewer branches than mesh order
+		merge_sort_keys(count);
+	}
+	frame_stats.depth_sort_repaired = repaired;
+
+	for (int i = 0; i < count; i++) {
+		sorted_triangles[i] = triangles[keys[i].triangle];
+	}
+	// a frame with nothing in view may have no buffers yet
+	if (count > 0) {
+		memcpy(triangles, sorted_triangles, sizeof(triangle_t) * count);
+	}
+
+	// remember the order for the next frame
+	if (face_ranks) {
+		for (int r = 0; r < num_previous_faces; r++) {
+			face_ranks[previous_faces[r]] = -1;
+		}
+		num_previous_faces = 0;
+		for (int i = 0; i < count; i++) {
+			int face = triangles[i].face_index;
+			if (face < num_ranked_faces && face_ranks[face] < 0) {
+				face_ranks[face] = num_previous_faces;
+				previous_faces[num_previous_faces++] = face;
+			}
+		}
+	}
+}
@@ -0,0 +1,20 @@
+#ifndef DEPTH_SORT_H
+#define DEPTH_SORT_H
+
+#include <stdbool.h>
+#include "triangle.h"
+
+// the order of the last frame is repaired by insertion while that moves the
+// triangles fewer places than this per triangle, past it the frame is merge sorted
+#define DEPTH_SORT_MAX_SHIFTS_PER_TRIANGLE 8
+// frames merge sorted after a repair gives up, before the next try
+#define DEPTH_SORT_RETRY_FRAMES 8
+
+// start from the order of the last frame, otherwise every frame is sorted from scratch
+extern bool coherent_depth_sort;
+
+void allocate_depth_sort_buffer(int num_faces);
+void free_depth_sort_buffer(void);
+void sort_triangles_by_depth(triangle_t* triangles, int count);
+
+#endif
@@ -1,14 +1,33 @@
+#include <math.h>
+#include <limits.h>
 #include "display.h"
+#include "stats.h"
 
 SDL_Window* window = NULL;
 SDL_Renderer* renderer = NULL;
 
 SDL_Texture* color_buffer_texture = NULL;
 // Declare a pointer to an array of uint32 elements
-uint32_t* color_buffer = NULL;
+THREAD_LOCAL uint32_t* color_buffer = NULL;
+THREAD_LOCAL uint16_t* overdraw_buffer = NULL;
+
+enum cull_method cull_method;
+enum frame_pacing frame_pacing;
+THREAD_LOCAL enum shading_method shading_method;
+THREAD_LOCAL enum line_method line_method;
+THREAD_LOCAL enum render_method render_method;
 
 int window_width = 800;
 int window_height = 600;
+int target_fps = FPS;
+
+THREAD_LOCAL int band_top = 0;
+THREAD_LOCAL int band_bottom = INT_MAX;
+
+bool dynamic_resolution = true;
+float resolution_scale = 1;
+int display_width = 800;
+int display_height = 600;
 
 // Set the pixel at row 10 column 20 to the color red
 //color_buffer[(window_width * 10) + 20] = 0xFFFF0000;
@@ -22,8 +41,8 @@ bool initialize_window(void) {
 	//Set width and height of the SDL window to the max screen sze
 	SDL_DisplayMode display_mode;
 	SDL_GetCurrentDisplayMode(0, &display_mode);
-	window_width = display_mode.w;
-	window_height = display_mode.h;
+	window_width = display_width = display_mode.w;
+	window_height = display_height = display_mode.h;
 
 	
 	// Create SDL window
@@ -73,29 +92,186 @@ void draw_grid(void) {
 }
 
 void draw_pixel(int x, int y, uint32_t color) {
-	if (x >=0 && x < window_width && y >=0 && y < window_height) {
-		color_buffer[(window_width * y) + x] = color;
+	if (x >=0 && x < window_width && y >= band_top && y < band_bottom && y < window_height) {
+		color_buffer[(window_width * (y - band_top)) + x] = color;
 	}
 }
 
+// Cohen-Sutherland outcodes, one bit per side of the viewport the point is past
+enum {
+	CLIP_INSIDE = 0,
+	CLIP_LEFT = 1,
+	CLIP_RIGHT = 2,
+	CLIP_TOP = 4,
+	CLIP_BOTTOM = 8
+};
+
+static int clip_outcode(float x, float y) {
+	int code = CLIP_INSIDE;
+	if (x < 0) code |= CLIP_LEFT;
+	else if (x > window_width - 1) code |= CLIP_RIGHT;
+	if (y < 0) code |= CLIP_TOP;
+	else if (y > window_height - 1) code |= CLIP_BOTTOM;
+	return code;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Clip a line to the color buffer with the Cohen-Sutherland algorithm
+// Endpoints outside the viewport are moved to the border they cross until
+// both are inside, or the line is dropped when both are past the same side
+///////////////////////////////////////////////////////////////////////////////
+static bool clip_line(float* x0, float* y0, float* x1, float* y1) {
+	int code0 = clip_outcode(*x0, *y0);
+	int code1 = clip_outcode(*x1, *y1);
+
+	while (true) {
+		if (!(code0 | code1)) {
+			return true;
+		}
+		if (code0 & code1) {
+			return false;
+		}
+
+		// move the endpoint that is outside onto the border
+		int code = code0 ? code0 : code1;
+		float x, y;
+		if (code & CLIP_BOTTOM) {
+			y = window_height - 1;
+			x = *x0 + (*x1 - *x0) * (y - *y0) / (*y1 - *y0);
+		} else if (code & CLIP_TOP) {
+			y = 0;
+			x = *x0 + (*x1 - *x0) * (y - *y0) / (*y1 - *y0);
+		} else if (code & CLIP_RIGHT) {
+			x = window_width - 1;
+			y = *y0 + (*y1 - *y0) * (x - *x0) / (*x1 - *x0);
+		} else {
+			x = 0;
+			y = *y0 + (*y1 - *y0) * (x - *x0) / (*x1 - *x0);
+		}
+
+		if (code == code0) {
+			*x0 = x;
+			*y0 = y;
+			code0 = clip_outcode(x, y);
+		} else {
+			*x1 = x;
+			*y1 = y;
+			code1 = clip_outcode(x, y);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Bresenham line: only integer adds per pixel, the error term decides when
+// the minor axis steps; the line is clipped once so pixels are written
+// straight into the color buffer without bounds checks
+///////////////////////////////////////////////////////////////////////////////
 void draw_line(int x0, int y0, int x1, int y1, uint32_t color) {
-	int delta_x = (x1 - x0);
-	int delta_y = (y1 - y0);
+	float fx0 = x0, fy0 = y0, fx1 = x1, fy1 = y1;
+	if (!clip_line(&fx0, &fy0, &fx1, &fy1)) {
+		return;
+	}
+	x0 = fx0 + 0.5f;
+	y0 = fy0 + 0.5f;
+	x1 = fx1 + 0.5f;
+	y1 = fy1 + 0.5f;
 
-	//find out how much you need to run / rise, whichever is longer
-	int longest_side_length = (abs(delta_x) >= abs(delta_y)) ? abs(delta_x) : abs(delta_y);
+	int delta_x = abs(x1 - x0);
+	int delta_y = -abs(y1 - y0);
+	int step_x = (x0 < x1) ? 1 : -1;
+	int step_y = (y0 < y1) ? window_width : -window_width;
+	int error = delta_x + delta_y;
 
-	//find out how much we need to increment in both x and y each step
-	float x_inc = delta_x / (float)longest_side_length; //always 1 (if x is longest side). need to cast one to float so that output is float, not int
-	float y_inc = delta_y / (float)longest_side_length; //grows more or less depending on slope, if y is shorter side
+	// a line that leaves the band is walked whole from the same clipped ends and only
+	// its pixels in the band are written, so it matches the line of the whole frame
+	if (y0 < band_top || y1 < band_top || y0 >= band_bottom || y1 >= band_bottom) {
+		int y_step = (y0 < y1) ? 1 : -1;
+		int length = (delta_x > -delta_y) ? delta_x : -delta_y;
+		for (int i = 0; i <= length; i++) {
+			if (y0 >= band_top && y0 < band_bottom) {
+				color_buffer[(window_width * (y0 - band_top)) + x0] = color;
+			}
+			int error2 = 2 * error;
+			if (error2 >= delta_y) {
+				error += delta_y;
+				x0 += step_x;
+			}
+			if (error2 <= delta_x) {
+				error += delta_x;
+				y0 += y_step;
+			}
+		}
+		return;
+	}
 
-	float current_x = x0;
-	float current_y = y0;
+	uint32_t* pixel = &color_buffer[(window_width * (y0 - band_top)) + x0];
+	int length = (delta_x > -delta_y) ? delta_x : -delta_y;
+	for (int i = 0; i <= length; i++) {
+		*pixel = color;
+		int error2 = 2 * error;
+		if (error2 >= delta_y) {
+			error += delta_y;
+			pixel += step_x;
+		}
+		if (error2 <= delta_x) {
+			error += delta_x;
+			pixel += step_y;
+		}
+	}
+}
 
-	for (int i = 0; i <= longest_side_length; i++) {
-		draw_pixel(round(current_x), round(current_y), color);
-		current_x += x_inc;
-		current_y += y_inc;
+// mix color over the pixel with a coverage between 0 and 1
+// red and blue are blended together in one multiply, they are 8 bits apart
+static void blend_pixel(int x, int y, uint32_t color, float coverage) {
+	if (x < 0 || x >= window_width || y < band_top || y >= band_bottom || y >= window_height) {
+		return;
+	}
+	uint32_t* pixel = &color_buffer[(window_width * (y - band_top)) + x];
+	uint32_t alpha = coverage * 256;
+	uint32_t red_blue = (((*pixel & 0xFF00FF) * (256 - alpha) + (color & 0xFF00FF) * alpha) >> 8) & 0xFF00FF;
+	uint32_t green = (((*pixel & 0x00FF00) * (256 - alpha) + (color & 0x00FF00) * alpha) >> 8) & 0x00FF00;
+	*pixel = (color & 0xFF000000) | red_blue | green;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Anti-aliased line with Xiaolin Wu's algorithm
+// Steps along the major axis and splits every pixel between the two pixels
+// the line passes through on the minor axis, weighted by their distance
+///////////////////////////////////////////////////////////////////////////////
+void draw_line_antialiased(float x0, float y0, float x1, float y1, uint32_t color) {
+	if (!clip_line(&x0, &y0, &x1, &y1)) {
+		return;
+	}
+
+	// walk along x, swapping the axes of steep lines
+	bool steep = fabs(y1 - y0) > fabs(x1 - x0);
+	if (steep) {
+		float tmp;
+		tmp = x0; x0 = y0; y0 = tmp;
+		tmp = x1; x1 = y1; y1 = tmp;
+	}
+	if (x0 > x1) {
+		float tmp;
+		tmp = x0; x0 = x1; x1 = tmp;
+		tmp = y0; y0 = y1; y1 = tmp;
+	}
+
+	float gradient = (x1 != x0) ? (y1 - y0) / (x1 - x0) : 1;
+	int x_start = roundf(x0);
+	int x_end = roundf(x1);
+	float y = y0 + gradient * (x_start - x0);
+
+	for (int x = x_start; x <= x_end; x++) {
+		int y_floor = floorf(y);
+		float fraction = y - y_floor;
+		if (steep) {
+			blend_pixel(y_floor, x, color, 1 - fraction);
+			blend_pixel(y_floor + 1, x, color, fraction);
+		} else {
+			blend_pixel(x, y_floor, color, 1 - fraction);
+			blend_pixel(x, y_floor + 1, color, fraction);
+		}
+		y += gradient;
 	}
 }
 
@@ -105,6 +281,22 @@ void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t colo
 	draw_line(x2, y2, x0, y0, color);
 }
 
+// draw the edges of a triangle selected by edge_mask (bit 0: v0-v1, bit 1: v1-v2, bit 2: v2-v0)
+void draw_triangle_edges(float x0, float y0, float x1, float y1, float x2, float y2, int edge_mask, uint32_t color) {
+	float x[4] = { x0, x1, x2, x0 };
+	float y[4] = { y0, y1, y2, y0 };
+	for (int i = 0; i < 3; i++) {
+		if (!(edge_mask & (1 << i))) {
+			continue;
+		}
+		if (line_method == LINE_ANTIALIASED) {
+			draw_line_antialiased(x[i], y[i], x[i + 1], y[i + 1], color);
+		} else {
+			draw_line(x[i], y[i], x[i + 1], y[i + 1], color);
+		}
+	}
+}
+
 void draw_rect(int x, int y, int width, int height, uint32_t color){
 	for (int i=0; i < width; i++) {
 		for (int j=0; j < height; j++) {
@@ -116,20 +308,52 @@ void draw_rect(int x, int y, int width, int height, uint32_t color){
 	}
 }
 
+void set_frame_pacing(enum frame_pacing pacing) {
+	frame_pacing = pacing;
+
+	// https://wiki.libsdl.org/SDL_RenderSetVSync
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+	if (SDL_RenderSetVSync(renderer, pacing == PACING_VSYNC) != 0) {
+		fprintf(stderr, "Error setting vsync: %s\n", SDL_GetError());
+	}
+#else
+	if (pacing == PACING_VSYNC) {
+		fprintf(stderr, "Error setting vsync: needs SDL 2.0.18 or later.\n");
+	}
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw the frames at a fraction of the window size, fill cost goes with the
+// number of pixels so it falls with the square of the scale
+///////////////////////////////////////////////////////////////////////////////
+
+void set_resolution_scale(float scale) {
+	resolution_scale = scale;
+	window_width = (int)(display_width * scale + 0.5f);
+	window_height = (int)(display_height * scale + 0.5f);
+	if (window_width < 1) window_width = 1;
+	if (window_height < 1) window_height = 1;
+}
+
 void render_color_buffer() {
 	//copy all content of color buffer and render it
 	// https://wiki.libsdl.org/SDL_UpdateTexture
 
+	// the texture has the size of the window, a scaled down frame only fills its top left corner
+	SDL_Rect frame_rect = { 0, 0, window_width, window_height };
+
 	//texture, sub-divisions, source, pitch (size of each row)
 	SDL_UpdateTexture(
 		color_buffer_texture,
-		NULL,
+		&frame_rect,
 		color_buffer,
 		(int)(window_width * sizeof(uint32_t))
 	);
 
 	// https://wiki.libsdl.org/SDL_RenderCopy
-	SDL_RenderCopy(renderer, color_buffer_texture, NULL, NULL);
+	// stretched over the whole window, with the filtering of SDL_HINT_RENDER_SCALE_QUALITY
+	SDL_RenderCopy(renderer, color_buffer_texture, &frame_rect, NULL);
 }
 
 void clear_color_buffer(uint32_t color) {
@@ -141,6 +365,31 @@ void clear_color_buffer(uint32_t color) {
 	
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Turn the overdraw counts into colors, from blue for pixels written once to
+// red for seven writes and white beyond; pixels no fill touched are left as
+// they are. Counts the covered pixels and resets the counts for the next frame
+///////////////////////////////////////////////////////////////////////////////
+void draw_overdraw_heat_map(void) {
+	static const uint32_t heat_colors[] = {
+		0xFF000000, 0xFF0000A0, 0xFF0060FF, 0xFF00C0C0, 0xFF00C000, 0xFFC0C000, 0xFFFF8000, 0xFFFF0000, 0xFFFFFFFF
+	};
+	const int max_count = sizeof(heat_colors) / sizeof(heat_colors[0]) - 1;
+
+	int num_pixels = window_width * window_height;
+	int covered = 0;
+	for (int i = 0; i < num_pixels; i++) {
+		int count = overdraw_buffer[i];
+		if (count == 0) {
+			continue;
+		}
+		covered++;
+		color_buffer[i] = heat_colors[count < max_count ? count : max_count];
+		overdraw_buffer[i] = 0;
+	}
+	frame_stats.pixels_covered = covered;
+}
+
 void destroy_window(void) {
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
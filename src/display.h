@@ -4,39 +4,97 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <SDL2/SDL.h>
+#include "thread_local.h"
 
+// default frame rate of PACING_TARGET_FPS
 #define FPS 30
-#define FRAME_TARGET_TIME (1000 / FPS)
 
 enum cull_method {
 	CULL_NONE,
-	CULL_BACKFACE
-} cull_method;
+	CULL_BACKFACE,
+	CULL_BACKFACE_SCREEN
+};
+
+enum shading_method {
+	SHADE_FLAT,
+	SHADE_GOURAUD
+};
+
+enum line_method {
+	LINE_BRESENHAM,
+	LINE_ANTIALIASED
+};
+
+// how the main loop paces frames, the animation speed doesn't depend on it
+enum frame_pacing {
+	PACING_UNCAPPED,	// present as soon as a frame is done
+	PACING_VSYNC,		// present on the display refresh
+	PACING_TARGET_FPS	// wait until 1 / target_fps seconds have passed since the last frame
+};
 
 enum render_method {
 	RENDER_WIRE,
 	RENDER_WIRE_VERTEX,
 	RENDER_FILL_TRIANGLE,
-	RENDER_FILL_TRIANGLE_WIRE
-} render_method;
+	RENDER_FILL_TRIANGLE_WIRE,
+	RENDER_TEXTURED,
+	RENDER_TEXTURED_WIRE,
+	RENDER_OVERDRAW,	// heat map of how many times the triangle fills write each pixel
+	RENDER_RAYCAST,		// the mesh is ray cast with hard shadows instead of rasterized
+	RENDER_POINTS		// every vertex is a depth tested splat, for point clouds
+};
+
+extern enum cull_method cull_method;
+extern enum frame_pacing frame_pacing;
+// the draw state, per thread: the render thread draws a frame with the state it
+// was recorded with while the main thread changes it for the next one
+extern THREAD_LOCAL enum shading_method shading_method;
+extern THREAD_LOCAL enum line_method line_method;
+extern THREAD_LOCAL enum render_method render_method;
 
 extern SDL_Window* window;
 extern SDL_Renderer* renderer;
 extern SDL_Texture* color_buffer_texture;
 // Declare a pointer to an array of uint32 elements
-extern uint32_t* color_buffer;
+extern THREAD_LOCAL uint32_t* color_buffer;
+// fills in RENDER_OVERDRAW mode count the writes to each pixel here instead of writing colors
+extern THREAD_LOCAL uint16_t* overdraw_buffer;
+
+// size of the frames drawn, the window's unless dynamic resolution scales them down
+extern int window_width;
+extern int window_height;
+extern int target_fps;
+
+// the color buffer holds rows band_top to band_bottom - 1 of the frame, every row
+// unless a poster is drawn a band at a time, and drawing is clipped to them
+extern THREAD_LOCAL int band_top;
+extern THREAD_LOCAL int band_bottom;
+
+// dynamic resolution draws smaller frames when they take longer than
+// DYNAMIC_RESOLUTION_TARGET_TIME to build or draw, SDL_RenderCopy stretches them over the window
+#define DYNAMIC_RESOLUTION_TARGET_TIME (1.0 / 60)
+#define MIN_RESOLUTION_SCALE 0.25f
+// the scale changes in steps of 1 / RESOLUTION_SCALE_STEPS
+#define RESOLUTION_SCALE_STEPS 16
 
-int window_width;
-int window_height;
+extern bool dynamic_resolution;
+extern float resolution_scale;
+extern int display_width;	// the window
+extern int display_height;
 
 bool initialize_window(void);
 void draw_grid(void);
 void draw_pixel(int x, int y, uint32_t color);
 void draw_line(int x0, int y0, int x1, int y1, uint32_t color);
 void draw_rect(int x, int y, int width, int height, uint32_t color);
+void draw_line_antialiased(float x0, float y0, float x1, float y1, uint32_t color);
 void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color);
+void draw_triangle_edges(float x0, float y0, float x1, float y1, float x2, float y2, int edge_mask, uint32_t color);
+void set_frame_pacing(enum frame_pacing pacing);
+void set_resolution_scale(float scale);
 void render_color_buffer();
 void clear_color_buffer(uint32_t color);
+void draw_overdraw_heat_map(void);
 void destroy_window(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include <math.h>
+#include "frustum.h"
+
+plane_t frustum_planes[NUM_FRUSTUM_PLANES];
+
+///////////////////////////////////////////////////////////////////////////////
+// Frustum planes are defined by a point and a normal vector
+///////////////////////////////////////////////////////////////////////////////
+// Near plane   :  P=(0, 0, znear), N=(0, 0,  1)
+// Far plane    :  P=(0, 0, zfar),  N=(0, 0, -1)
+// Top plane    :  P=(0, 0, 0),     N=(0, -cos(fov/2), sin(fov/2))
+// Bottom plane :  P=(0, 0, 0),     N=(0, cos(fov/2), sin(fov/2))
+// Left plane   :  P=(0, 0, 0),     N=(cos(fov/2), 0, sin(fov/2))
+// Right plane  :  P=(0, 0, 0),     N=(-cos(fov/2), 0, sin(fov/2))
+///////////////////////////////////////////////////////////////////////////////
+//
+//           /|-|
+//         /  | |
+//       /\   | |
+//     /      | |
+//  P*|-->  <-|*|   ----> +z-axis
+//     \      | |
+//       \/   | |
+//         \  | |
+//           \|-|
+//
+///////////////////////////////////////////////////////////////////////////////
+void init_frustum_planes(float fov_x, float fov_y, float z_near, float z_far) {
+	float cos_half_fov_x = cos(fov_x / 2);
+	float sin_half_fov_x = sin(fov_x / 2);
+	float cos_half_fov_y = cos(fov_y / 2);
+	float sin_half_fov_y = sin(fov_y / 2);
+
+	vec3_t origin = { 0, 0, 0 };
+
+	frustum_planes[LEFT_FRUSTUM_PLANE].point = origin;
+	frustum_planes[LEFT_FRUSTUM_PLANE].normal = (vec3_t){ cos_half_fov_x, 0, sin_half_fov_x };
+
+	frustum_planes[RIGHT_FRUSTUM_PLANE].point = origin;
+	frustum_planes[RIGHT_FRUSTUM_PLANE].normal = (vec3_t){ -cos_half_fov_x, 0, sin_half_fov_x };
+
+	frustum_planes[TOP_FRUSTUM_PLANE].point = origin;
+	frustum_planes[TOP_FRUSTUM_PLANE].normal = (vec3_t){ 0, -cos_half_fov_y, sin_half_fov_y };
+
+	frustum_planes[BOTTOM_FRUSTUM_PLANE].point = origin;
+	frustum_planes[BOTTOM_FRUSTUM_PLANE].normal = (vec3_t){ 0, cos_half_fov_y, sin_half_fov_y };
+
+	frustum_planes[NEAR_FRUSTUM_PLANE].point = (vec3_t){ 0, 0, z_near };
+	frustum_planes[NEAR_FRUSTUM_PLANE].normal = (vec3_t){ 0, 0, 1 };
+
+	frustum_planes[FAR_FRUSTUM_PLANE].point = (vec3_t){ 0, 0, z_far };
+	frustum_planes[FAR_FRUSTUM_PLANE].normal = (vec3_t){ 0, 0, -1 };
+}
+
+// a sphere is outside when it lies entirely behind any one of the planes
+bool sphere_outside_frustum(vec3_t center, float radius) {
+	for (int i = 0; i < NUM_FRUSTUM_PLANES; i++) {
+		vec3_t to_center = vec3_subtract(center, frustum_planes[i].point);
+		if (vec3_dot(to_center, frustum_planes[i].normal) < -radius) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static clip_vertex_t clip_vertex_lerp(const clip_vertex_t* a, const clip_vertex_t* b, float t) {
+	return (clip_vertex_t){
+		.position = {
+			a->position.x + (b->position.x - a->position.x) * t,
+			a->position.y + (b->position.y - a->position.y) * t,
+			a->position.z + (b->position.z - a->position.z) * t
+		},
+		.texcoord = {
+			a->texcoord.u + (b->texcoord.u - a->texcoord.u) * t,
+			a->texcoord.v + (b->texcoord.v - a->texcoord.v) * t
+		},
+		.intensity = a->intensity + (b->intensity - a->intensity) * t
+	};
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Cut a triangle down to the part in front of the near plane, which has no
+// corner, three or four; the corners keep their order, so four make a fan of
+// two triangles
+// It runs in view space before the projection, where texture coordinates and
+// intensities are still linear and w can't reach zero
+///////////////////////////////////////////////////////////////////////////////
+int clip_triangle_to_near_plane(const clip_vertex_t triangle[3], clip_vertex_t clipped[4]) {
+	float z_near = frustum_planes[NEAR_FRUSTUM_PLANE].point.z;
+	int count = 0;
+	for (int i = 0; i < 3; i++) {
+		const clip_vertex_t* current = &triangle[i];
+		const clip_vertex_t* next = &triangle[(i + 1) % 3];
+		bool current_inside = current->position.z >= z_near;
+		bool next_inside = next->position.z >= z_near;
+		if (current_inside) {
+			clipped[count++] = *current;
+		}
+		if (current_inside != next_inside) {
+			float t = (z_near - current->position.z) / (next->position.z - current->position.z);
+			clip_vertex_t cut = clip_vertex_lerp(current, next, t);
+			cut.position.z = z_near;
+			// leaving, the next edge runs along the near plane; entering, it goes on along this side
+			cut.side = current_inside ? -1 : current->side;
+			clipped[count++] = cut;
+		}
+	}
+	return count;
+}
@@ -0,0 +1,38 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <stdbool.h>
+#include "vector.h"
+#include "texture.h"
+
+enum {
+	LEFT_FRUSTUM_PLANE,
+	RIGHT_FRUSTUM_PLANE,
+	TOP_FRUSTUM_PLANE,
+	BOTTOM_FRUSTUM_PLANE,
+	NEAR_FRUSTUM_PLANE,
+	FAR_FRUSTUM_PLANE,
+	NUM_FRUSTUM_PLANES
+};
+
+// a plane is stored as a point on the plane and a normal pointing inside the frustum
+typedef struct {
+	vec3_t point;
+	vec3_t normal;
+} plane_t;
+
+extern plane_t frustum_planes[NUM_FRUSTUM_PLANES];
+
+// a corner of a triangle clipped in view space, with what the rasterizer interpolates
+typedef struct {
+	vec3_t position;
+	tex2_t texcoord;
+	float intensity;
+	int side;	// side of the face the edge to the next corner lies on, -1 along the near plane
+} clip_vertex_t;
+
+void init_frustum_planes(float fov_x, float fov_y, float z_near, float z_far);
+bool sphere_outside_frustum(vec3_t center, float radius);
+int clip_triangle_to_near_plane(const clip_vertex_t triangle[3], clip_vertex_t clipped[4]);
+
+#endif
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <string.h>
+#include "hud.h"
+#include "display.h"
+#include "stats.h"
+#include "array.h"
+
+// 5x7 bitmap font for space to Z, one byte per row with the leftmost pixel in
+// bit 4; lowercase letters are drawn as uppercase, characters without a glyph as blanks
+static const uint8_t font_glyphs['Z' + 1][FONT_HEIGHT] = {
+	[' '] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	['%'] = { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 },
+	['('] = { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 },
+	[')'] = { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 },
+	['+'] = { 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 },
+	[','] = { 0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08 },
+	['-'] = { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 },
+	['.'] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C },
+	['/'] = { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 },
+	['0'] = { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E },
+	['1'] = { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E },
+	['2'] = { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F },
+	['3'] = { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E },
+	['4'] = { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 },
+	['5'] = { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E },
+	['6'] = { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E },
+	['7'] = { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },
+	['8'] = { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E },
+	['9'] = { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C },
+	[':'] = { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 },
+	['='] = { 0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00 },
+	['A'] = { 0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },
+	['B'] = { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E },
+	['C'] = { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E },
+	['D'] = { 0x1E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x1E },
+	['E'] = { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F },
+	['F'] = { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 },
+	['G'] = { 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F },
+	['H'] = { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },
+	['I'] = { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E },
+	['J'] = { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C },
+	['K'] = { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 },
+	['L'] = { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F },
+	['M'] = { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 },
+	['N'] = { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 },
+	['O'] = { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },
+	['P'] = { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 },
+	['Q'] = { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D },
+	['R'] = { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 },
+	['S'] = { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E },
+	['T'] = { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },
+	['U'] = { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },
+	['V'] = { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 },
+	['W'] = { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A },
+	['X'] = { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 },
+	['Y'] = { 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04, 0x04 },
+	['Z'] = { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F },
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw a line of text straight into the color buffer, every font pixel is a
+// scale x scale block; text running off the buffer is clipped
+///////////////////////////////////////////////////////////////////////////////
+void draw_text(int x, int y, const char* text, int scale, uint32_t color) {
+	for (; *text; text++, x += (FONT_WIDTH + 1) * scale) {
+		int c = *text;
+		if (c >= 'a' && c <= 'z') {
+			c -= 'a' - 'A';
+		}
+		if (c < ' ' || c > 'Z') {
+			continue;
+		}
+		const uint8_t* glyph = font_glyphs[c];
+
+		for (int row = 0; row < FONT_HEIGHT * scale; row++) {
+			int py = y + row;
+			if (py < 0 || py >= window_height) {
+				continue;
+			}
+			uint8_t bits = glyph[row / scale];
+			uint32_t* pixels = &color_buffer[window_width * py];
+			for (int col = 0; col < FONT_WIDTH * scale; col++) {
+				int px = x + col;
+				if ((bits & (0x10 >> (col / scale))) && px >= 0 && px < window_width) {
+					pixels[px] = color;
+				}
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw the counters of the frame in the top left corner
+// Overdraw is the pixels the triangle fills wrote divided by the pixels they
+// covered; only the overdraw render mode counts coverage, the other modes
+// divide by the pixels of the color buffer instead
+///////////////////////////////////////////////////////////////////////////////
+void draw_hud(void) {
+	// allocations made by array_hold on any thread since the last HUD, which is one frame
+	static int previous_allocation_count = 0;
+	int allocation_count = SDL_AtomicGet(&array_allocation_count);
+	int allocations = allocation_count - previous_allocation_count;
+	previous_allocation_count = allocation_count;
+
+	double frame_ms = frame_time_histogram.last_time * 1000;
+	int culled = frame_stats.triangles_culled_by_cluster + frame_stats.triangles_culled_backface;
+	bool has_coverage = frame_stats.pixels_covered > 0;
+	float overdraw = (float)frame_stats.pixels_filled / (has_coverage ? frame_stats.pixels_covered : window_width * window_height);
+
+	char lines[6][64];
+	snprintf(lines[0], sizeof(lines[0]), "FRAME %.2f MS (%.0f FPS)", frame_ms, frame_ms > 0 ? 1000 / frame_ms : 0);
+	snprintf(lines[1], sizeof(lines[1]), "FACES %d CULLED %d DRAWN %d", frame_stats.triangles_total, culled, frame_stats.triangles_drawn);
+	snprintf(lines[2], sizeof(lines[2]), "CLUSTERS CULLED %d/%d OCCLUDED %d",
+		frame_stats.clusters_culled_backface + frame_stats.clusters_culled_frustum + frame_stats.clusters_culled_occlusion,
+		frame_stats.clusters_total, frame_stats.clusters_culled_occlusion);
+	snprintf(lines[3], sizeof(lines[3]), "PIXELS %d %s %.2f", frame_stats.pixels_filled,
+		has_coverage ? "OVERDRAW" : "PER SCREEN PIXEL", overdraw);
+	snprintf(lines[4], sizeof(lines[4]), "ALLOCATIONS %d ALL THREADS", allocations);
+	snprintf(lines[5], sizeof(lines[5]), "RESOLUTION %dX%d %.0f%%", window_width, window_height, resolution_scale * 100);
+
+	int longest_line = 0;
+	for (int i = 0; i < 6; i++) {
+		int length = strlen(lines[i]);
+		if (length > longest_line) longest_line = length;
+	}
+
+	const int scale = 2;
+	const int line_height = (FONT_HEIGHT + 2) * scale;
+	draw_rect(0, 0, longest_line * (FONT_WIDTH + 1) * scale + 12, 6 * line_height + 10, 0xFF000000);
+	for (int i = 0; i < 6; i++) {
+		draw_text(6, 6 + i * line_height, lines[i], scale, 0xFF00FF00);
+	}
+}
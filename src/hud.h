@@ -0,0 +1,13 @@
+#ifndef HUD_H
+#define HUD_H
+
+#include <stdint.h>
+
+// size of a glyph of the built-in font in font pixels, characters advance by one more
+#define FONT_WIDTH 5
+#define FONT_HEIGHT 7
+
+void draw_text(int x, int y, const char* text, int scale, uint32_t color);
+void draw_hud(void);
+
+#endif
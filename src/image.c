@@ -0,0 +1,820 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdbool.h>
+#include "image.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Inflate (RFC 1951) for the zlib stream inside PNG files
+// Huffman codes are decoded one bit at a time with canonical code counts,
+// which is slow but small, and images are only decoded at load time
+///////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+	const uint8_t* data;
+	int size;
+	int position;
+	uint32_t bit_buffer;
+	int bit_count;
+	bool error;
+} bit_reader_t;
+
+typedef struct {
+	uint16_t counts[16];	// number of codes of each length
+	uint16_t symbols[288];	// symbols ordered by their code
+} huffman_t;
+
+static const uint16_t length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t distance_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t distance_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static uint32_t read_bits(bit_reader_t* reader, int count) {
+	while (reader->bit_count < count) {
+		if (reader->position >= reader->size) {
+			reader->error = true;
+			return 0;
+		}
+		reader->bit_buffer |= (uint32_t)reader->data[reader->position++] << reader->bit_count;
+		reader->bit_count += 8;
+	}
+	uint32_t value = reader->bit_buffer & ((1u << count) - 1);
+	reader->bit_buffer >>= count;
+	reader->bit_count -= count;
+	return value;
+}
+
+static void build_huffman(huffman_t* huffman, const uint8_t* lengths, int count) {
+	uint16_t offsets[16];
+	memset(huffman->counts, 0, sizeof(huffman->counts));
+	for (int i = 0; i < count; i++) {
+		huffman->counts[lengths[i]]++;
+	}
+	huffman->counts[0] = 0;
+
+	offsets[1] = 0;
+	for (int length = 1; length < 15; length++) {
+		offsets[length + 1] = offsets[length] + huffman->counts[length];
+	}
+	for (int i = 0; i < count; i++) {
+		if (lengths[i] != 0) {
+			huffman->symbols[offsets[lengths[i]]++] = i;
+		}
+	}
+}
+
+static int decode_symbol(bit_reader_t* reader, const huffman_t* huffman) {
+	int code = 0;	// bits read so far
+	int first = 0;	// first code of the current length
+	int index = 0;	// index of the first symbol of the current length
+	for (int length = 1; length < 16; length++) {
+		code |= read_bits(reader, 1);
+		int count = huffman->counts[length];
+		if (code - count < first) {
+			return huffman->symbols[index + (code - first)];
+		}
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+	reader->error = true;
+	return -1;
+}
+
+static bool inflate_codes(bit_reader_t* reader, const huffman_t* literals, const huffman_t* distances, uint8_t* out, int out_size, int* out_position) {
+	while (!reader->error) {
+		int symbol = decode_symbol(reader, literals);
+		if (symbol < 0) {
+			return false;
+		}
+		if (symbol < 256) {
+			if (*out_position >= out_size) return false;
+			out[(*out_position)++] = symbol;
+			continue;
+		}
+		if (symbol == 256) {
+			return true;
+		}
+
+		symbol -= 257;
+		if (symbol >= 29) return false;
+		int length = length_base[symbol] + read_bits(reader, length_extra[symbol]);
+
+		int distance_symbol = decode_symbol(reader, distances);
+		if (distance_symbol < 0 || distance_symbol >= 30) return false;
+		int distance = distance_base[distance_symbol] + read_bits(reader, distance_extra[distance_symbol]);
+
+		if (distance > *out_position || *out_position + length > out_size) {
+			return false;
+		}
+		// byte by byte, the source may overlap the bytes being written
+		for (int i = 0; i < length; i++) {
+			out[*out_position] = out[*out_position - distance];
+			(*out_position)++;
+		}
+	}
+	return false;
+}
+
+// inflate a zlib stream into a buffer whose size is known in advance
+static bool zlib_inflate(const uint8_t* data, int size, uint8_t* out, int out_size) {
+	if (size < 2 || (data[0] & 0x0F) != 8 || ((data[0] << 8) | data[1]) % 31 != 0) {
+		return false;
+	}
+
+	bit_reader_t reader = { .data = data, .size = size, .position = 2 };
+	int out_position = 0;
+	bool last_block = false;
+
+	while (!last_block) {
+		last_block = read_bits(&reader, 1);
+		int type = read_bits(&reader, 2);
+
+		if (type == 0) {
+			// stored block: skip to the byte boundary, then LEN and its complement
+			reader.bit_buffer = 0;
+			reader.bit_count = 0;
+			if (reader.position + 4 > size) return false;
+			int length = data[reader.position] | (data[reader.position + 1] << 8);
+			int complement = data[reader.position + 2] | (data[reader.position + 3] << 8);
+			reader.position += 4;
+			if (length != (~complement & 0xFFFF) || reader.position + length > size || out_position + length > out_size) {
+				return false;
+			}
+			memcpy(out + out_position, data + reader.position, length);
+			reader.position += length;
+			out_position += length;
+		} else if (type == 1) {
+			// fixed Huffman codes
+			uint8_t lengths[288 + 30];
+			for (int i = 0; i < 144; i++) lengths[i] = 8;
+			for (int i = 144; i < 256; i++) lengths[i] = 9;
+			for (int i = 256; i < 280; i++) lengths[i] = 7;
+			for (int i = 280; i < 288; i++) lengths[i] = 8;
+			for (int i = 288; i < 288 + 30; i++) lengths[i] = 5;
+			huffman_t literals, distances;
+			build_huffman(&literals, lengths, 288);
+			build_huffman(&distances, lengths + 288, 30);
+			if (!inflate_codes(&reader, &literals, &distances, out, out_size, &out_position)) return false;
+		} else if (type == 2) {
+			// dynamic Huffman codes, themselves sent with a code length code
+			static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+			int num_literals = read_bits(&reader, 5) + 257;
+			int num_distances = read_bits(&reader, 5) + 1;
+			int num_code_lengths = read_bits(&reader, 4) + 4;
+			if (num_literals > 286 || num_distances > 30) return false;
+
+			uint8_t lengths[288 + 30] = { 0 };
+			for (int i = 0; i < num_code_lengths; i++) {
+				lengths[order[i]] = read_bits(&reader, 3);
+			}
+			huffman_t code_lengths;
+			build_huffman(&code_lengths, lengths, 19);
+
+			int index = 0;
+			memset(lengths, 0, sizeof(lengths));
+			while (index < num_literals + num_distances) {
+				int symbol = decode_symbol(&reader, &code_lengths);
+				if (symbol < 0 || reader.error) return false;
+				if (symbol < 16) {
+					lengths[index++] = symbol;
+					continue;
+				}
+				int repeat_value = 0;
+				int repeat_count;
+				if (symbol == 16) {
+					if (index == 0) return false;
+					repeat_value = lengths[index - 1];
+					repeat_count = 3 + read_bits(&reader, 2);
+				} else if (symbol == 17) {
+					repeat_count = 3 + read_bits(&reader, 3);
+				} else {
+					repeat_count = 11 + read_bits(&reader, 7);
+				}
+				if (index + repeat_count > num_literals + num_distances) return false;
+				while (repeat_count--) {
+					lengths[index++] = repeat_value;
+				}
+			}
+
+			huffman_t literals, distances;
+			build_huffman(&literals, lengths, num_literals);
+			build_huffman(&distances, lengths + num_literals, num_distances);
+			if (!inflate_codes(&reader, &literals, &distances, out, out_size, &out_position)) return false;
+		} else {
+			return false;
+		}
+
+		if (reader.error) {
+			return false;
+		}
+	}
+
+	return out_position == out_size;
+}
+
+// the largest image decoded, 8192x8192; its pixels and the decoded rows of a
+// PNG stay well inside an int, and a bogus header can't ask for gigabytes
+#define MAX_DECODED_PIXELS (1 << 26)
+
+///////////////////////////////////////////////////////////////////////////////
+// PNG decoder: non-interlaced 8-bit gray, gray+alpha, RGB and RGBA images,
+// and palette images of 1, 2, 4 or 8 bits per pixel
+///////////////////////////////////////////////////////////////////////////////
+
+static uint32_t read_u32_be(const uint8_t* p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static int paeth_predictor(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = abs(p - a);
+	int pb = abs(p - b);
+	int pc = abs(p - c);
+	if (pa <= pb && pa <= pc) return a;
+	if (pb <= pc) return b;
+	return c;
+}
+
+bool decode_png(const uint8_t* data, int size, image_t* image) {
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	if (size < 8 || memcmp(data, signature, 8) != 0) {
+		return false;
+	}
+
+	int width = 0, height = 0, bit_depth = 0, color_type = 0, interlace = 0;
+	uint32_t palette[256];
+	int palette_size = 0;
+	for (int i = 0; i < 256; i++) {
+		palette[i] = 0xFF000000;
+	}
+
+	uint8_t* compressed = NULL;
+	int compressed_size = 0;
+
+	// walk the chunks and gather every IDAT into one zlib stream
+	int position = 8;
+	while (position + 12 <= size) {
+		uint32_t length = read_u32_be(data + position);
+		const uint8_t* type = data + position + 4;
+		const uint8_t* chunk = data + position + 8;
+		if (length > (uint32_t)(size - position - 12)) {
+			break;
+		}
+
+		if (memcmp(type, "IHDR", 4) == 0 && length >= 13) {
+			width = read_u32_be(chunk);
+			height = read_u32_be(chunk + 4);
+			bit_depth = chunk[8];
+			color_type = chunk[9];
+			interlace = chunk[12];
+		} else if (memcmp(type, "PLTE", 4) == 0) {
+			palette_size = length / 3;
+			for (int i = 0; i < palette_size && i < 256; i++) {
+				palette[i] = 0xFF000000 | (chunk[i * 3] << 16) | (chunk[i * 3 + 1] << 8) | chunk[i * 3 + 2];
+			}
+		} else if (memcmp(type, "tRNS", 4) == 0 && color_type == 3) {
+			for (uint32_t i = 0; i < length && i < 256; i++) {
+				palette[i] = (palette[i] & 0x00FFFFFF) | ((uint32_t)chunk[i] << 24);
+			}
+		} else if (memcmp(type, "IDAT", 4) == 0) {
+			compressed = realloc(compressed, compressed_size + length);
+			memcpy(compressed + compressed_size, chunk, length);
+			compressed_size += length;
+		} else if (memcmp(type, "IEND", 4) == 0) {
+			break;
+		}
+		position += 12 + length;
+	}
+
+	int channels;
+	switch (color_type) {
+		case 0: channels = 1; break;
+		case 2: channels = 3; break;
+		case 3: channels = 1; break;
+		case 4: channels = 2; break;
+		case 6: channels = 4; break;
+		default: channels = 0; break;
+	}
+	bool supported_depth = (color_type == 3) ? (bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8) : (bit_depth == 8);
+	if (width <= 0 || height <= 0 || width > 32768 || height > 32768 || channels == 0 || !supported_depth || interlace != 0 || !compressed) {
+		fprintf(stderr, "Unsupported PNG image (color type %d, bit depth %d, interlace %d).\n", color_type, bit_depth, interlace);
+		free(compressed);
+		return false;
+	}
+	if ((uint64_t)width * height > MAX_DECODED_PIXELS) {
+		fprintf(stderr, "PNG image too large (%dx%d).\n", width, height);
+		free(compressed);
+		return false;
+	}
+
+	// every row is prefixed by its filter type
+	int row_bytes = (width * channels * bit_depth + 7) / 8;
+	int bytes_per_pixel = (channels * bit_depth + 7) / 8;
+	size_t raw_size = (size_t)height * (row_bytes + 1);
+	uint8_t* raw = malloc(raw_size);
+
+	if (!zlib_inflate(compressed, compressed_size, raw, (int)raw_size)) {
+		fprintf(stderr, "Corrupt PNG image data.\n");
+		free(compressed);
+		free(raw);
+		return false;
+	}
+	free(compressed);
+
+	// undo the per-row filters in place, the filter byte of each row is skipped
+	uint8_t* previous = NULL;
+	for (int y = 0; y < height; y++) {
+		uint8_t filter = raw[y * (row_bytes + 1)];
+		uint8_t* row = raw + y * (row_bytes + 1) + 1;
+		for (int i = 0; i < row_bytes; i++) {
+			int left = (i >= bytes_per_pixel) ? row[i - bytes_per_pixel] : 0;
+			int up = previous ? previous[i] : 0;
+			int up_left = (previous && i >= bytes_per_pixel) ? previous[i - bytes_per_pixel] : 0;
+			switch (filter) {
+				case 1: row[i] += left; break;
+				case 2: row[i] += up; break;
+				case 3: row[i] += (left + up) / 2; break;
+				case 4: row[i] += paeth_predictor(left, up, up_left); break;
+				default: break;
+			}
+		}
+		previous = row;
+	}
+
+	image->width = width;
+	image->height = height;
+	image->pixels = malloc(sizeof(uint32_t) * width * height);
+
+	for (int y = 0; y < height; y++) {
+		uint8_t* row = raw + y * (row_bytes + 1) + 1;
+		for (int x = 0; x < width; x++) {
+			uint32_t color;
+			uint8_t* p = row + x * channels;
+			switch (color_type) {
+				case 0: color = 0xFF000000 | (p[0] << 16) | (p[0] << 8) | p[0]; break;
+				case 2: color = 0xFF000000 | (p[0] << 16) | (p[1] << 8) | p[2]; break;
+				case 4: color = ((uint32_t)p[1] << 24) | (p[0] << 16) | (p[0] << 8) | p[0]; break;
+				case 6: color = ((uint32_t)p[3] << 24) | (p[0] << 16) | (p[1] << 8) | p[2]; break;
+				default: {
+					// palette indices are packed from the most significant bit
+					int bit = x * bit_depth;
+					int index = (row[bit / 8] >> (8 - bit_depth - bit % 8)) & ((1 << bit_depth) - 1);
+					color = palette[index];
+					break;
+				}
+			}
+			image->pixels[y * width + x] = color;
+		}
+	}
+
+	free(raw);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PPM decoder: binary (P6) and ascii (P3) with up to 8 bits per channel
+///////////////////////////////////////////////////////////////////////////////
+
+// read the next header number, skipping whitespace and # comments
+static int read_ppm_number(const uint8_t* data, int size, int* position) {
+	while (*position < size) {
+		if (data[*position] == '#') {
+			while (*position < size && data[*position] != '\n') (*position)++;
+		} else if (isspace(data[*position])) {
+			(*position)++;
+		} else {
+			break;
+		}
+	}
+	int value = -1;
+	while (*position < size && isdigit(data[*position])) {
+		// too many digits for an int is as bad as none
+		if (value > (INT_MAX - 9) / 10) {
+			return -1;
+		}
+		value = (value < 0 ? 0 : value * 10) + (data[*position] - '0');
+		(*position)++;
+	}
+	return value;
+}
+
+bool decode_ppm(const uint8_t* data, int size, image_t* image) {
+	if (size < 2 || data[0] != 'P' || (data[1] != '6' && data[1] != '3')) {
+		return false;
+	}
+	bool binary = data[1] == '6';
+	int position = 2;
+	int width = read_ppm_number(data, size, &position);
+	int height = read_ppm_number(data, size, &position);
+	int max_value = read_ppm_number(data, size, &position);
+	if (width <= 0 || height <= 0 || max_value <= 0 || max_value > 255) {
+		fprintf(stderr, "Unsupported PPM image.\n");
+		return false;
+	}
+	if ((uint64_t)width * height > MAX_DECODED_PIXELS) {
+		fprintf(stderr, "PPM image too large (%dx%d).\n", width, height);
+		return false;
+	}
+	int num_pixels = width * height;
+	// a single whitespace byte separates the header from binary data
+	position++;
+	if (binary && (int64_t)position + (int64_t)num_pixels * 3 > size) {
+		return false;
+	}
+
+	image->width = width;
+	image->height = height;
+	image->pixels = malloc(sizeof(uint32_t) * num_pixels);
+
+	for (int i = 0; i < num_pixels; i++) {
+		int rgb[3];
+		for (int c = 0; c < 3; c++) {
+			int value = binary ? data[position++] : read_ppm_number(data, size, &position);
+			if (value < 0) value = 0;
+			rgb[c] = value * 255 / max_value;
+		}
+		image->pixels[i] = 0xFF000000 | (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Deflate with the fixed Huffman codes and greedy LZ77 matching
+// A hash of the next three bytes finds the last position they appeared at;
+// rendered frames are mostly runs of flat color, which this handles well
+///////////////////////////////////////////////////////////////////////////////
+
+#define DEFLATE_WINDOW 32768
+#define DEFLATE_HASH_BITS 15
+
+typedef struct {
+	uint8_t* data;
+	int size;
+	uint32_t bit_buffer;
+	int bit_count;
+} bit_writer_t;
+
+static void write_bits(bit_writer_t* writer, uint32_t value, int count) {
+	writer->bit_buffer |= value << writer->bit_count;
+	writer->bit_count += count;
+	while (writer->bit_count >= 8) {
+		writer->data[writer->size++] = writer->bit_buffer & 0xFF;
+		writer->bit_buffer >>= 8;
+		writer->bit_count -= 8;
+	}
+}
+
+// Huffman codes are sent starting from their most significant bit
+static void write_code(bit_writer_t* writer, uint32_t code, int length) {
+	uint32_t reversed = 0;
+	for (int i = 0; i < length; i++) {
+		reversed = (reversed << 1) | ((code >> i) & 1);
+	}
+	write_bits(writer, reversed, length);
+}
+
+static void write_fixed_symbol(bit_writer_t* writer, int symbol) {
+	if (symbol < 144) write_code(writer, 0x30 + symbol, 8);
+	else if (symbol < 256) write_code(writer, 0x190 + symbol - 144, 9);
+	else if (symbol < 280) write_code(writer, symbol - 256, 7);
+	else write_code(writer, 0xC0 + symbol - 280, 8);
+}
+
+static void write_match(bit_writer_t* writer, int length, int distance) {
+	int symbol = 28;
+	while (length_base[symbol] > length) symbol--;
+	write_fixed_symbol(writer, 257 + symbol);
+	write_bits(writer, length - length_base[symbol], length_extra[symbol]);
+
+	symbol = 29;
+	while (distance_base[symbol] > distance) symbol--;
+	write_code(writer, symbol, 5);
+	write_bits(writer, distance - distance_base[symbol], distance_extra[symbol]);
+}
+
+static void reset_match_positions(int* last_position) {
+	for (int i = 0; i < (1 << DEFLATE_HASH_BITS); i++) {
+		last_position[i] = -DEFLATE_WINDOW;
+	}
+}
+
+// one block with the fixed codes, matches only reach back within data
+static void deflate_fixed_block(bit_writer_t* writer, const uint8_t* data, int size, bool final, int* last_position) {
+	write_bits(writer, final, 1);
+	write_bits(writer, 1, 2);
+
+	int position = 0;
+	while (position < size) {
+		int best_length = 0;
+		if (position + 3 <= size) {
+			uint32_t hash = ((data[position] << 16) | (data[position + 1] << 8) | data[position + 2]) * 2654435761u >> (32 - DEFLATE_HASH_BITS);
+			int candidate = last_position[hash];
+			last_position[hash] = position;
+			if (position - candidate < DEFLATE_WINDOW) {
+				int max_length = (size - position < 258) ? size - position : 258;
+				while (best_length < max_length && data[candidate + best_length] == data[position + best_length]) {
+					best_length++;
+				}
+				if (best_length >= 3) {
+					write_match(writer, best_length, position - candidate);
+					position += best_length;
+					continue;
+				}
+			}
+		}
+		write_fixed_symbol(writer, data[position++]);
+	}
+	write_fixed_symbol(writer, 256);
+}
+
+static uint32_t adler32_update(uint32_t adler, const uint8_t* data, int size) {
+	uint32_t a = adler & 0xFFFF, b = adler >> 16;
+	for (int i = 0; i < size; i++) {
+		a = (a + data[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	return (b << 16) | a;
+}
+
+// the adler-32 of the uncompressed data closes the zlib stream, big endian
+static void write_adler32(bit_writer_t* writer, uint32_t adler) {
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		writer->data[writer->size++] = (adler >> shift) & 0xFF;
+	}
+}
+
+// compress data into a zlib stream, returns its size; out needs room for the worst case
+static int zlib_deflate(const uint8_t* data, int size, uint8_t* out) {
+	bit_writer_t writer = { .data = out };
+	out[writer.size++] = 0x78;	// deflate, 32K window
+	out[writer.size++] = 0x01;	// no dictionary, fastest compression level
+
+	int* last_position = (int*) malloc(sizeof(int) * (1 << DEFLATE_HASH_BITS));
+	reset_match_positions(last_position);
+	deflate_fixed_block(&writer, data, size, true, last_position);
+	write_bits(&writer, 0, 7);	// flush the last partial byte
+	free(last_position);
+
+	write_adler32(&writer, adler32_update(1, data, size));
+	return writer.size;
+}
+
+static void write_u32_be(uint8_t* p, uint32_t value) {
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >> 8;
+	p[3] = value;
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t* data, int size) {
+	for (int i = 0; i < size; i++) {
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+		}
+	}
+	return crc;
+}
+
+static uint32_t crc32(const uint8_t* data, int size) {
+	return ~crc32_update(0xFFFFFFFF, data, size);
+}
+
+// append a chunk, the type and data must already be at out + 8
+static int finish_png_chunk(uint8_t* out, const char* type, int length) {
+	write_u32_be(out, length);
+	memcpy(out + 4, type, 4);
+	write_u32_be(out + 8 + length, crc32(out + 4, length + 4));
+	return length + 12;
+}
+
+// write a chunk straight to a file, its data can be anywhere
+static bool write_png_chunk(FILE* file, const char* type, const uint8_t* data, int length) {
+	uint8_t header[8];
+	write_u32_be(header, length);
+	memcpy(header + 4, type, 4);
+	uint8_t crc[4];
+	write_u32_be(crc, ~crc32_update(crc32_update(0xFFFFFFFF, header + 4, 4), data, length));
+	return fwrite(header, 1, 8, file) == 8 && (length == 0 || fwrite(data, 1, length, file) == (size_t)length) && fwrite(crc, 1, 4, file) == 4;
+}
+
+static void write_png_header(uint8_t* header, int width, int height) {
+	write_u32_be(header, width);
+	write_u32_be(header + 4, height);
+	header[8] = 8;	// bit depth
+	header[9] = 2;	// RGB
+	header[10] = 0;	// deflate
+	header[11] = 0;	// adaptive filters
+	header[12] = 0;	// not interlaced
+}
+
+// every row uses the Sub filter, which turns flat runs into zeros
+static void filter_png_rows(uint8_t* raw, const uint32_t* pixels, int width, int rows) {
+	int row_bytes = width * 3 + 1;
+	for (int y = 0; y < rows; y++) {
+		uint8_t* row = raw + y * row_bytes;
+		const uint32_t* row_pixels = pixels + y * width;
+		row[0] = 1;
+		uint32_t previous = 0;
+		for (int x = 0; x < width; x++) {
+			row[1 + x * 3] = ((row_pixels[x] >> 16) & 0xFF) - ((previous >> 16) & 0xFF);
+			row[2 + x * 3] = ((row_pixels[x] >> 8) & 0xFF) - ((previous >> 8) & 0xFF);
+			row[3 + x * 3] = (row_pixels[x] & 0xFF) - (previous & 0xFF);
+			previous = row_pixels[x];
+		}
+	}
+}
+
+static const uint8_t png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+///////////////////////////////////////////////////////////////////////////////
+// Encode an image as an 8-bit RGB PNG, alpha is dropped
+// Returns a malloc'd buffer and its size
+///////////////////////////////////////////////////////////////////////////////
+uint8_t* encode_png(const image_t* image, int* size) {
+	int row_bytes = image->width * 3 + 1;
+	int raw_size = row_bytes * image->height;
+	uint8_t* raw = (uint8_t*) malloc(raw_size);
+	filter_png_rows(raw, image->pixels, image->width, image->height);
+
+	// fixed codes take at most 9 bits per byte
+	int max_compressed = raw_size + raw_size / 8 + 64;
+	uint8_t* png = (uint8_t*) malloc(8 + 25 + 12 + max_compressed + 12);
+	memcpy(png, png_signature, 8);
+	int length = 8;
+
+	write_png_header(png + length + 8, image->width, image->height);
+	length += finish_png_chunk(png + length, "IHDR", 13);
+
+	int compressed_size = zlib_deflate(raw, raw_size, png + length + 8);
+	length += finish_png_chunk(png + length, "IDAT", compressed_size);
+	length += finish_png_chunk(png + length, "IEND", 0);
+
+	free(raw);
+	*size = length;
+	return png;
+}
+
+// convert pixels to the RGB bytes of a binary PPM
+static void pixels_to_rgb(uint8_t* rgb, const uint32_t* pixels, int num_pixels) {
+	for (int i = 0; i < num_pixels; i++) {
+		rgb[i * 3] = (pixels[i] >> 16) & 0xFF;
+		rgb[i * 3 + 1] = (pixels[i] >> 8) & 0xFF;
+		rgb[i * 3 + 2] = pixels[i] & 0xFF;
+	}
+}
+
+// encode an image as a binary PPM (P6)
+uint8_t* encode_ppm(const image_t* image, int* size) {
+	char header[32];
+	int header_size = sprintf(header, "P6\n%d %d\n255\n", image->width, image->height);
+	int num_pixels = image->width * image->height;
+	uint8_t* ppm = (uint8_t*) malloc(header_size + num_pixels * 3);
+	memcpy(ppm, header, header_size);
+	pixels_to_rgb(ppm + header_size, image->pixels, num_pixels);
+	*size = header_size + num_pixels * 3;
+	return ppm;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Write a PNG or PPM file a band of rows at a time, for images too large to
+// hold whole; a PNG gets one deflate block and one IDAT chunk per band, whose
+// matches don't reach back into the band before, and the zlib stream is closed
+// with an empty final block once every row is in
+///////////////////////////////////////////////////////////////////////////////
+
+struct image_writer {
+	FILE* file;
+	bool is_png;
+	int width;
+	int height;
+	int rows_written;
+	bool failed;
+	uint8_t* raw;		// the band filtered, or converted to RGB for a PPM
+	uint8_t* compressed;
+	int capacity;		// rows the buffers have room for
+	int* last_position;
+	bit_writer_t bits;	// the bits of the last byte carry over to the next band
+	uint32_t adler;
+};
+
+image_writer_t* open_image_writer(FILE* file, bool is_png, int width, int height) {
+	image_writer_t* writer = (image_writer_t*) calloc(1, sizeof(image_writer_t));
+	writer->file = file;
+	writer->is_png = is_png;
+	writer->width = width;
+	writer->height = height;
+	if (!is_png) {
+		writer->failed = fprintf(file, "P6\n%d %d\n255\n", width, height) < 0;
+		return writer;
+	}
+
+	uint8_t header[13];
+	write_png_header(header, width, height);
+	uint8_t zlib_header[2] = { 0x78, 0x01 };
+	writer->failed = fwrite(png_signature, 1, 8, file) != 8 || !write_png_chunk(file, "IHDR", header, 13) ||
+		!write_png_chunk(file, "IDAT", zlib_header, 2);
+	writer->last_position = (int*) malloc(sizeof(int) * (1 << DEFLATE_HASH_BITS));
+	writer->adler = 1;
+	return writer;
+}
+
+bool write_image_rows(image_writer_t* writer, const uint32_t* pixels, int rows) {
+	int row_bytes = writer->width * 3 + (writer->is_png ? 1 : 0);
+	int raw_size = row_bytes * rows;
+	if (rows > writer->capacity) {
+		writer->capacity = rows;
+		writer->raw = (uint8_t*) realloc(writer->raw, raw_size);
+		if (writer->is_png) {
+			writer->compressed = (uint8_t*) realloc(writer->compressed, raw_size + raw_size / 8 + 64);
+		}
+	}
+	writer->rows_written += rows;
+
+	if (!writer->is_png) {
+		pixels_to_rgb(writer->raw, pixels, writer->width * rows);
+		writer->failed |= fwrite(writer->raw, 1, raw_size, writer->file) != (size_t)raw_size;
+		return !writer->failed;
+	}
+
+	filter_png_rows(writer->raw, pixels, writer->width, rows);
+	writer->adler = adler32_update(writer->adler, writer->raw, raw_size);
+	writer->bits.data = writer->compressed;
+	writer->bits.size = 0;
+	reset_match_positions(writer->last_position);
+	deflate_fixed_block(&writer->bits, writer->raw, raw_size, false, writer->last_position);
+	writer->failed |= !write_png_chunk(writer->file, "IDAT", writer->compressed, writer->bits.size);
+	return !writer->failed;
+}
+
+// finish the file and free the writer, false when any write failed or rows are missing
+bool close_image_writer(image_writer_t* writer) {
+	bool ok = !writer->failed && writer->rows_written == writer->height;
+	if (writer->is_png) {
+		uint8_t end[16];
+		writer->bits.data = end;
+		writer->bits.size = 0;
+		write_bits(&writer->bits, 1, 1);
+		write_bits(&writer->bits, 1, 2);
+		write_fixed_symbol(&writer->bits, 256);
+		write_bits(&writer->bits, 0, 7);	// flush the last partial byte
+		write_adler32(&writer->bits, writer->adler);
+		ok = ok && write_png_chunk(writer->file, "IDAT", end, writer->bits.size) && write_png_chunk(writer->file, "IEND", NULL, 0);
+	}
+	free(writer->raw);
+	free(writer->compressed);
+	free(writer->last_position);
+	free(writer);
+	return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Load a PNG or PPM file, the format is detected from its first bytes
+///////////////////////////////////////////////////////////////////////////////
+bool load_image(const char* filename, image_t* image) {
+	FILE* file = fopen(filename, "rb");
+	if (!file) {
+		fprintf(stderr, "Error opening %s.\n", filename);
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	uint8_t* data = malloc(size > 0 ? size : 1);
+	bool read_ok = size > 0 && fread(data, 1, size, file) == (size_t)size;
+	fclose(file);
+
+	bool decoded = false;
+	if (read_ok && size >= 8 && data[0] == 0x89) {
+		decoded = decode_png(data, size, image);
+	} else if (read_ok && size >= 2 && data[0] == 'P') {
+		decoded = decode_ppm(data, size, image);
+	}
+	free(data);
+
+	if (!decoded) {
+		fprintf(stderr, "Error decoding image %s.\n", filename);
+	}
+	return decoded;
+}
+
+void free_image(image_t* image) {
+	free(image->pixels);
+	image->pixels = NULL;
+}
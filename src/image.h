@@ -0,0 +1,29 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// a decoded image with pixels in the same ARGB8888 format as the color buffer
+typedef struct {
+	int width;
+	int height;
+	uint32_t* pixels;	// row major, width * height entries
+} image_t;
+
+bool load_image(const char* filename, image_t* image);
+bool decode_png(const uint8_t* data, int size, image_t* image);
+bool decode_ppm(const uint8_t* data, int size, image_t* image);
+uint8_t* encode_png(const image_t* image, int* size);
+uint8_t* encode_ppm(const image_t* image, int* size);
+void free_image(image_t* image);
+
+// writes a PNG or PPM file a band of rows at a time, top to bottom
+typedef struct image_writer image_writer_t;
+
+image_writer_t* open_image_writer(FILE* file, bool is_png, int width, int height);
+bool write_image_rows(image_writer_t* writer, const uint32_t* pixels, int rows);
+bool close_image_writer(image_writer_t* writer);
+
+#endif
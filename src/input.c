@@ -0,0 +1,145 @@
+#include "input.h"
+#include "stats.h"
+
+// default key of every action
+SDL_Keycode action_bindings[NUM_ACTIONS] = {
+	[ACTION_QUIT] = SDLK_ESCAPE,
+	[ACTION_RENDER_WIRE_VERTEX] = SDLK_1,
+	[ACTION_RENDER_WIRE] = SDLK_2,
+	[ACTION_RENDER_FILL_TRIANGLE] = SDLK_3,
+	[ACTION_RENDER_FILL_TRIANGLE_WIRE] = SDLK_4,
+	[ACTION_RENDER_TEXTURED] = SDLK_5,
+	[ACTION_RENDER_TEXTURED_WIRE] = SDLK_6,
+	[ACTION_RENDER_OVERDRAW] = SDLK_7,
+	[ACTION_RENDER_RAYCAST] = SDLK_8,
+	[ACTION_RENDER_POINTS] = SDLK_9,
+	[ACTION_LINE_ANTIALIASED] = SDLK_a,
+	[ACTION_LINE_BRESENHAM] = SDLK_b,
+	[ACTION_CULL_BACKFACE] = SDLK_c,
+	[ACTION_CULL_BACKFACE_SCREEN] = SDLK_x,
+	[ACTION_CULL_NONE] = SDLK_d,
+	[ACTION_SHADE_FLAT] = SDLK_f,
+	[ACTION_SHADE_GOURAUD] = SDLK_g,
+	[ACTION_PACING_UNCAPPED] = SDLK_u,
+	[ACTION_PACING_VSYNC] = SDLK_v,
+	[ACTION_PACING_TARGET_FPS] = SDLK_t,
+	[ACTION_TOGGLE_FRAME_TIME_HISTOGRAM] = SDLK_h,
+	[ACTION_WRITE_TRACE] = SDLK_p,
+	[ACTION_TOGGLE_HUD] = SDLK_F1,
+	[ACTION_RESET_CAMERA] = SDLK_r,
+	[ACTION_TOGGLE_OCCLUSION_CULLING] = SDLK_o,
+	[ACTION_TOGGLE_COMPRESSED_MESH] = SDLK_z,
+	[ACTION_TOGGLE_DYNAMIC_RESOLUTION] = SDLK_n
+};
+
+// actions triggered by the events of the current frame
+static bool pressed_actions[NUM_ACTIONS];
+
+// keys held down, indexed by scancode so it follows the physical layout
+static bool key_states[SDL_NUM_SCANCODES];
+
+// the last left click of the current frame, in window pixels
+static bool mouse_click_pending = false;
+static int mouse_click_x, mouse_click_y;
+
+// SDL timestamp (ms) of the oldest event of this frame that triggered an action, 0 if none
+static Uint32 pending_input_timestamp = 0;
+
+void bind_action(enum action action, SDL_Keycode key) {
+	action_bindings[action] = key;
+}
+
+static void press_action(enum action action, Uint32 timestamp) {
+	pressed_actions[action] = true;
+	if (pending_input_timestamp == 0 || timestamp < pending_input_timestamp) {
+		pending_input_timestamp = timestamp;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Drain every pending SDL event, a single SDL_PollEvent per frame lets the
+// queue grow (a burst of mouse motion delays key presses by many frames)
+///////////////////////////////////////////////////////////////////////////////
+
+void poll_input(void) {
+	for (int i = 0; i < NUM_ACTIONS; i++) {
+		pressed_actions[i] = false;
+	}
+	mouse_click_pending = false;
+
+	SDL_Event event;
+	while (SDL_PollEvent(&event)) {
+		switch (event.type) {
+			case SDL_QUIT: //x button of window
+				pressed_actions[ACTION_QUIT] = true;
+				break;
+			case SDL_KEYDOWN:
+				if (event.key.keysym.scancode >= 0 && event.key.keysym.scancode < SDL_NUM_SCANCODES) {
+					key_states[event.key.keysym.scancode] = true;
+				}
+				// holding a key down only triggers its action once
+				if (event.key.repeat) {
+					break;
+				}
+				for (int i = 0; i < NUM_ACTIONS; i++) {
+					if (action_bindings[i] == event.key.keysym.sym) {
+						press_action(i, event.key.timestamp);
+					}
+				}
+				break;
+			case SDL_KEYUP:
+				if (event.key.keysym.scancode >= 0 && event.key.keysym.scancode < SDL_NUM_SCANCODES) {
+					key_states[event.key.keysym.scancode] = false;
+				}
+				break;
+			case SDL_MOUSEBUTTONDOWN:
+				if (event.button.button == SDL_BUTTON_LEFT) {
+					mouse_click_pending = true;
+					mouse_click_x = event.button.x;
+					mouse_click_y = event.button.y;
+				}
+				break;
+		}
+	}
+}
+
+bool action_pressed(enum action action) {
+	return pressed_actions[action];
+}
+
+bool is_key_down(SDL_Scancode scancode) {
+	return scancode >= 0 && scancode < SDL_NUM_SCANCODES && key_states[scancode];
+}
+
+// whether the left button was clicked this frame, and where
+bool mouse_clicked(int* x, int* y) {
+	if (mouse_click_pending) {
+		*x = mouse_click_x;
+		*y = mouse_click_y;
+	}
+	return mouse_click_pending;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Called when the frame that reacts to this frame's input is recorded, returns
+// the SDL timestamp of the oldest event it reacts to (0 if none) for the frame
+// to carry until input_frame_presented()
+///////////////////////////////////////////////////////////////////////////////
+
+Uint32 input_frame_recorded(void) {
+	Uint32 timestamp = pending_input_timestamp;
+	pending_input_timestamp = 0;
+	return timestamp;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Called after the frame is presented, the frame that reacts to an input is on
+// screen so the time since its event was queued is the input to photon latency
+// (up to the display scanout, which SDL can't see)
+///////////////////////////////////////////////////////////////////////////////
+
+void input_frame_presented(Uint32 input_timestamp) {
+	if (input_timestamp != 0) {
+		record_input_latency(SDL_GetTicks() - input_timestamp);
+	}
+}
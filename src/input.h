@@ -0,0 +1,49 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+// everything the keyboard can trigger, each action is bound to one key
+enum action {
+	ACTION_QUIT,
+	ACTION_RENDER_WIRE_VERTEX,
+	ACTION_RENDER_WIRE,
+	ACTION_RENDER_FILL_TRIANGLE,
+	ACTION_RENDER_FILL_TRIANGLE_WIRE,
+	ACTION_RENDER_TEXTURED,
+	ACTION_RENDER_TEXTURED_WIRE,
+	ACTION_RENDER_OVERDRAW,
+	ACTION_RENDER_RAYCAST,
+	ACTION_RENDER_POINTS,
+	ACTION_LINE_ANTIALIASED,
+	ACTION_LINE_BRESENHAM,
+	ACTION_CULL_BACKFACE,
+	ACTION_CULL_BACKFACE_SCREEN,
+	ACTION_CULL_NONE,
+	ACTION_SHADE_FLAT,
+	ACTION_SHADE_GOURAUD,
+	ACTION_PACING_UNCAPPED,
+	ACTION_PACING_VSYNC,
+	ACTION_PACING_TARGET_FPS,
+	ACTION_TOGGLE_FRAME_TIME_HISTOGRAM,
+	ACTION_WRITE_TRACE,
+	ACTION_TOGGLE_HUD,
+	ACTION_RESET_CAMERA,
+	ACTION_TOGGLE_OCCLUSION_CULLING,
+	ACTION_TOGGLE_COMPRESSED_MESH,
+	ACTION_TOGGLE_DYNAMIC_RESOLUTION,
+	NUM_ACTIONS
+};
+
+extern SDL_Keycode action_bindings[NUM_ACTIONS];
+
+void bind_action(enum action action, SDL_Keycode key);
+void poll_input(void);
+bool action_pressed(enum action action);
+bool is_key_down(SDL_Scancode scancode);
+bool mouse_clicked(int* x, int* y);
+Uint32 input_frame_recorded(void);
+void input_frame_presented(Uint32 input_timestamp);
+
+#endif
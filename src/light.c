@@ -1,22 +1,160 @@
 #include <stdint.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "light.h"
 
-light_t light = { .direction = { 0, 0, 1} };
+// compile an AVX2 copy of a kernel next to the baseline one, the loader picks the
+// copy for the CPU it runs on, so one binary gets 8 wide loops where AVX2 exists
+// (needs ifunc support, gcc or clang on glibc; -DNO_MULTIVERSIONING turns it off)
+#if defined(__x86_64__) && defined(__linux__) && defined(__GNUC__) && !defined(NO_MULTIVERSIONING)
+#define SIMD_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define SIMD_CLONES
+#endif
+
+light_t lights[MAX_NUM_LIGHTS] = {
+	{ .type = LIGHT_DIRECTIONAL, .direction = { 0, 0, 1 }, .intensity = 1.0 }
+};
+int num_lights = 1;
+
+THREAD_LOCAL light_t view_lights[MAX_NUM_LIGHTS];
+
+void add_light(light_t light) {
+	if (num_lights < MAX_NUM_LIGHTS) {
+		lights[num_lights++] = light;
+	}
+}
+
+// move the lights into the view space of the frame, directions ignore the translation (w = 0)
+void light_set_view_matrix(mat4_t view_matrix) {
+	for (int l = 0; l < num_lights; l++) {
+		light_t light = lights[l];
+		vec4_t direction = { light.direction.x, light.direction.y, light.direction.z, 0 };
+		light.direction = vec3_from_vec4(mat4_mul_vec4(view_matrix, direction));
+		light.position = vec3_from_vec4(mat4_mul_vec4(view_matrix, vec4_from_vec3(light.position)));
+		view_lights[l] = light;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sum the contribution of every light for a batch of view space surface points
+// One light at a time, the loops over the points are branch free (selects
+// instead of ifs) so the compiler turns them into SIMD code at -O3
+// (sqrtf needs -fno-math-errno to be vectorized)
+///////////////////////////////////////////////////////////////////////////////
+SIMD_CLONES
+void light_compute_intensities(float* intensities, vec3_stream_t positions, vec3_stream_t normals, int count) {
+	float* restrict out = intensities;
+	const float* restrict px = positions.x;
+	const float* restrict py = positions.y;
+	const float* restrict pz = positions.z;
+	const float* restrict nx = normals.x;
+	const float* restrict ny = normals.y;
+	const float* restrict nz = normals.z;
+
+	for (int i = 0; i < count; i++) {
+		out[i] = 0;
+	}
+
+	for (int l = 0; l < num_lights; l++) {
+		light_t light = view_lights[l];
+
+		if (light.type == LIGHT_DIRECTIONAL) {
+			// negative so that a normal facing the light gives a positive factor
+			float dx = -light.direction.x;
+			float dy = -light.direction.y;
+			float dz = -light.direction.z;
+			for (int i = 0; i < count; i++) {
+				float n_dot_l = nx[i] * dx + ny[i] * dy + nz[i] * dz;
+				out[i] += light.intensity * (n_dot_l > 0 ? n_dot_l : 0);
+			}
+		} else {
+			float inv_range_squared = 1.0f / (light.range * light.range);
+			for (int i = 0; i < count; i++) {
+				float lx = light.position.x - px[i];
+				float ly = light.position.y - py[i];
+				float lz = light.position.z - pz[i];
+				float distance_squared = lx * lx + ly * ly + lz * lz;
+				float inv_distance = 1.0f / sqrtf(distance_squared + 1e-12f);
+				float n_dot_l = (nx[i] * lx + ny[i] * ly + nz[i] * lz) * inv_distance;
+				float falloff = 1.0f - distance_squared * inv_range_squared;
+				float attenuation = falloff > 0 ? falloff : 0;
+				out[i] += light.intensity * (n_dot_l > 0 ? n_dot_l : 0) * attenuation;
+			}
+		}
+	}
+
+	for (int i = 0; i < count; i++) {
+		out[i] = out[i] < 1 ? out[i] : 1;
+	}
+}
+
+// convert a light intensity to the 1.15 fixed point factor used by the color kernels,
+// rounded and clamped to [0, 32768] where 32768 keeps the color unchanged
+uint16_t light_intensity_to_fixed(float intensity) {
+	intensity = intensity > 0 ? intensity : 0;
+	intensity = intensity < 1 ? intensity : 1;
+	return (uint16_t)(intensity * LIGHT_FIXED_ONE + 0.5f);
+}
 
 // change color based on a percentage factor to represent light intensity
+// every channel is multiplied by the 1.15 factor and shifted back, which is off from
+// the float product by less than 1/128 of a step, so it only rounds down differently
+// when that product is within a hair of a whole number
 uint32_t light_apply_intensity(uint32_t original_color, float percentage_factor) {
-	
-	if (percentage_factor < 0) percentage_factor = 0;
-	if (percentage_factor > 1) percentage_factor = 1;
+	uint32_t factor = light_intensity_to_fixed(percentage_factor);
 
 	// separate channels using bitwise operation
 	uint32_t a = (original_color & 0xFF000000);
-	uint32_t r = (original_color & 0x00FF0000) * percentage_factor;
-	uint32_t g = (original_color & 0x0000FF00) * percentage_factor;
-	uint32_t b = (original_color & 0x000000FF) * percentage_factor;
+	uint32_t r = ((original_color >> 16) & 0xFF) * factor >> 15;
+	uint32_t g = ((original_color >> 8) & 0xFF) * factor >> 15;
+	uint32_t b = (original_color & 0xFF) * factor >> 15;
 
 	// perform union of colors again
-	uint32_t new_color = a | (r & 0x00FF0000) | (g & 0x0000FF00) | (b & 0x000000FF);
-	
-	return new_color;
-}
\ No newline at end of file
+	return a | (r << 16) | (g << 8) | b;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Modulate a run of ARGB colors by 1.15 fixed point factors, alpha is kept
+// With SSE2 four pixels go through at once: the channels are widened to
+// 16 bits and doubled, so the high half of their product with the factor
+// of their pixel is the channel times the factor shifted back by 15
+///////////////////////////////////////////////////////////////////////////////
+void light_modulate_colors(uint32_t* out, const uint32_t* colors, const uint16_t* factors, int count) {
+	int i = 0;
+
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	// lanes 3 and 7 of every widened register hold the alpha of a pixel
+	const __m128i alpha_lanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+	const __m128i alpha_factor = _mm_set_epi16((short)LIGHT_FIXED_ONE, 0, 0, 0, (short)LIGHT_FIXED_ONE, 0, 0, 0);
+
+	for (; i + 4 <= count; i += 4) {
+		__m128i pixels = _mm_loadu_si128((const __m128i*)(colors + i));
+
+		// f0 f1 f2 f3 -> f0 f0 f0 f0 f1 f1 f1 f1 and f2 f2 f2 f2 f3 f3 f3 f3
+		__m128i f = _mm_loadl_epi64((const __m128i*)(factors + i));
+		f = _mm_unpacklo_epi16(f, f);
+		__m128i f_low = _mm_unpacklo_epi32(f, f);
+		__m128i f_high = _mm_unpackhi_epi32(f, f);
+		f_low = _mm_or_si128(_mm_andnot_si128(alpha_lanes, f_low), alpha_factor);
+		f_high = _mm_or_si128(_mm_andnot_si128(alpha_lanes, f_high), alpha_factor);
+
+		// 2 * 255 * 32768 fits the 32 bits the unsigned high multiply works in
+		__m128i low = _mm_mulhi_epu16(_mm_slli_epi16(_mm_unpacklo_epi8(pixels, zero), 1), f_low);
+		__m128i high = _mm_mulhi_epu16(_mm_slli_epi16(_mm_unpackhi_epi8(pixels, zero), 1), f_high);
+		_mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(low, high));
+	}
+#endif
+
+	for (; i < count; i++) {
+		uint32_t color = colors[i];
+		uint32_t factor = factors[i];
+		uint32_t r = ((color >> 16) & 0xFF) * factor >> 15;
+		uint32_t g = ((color >> 8) & 0xFF) * factor >> 15;
+		uint32_t b = (color & 0xFF) * factor >> 15;
+		out[i] = (color & 0xFF000000) | (r << 16) | (g << 8) | b;
+	}
+}
@@ -4,13 +4,46 @@
 #include <stdint.h>
 
 #include "vector.h"
+#include "matrix.h"
+#include "thread_local.h"
+
+#define MAX_NUM_LIGHTS 8
+
+// the color factor of full light, factors are 1.15 fixed point
+#define LIGHT_FIXED_ONE 32768
+
+enum light_type {
+	LIGHT_DIRECTIONAL,
+	LIGHT_POINT
+};
 
 typedef struct {
-	vec3_t direction;
+	enum light_type type;
+	vec3_t direction;	// direction the light travels (directional lights)
+	vec3_t position;	// world space position (point lights)
+	float range;		// distance where a point light fades out completely
+	float intensity;
 } light_t;
 
-extern light_t light;
+// lights are placed in world space, the kernels light view space positions
+// with the copies made by light_set_view_matrix() for the frame
+extern light_t lights[MAX_NUM_LIGHTS];
+extern int num_lights;
+extern THREAD_LOCAL light_t view_lights[MAX_NUM_LIGHTS];
+
+// positions and normals split into separate x, y and z arrays so the lighting
+// loop runs over plain float streams that the compiler can vectorize
+typedef struct {
+	float* x;
+	float* y;
+	float* z;
+} vec3_stream_t;
 
+void add_light(light_t light);
+void light_set_view_matrix(mat4_t view_matrix);
+void light_compute_intensities(float* intensities, vec3_stream_t positions, vec3_stream_t normals, int count);
+uint16_t light_intensity_to_fixed(float intensity);
 uint32_t light_apply_intensity(uint32_t original_color, float percentage_factor);
+void light_modulate_colors(uint32_t* out, const uint32_t* colors, const uint16_t* factors, int count);
 
-#endif
\ No newline at end of file
+#endif
@@ -1,20 +1,33 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <math.h>
+#include <limits.h>
+#include <sys/resource.h>
 #include <SDL2/SDL.h>
 #include "array.h"
 #include "display.h"
 #include "vector.h"
 #include "mesh.h"
 #include "matrix.h"
+#include "camera.h"
 #include "light.h"
-
-
-typedef struct {
-	float u;
-	float v;
-} tex2_t;
+#include "frustum.h"
+#include "occlusion.h"
+#include "depth_sort.h"
+#include "raycast.h"
+#include "points.h"
+#include "compress.h"
+#include "stream.h"
+#include "stats.h"
+#include "texture.h"
+#include "image.h"
+#include "input.h"
+#include "profile.h"
+#include "hud.h"
+#include "thread_local.h"
 
 
 // #define N_POINTS (9*9*9)
@@ -25,7 +38,23 @@ typedef struct {
 // Array of triangles that should be rendered frame by frame
 ///////////////////////////////////////////////////////////////////////////////
 
-triangle_t* triangles_to_render = NULL;
+THREAD_LOCAL triangle_t* triangles_to_render = NULL;
+
+///////////////////////////////////////////////////////////////////////////////
+// Per-vertex output of the vertex stage, indexed like mesh.vertices
+///////////////////////////////////////////////////////////////////////////////
+
+THREAD_LOCAL vec4_t* transformed_vertex_buffer = NULL;
+THREAD_LOCAL vec4_t* projected_vertex_buffer = NULL;
+THREAD_LOCAL float* vertex_intensity_buffer = NULL;
+
+// index of the last triangle to render that uses each mesh edge, indexed like mesh.edges
+THREAD_LOCAL int* edge_owner_buffer = NULL;
+
+// clusters that passed the frustum and backface tests this frame, and which of
+// them were drawn into the occlusion pyramid, indexed like mesh.clusters
+THREAD_LOCAL int* visible_cluster_buffer = NULL;
+THREAD_LOCAL bool* occluder_cluster_buffer = NULL;
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -33,32 +62,206 @@ triangle_t* triangles_to_render = NULL;
 ///////////////////////////////////////////////////////////////////////////////
 
 bool is_running = false;
-int previous_frame_time = 0;
+int previous_stats_time = 0;
+
+// the simulation advances in fixed steps of SIMULATION_STEP seconds whatever
+// the frame rate, 30 steps per second keeps the speed of the old frame cap
+#define SIMULATION_STEP (1.0 / 30)
+// longest frame time the simulation catches up on, so a stall (a window drag,
+// a breakpoint) doesn't turn into hundreds of steps in one frame
+#define MAX_FRAME_TIME 0.25
+
+// camera speeds in units and radians per second
+#define CAMERA_MOVE_SPEED 3.0
+#define CAMERA_TURN_SPEED 1.5
+
+Uint64 previous_frame_counter = 0;
+double simulation_accumulator = 0;
+vec3_t previous_mesh_rotation = { 0, 0, 0 };
+bool show_frame_time_histogram = false;
+bool show_hud = false;
 
 
-vec3_t camera_position = { 0, 0, 0};
 //vec3_t cube_rotation = { .x = 0, .y = 0, .z = 0};
 mat4_t proj_matrix;
+float znear = 0.1;
+float zfar = 100.0;
+
+///////////////////////////////////////////////////////////////////////////////
+// Frame packets, what the main thread hands to the render thread
+// update() records every frame into a packet: the triangles prepare_triangles()
+// made and a list of commands that draw them with the state they were recorded
+// with, so the render thread never reads what the main thread goes on changing
+// for the next frame. The main thread records a frame while the render thread
+// draws the one before, then presents it
+///////////////////////////////////////////////////////////////////////////////
 
-// typedef struct {
-// 	vec3_t position;
-// 	vec3_t rotation;
-// 	float fov_angle;
-// } camera_t;
+#define FRAME_PACKETS_IN_FLIGHT 2
+#define MAX_FRAME_COMMANDS 8
+
+enum render_command_type {
+	COMMAND_CLEAR,
+	COMMAND_SET_STATE,
+	COMMAND_DRAW_GRID,
+	COMMAND_DRAW_TRIANGLES,	// the triangles of the packet
+	COMMAND_RAYCAST,
+	COMMAND_DRAW_POINTS
+};
+
+typedef struct {
+	enum render_command_type type;
+	union {
+		uint32_t clear_color;
+		struct {
+			enum render_method render_method;
+			enum shading_method shading_method;
+			enum line_method line_method;
+		} state;
+		struct {
+			mat4_t view_matrix;
+			mat3x4_t world_view_matrix;
+			mat4_t proj_matrix;
+		} camera;
+	} data;
+} render_command_t;
+
+enum frame_packet_state {
+	PACKET_FREE,
+	PACKET_RECORDED,	// waiting for the render thread
+	PACKET_RENDERED		// waiting to be presented
+};
+
+typedef struct {
+	enum frame_packet_state state;
+	render_command_t commands[MAX_FRAME_COMMANDS];
+	int num_commands;
+	triangle_t* triangles;	// the triangles_to_render of the frame, the render thread frees them
+	frame_stats_t stats;	// those of update(), the render thread adds the pixels it draws
+	Uint32 input_timestamp;	// of the oldest input the frame reacts to, 0 if none
+	double update_time;	// seconds spent recording the frame and drawing it
+	double render_time;
+	uint32_t* pixels;
+} frame_packet_t;
+
+frame_packet_t frame_packets[FRAME_PACKETS_IN_FLIGHT];
+SDL_mutex* frame_packet_mutex = NULL;
+SDL_cond* frame_packet_changed = NULL;
+SDL_Thread* render_thread = NULL;
+bool render_thread_quit = false;
+
+// the camera of the last frame prepare_triangles() prepared, the ray cast command records it
+THREAD_LOCAL mat4_t frame_view_matrix;
+THREAD_LOCAL mat3x4_t frame_world_view_matrix;
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocate the vertex stage output of the calling thread, one entry per mesh vertex;
+// the threads that draw allocate their overdraw counters, one per pixel, themselves
+///////////////////////////////////////////////////////////////////////////////
+
+void allocate_vertex_stage_buffers(void) {
+	int num_vertices = array_length(mesh.vertices);
+	transformed_vertex_buffer = (vec4_t*) malloc(sizeof(vec4_t) * num_vertices);
+	projected_vertex_buffer = (vec4_t*) malloc(sizeof(vec4_t) * num_vertices);
+	vertex_intensity_buffer = (float*) malloc(sizeof(float) * num_vertices);
+	edge_owner_buffer = (int*) malloc(sizeof(int) * array_length(mesh.edges));
+	visible_cluster_buffer = (int*) malloc(sizeof(int) * array_length(mesh.clusters));
+	occluder_cluster_buffer = (bool*) calloc(array_length(mesh.clusters), sizeof(bool));
+	allocate_occlusion_buffer();
+	allocate_depth_sort_buffer(array_length(mesh.faces));
+}
+
+void free_vertex_stage_buffers(void) {
+	free(transformed_vertex_buffer);
+	free(projected_vertex_buffer);
+	free(vertex_intensity_buffer);
+	free(edge_owner_buffer);
+	free(visible_cluster_buffer);
+	free(occluder_cluster_buffer);
+	free_occlusion_buffer();
+	free_depth_sort_buffer();
+	free_point_buffers();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Put the camera back at the origin, looking at the model
+///////////////////////////////////////////////////////////////////////////////
+
+void reset_camera(void) {
+	camera_set_position((vec3_t){ 0, 0, 0 });
+	camera_look_at(mesh.translation);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Load the model and set up the projection and lights, shared by the window
+// and the batch renderer; window_width and window_height must be set
+///////////////////////////////////////////////////////////////////////////////
+
+void setup_scene(char* filename) {
+	// initialize the perspective projection matrix
+	float fov = M_PI / 3.0; //radians, angle measured based on pi, 180/3, or 60 deg
+	float aspect = (float)window_height / (float)window_width;
+	proj_matrix = mat4_make_perspective(fov, aspect, znear, zfar);
+
+	// initialize the frustum planes used to cull clusters, fov is vertical so derive the horizontal one
+	float fov_x = atan(tan(fov / 2) / aspect) * 2;
+	init_frustum_planes(fov_x, fov, znear, zfar);
+	init_occlusion_culling(proj_matrix, znear);
+
+	// loads the hard coded cube values in the mesh data structure
+	//load_cube_mesh_data(); //load from static array of vertices and faces
+
+	// a paged mesh starts out empty, its pages are loaded as the frames ask for them
+	if (is_paged_mesh_file(filename)) {
+		open_paged_mesh(filename);
+	} else {
+		load_obj_file_data(filename);
+	}
+
+	// textured render modes fall back to the filled triangles when there is no texture
+	PROFILE_BEGIN("load_texture");
+	mesh.texture = load_texture("./assets/uv_grid.png");
+	PROFILE_END();
+
+	// the compressed copy is only built when the vertex stage is to read it, and the turntable
+	// and the poster never switch back, so the float normals go; the ray caster and the point
+	// splats read the float arrays, paged meshes are not compressed
+	if (use_compressed_mesh && !stream_is_open() && render_method != RENDER_RAYCAST && render_method != RENDER_POINTS) {
+		compress_loaded_mesh(true);
+	}
+	if (use_compressed_mesh && mesh.compressed) {
+		print_compression_savings(stderr, filename, mesh.compressed, array_length(mesh.vertices), vertex_stage_float_bytes());
+	}
+
+	allocate_vertex_stage_buffers();
+
+	// a point light above and to the left of the model, on top of the default directional light
+	add_light((light_t){ .type = LIGHT_POINT, .position = { -3, 3, 2 }, .range = 12, .intensity = 0.5 });
+
+	// the model sits in front of the camera, which starts at the origin looking at it
+	mesh.translation = (vec3_t){ 0, 0, 5 };
+	reset_camera();
+
+	// build the view matrix now, the turntable workers only ever read it
+	camera_get_view_matrix();
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 // Setup function to initialize variables and game objects
 ///////////////////////////////////////////////////////////////////////////////
 
-void setup(void) {
+void setup(char* filename) {
 
 	// initialize render mode and triangle culling method
 	render_method = RENDER_WIRE;
+	line_method = LINE_BRESENHAM;
 	cull_method = CULL_BACKFACE;
+	shading_method = SHADE_FLAT;
+	set_frame_pacing(PACING_TARGET_FPS);
+
+	// the color buffers are those of the frame packets, see start_render_thread()
 
-	// Allocate the required bytes in memory for the color buffer
-	// Cast to uint32_t, which is type of color buffer
-	color_buffer = (uint32_t*) malloc(sizeof(uint32_t) * window_width * window_height);
+	// dynamic resolution stretches smaller frames over the window, bilinear filtering smooths them
+	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
 
 	// Create SDL texture that is used to display the color buffer
 	// https://wiki.libsdl.org/SDL_PixelFormat
@@ -70,17 +273,15 @@ void setup(void) {
 		window_height
 	);
 
-	// initialize the perspective projection matrix
-	float fov = M_PI / 3.0; //radians, angle measured based on pi, 180/3, or 60 deg
-	float aspect = (float)window_height / (float)window_width;
-	float znear = 0.1;
-	float zfar = 100.0;
-	proj_matrix = mat4_make_perspective(fov, aspect, znear, zfar);
-
-	// loads the hard coded cube values in the mesh data structure
-	//load_cube_mesh_data(); //load from static array of vertices and faces
+	setup_scene(filename);
+	// a point cloud has nothing else to draw
+	if (array_length(mesh.faces) == 0 && !stream_is_open()) {
+		render_method = RENDER_POINTS;
+	}
 
-	load_obj_file_data("./assets/f22.obj");
+	// start with one step owed, it places the mesh before the first frame is drawn
+	simulation_accumulator = SIMULATION_STEP;
+	previous_frame_counter = SDL_GetPerformanceCounter();
 
 	// vec3_t a = { 2.5,  6.4,  3.0};
 	// vec3_t b = { -2.2, 1.4, -1.0};
@@ -92,210 +293,789 @@ void setup(void) {
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Poll system events and handle keyboard input
+// Switch the frame pacing, the frame times of the old mode are printed and
+// the histogram starts over
+///////////////////////////////////////////////////////////////////////////////
+
+void change_frame_pacing(enum frame_pacing pacing) {
+	if (pacing == frame_pacing) {
+		return;
+	}
+	print_frame_time_histogram();
+	reset_frame_time_histogram();
+	set_frame_pacing(pacing);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Poll system events and run the actions bound to the pressed keys
 ///////////////////////////////////////////////////////////////////////////////
 
 void process_input(void) {
-	SDL_Event event;
-	SDL_PollEvent(&event);
+	PROFILE_BEGIN("process_input");
+	poll_input();
+
+	if (action_pressed(ACTION_QUIT))
+		is_running = false;
+	if (action_pressed(ACTION_RENDER_WIRE_VERTEX))
+		render_method = RENDER_WIRE_VERTEX;
+	if (action_pressed(ACTION_RENDER_WIRE))
+		render_method = RENDER_WIRE;
+	if (action_pressed(ACTION_RENDER_FILL_TRIANGLE))
+		render_method = RENDER_FILL_TRIANGLE;
+	if (action_pressed(ACTION_RENDER_FILL_TRIANGLE_WIRE))
+		render_method = RENDER_FILL_TRIANGLE_WIRE;
+	if (action_pressed(ACTION_RENDER_TEXTURED))
+		render_method = RENDER_TEXTURED;
+	if (action_pressed(ACTION_RENDER_TEXTURED_WIRE))
+		render_method = RENDER_TEXTURED_WIRE;
+	if (action_pressed(ACTION_RENDER_OVERDRAW))
+		render_method = RENDER_OVERDRAW;
+	if (action_pressed(ACTION_RENDER_RAYCAST))
+		render_method = RENDER_RAYCAST;
+	if (action_pressed(ACTION_RENDER_POINTS))
+		render_method = RENDER_POINTS;
+	if (action_pressed(ACTION_LINE_ANTIALIASED))
+		line_method = LINE_ANTIALIASED;
+	if (action_pressed(ACTION_LINE_BRESENHAM))
+		line_method = LINE_BRESENHAM;
+	if (action_pressed(ACTION_CULL_BACKFACE))
+		cull_method = CULL_BACKFACE;
+	if (action_pressed(ACTION_CULL_BACKFACE_SCREEN))
+		cull_method = CULL_BACKFACE_SCREEN;
+	if (action_pressed(ACTION_CULL_NONE))
+		cull_method = CULL_NONE;
+	if (action_pressed(ACTION_SHADE_FLAT))
+		shading_method = SHADE_FLAT;
+	if (action_pressed(ACTION_SHADE_GOURAUD))
+		shading_method = SHADE_GOURAUD;
+	if (action_pressed(ACTION_PACING_UNCAPPED))
+		change_frame_pacing(PACING_UNCAPPED);
+	if (action_pressed(ACTION_PACING_VSYNC))
+		change_frame_pacing(PACING_VSYNC);
+	if (action_pressed(ACTION_PACING_TARGET_FPS))
+		change_frame_pacing(PACING_TARGET_FPS);
+	if (action_pressed(ACTION_TOGGLE_FRAME_TIME_HISTOGRAM))
+		show_frame_time_histogram = !show_frame_time_histogram;
+	if (action_pressed(ACTION_TOGGLE_HUD))
+		show_hud = !show_hud;
+	if (action_pressed(ACTION_WRITE_TRACE) && profile_write_chrome_trace("trace.json"))
+		printf("wrote trace.json\n");
+	if (action_pressed(ACTION_RESET_CAMERA))
+		reset_camera();
+	if (action_pressed(ACTION_TOGGLE_OCCLUSION_CULLING))
+		occlusion_culling = !occlusion_culling;
+	if (action_pressed(ACTION_TOGGLE_COMPRESSED_MESH)) {
+		use_compressed_mesh = !use_compressed_mesh;
+		printf("compressed mesh %s\n", use_compressed_mesh ? "on" : "off");
+		// built the first time it is turned on, the window keeps the floats to switch back to
+		if (use_compressed_mesh && !stream_is_open()) {
+			compress_loaded_mesh(false);
+		}
+		if (use_compressed_mesh && mesh.compressed) {
+			print_compression_savings(stdout, "mesh", mesh.compressed, array_length(mesh.vertices), vertex_stage_float_bytes());
+		}
+	}
 
-	switch (event.type) {
-		case SDL_QUIT: //x button of window
-			is_running = false;
-			break;
-		case SDL_KEYDOWN:
-			if (event.key.keysym.sym == SDLK_ESCAPE)
-				is_running = false;
-			if (event.key.keysym.sym == SDLK_1)
-				render_method = RENDER_WIRE_VERTEX;
-			if (event.key.keysym.sym == SDLK_2)
-				render_method = RENDER_WIRE;
-			if (event.key.keysym.sym == SDLK_3)
-				render_method = RENDER_FILL_TRIANGLE;
-			if (event.key.keysym.sym == SDLK_4)
-				render_method = RENDER_FILL_TRIANGLE_WIRE;
-			if (event.key.keysym.sym == SDLK_c)
-				cull_method = CULL_BACKFACE;
-			if (event.key.keysym.sym == SDLK_d)
-				cull_method = CULL_NONE;
-			break;
+	if (action_pressed(ACTION_TOGGLE_DYNAMIC_RESOLUTION)) {
+		dynamic_resolution = !dynamic_resolution;
+		printf("dynamic resolution %s\n", dynamic_resolution ? "on" : "off");
 	}
+
+	// the ray goes through the camera of the frame on screen, whose pixels are stretched over the window
+	int click_x, click_y;
+	if (mouse_clicked(&click_x, &click_y)) {
+		int face = raycast_pick(click_x * window_width / display_width, click_y * window_height / display_height);
+		if (face >= 0)
+			printf("picked face %d\n", face + 1);
+		else
+			printf("picked nothing\n");
+	}
+	PROFILE_END();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Update function frame by frame with a fixed time step
+// Move the camera with the held keys, w/s walk, q/e sink and rise, the arrows
+// turn and look up and down, and with shift held left/right strafe instead
 ///////////////////////////////////////////////////////////////////////////////
 
-void update(void) {
-	// while loops are processor instructions, part of the executor
-	// process needs to share CPU with other tasks and not burn a lot of resources doing nothing
-	// while loops are going to consume 100% of CPU core, don't want to have processor caught up here
-	// while (!SDL_TICKS_PASSED(SDL_GetTicks(), previous_frame_time + FRAME_TARGET_TIME));
+void update_camera(float frame_time) {
+	float step = CAMERA_MOVE_SPEED * frame_time;
+	float turn = CAMERA_TURN_SPEED * frame_time;
+
+	float forward = 0, right = 0, up = 0, yaw = 0, pitch = 0;
+	if (is_key_down(SDL_SCANCODE_W)) forward += step;
+	if (is_key_down(SDL_SCANCODE_S)) forward -= step;
+	if (is_key_down(SDL_SCANCODE_E)) up += step;
+	if (is_key_down(SDL_SCANCODE_Q)) up -= step;
+	if (is_key_down(SDL_SCANCODE_UP)) pitch += turn;
+	if (is_key_down(SDL_SCANCODE_DOWN)) pitch -= turn;
+
+	bool strafe = is_key_down(SDL_SCANCODE_LSHIFT) || is_key_down(SDL_SCANCODE_RSHIFT);
+	if (is_key_down(SDL_SCANCODE_RIGHT)) {
+		if (strafe) right += step; else yaw += turn;
+	}
+	if (is_key_down(SDL_SCANCODE_LEFT)) {
+		if (strafe) right -= step; else yaw -= turn;
+	}
+
+	// the camera only marks its view matrix dirty when something actually moved
+	if (forward != 0 || right != 0 || up != 0) {
+		camera_move(forward, right, up);
+	}
+	if (yaw != 0 || pitch != 0) {
+		camera_rotate(yaw, pitch);
+	}
+}
 
-	// https://wiki.libsdl.org/SDL_Delay are using OS instructions to yield attention to other processes
-	int time_to_wait = FRAME_TARGET_TIME - (SDL_GetTicks() - previous_frame_time);
+///////////////////////////////////////////////////////////////////////////////
+// Project a transformed vertex and map it from normalized device coordinates
+// to screen pixels
+///////////////////////////////////////////////////////////////////////////////
 
-	if (time_to_wait > 0 && time_to_wait <= FRAME_TARGET_TIME) {
-		SDL_Delay(time_to_wait);
+vec4_t project_to_screen(vec4_t projected_point) {
+	//scale into the view
+	projected_point.x *= (window_width / 2.0);
+	projected_point.y *= (window_height / 2.0);
+
+	//invert y values to account for flipped screen y coordinate
+	projected_point.y *= -1;
+
+	// translate projected points to the middle of the screen
+	projected_point.x += (window_width / 2.0);
+	projected_point.y += (window_height / 2.0);
+
+	return projected_point;
+}
+
+// the vertex stage reads the compressed copy of the mesh, paged meshes have none
+static bool vertex_stage_compressed(void) {
+	return use_compressed_mesh && mesh.compressed != NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Light the vertices of a cluster with one call to the lighting kernel
+// Positions come from the vertex stage, normals are rotated into view space
+///////////////////////////////////////////////////////////////////////////////
+
+void light_cluster_vertices(cluster_t* cluster, const mat3x4_t* normal_matrix, bool renormalize) {
+	float px[CLUSTER_MAX_VERTICES], py[CLUSTER_MAX_VERTICES], pz[CLUSTER_MAX_VERTICES];
+	float nx[CLUSTER_MAX_VERTICES], ny[CLUSTER_MAX_VERTICES], nz[CLUSTER_MAX_VERTICES];
+	float intensities[CLUSTER_MAX_VERTICES];
+
+	bool compressed = vertex_stage_compressed();
+	if (compressed) {
+		decode_normals(&mesh.compressed->normals[cluster->first_vertex], cluster->num_vertices, nx, ny, nz);
 	}
 
-	previous_frame_time = SDL_GetTicks(); //how many ms since SDL_Init
+	int* cluster_vertices = &mesh.cluster_vertices[cluster->first_vertex];
+	for (int j = 0; j < cluster->num_vertices; j++) {
+		int index = cluster_vertices[j];
+		vec4_t position = transformed_vertex_buffer[index];
+		vec3_t model_normal = compressed ? (vec3_t){ nx[j], ny[j], nz[j] } : mesh.normals[index];
+		vec3_t normal = mat3x4_mul_direction(normal_matrix, model_normal);
+		if (renormalize) {
+			vec3_normalize(&normal);
+		}
+		px[j] = position.x;
+		py[j] = position.y;
+		pz[j] = position.z;
+		nx[j] = normal.x;
+		ny[j] = normal.y;
+		nz[j] = normal.z;
+	}
 
-	// Initialize the array of triangles to render
-	triangles_to_render = NULL; //replace at every loop
+	vec3_stream_t positions = { px, py, pz };
+	vec3_stream_t normals = { nx, ny, nz };
+	light_compute_intensities(intensities, positions, normals, cluster->num_vertices);
 
-	// Change the mesh scale/rotation values per animation frame
-	mesh.rotation.x += 0.01;
-	mesh.rotation.y += 0.01;
-	mesh.rotation.z += 0.01;
+	for (int j = 0; j < cluster->num_vertices; j++) {
+		vertex_intensity_buffer[cluster_vertices[j]] = intensities[j];
+	}
+}
 
-	// mesh.scale.x += 0.002;
-	// mesh.scale.y += 0.001;
-	// mesh.translation.x += 0.01;
-	mesh.translation.z = 5.0;
+///////////////////////////////////////////////////////////////////////////////
+// VERTEX STAGE: transform and project every vertex of a cluster once,
+// the faces only look the results up
+// Compressed positions come out of the decoder quantized, the matrices
+// passed for them dequantize too, see dequantize_matrix()
+///////////////////////////////////////////////////////////////////////////////
 
-	// create a scale and translation, rotation, matrix that will be used to multiply the mesh vertices
-	mat4_t scale_matrix = mat4_make_scale(mesh.scale.x, mesh.scale.y, mesh.scale.z);
-	mat4_t rotation_matrix_x = mat4_make_rotation_x(mesh.rotation.x);
-	mat4_t rotation_matrix_y = mat4_make_rotation_y(mesh.rotation.y);
-	mat4_t rotation_matrix_z = mat4_make_rotation_z(mesh.rotation.z);
-	mat4_t translation_matrix = mat4_make_translation(mesh.translation.x, mesh.translation.y, mesh.translation.z);
+void transform_cluster_vertices(cluster_t* cluster, const mat3x4_t* world_view_matrix, const mat4_t* world_view_projection_matrix) {
+	int* cluster_vertices = &mesh.cluster_vertices[cluster->first_vertex];
+	if (vertex_stage_compressed()) {
+		float x[CLUSTER_MAX_VERTICES], y[CLUSTER_MAX_VERTICES], z[CLUSTER_MAX_VERTICES];
+		decode_positions(&mesh.compressed->positions[cluster->first_vertex], cluster->num_vertices, x, y, z);
+		for (int j = 0; j < cluster->num_vertices; j++) {
+			int index = cluster_vertices[j];
+			vec3_t vertex = { x[j], y[j], z[j] };
+			transformed_vertex_buffer[index] = mat3x4_mul_point(world_view_matrix, vertex);
+			projected_vertex_buffer[index] = project_to_screen(mat4_mul_point_project(world_view_projection_matrix, vertex));
+		}
+		return;
+	}
+	for (int j = 0; j < cluster->num_vertices; j++) {
+		int index = cluster_vertices[j];
+		vec3_t vertex = mesh.vertices[index];
+		transformed_vertex_buffer[index] = mat3x4_mul_point(world_view_matrix, vertex);
+		projected_vertex_buffer[index] = project_to_screen(mat4_mul_point_project(world_view_projection_matrix, vertex));
+	}
+}
 
-	// loop all triangle faces
-	int num_faces = array_length(mesh.faces);
-	for (int i = 0; i < num_faces; i ++) {
-		face_t mesh_face = mesh.faces[i];
+// 0-based mesh vertex indices and color of face i, which belongs to the cluster
+static void get_cluster_face(cluster_t* cluster, int i, bool compressed, int indices[3], uint32_t* color) {
+	if (compressed) {
+		compressed_face_t face = mesh.compressed->faces[i];
+		int* cluster_vertices = &mesh.cluster_vertices[cluster->first_vertex];
+		indices[0] = cluster_vertices[face.a];
+		indices[1] = cluster_vertices[face.b];
+		indices[2] = cluster_vertices[face.c];
+		*color = mesh.compressed->palette[face.color];
+	} else {
+		face_t face = mesh.faces[i];
+		indices[0] = face.a - 1;
+		indices[1] = face.b - 1;
+		indices[2] = face.c - 1;
+		*color = face.color;
+	}
+}
 
-		vec3_t face_vertices[3];
-		face_vertices[0] = mesh.vertices[mesh_face.a - 1];
-		face_vertices[1] = mesh.vertices[mesh_face.b - 1];
-		face_vertices[2] = mesh.vertices[mesh_face.c - 1];
+// distance from the camera plane to the nearest point of the view space bounding sphere
+static float cluster_nearest_depth(cluster_t* cluster, const mat3x4_t* world_view_matrix, float max_scale) {
+	return mat3x4_mul_point(world_view_matrix, cluster->center).z - cluster->radius * max_scale;
+}
 
-		vec4_t transformed_vertices[3];
+static bool cluster_occluded(cluster_t* cluster, const mat3x4_t* world_view_matrix, float max_scale) {
+	vec3_t center = vec3_from_vec4(mat3x4_mul_point(world_view_matrix, cluster->center));
+	return sphere_occluded(center, cluster->radius * max_scale);
+}
 
-		// PERFORM TRANSFORMATION
+///////////////////////////////////////////////////////////////////////////////
+// Draw the nearest visible clusters into the occlusion pyramid, at most half of
+// them so there is something left to test, and mark them in occluder_cluster_buffer
+// The position matrices are the ones transform_cluster_vertices() takes
+///////////////////////////////////////////////////////////////////////////////
 
-		//loop all three vertices of this current face and apply transformations
-		for (int j = 0; j < 3; j++) {
-			// vec3_t transformed_vertex = face_vertices[j];
-			vec4_t transformed_vertex = vec4_from_vec3(face_vertices[j]);
-
-			
-			// use matrix to accumulate transformations
-			// transformed_vertex = mat4_mul_vec4(scale_matrix, transformed_vertex);
-			// transformed_vertex = mat4_mul_vec4(rotation_matrix_x, transformed_vertex);
-			// transformed_vertex = mat4_mul_vec4(rotation_matrix_y, transformed_vertex);
-			// transformed_vertex = mat4_mul_vec4(rotation_matrix_z, transformed_vertex);
-			// transformed_vertex = mat4_mul_vec4(translation_matrix, transformed_vertex);
-
-			// Create world matrix combining scae, rotation, and translation matrices
-			mat4_t world_matrix = mat4_identity();
-			world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
-			world_matrix = mat4_mul_mat4(rotation_matrix_z, world_matrix);
-			world_matrix = mat4_mul_mat4(rotation_matrix_y, world_matrix);
-			world_matrix = mat4_mul_mat4(rotation_matrix_x, world_matrix);
-			world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
-		
-			transformed_vertex = mat4_mul_vec4(world_matrix, transformed_vertex);
-
-			// translate the vertex away from the camera
-			// transformed_vertex.z += 5;
-
-			// Save transformed vertex in the array of transformed vertices
-			transformed_vertices[j] = transformed_vertex;
-
-		}
-
- 		// CHECK BACKFACE CULLING
-		vec3_t vector_a = vec3_from_vec4(transformed_vertices[0]); //   A
-		vec3_t vector_b = vec3_from_vec4(transformed_vertices[1]); // /   \ //
-		vec3_t vector_c = vec3_from_vec4(transformed_vertices[2]); // C---B
-
-		// Get the vector subtraction of B-A and C-A
-		vec3_t vector_ab = vec3_subtract(vector_b, vector_a);
-		vec3_t vector_ac = vec3_subtract(vector_c, vector_a);
-		vec3_normalize(&vector_ab);
-		vec3_normalize(&vector_ac);
-
-		// compute face normal using cross product to find perpendicular
-		// because we're using left handed system handedness, z values grow inside monitor
-		// for cross product to work properly
-		vec3_t normal = vec3_cross(vector_ab, vector_ac);
-
-		//normalize the face normal vector
-		vec3_normalize(&normal); //exercise to pass a variable by reference
-
-		// find vector bewteen point in the triangle and the camera origin
-		vec3_t camera_ray = vec3_subtract(camera_position, vector_a);
-
-		// calculate how aligned face normal is with camera ray using dot product
-		float dot_normal_camera = vec3_dot(normal, camera_ray);
-		
-		if (cull_method == CULL_BACKFACE) {
-			// bypass triangles that are looking away from the camera
-			if (dot_normal_camera < 0) {
+void build_occluders(int num_visible_clusters, const mat3x4_t* world_view_matrix,
+	const mat3x4_t* position_matrix, const mat4_t* position_projection_matrix, float max_scale) {
+	clear_occlusion_buffer();
+
+	int num_occluders = num_visible_clusters / 2;
+	if (num_occluders > OCCLUSION_MAX_OCCLUDERS) {
+		num_occluders = OCCLUSION_MAX_OCCLUDERS;
+	}
+
+	for (int n = 0; n < num_occluders; n++) {
+		// pick the nearest cluster not drawn yet
+		int nearest = -1;
+		float nearest_depth = 0;
+		for (int v = 0; v < num_visible_clusters; v++) {
+			int k = visible_cluster_buffer[v];
+			if (occluder_cluster_buffer[k]) {
+				continue;
+			}
+			float depth = cluster_nearest_depth(&mesh.clusters[k], world_view_matrix, max_scale);
+			if (nearest < 0 || depth < nearest_depth) {
+				nearest = k;
+				nearest_depth = depth;
+			}
+		}
+		occluder_cluster_buffer[nearest] = true;
+
+		cluster_t* cluster = &mesh.clusters[nearest];
+		transform_cluster_vertices(cluster, position_matrix, position_projection_matrix);
+
+		// every face hides what is behind it whichever way it faces, so all of them are drawn;
+		// faces reaching behind the camera project wrong and are left out
+		bool compressed = vertex_stage_compressed();
+		for (int i = cluster->first_face; i < cluster->first_face + cluster->num_faces; i++) {
+			int indices[3];
+			uint32_t color;
+			get_cluster_face(cluster, i, compressed, indices, &color);
+			vec4_t a = transformed_vertex_buffer[indices[0]];
+			vec4_t b = transformed_vertex_buffer[indices[1]];
+			vec4_t c = transformed_vertex_buffer[indices[2]];
+			if (a.z <= 0 || b.z <= 0 || c.z <= 0) {
 				continue;
 			}
+			draw_occluder_triangle(
+				projected_vertex_buffer[indices[0]], projected_vertex_buffer[indices[1]], projected_vertex_buffer[indices[2]],
+				fmax(a.z, fmax(b.z, c.z)));
 		}
+	}
 
-		vec4_t projected_points[3];
+	build_occlusion_pyramid();
+}
 
-		// PERFORM PROJECTION FROM 3D TO 2D FACES by looping all three vertices
-		for (int j = 0; j < 3; j++) {	
+///////////////////////////////////////////////////////////////////////////////
+// Transform, cull, light and sort the mesh into triangles_to_render
+///////////////////////////////////////////////////////////////////////////////
+
+void prepare_triangles(void) {
+	PROFILE_BEGIN("prepare_triangles");
+
+	// Initialize the array of triangles to render
+	triangles_to_render = NULL; //replace at every loop
 
-			// project current vertex
-			projected_points[j] = mat4_mul_vec4_project(proj_matrix, transformed_vertices[j]);
+	// Create world matrix combining scale, rotation, and translation
+	// it is the same for every vertex, so build it once per frame
+	mat3x4_t world_matrix = mat3x4_make_trs(vec3_from_vec4(mesh.scale), mesh.rotation, mesh.translation);
+
+	// everything below works in view space, where the camera sits at the origin looking down +z,
+	// so the view matrix is folded into the world matrix once instead of moving the camera per face
+	// world and view are affine, only the projection needs the full 4x4
+	mat4_t view_matrix = camera_get_view_matrix();
+	mat3x4_t affine_view_matrix = mat3x4_from_mat4(&view_matrix);
+	mat3x4_t world_view_matrix;
+	mat3x4_mul_mat3x4_into(&world_view_matrix, &affine_view_matrix, &world_matrix);
+	mat4_t world_view_projection_matrix;
+	mat4_mul_mat3x4_into(&world_view_projection_matrix, &proj_matrix, &world_view_matrix);
+	light_set_view_matrix(view_matrix);
+
+	// the matrices the vertex stage applies to the stored positions, compressed ones are
+	// still quantized so their dequantization is folded in
+	bool compressed = vertex_stage_compressed();
+	mat3x4_t position_matrix = world_view_matrix;
+	mat4_t position_projection_matrix = world_view_projection_matrix;
+	if (compressed) {
+		position_matrix = dequantize_matrix(mesh.compressed, &world_view_matrix);
+		mat4_mul_mat3x4_into(&position_projection_matrix, &proj_matrix, &position_matrix);
+	}
+	raycast_set_camera(&world_view_matrix, &proj_matrix);
+	frame_view_matrix = view_matrix;
+	frame_world_view_matrix = world_view_matrix;
+
+	// the normal cone only survives the world transform when the scale is uniform
+	float max_scale = fmax(fabs(mesh.scale.x), fmax(fabs(mesh.scale.y), fabs(mesh.scale.z)));
+	bool uniform_scale = (mesh.scale.x == mesh.scale.y && mesh.scale.y == mesh.scale.z);
+
+	// precomputed normals are rotated with the inverse-transpose of the world-view matrix
+	// under uniform scale that is the rotation divided by the scale, so multiplying
+	// the scale back keeps unit normals unit length and no normalization is needed
+	mat3x4_t normal_matrix = mat3x4_make_normal_matrix(&world_view_matrix);
+	if (uniform_scale) {
+		for (int row = 0; row < 3; row++) {
+			for (int col = 0; col < 3; col++) {
+				normal_matrix.m[row][col] *= max_scale;
+			}
+		}
+	}
 
-			//scale into the view
-			projected_points[j].x *= (window_width / 2.0);
-			projected_points[j].y *= (window_height / 2.0);
+	reset_frame_stats();
 
-			//invert y values to account for flipped screen y coordinate
-			projected_points[j].y *= -1;
+	// the ray cast and point modes draw the mesh itself, there are no triangles to prepare
+	if (render_method == RENDER_RAYCAST || render_method == RENDER_POINTS) {
+		PROFILE_END();
+		return;
+	}
 
-			// translate projected points to the middle of the screen
-			projected_points[j].x += (window_width / 2.0);
-			projected_points[j].y += (window_height / 2.0);
+	// fill the clusters of a paged mesh with the pages resident for this view
+	if (stream_is_open()) {
+		stream_update(&world_view_matrix, &proj_matrix, max_scale, cull_method != CULL_NONE && uniform_scale);
+	}
+
+	PROFILE_BEGIN("cull clusters");
+	// loop all face clusters, rejecting whole clusters before touching their vertices
+	int num_clusters = array_length(mesh.clusters);
+	int num_visible_clusters = 0;
+	for (int k = 0; k < num_clusters; k++) {
+		cluster_t* cluster = &mesh.clusters[k];
+		// slots of a paged mesh holding no page this frame
+		if (cluster->num_faces == 0) {
+			continue;
+		}
+		frame_stats.clusters_total++;
+		frame_stats.triangles_total += cluster->num_faces;
+
+		enum cluster_cull_result cull_result = cull_cluster(
+			cluster, &world_view_matrix, max_scale,
+			cull_method != CULL_NONE && uniform_scale);
+
+		if (cull_result != CLUSTER_VISIBLE) {
+			if (cull_result == CLUSTER_CULLED_BACKFACE) frame_stats.clusters_culled_backface++;
+			if (cull_result == CLUSTER_CULLED_FRUSTUM) frame_stats.clusters_culled_frustum++;
+			frame_stats.triangles_culled_by_cluster += cluster->num_faces;
+			continue;
+		}
+		visible_cluster_buffer[num_visible_clusters++] = k;
+	}
+	PROFILE_END();
+
+	// the wireframe modes show what is behind the faces, only the fills can hide clusters
+	// the mesh is the only object, its bounding box is tested like every object would be
+	// before its clusters, though its own nearest clusters are all that can hide it
+	bool test_occlusion = occlusion_culling && render_method != RENDER_WIRE && render_method != RENDER_WIRE_VERTEX;
+	bool mesh_occluded = false;
+	frame_stats.objects_total++;
+	if (test_occlusion) {
+		PROFILE_BEGIN("occlusion pyramid");
+		build_occluders(num_visible_clusters, &world_view_matrix, &position_matrix, &position_projection_matrix, max_scale);
+		mesh_occluded = box_occluded(mesh.bounds_min, mesh.bounds_max, &world_view_matrix);
+		if (mesh_occluded) {
+			frame_stats.objects_culled_occlusion++;
+		}
+		PROFILE_END();
+	}
+
+	PROFILE_BEGIN("transform and light clusters");
+	for (int v = 0; v < num_visible_clusters; v++) {
+		int k = visible_cluster_buffer[v];
+		cluster_t* cluster = &mesh.clusters[k];
+
+		// the occluders went through the vertex stage already, and can't hide themselves
+		if (test_occlusion && occluder_cluster_buffer[k]) {
+			occluder_cluster_buffer[k] = false;
+		} else {
+			if (test_occlusion && (mesh_occluded || cluster_occluded(cluster, &world_view_matrix, max_scale))) {
+				frame_stats.clusters_culled_occlusion++;
+				frame_stats.triangles_culled_by_cluster += cluster->num_faces;
+				continue;
+			}
+			transform_cluster_vertices(cluster, &position_matrix, &position_projection_matrix);
+		}
+
+		bool is_lit = render_method == RENDER_FILL_TRIANGLE || render_method == RENDER_FILL_TRIANGLE_WIRE ||
+			render_method == RENDER_TEXTURED || render_method == RENDER_TEXTURED_WIRE;
+
+		// Gouraud shading lights the vertices of the cluster in one batch
+		if (is_lit && shading_method == SHADE_GOURAUD) {
+			light_cluster_vertices(cluster, &normal_matrix, !uniform_scale);
+		}
+
+		// flat shading collects the surviving faces and lights them in one batch after the loop,
+		// once per triangle since a face cut by the near plane can make two
+		float face_px[2 * CLUSTER_MAX_FACES], face_py[2 * CLUSTER_MAX_FACES], face_pz[2 * CLUSTER_MAX_FACES];
+		float face_nx[2 * CLUSTER_MAX_FACES], face_ny[2 * CLUSTER_MAX_FACES], face_nz[2 * CLUSTER_MAX_FACES];
+		int first_cluster_triangle = array_length(triangles_to_render);
+		int num_lit_faces = 0;
+
+		// compressed face normals are decoded for the whole cluster at once
+		float model_nx[CLUSTER_MAX_FACES], model_ny[CLUSTER_MAX_FACES], model_nz[CLUSTER_MAX_FACES];
+		if (compressed) {
+			decode_normals(&mesh.compressed->face_normals[cluster->first_face], cluster->num_faces, model_nx, model_ny, model_nz);
 		}
 
-		// calculate the average depth for each face based on the vertices after transformation
-		float avg_depth = (transformed_vertices[0].z + transformed_vertices[1].z + transformed_vertices[2].z)/3;
+		// loop all triangle faces of the cluster
+		for (int i = cluster->first_face; i < cluster->first_face + cluster->num_faces; i++) {
+			int indices[3];
+			uint32_t face_color;
+			get_cluster_face(cluster, i, compressed, indices, &face_color);
+
+			vec4_t transformed_vertices[3];
+			vec4_t projected_points[3];
+			for (int j = 0; j < 3; j++) {
+				transformed_vertices[j] = transformed_vertex_buffer[indices[j]];
+				projected_points[j] = projected_vertex_buffer[indices[j]];
+			}
+
+			// CHECK BACKFACE CULLING
+			vec3_t vector_a = vec3_from_vec4(transformed_vertices[0]);
+
+			// the face normal was computed at load time, so it only needs to be rotated
+			// into view space (a direction, the translation is left out)
+			int n = i - cluster->first_face;
+			vec3_t model_normal = compressed ? (vec3_t){ model_nx[n], model_ny[n], model_nz[n] } : mesh.face_normals[i];
+			vec3_t normal = mat3x4_mul_direction(&normal_matrix, model_normal);
+
+			bool is_backface = false;
+
+			if (cull_method == CULL_BACKFACE) {
+				// the camera is at the origin, so the vertex itself is the ray from the camera to the face
+				// and triangles looking away from the camera have a normal along that ray
+				is_backface = vec3_dot(normal, vector_a) > 0;
+			}
+
+			// the projected winding only means something when all three vertices are in front of the camera,
+			// triangles crossing the camera plane fall back to the 3D test
+			bool in_front_of_camera = transformed_vertices[0].z > 0 && transformed_vertices[1].z > 0 && transformed_vertices[2].z > 0;
 
-		// calculate the shade intensity based on how aligned the face normal is to the light direction
-		float light_intensity_factor = -vec3_dot(normal, light.direction); //negative so that dot product works
+			if (cull_method == CULL_BACKFACE_SCREEN && !in_front_of_camera) {
+				is_backface = vec3_dot(normal, vector_a) > 0;
+			} else if (cull_method == CULL_BACKFACE_SCREEN) {
+				// twice the signed area of the projected triangle, positive when the
+				// vertices wind clockwise on screen (y grows downwards), which is front facing
+				float signed_area =
+					(projected_points[1].x - projected_points[0].x) * (projected_points[2].y - projected_points[0].y) -
+					(projected_points[1].y - projected_points[0].y) * (projected_points[2].x - projected_points[0].x);
 
-		// calculate triangle color based on the light angle
-		uint32_t triangle_color = light_apply_intensity(mesh_face.color, light_intensity_factor);
+				is_backface = signed_area < 0;
+			}
 
-		triangle_t projected_triangle = {
-			.points = {
-				{ projected_points[0].x, projected_points[0].y },
-				{ projected_points[1].x, projected_points[1].y },
-				{ projected_points[2].x, projected_points[2].y }},
-			.color = triangle_color,
-			.avg_depth = avg_depth};			
+#ifdef VALIDATE_CULLING
+			// compare against the original test, which normalized both edges and the normal
+			if (cull_method != CULL_NONE) {
+				vec3_t reference_ab = vec3_subtract(vec3_from_vec4(transformed_vertices[1]), vector_a);
+				vec3_t reference_ac = vec3_subtract(vec3_from_vec4(transformed_vertices[2]), vector_a);
+				vec3_normalize(&reference_ab);
+				vec3_normalize(&reference_ac);
+				vec3_t reference_normal = vec3_cross(reference_ab, reference_ac);
+				vec3_normalize(&reference_normal);
+				bool reference_is_backface = vec3_dot(reference_normal, vector_a) > 0;
+				if (reference_is_backface != is_backface) {
+					frame_stats.cull_mismatches++;
+				}
+			}
+#endif
 
-			//projected_triangle.points[j] = projected_point;
-		
+			if (is_backface) {
+				frame_stats.triangles_culled_backface++;
+				continue;
+			}
 
-		//save projected triangle in array of triangles to render
-		//triangles_to_render[i] = projected_triangle;
-		array_push(triangles_to_render, projected_triangle);
+			// calculate the average depth for each face based on the vertices after transformation
+			float avg_depth = (transformed_vertices[0].z + transformed_vertices[1].z + transformed_vertices[2].z)/3;
+
+			triangle_t projected_triangle = {
+				.points = { projected_points[0], projected_points[1], projected_points[2] },
+				.texcoords = { mesh.texcoords[indices[0]], mesh.texcoords[indices[1]], mesh.texcoords[indices[2]] },
+				.color = face_color,
+				.intensities = { 1, 1, 1 },
+				.avg_depth = avg_depth,
+				.face_index = i,
+				.sides = { 0, 1, 2 }};
+
+			if (is_lit && shading_method == SHADE_GOURAUD) {
+				// the rasterizer interpolates the light reaching each vertex
+				for (int j = 0; j < 3; j++) {
+					projected_triangle.intensities[j] = vertex_intensity_buffer[indices[j]];
+				}
+			}
+
+			// a face reaching behind the near plane is cut to the part in front of it before
+			// the projection, which leaves nothing, one triangle or two
+			triangle_t pieces[2] = { projected_triangle };
+			int num_pieces = 1;
+			if (transformed_vertices[0].z < znear || transformed_vertices[1].z < znear || transformed_vertices[2].z < znear) {
+				clip_vertex_t corners[3], clipped[4];
+				for (int j = 0; j < 3; j++) {
+					corners[j] = (clip_vertex_t){
+						vec3_from_vec4(transformed_vertices[j]), projected_triangle.texcoords[j], projected_triangle.intensities[j], j };
+				}
+				int num_corners = clip_triangle_to_near_plane(corners, clipped);
+				num_pieces = num_corners > 2 ? num_corners - 2 : 0;
+				for (int t = 0; t < num_pieces; t++) {
+					// a fan from the first corner, the diagonal of two pieces isn't a side of the face
+					const clip_vertex_t* fan[3] = { &clipped[0], &clipped[t + 1], &clipped[t + 2] };
+					pieces[t] = projected_triangle;
+					for (int j = 0; j < 3; j++) {
+						pieces[t].points[j] = project_to_screen(mat4_mul_point_project(&proj_matrix, fan[j]->position));
+						pieces[t].texcoords[j] = fan[j]->texcoord;
+						pieces[t].intensities[j] = fan[j]->intensity;
+						pieces[t].sides[j] = fan[j]->side;
+					}
+					if (num_pieces == 2) {
+						pieces[t].sides[t == 0 ? 2 : 0] = -1;
+					}
+				}
+				frame_stats.triangles_clipped++;
+			}
+
+			for (int t = 0; t < num_pieces; t++) {
+				if (is_lit && shading_method == SHADE_FLAT) {
+					// the normal only needs renormalizing under non-uniform scale
+					if (!uniform_scale && t == 0) {
+						vec3_normalize(&normal);
+					}
+					face_px[num_lit_faces] = (transformed_vertices[0].x + transformed_vertices[1].x + transformed_vertices[2].x) / 3;
+					face_py[num_lit_faces] = (transformed_vertices[0].y + transformed_vertices[1].y + transformed_vertices[2].y) / 3;
+					face_pz[num_lit_faces] = avg_depth;
+					face_nx[num_lit_faces] = normal.x;
+					face_ny[num_lit_faces] = normal.y;
+					face_nz[num_lit_faces] = normal.z;
+					num_lit_faces++;
+				}
+
+				//save projected triangle in array of triangles to render
+				array_push(triangles_to_render, pieces[t]);
+			}
+		}
+
+		if (num_lit_faces > 0) {
+			// calculate the shade intensity of every face from the light reaching its center
+			float intensities[2 * CLUSTER_MAX_FACES];
+			vec3_stream_t positions = { face_px, face_py, face_pz };
+			vec3_stream_t normals = { face_nx, face_ny, face_nz };
+			light_compute_intensities(intensities, positions, normals, num_lit_faces);
+
+			// calculate triangle colors based on the light intensity, all faces of the cluster in one batch
+			uint32_t colors[2 * CLUSTER_MAX_FACES];
+			uint16_t factors[2 * CLUSTER_MAX_FACES];
+			for (int n = 0; n < num_lit_faces; n++) {
+				triangle_t* triangle = &triangles_to_render[first_cluster_triangle + n];
+				triangle->intensities[0] = triangle->intensities[1] = triangle->intensities[2] = intensities[n];
+				colors[n] = triangle->color;
+				factors[n] = light_intensity_to_fixed(intensities[n]);
+			}
+			light_modulate_colors(colors, colors, factors, num_lit_faces);
+			for (int n = 0; n < num_lit_faces; n++) {
+				triangles_to_render[first_cluster_triangle + n].color = colors[n];
+			}
+		}
 	}
+	PROFILE_END();
 
-	// Sort triangles to render by their avg_depth
+	// Sort triangles to render by their avg_depth, starting from the order of the last frame
+	PROFILE_BEGIN("sort triangles");
 	int num_triangles = array_length(triangles_to_render);
+	frame_stats.triangles_drawn = num_triangles;
 
+	sort_triangles_by_depth(triangles_to_render, num_triangles);
+	PROFILE_END();
+
+	// wireframes draw each mesh edge once, with the last triangle drawn that uses it
+	// so the edge stays on top of both faces, instead of once per face
+	PROFILE_BEGIN("edge owners");
+	// the sides of a triangle cut by the near plane map to the sides of its face they lie on
 	for (int i = 0; i < num_triangles; i++) {
-		for (int j = i; j < num_triangles; j++) {
-			if (triangles_to_render[i].avg_depth < triangles_to_render[j].avg_depth) {
-				// swap the triangles position in the array (bubble sort)
-				triangle_t temp = triangles_to_render[i];
-				triangles_to_render[i] = triangles_to_render[j];
-				triangles_to_render[j] = temp;
+		triangle_t* triangle = &triangles_to_render[i];
+		int* face_edges = &mesh.face_edges[3 * triangle->face_index];
+		for (int j = 0; j < 3; j++) {
+			if (triangle->sides[j] >= 0) {
+				edge_owner_buffer[face_edges[triangle->sides[j]]] = i;
+			}
+		}
+	}
+	for (int i = 0; i < num_triangles; i++) {
+		triangle_t* triangle = &triangles_to_render[i];
+		int* face_edges = &mesh.face_edges[3 * triangle->face_index];
+		int edge_mask = 0;
+		for (int j = 0; j < 3; j++) {
+			if (triangle->sides[j] >= 0 && edge_owner_buffer[face_edges[triangle->sides[j]]] == i) {
+				edge_mask |= 1 << j;
 			}
 		}
+		triangle->edge_mask = edge_mask;
+	}
+	PROFILE_END();
+
+	PROFILE_END();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Change the mesh scale/rotation values per animation frame
+///////////////////////////////////////////////////////////////////////////////
+
+void animate_mesh(void) {
+	mesh.rotation.x += 0.01;
+	mesh.rotation.y += 0.01;
+	mesh.rotation.z += 0.01;
+
+	// mesh.scale.x += 0.002;
+	// mesh.scale.y += 0.001;
+	// mesh.translation.x += 0.01;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Wait until 1 / target_fps seconds have passed since the last frame
+///////////////////////////////////////////////////////////////////////////////
+
+void wait_for_target_frame_time(void) {
+	Uint64 frequency = SDL_GetPerformanceFrequency();
+	Uint64 target_counter = previous_frame_counter + frequency / target_fps;
+
+	// https://wiki.libsdl.org/SDL_Delay yields the CPU to other processes, but it
+	// sleeps in whole ms and often oversleeps, so sleep until about 2 ms are left
+	// and spin on the high resolution counter for the rest
+	for (;;) {
+		Uint64 now = SDL_GetPerformanceCounter();
+		if (now >= target_counter) {
+			break;
+		}
+		Uint64 remaining_ms = (target_counter - now) * 1000 / frequency;
+		if (remaining_ms > 2) {
+			SDL_Delay((Uint32)(remaining_ms - 2));
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Record the frame prepare_triangles() just prepared into a packet, with the
+// draw state of this thread, and take its triangles over
+///////////////////////////////////////////////////////////////////////////////
+
+static void record_command(frame_packet_t* packet, render_command_t command) {
+	if (packet->num_commands < MAX_FRAME_COMMANDS) {
+		packet->commands[packet->num_commands++] = command;
+	}
+}
+
+void record_frame_packet(frame_packet_t* packet) {
+	packet->num_commands = 0;
+
+	render_command_t clear = { .type = COMMAND_CLEAR, .data.clear_color = 0xFF000000 };
+	record_command(packet, clear);
+
+	render_command_t state = { .type = COMMAND_SET_STATE };
+	state.data.state.render_method = render_method;
+	state.data.state.shading_method = shading_method;
+	state.data.state.line_method = line_method;
+	record_command(packet, state);
+
+	render_command_t grid = { .type = COMMAND_DRAW_GRID };
+	record_command(packet, grid);
+
+	if (render_method == RENDER_RAYCAST) {
+		render_command_t raycast = { .type = COMMAND_RAYCAST };
+		raycast.data.camera.view_matrix = frame_view_matrix;
+		raycast.data.camera.world_view_matrix = frame_world_view_matrix;
+		raycast.data.camera.proj_matrix = proj_matrix;
+		record_command(packet, raycast);
+	} else if (render_method == RENDER_POINTS) {
+		render_command_t points = { .type = COMMAND_DRAW_POINTS };
+		points.data.camera.world_view_matrix = frame_world_view_matrix;
+		points.data.camera.proj_matrix = proj_matrix;
+		record_command(packet, points);
+	} else {
+		render_command_t draw = { .type = COMMAND_DRAW_TRIANGLES };
+		record_command(packet, draw);
+	}
+
+	packet->triangles = triangles_to_render;
+	triangles_to_render = NULL;
+	packet->stats = frame_stats;
+	packet->input_timestamp = input_frame_recorded();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Update function frame by frame with a fixed time step
+// The time since the last frame is added to an accumulator that is spent in
+// whole simulation steps, the leftover fraction of a step interpolates between
+// the last two simulated states so motion stays smooth at any frame rate
+// The frame is recorded into the packet for the render thread to draw
+///////////////////////////////////////////////////////////////////////////////
+
+void update(frame_packet_t* packet) {
+	PROFILE_BEGIN("update");
+
+	Uint64 now = SDL_GetPerformanceCounter();
+	Uint64 update_start = now;
+	double frame_time = (double)(now - previous_frame_counter) / SDL_GetPerformanceFrequency();
+	previous_frame_counter = now;
+	record_frame_time(frame_time);
+
+	if (frame_time > MAX_FRAME_TIME) {
+		frame_time = MAX_FRAME_TIME;
 	}
+	update_camera(frame_time);
+
+	simulation_accumulator += frame_time;
+	while (simulation_accumulator >= SIMULATION_STEP) {
+		previous_mesh_rotation = mesh.rotation;
+		animate_mesh();
+		simulation_accumulator -= SIMULATION_STEP;
+	}
+
+	// build the frame with the interpolated rotation, then restore the simulated one
+	float alpha = (float)(simulation_accumulator / SIMULATION_STEP);
+	vec3_t simulated_rotation = mesh.rotation;
+	mesh.rotation.x = previous_mesh_rotation.x + (simulated_rotation.x - previous_mesh_rotation.x) * alpha;
+	mesh.rotation.y = previous_mesh_rotation.y + (simulated_rotation.y - previous_mesh_rotation.y) * alpha;
+	mesh.rotation.z = previous_mesh_rotation.z + (simulated_rotation.z - previous_mesh_rotation.z) * alpha;
+	prepare_triangles();
+	mesh.rotation = simulated_rotation;
+	record_frame_packet(packet);
+	packet->update_time = (double)(SDL_GetPerformanceCounter() - update_start) / SDL_GetPerformanceFrequency();
+
+	PROFILE_END();
 }
 
 	/*
@@ -318,94 +1098,287 @@ void update(void) {
 	}
 	*/
 
+///////////////////////////////////////////////////////////////////////////////
+// Draw one prepared triangle into the color buffer with the current render method
+///////////////////////////////////////////////////////////////////////////////
+
+void draw_prepared_triangle(const triangle_t* prepared) {
+	triangle_t triangle = *prepared;
+
+	// without a texture the textured modes draw like the filled ones
+	bool is_textured = (render_method == RENDER_TEXTURED || render_method == RENDER_TEXTURED_WIRE) && mesh.texture;
+	bool is_filled = render_method == RENDER_FILL_TRIANGLE || render_method == RENDER_FILL_TRIANGLE_WIRE || render_method == RENDER_OVERDRAW ||
+		((render_method == RENDER_TEXTURED || render_method == RENDER_TEXTURED_WIRE) && !mesh.texture);
+
+	//Draw textured triangle faces, modulated by the light
+	if (is_textured) {
+		draw_textured_triangle(&triangle, mesh.texture);
+	}
+
+	//Draw filled triangle faces, the overdraw mode only counts the pixels they write
+	if (is_filled && (shading_method == SHADE_FLAT || render_method == RENDER_OVERDRAW)) {
+		draw_filled_triangle(
+			triangle.points[0].x, triangle.points[0].y, //vertex A
+			triangle.points[1].x, triangle.points[1].y, //vertex B
+			triangle.points[2].x, triangle.points[2].y, //vertex C
+			triangle.color);
+	}
+
+	//Draw filled triangle faces with the light interpolated from the vertices
+	if (is_filled && shading_method == SHADE_GOURAUD && render_method != RENDER_OVERDRAW) {
+		draw_shaded_triangle(
+			triangle.points[0].x, triangle.points[0].y, triangle.intensities[0], //vertex A
+			triangle.points[1].x, triangle.points[1].y, triangle.intensities[1], //vertex B
+			triangle.points[2].x, triangle.points[2].y, triangle.intensities[2], //vertex C
+			triangle.color);
+	}
+
+	if (render_method == RENDER_WIRE || render_method == RENDER_WIRE_VERTEX || render_method == RENDER_FILL_TRIANGLE_WIRE || render_method == RENDER_TEXTURED_WIRE) {
+		//Draw the edges of the triangle that no other triangle draws
+		draw_triangle_edges(
+			triangle.points[0].x, triangle.points[0].y, //vertex A
+			triangle.points[1].x, triangle.points[1].y, //vertex B
+			triangle.points[2].x, triangle.points[2].y, //vertex C
+			triangle.edge_mask,
+			0xFFFFFF);
+	}
+
+	if (render_method == RENDER_WIRE_VERTEX ) {
+		//Draw vertex points
+		// -3 and 6 ensures that rectangles sit in the center of the vertex
+		draw_rect(triangle.points[0].x - 3, triangle.points[0].y - 3, 6, 6, 0xFFFFFF00);
+		draw_rect(triangle.points[1].x - 3, triangle.points[1].y - 3, 6, 6, 0xFFFFFF00);
+		draw_rect(triangle.points[2].x - 3, triangle.points[2].y - 3, 6, 6, 0xFFFFFF00);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw triangles_to_render into the color buffer with the current render method
+///////////////////////////////////////////////////////////////////////////////
+
+void draw_triangles(void) {
+	PROFILE_BEGIN("draw_triangles");
+	int num_triangles = array_length(triangles_to_render);
+
+	//loop all projected triangles and render them
+	for (int i = 0; i < num_triangles; i++) {
+		draw_prepared_triangle(&triangles_to_render[i]);
+	}
+
+	if (render_method == RENDER_OVERDRAW) {
+		draw_overdraw_heat_map();
+	}
+	PROFILE_END();
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Render function to draw objects on the display
+// Plays the commands of a packet back into its pixels, on the render thread
 ///////////////////////////////////////////////////////////////////////////////
 
-void render(void) {
+void render(frame_packet_t* packet) {
 	// we don't need these anymore as we are using the color buffer
 	// SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
 	// SDL_RenderClear(renderer);
+	PROFILE_BEGIN("render");
 
-	draw_grid();
+	color_buffer = packet->pixels;
+	triangles_to_render = packet->triangles;
+	frame_stats = packet->stats;
 
-	int num_triangles = array_length(triangles_to_render);
+	for (int i = 0; i < packet->num_commands; i++) {
+		render_command_t* command = &packet->commands[i];
+		switch (command->type) {
+		case COMMAND_CLEAR:
+			clear_color_buffer(command->data.clear_color);
+			break;
+		case COMMAND_SET_STATE:
+			render_method = command->data.state.render_method;
+			shading_method = command->data.state.shading_method;
+			line_method = command->data.state.line_method;
+			break;
+		case COMMAND_DRAW_GRID:
+			PROFILE_BEGIN("draw_grid");
+			draw_grid();
+			PROFILE_END();
+			break;
+		case COMMAND_DRAW_TRIANGLES:
+			draw_triangles();
+			break;
+		case COMMAND_RAYCAST:
+			light_set_view_matrix(command->data.camera.view_matrix);
+			raycast_set_camera(&command->data.camera.world_view_matrix, &command->data.camera.proj_matrix);
+			render_raycast();
+			break;
+		case COMMAND_DRAW_POINTS: {
+			mat4_t world_view_projection_matrix;
+			mat4_mul_mat3x4_into(&world_view_projection_matrix, &command->data.camera.proj_matrix, &command->data.camera.world_view_matrix);
+			render_points(&world_view_projection_matrix);
+			break;
+		}
+		}
+	}
+
+	packet->stats = frame_stats;
+	// Clear the array of triangles to render every frame loop
+	array_free(triangles_to_render);
+	triangles_to_render = NULL;
+	packet->triangles = NULL;
 
-	// draw_pixel(50, 50, 0xFFFFFF00);
-	// draw_rect(300, 200, 300, 150, 0xFFFF00FF);
-	//draw_line(100, 200, 300, 50, 0xFF00FF00);
+	PROFILE_END();
+}
 
-	// loop all projected triangles and render them
-	// 	for (int i = 0; i < num_triangles; i++) {
-	// 	//for (int i = 0; i < N_MESH_FACES; i++) {
-	// 		triangle_t triangle = triangles_to_render[i];
+///////////////////////////////////////////////////////////////////////////////
+// The render thread draws the packets in the order they were recorded
+// It has its own copy of the mesh, of which drawing only reads the texture and
+// the hierarchy the loader built, and its own overdraw counters
+///////////////////////////////////////////////////////////////////////////////
 
-	// 		//Draw vertex points
-	// 		draw_rect(triangle.points[0].x, triangle.points[0].y, 3, 3, 0xFFFFFF00);
-	// 		draw_rect(triangle.points[1].x, triangle.points[1].y, 3, 3, 0xFFFFFF00);
-	// 		draw_rect(triangle.points[2].x, triangle.points[2].y, 3, 3, 0xFFFFFF00);
+int render_thread_main(void* data) {
+	mesh = *(mesh_t*) data;
+	overdraw_buffer = (uint16_t*) calloc(window_width * window_height, sizeof(uint16_t));
+	profile_set_thread_name("render");
 
-	// 		//Draw unfilled triangle faces
-	// 		draw_triangle(
-	// 			triangle.points[0].x, triangle.points[0].y, //vertex A
-	// 			triangle.points[1].x, triangle.points[1].y, //vertex B
-	// 			triangle.points[2].x, triangle.points[2].y, //vertex C
-	// 			0xFF00FF00);
-	// }
+	for (int index = 0; ; index = (index + 1) % FRAME_PACKETS_IN_FLIGHT) {
+		frame_packet_t* packet = &frame_packets[index];
 
-	//loop all projected triangles and render them
-		for (int i = 0; i < num_triangles; i++) {
-		//for (int i = 0; i < N_MESH_FACES; i++) {
-			triangle_t triangle = triangles_to_render[i];
-
-			//Draw filled triangle faces
-			if (render_method == RENDER_FILL_TRIANGLE || render_method == RENDER_FILL_TRIANGLE_WIRE) {
-				draw_filled_triangle(
-					triangle.points[0].x, triangle.points[0].y, //vertex A
-					triangle.points[1].x, triangle.points[1].y, //vertex B
-					triangle.points[2].x, triangle.points[2].y, //vertex C
-					triangle.color);
-			}
+		SDL_LockMutex(frame_packet_mutex);
+		while (packet->state != PACKET_RECORDED && !render_thread_quit) {
+			SDL_CondWait(frame_packet_changed, frame_packet_mutex);
+		}
+		bool has_packet = packet->state == PACKET_RECORDED;
+		SDL_UnlockMutex(frame_packet_mutex);
+		if (!has_packet) {
+			break;
+		}
 
-			if (render_method == RENDER_WIRE || render_method == RENDER_WIRE_VERTEX || render_method == RENDER_FILL_TRIANGLE_WIRE) {
-				//Draw unfilled triangle faces
-				draw_triangle(
-					triangle.points[0].x, triangle.points[0].y, //vertex A
-					triangle.points[1].x, triangle.points[1].y, //vertex B
-					triangle.points[2].x, triangle.points[2].y, //vertex C
-					0xFFFFFF);
-			}
+		Uint64 render_start = SDL_GetPerformanceCounter();
+		render(packet);
+		packet->render_time = (double)(SDL_GetPerformanceCounter() - render_start) / SDL_GetPerformanceFrequency();
 
-			if (render_method == RENDER_WIRE_VERTEX ) {
-				//Draw vertex points
-				// -3 and 6 ensures that rectangles sit in the center of the vertex
-				draw_rect(triangle.points[0].x - 3, triangle.points[0].y - 3, 6, 6, 0xFFFFFF00);
-				draw_rect(triangle.points[1].x - 3, triangle.points[1].y - 3, 6, 6, 0xFFFFFF00);
-				draw_rect(triangle.points[2].x - 3, triangle.points[2].y - 3, 6, 6, 0xFFFFFF00);
-			}
+		SDL_LockMutex(frame_packet_mutex);
+		packet->state = PACKET_RENDERED;
+		SDL_CondBroadcast(frame_packet_changed);
+		SDL_UnlockMutex(frame_packet_mutex);
+	}
+
+	free(overdraw_buffer);
+	free_point_buffers();
+	return 0;
+}
+
+void start_render_thread(void) {
+	for (int i = 0; i < FRAME_PACKETS_IN_FLIGHT; i++) {
+		frame_packets[i].state = PACKET_FREE;
+		frame_packets[i].pixels = (uint32_t*) malloc(sizeof(uint32_t) * window_width * window_height);
 	}
+	frame_packet_mutex = SDL_CreateMutex();
+	frame_packet_changed = SDL_CreateCond();
+	render_thread_quit = false;
+	render_thread = SDL_CreateThread(render_thread_main, "render", &mesh);
+}
 
-	//draw_filled_triangle(300, 100, 50, 400, 500, 700, 0xFF00FF00);
+// waits for the frames in flight to be drawn, they are dropped without being presented
+void stop_render_thread(void) {
+	SDL_LockMutex(frame_packet_mutex);
+	render_thread_quit = true;
+	SDL_CondBroadcast(frame_packet_changed);
+	SDL_UnlockMutex(frame_packet_mutex);
+	SDL_WaitThread(render_thread, NULL);
+
+	for (int i = 0; i < FRAME_PACKETS_IN_FLIGHT; i++) {
+		array_free(frame_packets[i].triangles);
+		free(frame_packets[i].pixels);
+		frame_packets[i].triangles = NULL;
+		frame_packets[i].pixels = NULL;
+	}
+	SDL_DestroyCond(frame_packet_changed);
+	SDL_DestroyMutex(frame_packet_mutex);
+}
 
-	// for (int i = 0; i < N_POINTS; i++) {
-	// 	vec2_t projected_point = projected_points[i];
-	// 	draw_rect(
-	// 		projected_point.x + (window_width/2), //translation
-	// 		projected_point.y + (window_height/2),
-	// 		4,
-	// 		4,
-	// 		0xFFFFFF00);
-	// }
+// blocks until the packet is in the given state
+void wait_for_frame_packet(frame_packet_t* packet, enum frame_packet_state state) {
+	SDL_LockMutex(frame_packet_mutex);
+	while (packet->state != state) {
+		SDL_CondWait(frame_packet_changed, frame_packet_mutex);
+	}
+	SDL_UnlockMutex(frame_packet_mutex);
+}
 
-	// Clear the array of triangles to render every frame loop
-	array_free(triangles_to_render);
-	
-	render_color_buffer();
+void set_frame_packet_state(frame_packet_t* packet, enum frame_packet_state state) {
+	SDL_LockMutex(frame_packet_mutex);
+	packet->state = state;
+	SDL_CondBroadcast(frame_packet_changed);
+	SDL_UnlockMutex(frame_packet_mutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Dynamic resolution
+// The main thread records a frame while the render thread draws the last one,
+// so a frame takes as long as the slower of the two; when that is over the
+// target the frames are drawn smaller, when it is well under they grow back.
+// Only the drawing depends on the pixel count, so the scale moves by the
+// square root of the time ratio, in whole steps and after a few frames of
+// the new size have been measured, so it doesn't swing on every spike
+///////////////////////////////////////////////////////////////////////////////
+
+#define RESOLUTION_SETTLE_FRAMES 15
 
-	clear_color_buffer(0xFF000000);
+double smoothed_frame_work = 0;
+int frames_at_resolution = 0;
 
+float choose_resolution_scale(const frame_packet_t* packet) {
+	if (!dynamic_resolution) {
+		return 1;
+	}
+	double work = fmax(packet->update_time, packet->render_time);
+	smoothed_frame_work = frames_at_resolution == 0 ? work : 0.9 * smoothed_frame_work + 0.1 * work;
+	if (++frames_at_resolution < RESOLUTION_SETTLE_FRAMES) {
+		return resolution_scale;
+	}
+
+	// grow back only with room to spare, part of the work doesn't shrink with the frame
+	double target = DYNAMIC_RESOLUTION_TARGET_TIME;
+	if (smoothed_frame_work <= target && smoothed_frame_work >= 0.7 * target) {
+		return resolution_scale;
+	}
+	float scale = resolution_scale * sqrtf((float)(target / smoothed_frame_work));
+	scale = floorf(scale * RESOLUTION_SCALE_STEPS) / RESOLUTION_SCALE_STEPS;
+	return fminf(fmaxf(scale, MIN_RESOLUTION_SCALE), 1);
+}
+
+// the occlusion pyramid follows the size of the frames, its buffer was allocated for the full window
+void change_resolution_scale(float scale) {
+	set_resolution_scale(scale);
+	init_occlusion_culling(proj_matrix, znear);
+	smoothed_frame_work = 0;
+	frames_at_resolution = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Present a drawn packet on the main thread, SDL wants the window on the
+// thread that created it; the overlays show the statistics of that frame
+///////////////////////////////////////////////////////////////////////////////
+
+void present(frame_packet_t* packet) {
+	PROFILE_BEGIN("present");
+	color_buffer = packet->pixels;
+	frame_stats = packet->stats;
+
+	if (show_frame_time_histogram) {
+		double target_time = frame_pacing == PACING_TARGET_FPS ? 1.0 / target_fps : 0;
+		draw_frame_time_histogram(10, window_height - 90, target_time);
+	}
+	if (show_hud) {
+		draw_hud();
+	}
+
+	render_color_buffer();
 	SDL_RenderPresent(renderer);
+	input_frame_presented(packet->input_timestamp);
 
+	color_buffer = NULL;
+	PROFILE_END();
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -414,19 +1387,628 @@ void render(void) {
 
 void free_resources(void) {
 	free(color_buffer); //raw free call
+	close_paged_mesh();
 	array_free(mesh.faces); //wrapper to free dynamic array
 	array_free(mesh.vertices);
+	array_free(mesh.normals);
+	array_free(mesh.texcoords);
+	array_free(mesh.face_normals);
+	array_free(mesh.edges);
+	array_free(mesh.face_edges);
+	array_free(mesh.clusters);
+	array_free(mesh.cluster_vertices);
+	free_bvh(mesh.bvh);
+	free_compressed_mesh(mesh.compressed);
+	free_vertex_stage_buffers();
+	free_texture(mesh.texture);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Turntable batch rendering, without a window
+// Worker threads claim frames in order and draw each one into the pixels of a
+// frame slot with their own copy of the per-frame state, then encode it; the
+// main thread writes the slots to disk in frame order while the workers go on
+///////////////////////////////////////////////////////////////////////////////
+
+enum output_format {
+	OUTPUT_PPM,
+	OUTPUT_PNG,
+	OUTPUT_RAW	// every frame appended to one stream of ARGB8888 pixels
+};
+
+enum slot_state {
+	SLOT_FREE,
+	SLOT_RENDERING,
+	SLOT_READY
+};
+
+typedef struct {
+	int frame;
+	enum slot_state state;
+	uint32_t* pixels;
+	uint8_t* encoded;	// the image file, unused for raw output
+	int encoded_size;
+} frame_slot_t;
+
+typedef struct {
+	int num_frames;
+	enum output_format format;
+	mesh_t* shared_mesh;	// the mesh loaded by the main thread
+	enum render_method render_method;	// the draw state is per thread, the workers copy the main thread's
+	enum shading_method shading_method;
+	enum line_method line_method;
+	frame_slot_t* slots;	// frame n goes to slot n % num_slots
+	int num_slots;
+	int frames_written;	// frames handed to the output so far, they are written in order
+	SDL_atomic_t next_frame;
+	SDL_mutex* mutex;
+	SDL_cond* slot_changed;
+} turntable_t;
+
+int turntable_worker(void* data) {
+	turntable_t* turntable = (turntable_t*) data;
+
+	mesh = *turntable->shared_mesh;
+	render_method = turntable->render_method;
+	shading_method = turntable->shading_method;
+	line_method = turntable->line_method;
+	allocate_vertex_stage_buffers();
+	overdraw_buffer = (uint16_t*) calloc(window_width * window_height, sizeof(uint16_t));
+	profile_set_thread_name("turntable worker");
+
+	while (true) {
+		int frame = SDL_AtomicAdd(&turntable->next_frame, 1);
+		if (frame >= turntable->num_frames) {
+			break;
+		}
+		frame_slot_t* slot = &turntable->slots[frame % turntable->num_slots];
+
+		// wait until the frame that used the slot before has been written, checking the
+		// slot alone isn't enough: a worker that claimed a frame num_slots later could
+		// have taken the free slot first, then the writer would wait for this frame forever
+		SDL_LockMutex(turntable->mutex);
+		while (frame >= turntable->frames_written + turntable->num_slots) {
+			SDL_CondWait(turntable->slot_changed, turntable->mutex);
+		}
+		slot->state = SLOT_RENDERING;
+		slot->frame = frame;
+		SDL_UnlockMutex(turntable->mutex);
+
+		PROFILE_BEGIN("render frame");
+
+		// the same float additions as the first frame + 1 simulation steps of the window loop
+		mesh.rotation = turntable->shared_mesh->rotation;
+		for (int i = 0; i <= frame; i++) {
+			animate_mesh();
+		}
+
+		color_buffer = slot->pixels;
+		clear_color_buffer(0xFF000000);
+		prepare_triangles();
+		if (render_method == RENDER_RAYCAST) {
+			render_raycast();
+		} else if (render_method == RENDER_POINTS) {
+			mat4_t world_view_projection_matrix;
+			mat4_mul_mat3x4_into(&world_view_projection_matrix, &proj_matrix, &frame_world_view_matrix);
+			render_points(&world_view_projection_matrix);
+		} else {
+			draw_triangles();
+		}
+		array_free(triangles_to_render);
+		PROFILE_END();
+
+		PROFILE_BEGIN("encode frame");
+		image_t image = { .width = window_width, .height = window_height, .pixels = slot->pixels };
+		if (turntable->format == OUTPUT_PNG) {
+			slot->encoded = encode_png(&image, &slot->encoded_size);
+		} else if (turntable->format == OUTPUT_PPM) {
+			slot->encoded = encode_ppm(&image, &slot->encoded_size);
+		}
+		PROFILE_END();
+
+		SDL_LockMutex(turntable->mutex);
+		slot->state = SLOT_READY;
+		SDL_CondBroadcast(turntable->slot_changed);
+		SDL_UnlockMutex(turntable->mutex);
+	}
+
+	free_vertex_stage_buffers();
+	free(overdraw_buffer);
+	return 0;
+}
+
+// the render methods by their name on the command line
+static const char* render_method_names[] = { "wire", "wire-vertex", "fill", "fill-wire", "textured", "textured-wire", "overdraw", "raycast", "points" };
+static const enum render_method render_methods[] = {
+	RENDER_WIRE, RENDER_WIRE_VERTEX, RENDER_FILL_TRIANGLE, RENDER_FILL_TRIANGLE_WIRE, RENDER_TEXTURED, RENDER_TEXTURED_WIRE, RENDER_OVERDRAW, RENDER_RAYCAST, RENDER_POINTS
+};
+static const int num_render_methods = sizeof(render_methods) / sizeof(render_methods[0]);
+
+void print_turntable_usage(void) {
+	fprintf(stderr,
+		"usage: renderer [model.obj | model.pages [budget MB]]\n"
+		"       renderer --pack <model.obj> <model.pages>\n"
+		"       renderer --turntable <model.obj | model.pages> <frames> [options]\n"
+		"       renderer --poster <model.obj | model.pages> <w>x<h> [options]\n"
+		"  -o <path>     output prefix, frames are written to <path>0000.png and so on (default \"frame\")\n"
+		"                raw output is one file, - writes it to stdout; a poster is written to <path> (default poster.png)\n"
+		"  -f <format>   png, ppm or raw (ARGB8888, bgra in ffmpeg terms)\n"
+		"  -s <w>x<h>    frame size (default 800x600)\n"
+		"  -j <threads>  render threads (default one per core)\n"
+		"  -r <method>   wire, wire-vertex, fill, fill-wire, textured, textured-wire, overdraw, raycast or points (default fill)\n"
+		"  -g            Gouraud shading\n"
+		"  -z            transform the compressed mesh (16-bit positions and indices, octahedral normals)\n"
+		"  -m <MB>       memory budget of the resident pages of a paged mesh (default 256)\n"
+		"  -t <path>     write a Chrome trace of the render threads to <path>\n"
+		"  a poster is the first turntable frame at any size up to 32768x32768, drawn in bands of rows to bound the memory;\n"
+		"  it takes -o, -f, -r (not overdraw, raycast or points), -g, -z and -m\n");
+}
+
+int run_turntable(int argc, char* argv[]) {
+	if (argc < 2 || atoi(argv[1]) <= 0) {
+		print_turntable_usage();
+		return 1;
+	}
+
+	char* filename = argv[0];
+	const char* output = "frame";
+	const char* trace_path = NULL;
+	int num_threads = SDL_GetCPUCount();
+	turntable_t turntable = { .num_frames = atoi(argv[1]), .format = OUTPUT_PNG };
+
+	window_width = 800;
+	window_height = 600;
+	render_method = RENDER_FILL_TRIANGLE;
+	line_method = LINE_BRESENHAM;
+	cull_method = CULL_BACKFACE;
+	shading_method = SHADE_FLAT;
+
+	for (int i = 2; i < argc; i++) {
+		bool has_value = i + 1 < argc;
+		if (strcmp(argv[i], "-o") == 0 && has_value) {
+			output = argv[++i];
+		} else if (strcmp(argv[i], "-f") == 0 && has_value) {
+			i++;
+			if (strcmp(argv[i], "png") == 0) turntable.format = OUTPUT_PNG;
+			else if (strcmp(argv[i], "ppm") == 0) turntable.format = OUTPUT_PPM;
+			else if (strcmp(argv[i], "raw") == 0) turntable.format = OUTPUT_RAW;
+			else { print_turntable_usage(); return 1; }
+		} else if (strcmp(argv[i], "-s") == 0 && has_value) {
+			if (sscanf(argv[++i], "%dx%d", &window_width, &window_height) != 2 || window_width <= 0 || window_height <= 0) {
+				print_turntable_usage();
+				return 1;
+			}
+		} else if (strcmp(argv[i], "-j") == 0 && has_value) {
+			num_threads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-r") == 0 && has_value) {
+			i++;
+			int method = 0;
+			while (method < num_render_methods && strcmp(argv[i], render_method_names[method]) != 0) method++;
+			if (method == num_render_methods) { print_turntable_usage(); return 1; }
+			render_method = render_methods[method];
+		} else if (strcmp(argv[i], "-g") == 0) {
+			shading_method = SHADE_GOURAUD;
+		} else if (strcmp(argv[i], "-t") == 0 && has_value) {
+			trace_path = argv[++i];
+		} else if (strcmp(argv[i], "-z") == 0) {
+			use_compressed_mesh = true;
+		} else if (strcmp(argv[i], "-m") == 0 && has_value) {
+			stream_budget_mb = atoi(argv[++i]);
+		} else {
+			print_turntable_usage();
+			return 1;
+		}
+	}
+	if (num_threads < 1) {
+		num_threads = 1;
+	}
+
+	profile_set_thread_name("main");
+	setup_scene(filename);
+	if (array_length(mesh.vertices) == 0 && !stream_is_open()) {
+		fprintf(stderr, "Error: no vertices loaded from %s.\n", filename);
+		return 1;
+	}
+	// a point cloud has nothing else to draw
+	if (array_length(mesh.faces) == 0 && !stream_is_open()) {
+		render_method = RENDER_POINTS;
+	}
+
+	// the pages of a paged mesh are loaded for the view of one frame at a time, so
+	// a single worker renders the frames in order, each once all of its pages are in
+	if (stream_is_open()) {
+		num_threads = 1;
+		stream_wait_for_loads = true;
+	}
+
+	FILE* stream = NULL;
+	if (turntable.format == OUTPUT_RAW) {
+		stream = (strcmp(output, "-") == 0) ? stdout : fopen(output, "wb");
+		if (!stream) {
+			fprintf(stderr, "Error opening %s.\n", output);
+			return 1;
+		}
+	}
+
+	// two slots per thread, so a worker can start its next frame while the last one is written
+	turntable.num_slots = 2 * num_threads;
+	turntable.slots = (frame_slot_t*) calloc(turntable.num_slots, sizeof(frame_slot_t));
+	for (int i = 0; i < turntable.num_slots; i++) {
+		turntable.slots[i].pixels = (uint32_t*) malloc(sizeof(uint32_t) * window_width * window_height);
+	}
+	turntable.shared_mesh = &mesh;
+	turntable.render_method = render_method;
+	turntable.shading_method = shading_method;
+	turntable.line_method = line_method;
+	turntable.mutex = SDL_CreateMutex();
+	turntable.slot_changed = SDL_CreateCond();
+	SDL_AtomicSet(&turntable.next_frame, 0);
+
+	Uint64 start_time = SDL_GetPerformanceCounter();
+
+	// every worker already has a frame of its own, ray cast and point frames are drawn on the worker alone
+	raycast_use_thread_pool = false;
+	points_use_thread_pool = false;
+
+	SDL_Thread** threads = (SDL_Thread**) malloc(sizeof(SDL_Thread*) * num_threads);
+	for (int i = 0; i < num_threads; i++) {
+		threads[i] = SDL_CreateThread(turntable_worker, "turntable", &turntable);
+	}
+
+	// write the frames in order as they become ready
+	bool write_failed = false;
+	for (int frame = 0; frame < turntable.num_frames; frame++) {
+		frame_slot_t* slot = &turntable.slots[frame % turntable.num_slots];
+
+		PROFILE_BEGIN("wait for frame");
+		SDL_LockMutex(turntable.mutex);
+		while (slot->state != SLOT_READY || slot->frame != frame) {
+			SDL_CondWait(turntable.slot_changed, turntable.mutex);
+		}
+		SDL_UnlockMutex(turntable.mutex);
+		PROFILE_END();
+
+		PROFILE_BEGIN("write frame");
+		if (turntable.format == OUTPUT_RAW) {
+			size_t num_pixels = (size_t)window_width * window_height;
+			write_failed |= fwrite(slot->pixels, sizeof(uint32_t), num_pixels, stream) != num_pixels;
+		} else {
+			char path[1024];
+			snprintf(path, sizeof(path), "%s%04d.%s", output, frame, turntable.format == OUTPUT_PNG ? "png" : "ppm");
+			FILE* file = fopen(path, "wb");
+			if (file) {
+				write_failed |= fwrite(slot->encoded, 1, slot->encoded_size, file) != (size_t)slot->encoded_size;
+				fclose(file);
+			} else {
+				fprintf(stderr, "Error opening %s.\n", path);
+				write_failed = true;
+			}
+			free(slot->encoded);
+			slot->encoded = NULL;
+		}
+		PROFILE_END();
+
+		SDL_LockMutex(turntable.mutex);
+		slot->state = SLOT_FREE;
+		turntable.frames_written++;
+		SDL_CondBroadcast(turntable.slot_changed);
+		SDL_UnlockMutex(turntable.mutex);
+	}
+
+	for (int i = 0; i < num_threads; i++) {
+		SDL_WaitThread(threads[i], NULL);
+	}
+
+	double seconds = (double)(SDL_GetPerformanceCounter() - start_time) / SDL_GetPerformanceFrequency();
+	fprintf(stderr, "%d frames in %.2f s (%.1f frames/s) on %d threads\n",
+		turntable.num_frames, seconds, turntable.num_frames / seconds, num_threads);
+
+	if (trace_path) {
+		write_failed |= !profile_write_chrome_trace(trace_path);
+	}
+
+	if (stream && stream != stdout) {
+		fclose(stream);
+	}
+	for (int i = 0; i < turntable.num_slots; i++) {
+		free(turntable.slots[i].pixels);
+	}
+	free(turntable.slots);
+	free(threads);
+	SDL_DestroyCond(turntable.slot_changed);
+	SDL_DestroyMutex(turntable.mutex);
+	free_resources();
+
+	if (write_failed) {
+		fprintf(stderr, "Error writing frames.\n");
+		return 1;
+	}
+	return 0;
+}
+
+// peak resident memory of the process in MB, ru_maxrss is in KB on Linux and bytes on macOS
+static long peak_resident_mb(void) {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss / (1024 * 1024);
+#else
+	return usage.ru_maxrss / 1024;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Convert a model to a paged mesh that the renderer streams from disk
+// The whole model is loaded first, so packing needs the memory of the model
+// (without the ray casting hierarchy, which no page keeps) even though the
+// renderer then draws it in any budget
+///////////////////////////////////////////////////////////////////////////////
+
+int run_pack(int argc, char* argv[]) {
+	if (argc != 2) {
+		print_turntable_usage();
+		return 1;
+	}
+	load_mesh_bvh = false;
+	load_obj_file_data(argv[0]);
+	if (array_length(mesh.faces) == 0) {
+		fprintf(stderr, "Error: no faces loaded from %s.\n", argv[0]);
+		return 1;
+	}
+	bool ok = write_paged_mesh(argv[1]);
+	if (ok) {
+		printf("%d faces in %d pages written to %s\n", array_length(mesh.faces), array_length(mesh.clusters), argv[1]);
+		printf("peak resident memory: %ld MB\n", peak_resident_mb());
+	}
+	free_resources();
+	return ok ? 0 : 1;
+}
+
+// a band of a poster holds about this many pixels, at least one row
+#define POSTER_BAND_PIXELS (1 << 20)
+// rows past its vertices a triangle can draw into
+#define POSTER_ROW_MARGIN 4
+// the largest poster side, the largest image the png loader reads back
+#define POSTER_MAX_SIZE 32768
+
+///////////////////////////////////////////////////////////////////////////////
+// Bin the prepared triangles by the first band of rows they can draw into, in
+// draw order within each band, and note the last one in last_bands; every
+// triangle is binned once however many bands it spans, so the bins take as
+// much memory at any height. band_starts gets num_bands + 1 entries and the
+// returned array holds the triangles starting in band b from band_starts[b] on
+///////////////////////////////////////////////////////////////////////////////
+
+int* bin_triangles_by_band(int band_rows, int num_bands, int* band_starts, int* last_bands) {
+	int num_triangles = array_length(triangles_to_render);
+	int* first_bands = (int*) malloc(sizeof(int) * (num_triangles > 0 ? num_triangles : 1));
+	for (int b = 0; b <= num_bands; b++) {
+		band_starts[b] = 0;
+	}
+
+	for (int i = 0; i < num_triangles; i++) {
+		vec4_t* points = triangles_to_render[i].points;
+		float min_y = fminf(points[0].y, fminf(points[1].y, points[2].y));
+		float max_y = fmaxf(points[0].y, fmaxf(points[1].y, points[2].y));
+		// the vertex squares of RENDER_WIRE_VERTEX reach the furthest past the vertices
+		float top = fmaxf(floorf(min_y) - POSTER_ROW_MARGIN, 0);
+		float bottom = fminf(ceilf(max_y) + POSTER_ROW_MARGIN, window_height - 1);
+		if (top > bottom) {
+			first_bands[i] = -1;
+			continue;
+		}
+		first_bands[i] = (int)top / band_rows;
+		last_bands[i] = (int)bottom / band_rows;
+		band_starts[first_bands[i] + 1]++;
+	}
+
+	for (int b = 0; b < num_bands; b++) {
+		band_starts[b + 1] += band_starts[b];
+	}
+	int* band_triangles = (int*) malloc(sizeof(int) * (band_starts[num_bands] > 0 ? band_starts[num_bands] : 1));
+	int* band_ends = (int*) malloc(sizeof(int) * num_bands);
+	memcpy(band_ends, band_starts, sizeof(int) * num_bands);
+	for (int i = 0; i < num_triangles; i++) {
+		if (first_bands[i] >= 0) {
+			band_triangles[band_ends[first_bands[i]]++] = i;
+		}
+	}
+
+	free(band_ends);
+	free(first_bands);
+	return band_triangles;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Render the first turntable frame at any size, a poster, without holding it
+// The triangles are prepared once for the whole frame and binned by bands of
+// rows, then every band is drawn into the same small color buffer, clipped to
+// its rows, and written out before the next one; what is kept grows with the
+// model and the width of the frame, not its height
+///////////////////////////////////////////////////////////////////////////////
+
+int run_poster(int argc, char* argv[]) {
+	if (argc < 2 || sscanf(argv[1], "%dx%d", &window_width, &window_height) != 2 || window_width <= 0 || window_height <= 0 ||
+		window_width > POSTER_MAX_SIZE || window_height > POSTER_MAX_SIZE) {
+		print_turntable_usage();
+		return 1;
+	}
+
+	char* filename = argv[0];
+	const char* output = "poster.png";
+	enum output_format format = OUTPUT_PNG;
+	render_method = RENDER_FILL_TRIANGLE;
+	line_method = LINE_BRESENHAM;
+	cull_method = CULL_BACKFACE;
+	shading_method = SHADE_FLAT;
+
+	for (int i = 2; i < argc; i++) {
+		bool has_value = i + 1 < argc;
+		if (strcmp(argv[i], "-o") == 0 && has_value) {
+			output = argv[++i];
+		} else if (strcmp(argv[i], "-f") == 0 && has_value) {
+			i++;
+			if (strcmp(argv[i], "png") == 0) format = OUTPUT_PNG;
+			else if (strcmp(argv[i], "ppm") == 0) format = OUTPUT_PPM;
+			else if (strcmp(argv[i], "raw") == 0) format = OUTPUT_RAW;
+			else { print_turntable_usage(); return 1; }
+		} else if (strcmp(argv[i], "-r") == 0 && has_value) {
+			i++;
+			int method = 0;
+			while (method < num_render_methods && strcmp(argv[i], render_method_names[method]) != 0) method++;
+			if (method == num_render_methods) { print_turntable_usage(); return 1; }
+			render_method = render_methods[method];
+		} else if (strcmp(argv[i], "-g") == 0) {
+			shading_method = SHADE_GOURAUD;
+		} else if (strcmp(argv[i], "-z") == 0) {
+			use_compressed_mesh = true;
+		} else if (strcmp(argv[i], "-m") == 0 && has_value) {
+			stream_budget_mb = atoi(argv[++i]);
+		} else {
+			print_turntable_usage();
+			return 1;
+		}
+	}
+	// the overdraw heat map, the ray caster and the point splats work on the whole frame at once
+	if (render_method == RENDER_OVERDRAW || render_method == RENDER_RAYCAST || render_method == RENDER_POINTS) {
+		fprintf(stderr, "Error: a poster is drawn with the wire, fill and textured methods only.\n");
+		return 1;
+	}
+
+	profile_set_thread_name("main");
+	setup_scene(filename);
+	if (array_length(mesh.faces) == 0 && !stream_is_open()) {
+		fprintf(stderr, "Error: no faces loaded from %s.\n", filename);
+		free_resources();
+		return 1;
+	}
+	// the depth pyramid has a cell for every 8x8 pixels of the frame, too many to keep for a poster
+	occlusion_culling = false;
+	free_occlusion_buffer();
+	stream_wait_for_loads = true;
+
+	FILE* file = (strcmp(output, "-") == 0) ? stdout : fopen(output, "wb");
+	if (!file) {
+		fprintf(stderr, "Error opening %s.\n", output);
+		free_resources();
+		return 1;
+	}
+
+	Uint64 start_time = SDL_GetPerformanceCounter();
+
+	// the same pose as the first turntable frame
+	animate_mesh();
+	prepare_triangles();
+
+	int band_rows = POSTER_BAND_PIXELS / window_width;
+	band_rows = band_rows > 0 ? band_rows : 1;
+	band_rows = band_rows < window_height ? band_rows : window_height;
+	int num_bands = (window_height + band_rows - 1) / band_rows;
+	int num_triangles = array_length(triangles_to_render);
+	int* band_starts = (int*) malloc(sizeof(int) * (num_bands + 1));
+	int* last_bands = (int*) malloc(sizeof(int) * (num_triangles > 0 ? num_triangles : 1));
+	PROFILE_BEGIN("bin triangles");
+	int* band_triangles = bin_triangles_by_band(band_rows, num_bands, band_starts, last_bands);
+	PROFILE_END();
+	// the triangles that reach into the band being drawn, in draw order
+	int* active = (int*) malloc(sizeof(int) * (num_triangles > 0 ? num_triangles : 1));
+	int* next_active = (int*) malloc(sizeof(int) * (num_triangles > 0 ? num_triangles : 1));
+	int num_active = 0;
+	long band_draws = 0;
+
+	color_buffer = (uint32_t*) malloc(sizeof(uint32_t) * window_width * band_rows);
+	image_writer_t* writer = format == OUTPUT_RAW ? NULL : open_image_writer(file, format == OUTPUT_PNG, window_width, window_height);
+	bool write_failed = false;
+	for (int b = 0; b < num_bands; b++) {
+		band_top = b * band_rows;
+		band_bottom = band_top + band_rows < window_height ? band_top + band_rows : window_height;
+		int rows = band_bottom - band_top;
+
+		PROFILE_BEGIN("draw band");
+		for (int i = 0; i < window_width * rows; i++) {
+			color_buffer[i] = 0xFF000000;
+		}
+		// the triangles of the last band that reach this one merged with the ones starting in it,
+		// both in draw order
+		int kept = 0, t = band_starts[b];
+		for (int a = 0; a < num_active || t < band_starts[b + 1];) {
+			int i = (t == band_starts[b + 1] || (a < num_active && active[a] < band_triangles[t])) ? active[a++] : band_triangles[t++];
+			if (last_bands[i] >= b) {
+				next_active[kept++] = i;
+			}
+		}
+		int* temp = active;
+		active = next_active;
+		next_active = temp;
+		num_active = kept;
+		for (int a = 0; a < num_active; a++) {
+			draw_prepared_triangle(&triangles_to_render[active[a]]);
+		}
+		band_draws += num_active;
+		PROFILE_END();
+
+		PROFILE_BEGIN("write band");
+		if (writer) {
+			write_failed |= !write_image_rows(writer, color_buffer, rows);
+		} else {
+			size_t num_pixels = (size_t)window_width * rows;
+			write_failed |= fwrite(color_buffer, sizeof(uint32_t), num_pixels, file) != num_pixels;
+		}
+		PROFILE_END();
+	}
+	band_top = 0;
+	band_bottom = INT_MAX;
+	if (writer) {
+		write_failed |= !close_image_writer(writer);
+	}
+
+	double seconds = (double)(SDL_GetPerformanceCounter() - start_time) / SDL_GetPerformanceFrequency();
+	fprintf(stderr, "%dx%d in %d bands of %d rows, %d triangles drawn into %ld bands, in %.2f s\n",
+		window_width, window_height, num_bands, band_rows, num_triangles, band_draws, seconds);
+	fprintf(stderr, "peak resident memory: %ld MB\n", peak_resident_mb());
+
+	if (file != stdout) {
+		write_failed |= fclose(file) != 0;
+	}
+	free(band_triangles);
+	free(band_starts);
+	free(last_bands);
+	free(active);
+	free(next_active);
+	array_free(triangles_to_render);
+	triangles_to_render = NULL;
+	free_resources();
+	color_buffer = NULL;
+
+	if (write_failed) {
+		fprintf(stderr, "Error writing %s.\n", output);
+		return 1;
+	}
+	return 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Main function
 ///////////////////////////////////////////////////////////////////////////////
 
-int main(void) {
-	
+int main(int argc, char* argv[]) {
+	if (argc > 1 && strcmp(argv[1], "--turntable") == 0) {
+		return run_turntable(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "--poster") == 0) {
+		return run_poster(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "--pack") == 0) {
+		return run_pack(argc - 2, argv + 2);
+	}
+
+	profile_set_thread_name("main");
 	is_running = initialize_window();
 
-	setup();
+	if (argc > 2) {
+		stream_budget_mb = atoi(argv[2]);
+	}
+	setup(argc > 1 ? argv[1] : "./assets/f22.obj");
 
 	//vec3_t myvector = {2.0, 3.0, -4.0};
 
@@ -441,12 +2023,56 @@ int main(void) {
 	// instead, we need to think about a fixed fps
 
 	// to fix, we added a while loop in update()
-	while (is_running) {
+	start_render_thread();
+	frame_packet_t* previous_packet = NULL;
+	for (int frame = 0; is_running; frame++) {
+		// wait before polling, so the input a frame reacts to is as recent as possible
+		if (frame_pacing == PACING_TARGET_FPS) {
+			PROFILE_BEGIN("wait for frame time");
+			wait_for_target_frame_time();
+			PROFILE_END();
+		}
 		process_input();
-		update();
-		render();
+
+		// frame n is recorded while the render thread draws frame n - 1, which is
+		// presented next, so what is on screen is one frame older than the input
+		frame_packet_t* packet = &frame_packets[frame % FRAME_PACKETS_IN_FLIGHT];
+		wait_for_frame_packet(packet, PACKET_FREE);
+		update(packet);
+		set_frame_packet_state(packet, PACKET_RECORDED);
+
+		if (previous_packet) {
+			PROFILE_BEGIN("wait for render");
+			wait_for_frame_packet(previous_packet, PACKET_RENDERED);
+			PROFILE_END();
+			present(previous_packet);
+			float scale = choose_resolution_scale(previous_packet);
+			set_frame_packet_state(previous_packet, PACKET_FREE);
+
+			// the frame in flight was recorded at the old size, it goes on screen before the switch
+			if (scale != resolution_scale) {
+				wait_for_frame_packet(packet, PACKET_RENDERED);
+				present(packet);
+				set_frame_packet_state(packet, PACKET_FREE);
+				packet = NULL;
+				change_resolution_scale(scale);
+			}
+		}
+		previous_packet = packet;
+
+		// report the culling statistics of the last frame once per second
+		if (SDL_GetTicks() - previous_stats_time >= 1000) {
+			print_frame_stats();
+			print_input_latency();
+			previous_stats_time = SDL_GetTicks();
+		}
 	}
 
+	print_frame_time_histogram();
+
+	stop_render_thread();
+	raycast_shutdown_thread_pool();
+	points_shutdown_thread_pool();
 	destroy_window();
 	free_resources();
 
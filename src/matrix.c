@@ -84,23 +84,78 @@ mat4_t mat4_make_rotation_z(float angle) {
     return m;
 }
 
-vec4_t mat4_mul_vec4(mat4_t m, vec4_t v) {
-    vec4_t result;
-    result.x = m.m[0][0] * v.x + m.m[0][1] * v.y + m.m[0][2] * v.z + m.m[0][3] * v.w;
-    result.y = m.m[1][0] * v.x + m.m[1][1] * v.y + m.m[1][2] * v.z + m.m[1][3] * v.w;
-    result.z = m.m[2][0] * v.x + m.m[2][1] * v.y + m.m[2][2] * v.z + m.m[2][3] * v.w;
-    result.w = m.m[3][0] * v.x + m.m[3][1] * v.y + m.m[3][2] * v.z + m.m[3][3] * v.w;
-    return result;
+// the world matrix of a mesh, scale first, then the rotations around z, y and x, then
+// the translation; the same as multiplying the five matrices, with the rotation
+// product Rx * Ry * Rz written out so each angle costs one sin and one cos
+mat3x4_t mat3x4_make_trs(vec3_t scale, vec3_t rotation, vec3_t translation) {
+    float cx = cos(rotation.x), sx = sin(rotation.x);
+    float cy = cos(rotation.y), sy = sin(rotation.y);
+    float cz = cos(rotation.z), sz = sin(rotation.z);
+
+    // | cy*cz              -cy*sz              sy      |
+    // | cx*sz + sx*sy*cz    cx*cz - sx*sy*sz  -sx*cy   |
+    // | sx*sz - cx*sy*cz    sx*cz + cx*sy*sz   cx*cy   |
+    // each column is then scaled by the scale of its axis
+    mat3x4_t m = {{
+        { cy * cz * scale.x,                  -cy * sz * scale.y,                  sy * scale.z,       translation.x },
+        { (cx * sz + sx * sy * cz) * scale.x, (cx * cz - sx * sy * sz) * scale.y, -sx * cy * scale.z, translation.y },
+        { (sx * sz - cx * sy * cz) * scale.x, (sx * cz + cx * sy * sz) * scale.y,  cx * cy * scale.z, translation.z }
+    }};
+    return m;
 }
 
-mat4_t mat4_mul_mat4(mat4_t a, mat4_t b) {
-    mat4_t m;
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            m.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+// normals have to be transformed by the inverse-transpose of the world matrix so that
+// they stay perpendicular to the surface under non-uniform scale; only the upper 3x3
+// (rotation and scale) matters, the translation column is dropped
+mat4_t mat4_make_normal_matrix(mat4_t m) {
+    mat3x4_t affine = mat3x4_from_mat4(&m);
+    mat3x4_t n = mat3x4_make_normal_matrix(&affine);
+    return mat4_from_mat3x4(&n);
+}
+
+mat3x4_t mat3x4_make_normal_matrix(const mat3x4_t* m) {
+    float a = m->m[0][0], b = m->m[0][1], c = m->m[0][2];
+    float d = m->m[1][0], e = m->m[1][1], f = m->m[1][2];
+    float g = m->m[2][0], h = m->m[2][1], i = m->m[2][2];
+
+    // the inverse-transpose is the cofactor matrix divided by the determinant
+    float cofactor[3][3] = {
+        { e * i - f * h, f * g - d * i, d * h - e * g },
+        { c * h - b * i, a * i - c * g, b * g - a * h },
+        { b * f - c * e, c * d - a * f, a * e - b * d }
+    };
+    float det = a * cofactor[0][0] + b * cofactor[0][1] + c * cofactor[0][2];
+
+    mat3x4_t n = {{
+        { 1, 0, 0, 0 },
+        { 0, 1, 0, 0 },
+        { 0, 0, 1, 0 }
+    }};
+    if (det == 0) {
+        return n;
+    }
+    for (int row = 0; row < 3; row++) {
+        for (int col = 0; col < 3; col++) {
+            n.m[row][col] = cofactor[row][col] / det;
         }
     }
-    return m;
+    return n;
+}
+
+// inverse of an affine transform, the 3x3 part is inverted with the same cofactors
+// as the normal matrix (transposed) and the translation is moved back through it
+mat3x4_t mat3x4_inverse(const mat3x4_t* m) {
+    mat3x4_t n = mat3x4_make_normal_matrix(m);
+    mat3x4_t inverse;
+    for (int row = 0; row < 3; row++) {
+        for (int col = 0; col < 3; col++) {
+            inverse.m[row][col] = n.m[col][row];
+        }
+    }
+    for (int row = 0; row < 3; row++) {
+        inverse.m[row][3] = -(inverse.m[row][0] * m->m[0][3] + inverse.m[row][1] * m->m[1][3] + inverse.m[row][2] * m->m[2][3]);
+    }
+    return inverse;
 }
 
 mat4_t mat4_make_perspective(float fov, float aspect, float znear, float zfar) {
@@ -117,18 +172,23 @@ mat4_t mat4_make_perspective(float fov, float aspect, float znear, float zfar) {
     return m;
 }
 
+mat4_t mat4_look_at(vec3_t eye, vec3_t target, vec3_t up) {
+    // forward (z), right (x) and up (y) axes of the camera, left handed like the projection
+    vec3_t z = vec3_subtract(target, eye);
+    vec3_normalize(&z);
+    vec3_t x = vec3_cross(up, z);
+    vec3_normalize(&x);
+    vec3_t y = vec3_cross(z, x);
 
-// not a simple multiplication as we need to also do the perpspective divide
-vec4_t mat4_mul_vec4_project(mat4_t mat_proj, vec4_t v) {
-    // multiply the projection matrix by our original vector
-    vec4_t result = mat4_mul_vec4(mat_proj, v);
-
-    // perform perspective divide with original z-value
-    if (result.w != 0.0) {
-        result.x /= result.w;
-        result.y /= result.w;
-        result.z /= result.w;
-    }
-
-    return result;
+    // | x.x  x.y  x.z  -dot(x,eye) |
+    // | y.x  y.y  y.z  -dot(y,eye) |
+    // | z.x  z.y  z.z  -dot(z,eye) |
+    // |   0    0    0            1 |
+    mat4_t view_matrix = {{
+        { x.x, x.y, x.z, -vec3_dot(x, eye) },
+        { y.x, y.y, y.z, -vec3_dot(y, eye) },
+        { z.x, z.y, z.z, -vec3_dot(z, eye) },
+        {   0,   0,   0,                 1 }
+    }};
+    return view_matrix;
 }
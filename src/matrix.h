@@ -7,15 +7,139 @@ typedef struct {
     float m[4][4];
 } mat4_t;
 
+// an affine transform (rotation, scale, translation), the last row is always
+// 0 0 0 1 so it isn't stored and the products skip it
+typedef struct {
+    float m[3][4];
+} mat3x4_t;
+
 mat4_t mat4_identity(void);
 mat4_t mat4_make_scale(float sx, float sy, float sz);
 mat4_t mat4_make_translation(float tx, float ty, float tz);
 mat4_t mat4_make_rotation_x(float angle);
 mat4_t mat4_make_rotation_y(float angle);
 mat4_t mat4_make_rotation_z(float angle);
-vec4_t mat4_mul_vec4(mat4_t m, vec4_t v);
-mat4_t mat4_mul_mat4(mat4_t a, mat4_t b);
+mat4_t mat4_make_normal_matrix(mat4_t m);
 mat4_t mat4_make_perspective(float fov, float aspect, float znear, float zfar);
-vec4_t mat4_mul_vec4_project(mat4_t mat_proj, vec4_t v);
+mat4_t mat4_look_at(vec3_t eye, vec3_t target, vec3_t up);
+
+mat3x4_t mat3x4_make_trs(vec3_t scale, vec3_t rotation, vec3_t translation);
+mat3x4_t mat3x4_make_normal_matrix(const mat3x4_t* m);
+mat3x4_t mat3x4_inverse(const mat3x4_t* m);
+
+///////////////////////////////////////////////////////////////////////////////
+// The products run per vertex and per face, so they live here to be inlined
+// The _into variants write through restrict pointers, out must not alias the inputs
+///////////////////////////////////////////////////////////////////////////////
+
+static inline vec4_t mat4_mul_vec4(mat4_t m, vec4_t v) {
+    vec4_t result;
+    result.x = m.m[0][0] * v.x + m.m[0][1] * v.y + m.m[0][2] * v.z + m.m[0][3] * v.w;
+    result.y = m.m[1][0] * v.x + m.m[1][1] * v.y + m.m[1][2] * v.z + m.m[1][3] * v.w;
+    result.z = m.m[2][0] * v.x + m.m[2][1] * v.y + m.m[2][2] * v.z + m.m[2][3] * v.w;
+    result.w = m.m[3][0] * v.x + m.m[3][1] * v.y + m.m[3][2] * v.z + m.m[3][3] * v.w;
+    return result;
+}
+
+static inline void mat4_mul_mat4_into(mat4_t* restrict out, const mat4_t* restrict a, const mat4_t* restrict b) {
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            out->m[i][j] = a->m[i][0] * b->m[0][j] + a->m[i][1] * b->m[1][j] + a->m[i][2] * b->m[2][j] + a->m[i][3] * b->m[3][j];
+        }
+    }
+}
+
+static inline mat4_t mat4_mul_mat4(mat4_t a, mat4_t b) {
+    mat4_t m;
+    mat4_mul_mat4_into(&m, &a, &b);
+    return m;
+}
+
+// a full 4x4 (a projection) after an affine transform, b's missing row is 0 0 0 1
+static inline void mat4_mul_mat3x4_into(mat4_t* restrict out, const mat4_t* restrict a, const mat3x4_t* restrict b) {
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 3; j++) {
+            out->m[i][j] = a->m[i][0] * b->m[0][j] + a->m[i][1] * b->m[1][j] + a->m[i][2] * b->m[2][j];
+        }
+        out->m[i][3] = a->m[i][0] * b->m[0][3] + a->m[i][1] * b->m[1][3] + a->m[i][2] * b->m[2][3] + a->m[i][3];
+    }
+}
+
+// a point (w = 1), the last column is added without a multiply
+static inline vec4_t mat4_mul_point(const mat4_t* restrict m, vec3_t p) {
+    vec4_t result;
+    result.x = m->m[0][0] * p.x + m->m[0][1] * p.y + m->m[0][2] * p.z + m->m[0][3];
+    result.y = m->m[1][0] * p.x + m->m[1][1] * p.y + m->m[1][2] * p.z + m->m[1][3];
+    result.z = m->m[2][0] * p.x + m->m[2][1] * p.y + m->m[2][2] * p.z + m->m[2][3];
+    result.w = m->m[3][0] * p.x + m->m[3][1] * p.y + m->m[3][2] * p.z + m->m[3][3];
+    return result;
+}
+
+// not a simple multiplication as we need to also do the perpspective divide
+static inline vec4_t perspective_divide(vec4_t result) {
+    // perform perspective divide with original z-value
+    if (result.w != 0.0) {
+        result.x /= result.w;
+        result.y /= result.w;
+        result.z /= result.w;
+    }
+    return result;
+}
+
+static inline vec4_t mat4_mul_vec4_project(mat4_t mat_proj, vec4_t v) {
+    return perspective_divide(mat4_mul_vec4(mat_proj, v));
+}
+
+static inline vec4_t mat4_mul_point_project(const mat4_t* restrict mat_proj, vec3_t p) {
+    return perspective_divide(mat4_mul_point(mat_proj, p));
+}
+
+static inline mat3x4_t mat3x4_from_mat4(const mat4_t* m) {
+    mat3x4_t result = {{
+        { m->m[0][0], m->m[0][1], m->m[0][2], m->m[0][3] },
+        { m->m[1][0], m->m[1][1], m->m[1][2], m->m[1][3] },
+        { m->m[2][0], m->m[2][1], m->m[2][2], m->m[2][3] }
+    }};
+    return result;
+}
+
+static inline mat4_t mat4_from_mat3x4(const mat3x4_t* m) {
+    mat4_t result = {{
+        { m->m[0][0], m->m[0][1], m->m[0][2], m->m[0][3] },
+        { m->m[1][0], m->m[1][1], m->m[1][2], m->m[1][3] },
+        { m->m[2][0], m->m[2][1], m->m[2][2], m->m[2][3] },
+        {          0,          0,          0,          1 }
+    }};
+    return result;
+}
+
+// 9 multiplies instead of the 16 of mat4_mul_vec4, w comes out as 1
+static inline vec4_t mat3x4_mul_point(const mat3x4_t* restrict m, vec3_t p) {
+    vec4_t result;
+    result.x = m->m[0][0] * p.x + m->m[0][1] * p.y + m->m[0][2] * p.z + m->m[0][3];
+    result.y = m->m[1][0] * p.x + m->m[1][1] * p.y + m->m[1][2] * p.z + m->m[1][3];
+    result.z = m->m[2][0] * p.x + m->m[2][1] * p.y + m->m[2][2] * p.z + m->m[2][3];
+    result.w = 1;
+    return result;
+}
+
+// directions (normals, axes) leave the translation column out
+static inline vec3_t mat3x4_mul_direction(const mat3x4_t* restrict m, vec3_t d) {
+    vec3_t result;
+    result.x = m->m[0][0] * d.x + m->m[0][1] * d.y + m->m[0][2] * d.z;
+    result.y = m->m[1][0] * d.x + m->m[1][1] * d.y + m->m[1][2] * d.z;
+    result.z = m->m[2][0] * d.x + m->m[2][1] * d.y + m->m[2][2] * d.z;
+    return result;
+}
+
+// composing two affine transforms is 36 multiplies instead of 64
+static inline void mat3x4_mul_mat3x4_into(mat3x4_t* restrict out, const mat3x4_t* restrict a, const mat3x4_t* restrict b) {
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            out->m[i][j] = a->m[i][0] * b->m[0][j] + a->m[i][1] * b->m[1][j] + a->m[i][2] * b->m[2][j];
+        }
+        out->m[i][3] = a->m[i][0] * b->m[0][3] + a->m[i][1] * b->m[1][3] + a->m[i][2] * b->m[2][3] + a->m[i][3];
+    }
+}
 
 #endif
@@ -1,11 +1,26 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 #include "mesh.h"
 #include "array.h"
+#include "profile.h"
 
-mesh_t mesh = {
+bool load_mesh_bvh = true;
+
+THREAD_LOCAL mesh_t mesh = {
 	.vertices = NULL,
 	.faces = NULL,
+	.normals = NULL,
+	.texcoords = NULL,
+	.face_normals = NULL,
+	.edges = NULL,
+	.face_edges = NULL,
+	.clusters = NULL,
+	.cluster_vertices = NULL,
+	.bvh = NULL,
+	.compressed = NULL,
+	.texture = NULL,
 	.rotation = { 0, 0, 0 },
 	.scale = { 1.0, 1.0, 1.0 },
 	.translation = {0, 0, 0 }
@@ -43,6 +58,115 @@ face_t cube_faces[N_CUBE_FACES] = {
 	{ .a = 6, .b = 1, .c = 4, .color= 0xFFFFFFFF },
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// Unit face normals, one per face, with the same winding as the backface test
+///////////////////////////////////////////////////////////////////////////////
+static vec3_t* make_face_normals(vec3_t* vertices, face_t* faces) {
+	vec3_t* face_normals = NULL;
+	int num_faces = array_length(faces);
+	for (int i = 0; i < num_faces; i++) {
+		vec3_t a = vertices[faces[i].a - 1];
+		vec3_t b = vertices[faces[i].b - 1];
+		vec3_t c = vertices[faces[i].c - 1];
+		vec3_t normal = vec3_cross(vec3_subtract(b, a), vec3_subtract(c, a));
+		// degenerate faces keep a zero normal instead of dividing by zero
+		if (vec3_length(normal) > 0) {
+			vec3_normalize(&normal);
+		}
+		array_push(face_normals, normal);
+	}
+	return face_normals;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Smooth vertex normals: area weighted average of the normals of the faces
+// that share the vertex (the unnormalized cross product is twice the area)
+///////////////////////////////////////////////////////////////////////////////
+static vec3_t* make_vertex_normals(vec3_t* vertices, face_t* faces) {
+	int num_vertices = array_length(vertices);
+	int num_faces = array_length(faces);
+	vec3_t* normals = array_hold(NULL, num_vertices, sizeof(vec3_t));
+	memset(normals, 0, sizeof(vec3_t) * num_vertices);
+
+	for (int i = 0; i < num_faces; i++) {
+		int indices[3] = { faces[i].a - 1, faces[i].b - 1, faces[i].c - 1 };
+		vec3_t a = vertices[indices[0]];
+		vec3_t b = vertices[indices[1]];
+		vec3_t c = vertices[indices[2]];
+		vec3_t normal = vec3_cross(vec3_subtract(b, a), vec3_subtract(c, a));
+		for (int j = 0; j < 3; j++) {
+			normals[indices[j]] = vec3_add(normals[indices[j]], normal);
+		}
+	}
+	for (int i = 0; i < num_vertices; i++) {
+		if (vec3_length(normals[i]) > 0) {
+			vec3_normalize(&normals[i]);
+		}
+	}
+	return normals;
+}
+
+typedef struct {
+	uint64_t key;	// the two vertex indices of the edge, smaller one first
+	int side;	// 3 * face index + side of the face
+} edge_sort_entry_t;
+
+static int compare_edge_sort_entries(const void* a, const void* b) {
+	uint64_t key_a = ((const edge_sort_entry_t*)a)->key;
+	uint64_t key_b = ((const edge_sort_entry_t*)b)->key;
+	return (key_a > key_b) - (key_a < key_b);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Find the unique edges of the faces, so wireframes can draw shared edges once
+// canonical_vertices maps every vertex to the first vertex at the same
+// position (NULL when no vertex is duplicated), so seams don't split edges
+// Returns the edge index of the three sides of every face
+///////////////////////////////////////////////////////////////////////////////
+static int* make_face_edges(face_t* faces, int* canonical_vertices, edge_t** edges) {
+	int num_faces = array_length(faces);
+	int* face_edges = array_hold(NULL, 3 * num_faces, sizeof(int));
+
+	edge_sort_entry_t* entries = (edge_sort_entry_t*) malloc(sizeof(edge_sort_entry_t) * 3 * num_faces);
+	for (int i = 0; i < num_faces; i++) {
+		int indices[3] = { faces[i].a - 1, faces[i].b - 1, faces[i].c - 1 };
+		for (int j = 0; j < 3; j++) {
+			uint64_t a = canonical_vertices ? canonical_vertices[indices[j]] : indices[j];
+			uint64_t b = canonical_vertices ? canonical_vertices[indices[(j + 1) % 3]] : indices[(j + 1) % 3];
+			entries[3 * i + j].key = (a < b) ? (a << 32) | b : (b << 32) | a;
+			entries[3 * i + j].side = 3 * i + j;
+		}
+	}
+	qsort(entries, 3 * num_faces, sizeof(edge_sort_entry_t), compare_edge_sort_entries);
+
+	// equal keys are next to each other after sorting
+	for (int i = 0; i < 3 * num_faces; i++) {
+		if (i == 0 || entries[i].key != entries[i - 1].key) {
+			edge_t edge = { .a = entries[i].key >> 32, .b = entries[i].key & 0xFFFFFFFF };
+			array_push(*edges, edge);
+		}
+		face_edges[entries[i].side] = array_length(*edges) - 1;
+	}
+
+	free(entries);
+	return face_edges;
+}
+
+// the model space bounding box of the mesh, tested as a whole before its clusters
+static void make_bounds(vec3_t* vertices, vec3_t* bounds_min, vec3_t* bounds_max) {
+	int num_vertices = array_length(vertices);
+	*bounds_min = *bounds_max = num_vertices > 0 ? vertices[0] : (vec3_t){ 0, 0, 0 };
+	for (int i = 1; i < num_vertices; i++) {
+		vec3_t v = vertices[i];
+		if (v.x < bounds_min->x) bounds_min->x = v.x;
+		if (v.y < bounds_min->y) bounds_min->y = v.y;
+		if (v.z < bounds_min->z) bounds_min->z = v.z;
+		if (v.x > bounds_max->x) bounds_max->x = v.x;
+		if (v.y > bounds_max->y) bounds_max->y = v.y;
+		if (v.z > bounds_max->z) bounds_max->z = v.z;
+	}
+}
+
 void load_cube_mesh_data(void) {
 	for (int i = 0; i < N_CUBE_VERTICES; i++) {
 		vec3_t cube_vertex = cube_vertices[i];
@@ -52,6 +176,60 @@ void load_cube_mesh_data(void) {
 		face_t cube_face = cube_faces[i];
 		array_push(mesh.faces, cube_face);
 	}
+	// the cube shares its corners between faces, so it has no useful uv mapping
+	mesh.texcoords = array_hold(NULL, N_CUBE_VERTICES, sizeof(tex2_t));
+	memset(mesh.texcoords, 0, sizeof(tex2_t) * N_CUBE_VERTICES);
+	mesh.clusters = build_clusters(mesh.vertices, mesh.faces);
+	mesh.cluster_vertices = build_cluster_vertex_lists(mesh.clusters, mesh.faces, array_length(mesh.vertices));
+	make_bounds(mesh.vertices, &mesh.bounds_min, &mesh.bounds_max);
+	mesh.bvh = build_bvh(mesh.vertices, mesh.faces);
+	mesh.normals = make_vertex_normals(mesh.vertices, mesh.faces);
+	mesh.face_normals = make_face_normals(mesh.vertices, mesh.faces);
+	mesh.face_edges = make_face_edges(mesh.faces, NULL, &mesh.edges);
+}
+
+// one face corner as written in the .obj file, indices are 1-based and 0 when missing
+typedef struct {
+	int position;
+	int texcoord;
+	int normal;
+} obj_corner_t;
+
+// every distinct position/texcoord/normal triple becomes one mesh vertex; the
+// variants of a position are chained so shared corners resolve to the same vertex
+typedef struct {
+	int texcoord;
+	int normal;
+	int next;
+} vertex_variant_t;
+
+///////////////////////////////////////////////////////////////////////////////
+// Parse a face corner in any of the "v", "v/vt", "v//vn" or "v/vt/vn" forms
+// Returns the position after the corner, or NULL when there is none left
+///////////////////////////////////////////////////////////////////////////////
+static char* parse_obj_corner(char* cursor, obj_corner_t* corner, int num_positions, int num_texcoords, int num_normals) {
+	char* end;
+	corner->position = strtol(cursor, &end, 10);
+	corner->texcoord = 0;
+	corner->normal = 0;
+	if (end == cursor) {
+		return NULL;
+	}
+	cursor = end;
+	if (*cursor == '/') {
+		// the texture coordinate index is empty in the "v//vn" form, which leaves it 0
+		corner->texcoord = strtol(cursor + 1, &end, 10);
+		cursor = end;
+		if (*cursor == '/') {
+			corner->normal = strtol(cursor + 1, &end, 10);
+			cursor = end;
+		}
+	}
+	// negative indices count backwards from the last element read so far
+	if (corner->position < 0) corner->position += num_positions + 1;
+	if (corner->texcoord < 0) corner->texcoord += num_texcoords + 1;
+	if (corner->normal < 0) corner->normal += num_normals + 1;
+	return cursor;
 }
 
 void load_obj_file_data(char* filename) {
@@ -59,39 +237,196 @@ void load_obj_file_data(char* filename) {
 	// Load vertices and faces in mesh.vertices and mesh.faces
 	FILE* file;
 	file = fopen(filename, "r");
+	if (!file) {
+		fprintf(stderr, "Error opening %s.\n", filename);
+		return;
+	}
+	PROFILE_BEGIN("load_obj_file_data");
+	PROFILE_BEGIN("parse obj");
+
+	vec3_t* positions = NULL;
+	vec3_t* file_normals = NULL;
+	tex2_t* file_texcoords = NULL;
+	obj_corner_t* corners = NULL; // three corners per triangle
 
 	char line[1024]; //max char per line for file
 
 	while (fgets(line, 1024, file)) {
-		//printf("LINE = %s", line);
-
 		//compare strings in C, for numchar
 		// vertex information
 		if (strncmp(line, "v ", 2) == 0) {
 			vec3_t vertex;
 			sscanf(line, "v %f %f %f", &vertex.x, &vertex.y, &vertex.z);
-			array_push(mesh.vertices, vertex);
+			array_push(positions, vertex);
+		}
+		// texture coordinate information, v is flipped so that v = 0 is the top row of the image
+		if (strncmp(line, "vt ", 3) == 0) {
+			tex2_t texcoord;
+			sscanf(line, "vt %f %f", &texcoord.u, &texcoord.v);
+			texcoord.v = 1 - texcoord.v;
+			array_push(file_texcoords, texcoord);
 		}
-		// face information
+		// vertex normal information
+		if (strncmp(line, "vn ", 3) == 0) {
+			vec3_t normal;
+			sscanf(line, "vn %f %f %f", &normal.x, &normal.y, &normal.z);
+			array_push(file_normals, normal);
+		}
+		// face information, polygons are split into a fan of triangles
 		if (strncmp(line, "f ", 2) == 0) {
-			int vertex_indices[3];
-			int texture_indices[3];
-			int normal_indices[3];
-
-			sscanf(
-				line, "f %d/%d/%d %d/%d/%d %d/%d/%d",
-				&vertex_indices[0], &texture_indices[0], &normal_indices[0],
-				&vertex_indices[1], &texture_indices[1], &normal_indices[1],
-				&vertex_indices[2], &texture_indices[2], &normal_indices[2]);
-			
-			face_t face = {
-				.a = vertex_indices[0],
-				.b = vertex_indices[1],
-				.c = vertex_indices[2],
-				.color = 0xFFFFFF
-			};
-
-			array_push(mesh.faces, face);
+			obj_corner_t polygon[64];
+			int num_corners = 0;
+			char* cursor = line + 2;
+			while (num_corners < 64 && (cursor = parse_obj_corner(cursor, &polygon[num_corners], array_length(positions), array_length(file_texcoords), array_length(file_normals)))) {
+				num_corners++;
+			}
+			for (int i = 1; i + 1 < num_corners; i++) {
+				array_push(corners, polygon[0]);
+				array_push(corners, polygon[i]);
+				array_push(corners, polygon[i + 1]);
+			}
 		}
 	}
-}
\ No newline at end of file
+	fclose(file);
+	PROFILE_END();
+
+	PROFILE_BEGIN("build vertices and faces");
+	int num_positions = array_length(positions);
+	int num_file_texcoords = array_length(file_texcoords);
+	int num_file_normals = array_length(file_normals);
+	int num_corners = array_length(corners);
+
+	// resolve every corner to a vertex, splitting positions that are used with different uvs or normals
+	int* first_variant = malloc(sizeof(int) * (num_positions + 1));
+	for (int i = 0; i <= num_positions; i++) {
+		first_variant[i] = -1;
+	}
+	vertex_variant_t* variants = NULL;
+	int* canonical_vertices = NULL; // first vertex made from the same position, parallel to mesh.vertices
+
+	for (int i = 0; i + 2 < num_corners; i += 3) {
+		int indices[3];
+		bool valid = true;
+		for (int j = 0; j < 3; j++) {
+			obj_corner_t corner = corners[i + j];
+			if (corner.position < 1 || corner.position > num_positions) {
+				valid = false;
+				break;
+			}
+			if (corner.texcoord < 1 || corner.texcoord > num_file_texcoords) {
+				corner.texcoord = 0;
+			}
+			if (corner.normal < 1 || corner.normal > num_file_normals) {
+				corner.normal = 0;
+			}
+
+			int variant = first_variant[corner.position];
+			while (variant != -1 && (variants[variant].texcoord != corner.texcoord || variants[variant].normal != corner.normal)) {
+				variant = variants[variant].next;
+			}
+			if (variant == -1) {
+				vertex_variant_t new_variant = { .texcoord = corner.texcoord, .normal = corner.normal, .next = first_variant[corner.position] };
+				tex2_t texcoord = { 0, 0 };
+				if (corner.texcoord != 0) {
+					texcoord = file_texcoords[corner.texcoord - 1];
+				}
+				int canonical = (first_variant[corner.position] == -1) ? array_length(variants) : canonical_vertices[first_variant[corner.position]];
+				array_push(variants, new_variant);
+				array_push(canonical_vertices, canonical);
+				array_push(mesh.vertices, positions[corner.position - 1]);
+				array_push(mesh.texcoords, texcoord);
+				variant = array_length(variants) - 1;
+				first_variant[corner.position] = variant;
+			}
+			indices[j] = variant + 1;
+		}
+		if (!valid) {
+			continue;
+		}
+
+		face_t face = {
+			.a = indices[0],
+			.b = indices[1],
+			.c = indices[2],
+			.color = 0xFFFFFF
+		};
+
+		array_push(mesh.faces, face);
+	}
+
+	// a file of positions alone is a point cloud (a lidar scan), its positions are the vertices
+	if (num_corners == 0 && num_positions > 0) {
+		mesh.vertices = positions;
+		positions = NULL;
+		mesh.texcoords = array_hold(NULL, num_positions, sizeof(tex2_t));
+		memset(mesh.texcoords, 0, sizeof(tex2_t) * num_positions);
+	}
+	PROFILE_END();
+
+	// group the faces into clusters that can be culled as a whole
+	PROFILE_BEGIN("build clusters");
+	mesh.clusters = build_clusters(mesh.vertices, mesh.faces);
+	mesh.cluster_vertices = build_cluster_vertex_lists(mesh.clusters, mesh.faces, array_length(mesh.vertices));
+	make_bounds(mesh.vertices, &mesh.bounds_min, &mesh.bounds_max);
+	PROFILE_END();
+
+	if (load_mesh_bvh) {
+		PROFILE_BEGIN("build bvh");
+		mesh.bvh = build_bvh(mesh.vertices, mesh.faces);
+		PROFILE_END();
+	}
+
+	// normals from the file win, the rest are averaged from the faces around the vertex
+	PROFILE_BEGIN("normals and edges");
+	mesh.normals = make_vertex_normals(mesh.vertices, mesh.faces);
+	int num_variants = array_length(variants);
+	for (int i = 0; i < num_variants; i++) {
+		if (variants[i].normal == 0) {
+			continue;
+		}
+		vec3_t file_normal = file_normals[variants[i].normal - 1];
+		if (vec3_length(file_normal) > 0) {
+			vec3_normalize(&file_normal);
+			mesh.normals[i] = file_normal;
+		}
+	}
+	mesh.face_normals = make_face_normals(mesh.vertices, mesh.faces);
+	mesh.face_edges = make_face_edges(mesh.faces, canonical_vertices, &mesh.edges);
+	PROFILE_END();
+
+	free(first_variant);
+	array_free(canonical_vertices);
+	array_free(variants);
+	array_free(corners);
+	array_free(file_normals);
+	array_free(file_texcoords);
+	array_free(positions);
+	PROFILE_END();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build the compressed copy of the loaded mesh the first time the vertex stage
+// is asked to read it; with free_floats the float vertex and face normals it
+// stands in for are freed, the positions and faces stay since the counts, the
+// texture coordinates and the ray caster go by them
+///////////////////////////////////////////////////////////////////////////////
+void compress_loaded_mesh(bool free_floats) {
+	if (mesh.compressed == NULL) {
+		PROFILE_BEGIN("compress mesh");
+		mesh.compressed = compress_mesh(mesh.vertices, mesh.normals, mesh.faces, mesh.face_normals,
+			mesh.clusters, mesh.cluster_vertices, mesh.bounds_min, mesh.bounds_max);
+		PROFILE_END();
+	}
+	// a mesh with too many colors stays uncompressed and keeps its floats
+	if (free_floats && mesh.compressed) {
+		array_free(mesh.normals);
+		array_free(mesh.face_normals);
+		mesh.normals = mesh.face_normals = NULL;
+	}
+}
+
+// bytes of the float arrays the compressed mesh stands in for that are still allocated
+size_t vertex_stage_float_bytes(void) {
+	return sizeof(vec3_t) * (array_length(mesh.vertices) + array_length(mesh.normals) + array_length(mesh.face_normals)) +
+		sizeof(face_t) * array_length(mesh.faces);
+}
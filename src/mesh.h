@@ -1,8 +1,15 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include <stddef.h>
+#include <stdbool.h>
 #include "vector.h"
 #include "triangle.h"
+#include "cluster.h"
+#include "bvh.h"
+#include "compress.h"
+#include "texture.h"
+#include "thread_local.h"
 
 #define N_CUBE_VERTICES 8
 #define N_CUBE_FACES (6*2) //6 cube faces, 2 triangles per face
@@ -12,20 +19,45 @@ extern vec3_t cube_vertices[N_CUBE_VERTICES];
 // the numbers are indices of points from array of cube vertices
 extern face_t cube_faces[N_CUBE_FACES];
 
+// an edge between two vertices, shared by the faces on both of its sides
+typedef struct {
+	int a;
+	int b;
+} edge_t;
+
 // Define a struct for dynamic size meshes, with array of vertices and faces
 
 typedef struct {
 	vec3_t* vertices; //dynamic array of vertices
+	vec3_t* normals;	//dynamic array of unit vertex normals, parallel to vertices
+	tex2_t* texcoords;	//dynamic array of uv coordinates, parallel to vertices
 	face_t* faces; 	   //dynamic array of faces
+	vec3_t* face_normals;	//dynamic array of unit face normals, parallel to faces
+	edge_t* edges;		//dynamic array of unique edges, vertices split at uv/normal seams count once
+	int* face_edges;	//three edge indices per face, for the sides ab, bc and ca
+	cluster_t* clusters;	//dynamic array of face clusters, built after loading
+	int* cluster_vertices;	//vertex indices used by each cluster, see cluster_t
+	bvh_t* bvh;		//hierarchy over the faces for the ray cast render mode and picking
+	compressed_mesh_t* compressed;	//quantized copy of what the vertex stage reads, see use_compressed_mesh
+	texture_t* texture;	//texture sampled with the uv coordinates, NULL when untextured
+	vec3_t bounds_min;	//model space bounding box of the vertices
+	vec3_t bounds_max;
 	vec3_t rotation;	//rotation with x, y, and z values (Euler angles)
 	vec4_t scale;		//scale with x, y, z values
 	vec3_t translation;		//translate
 } mesh_t;
 
-extern mesh_t mesh;
+// the arrays are shared, a render thread starts from a shallow copy of the loaded mesh
+extern THREAD_LOCAL mesh_t mesh;
+
+// whether load_obj_file_data() builds the hierarchy, only the ray caster and picking use it
+extern bool load_mesh_bvh;
 
 void load_cube_mesh_data(void);
 
 void load_obj_file_data(char* filename);
 
+void compress_loaded_mesh(bool free_floats);
+size_t vertex_stage_float_bytes(void);
+
 #endif
\ No newline at end of file
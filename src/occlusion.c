@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+#include "occlusion.h"
+#include "display.h"
+#include "thread_local.h"
+
+bool occlusion_culling = true;
+
+// the pyramid layout and the projection are the same for every thread
+static int num_levels = 0;
+static int level_width[OCCLUSION_MAX_LEVELS];
+static int level_height[OCCLUSION_MAX_LEVELS];
+static int level_offset[OCCLUSION_MAX_LEVELS];
+static int total_cells = 0;
+static float projection_scale_x;
+static float projection_scale_y;
+static float near_z;
+
+// every level of the pyramid one after the other, the finest first; a cell holds
+// the farthest view space depth of what covers it (FLT_MAX when nothing does)
+static THREAD_LOCAL float* occlusion_depths = NULL;
+
+///////////////////////////////////////////////////////////////////////////////
+// Hierarchical-Z occlusion culling
+// The nearest clusters are drawn into a low resolution depth buffer, its cells
+// are merged 2x2 into coarser levels keeping the farthest depth, then a bounding
+// volume is hidden when its nearest point is behind every cell of the level
+// where its screen rectangle spans at most 2x2 cells
+///////////////////////////////////////////////////////////////////////////////
+void init_occlusion_culling(mat4_t proj_matrix, float z_near) {
+	projection_scale_x = proj_matrix.m[0][0];
+	projection_scale_y = proj_matrix.m[1][1];
+	near_z = z_near;
+
+	int cell_size = 1 << OCCLUSION_CELL_SHIFT;
+	int width = (window_width + cell_size - 1) / cell_size;
+	int height = (window_height + cell_size - 1) / cell_size;
+	num_levels = 0;
+	total_cells = 0;
+	while (num_levels < OCCLUSION_MAX_LEVELS) {
+		level_width[num_levels] = width;
+		level_height[num_levels] = height;
+		level_offset[num_levels] = total_cells;
+		total_cells += width * height;
+		num_levels++;
+		if (width == 1 && height == 1) {
+			break;
+		}
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+	}
+}
+
+void allocate_occlusion_buffer(void) {
+	occlusion_depths = (float*) malloc(sizeof(float) * total_cells);
+}
+
+void free_occlusion_buffer(void) {
+	free(occlusion_depths);
+	occlusion_depths = NULL;
+}
+
+void clear_occlusion_buffer(void) {
+	for (int i = 0; i < level_width[0] * level_height[0]; i++) {
+		occlusion_depths[i] = FLT_MAX;
+	}
+}
+
+// twice the signed area of abp, positive when p is on the inner side of ab
+static float edge_function(vec4_t a, vec4_t b, float px, float py) {
+	return (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw a projected triangle into the finest level, depth is the farthest view
+// space z of its vertices; a cell is covered when its center is inside, which
+// (unlike requiring all four corners) leaves no gaps along the shared edges of
+// a surface, the tests make up for the half cell it can overshoot at silhouettes
+///////////////////////////////////////////////////////////////////////////////
+void draw_occluder_triangle(vec4_t a, vec4_t b, vec4_t c, float depth) {
+	float area = edge_function(a, b, c.x, c.y);
+	if (area == 0) {
+		return;
+	}
+	if (area < 0) {
+		vec4_t temp = b;
+		b = c;
+		c = temp;
+	}
+
+	float cell_size = 1 << OCCLUSION_CELL_SHIFT;
+	float min_x = fmin(a.x, fmin(b.x, c.x));
+	float min_y = fmin(a.y, fmin(b.y, c.y));
+	float max_x = fmax(a.x, fmax(b.x, c.x));
+	float max_y = fmax(a.y, fmax(b.y, c.y));
+
+	// the cells whose center is inside the bounding box
+	int x_start = (int)fmax(ceil(min_x / cell_size - 0.5), 0);
+	int y_start = (int)fmax(ceil(min_y / cell_size - 0.5), 0);
+	int x_end = (int)fmin(floor(max_x / cell_size - 0.5), level_width[0] - 1);
+	int y_end = (int)fmin(floor(max_y / cell_size - 0.5), level_height[0] - 1);
+
+	for (int y = y_start; y <= y_end; y++) {
+		float center_y = (y + 0.5) * cell_size;
+		for (int x = x_start; x <= x_end; x++) {
+			float center_x = (x + 0.5) * cell_size;
+			bool covered =
+				edge_function(a, b, center_x, center_y) >= 0 &&
+				edge_function(b, c, center_x, center_y) >= 0 &&
+				edge_function(c, a, center_x, center_y) >= 0;
+
+			float* cell = &occlusion_depths[y * level_width[0] + x];
+			if (covered && depth < *cell) {
+				*cell = depth;
+			}
+		}
+	}
+}
+
+void build_occlusion_pyramid(void) {
+	for (int level = 1; level < num_levels; level++) {
+		const float* fine = &occlusion_depths[level_offset[level - 1]];
+		float* coarse = &occlusion_depths[level_offset[level]];
+		int fine_width = level_width[level - 1];
+		int fine_height = level_height[level - 1];
+
+		for (int y = 0; y < level_height[level]; y++) {
+			int y0 = 2 * y;
+			int y1 = y0 + 1 < fine_height ? y0 + 1 : y0;
+			for (int x = 0; x < level_width[level]; x++) {
+				int x0 = 2 * x;
+				int x1 = x0 + 1 < fine_width ? x0 + 1 : x0;
+				float farthest = fmax(
+					fmax(fine[y0 * fine_width + x0], fine[y0 * fine_width + x1]),
+					fmax(fine[y1 * fine_width + x0], fine[y1 * fine_width + x1]));
+				coarse[y * level_width[level] + x] = farthest;
+			}
+		}
+	}
+}
+
+// whether a rectangle in normalized device coordinates, all of it at least nearest_depth
+// away, is behind the pyramid
+static bool rect_occluded(float min_x, float min_y, float max_x, float max_y, float nearest_depth) {
+	// to pixels, y grows downwards on screen, then to cells of the finest level
+	float cell_size = 1 << OCCLUSION_CELL_SHIFT;
+	float left = (min_x + 1) * (window_width / 2.0) / cell_size;
+	float right = (max_x + 1) * (window_width / 2.0) / cell_size;
+	float top = (1 - max_y) * (window_height / 2.0) / cell_size;
+	float bottom = (1 - min_y) * (window_height / 2.0) / cell_size;
+
+	// outside of the screen is the frustum test's job
+	if (right < 0 || bottom < 0 || left >= level_width[0] || top >= level_height[0]) {
+		return false;
+	}
+	// one more cell on every side, the occluders can overshoot their silhouette by half a cell
+	int x0 = (int)fmax(left - 1, 0);
+	int y0 = (int)fmax(top - 1, 0);
+	int x1 = (int)fmin(right + 1, level_width[0] - 1);
+	int y1 = (int)fmin(bottom + 1, level_height[0] - 1);
+
+	// climb until the rectangle spans at most 2x2 cells
+	int level = 0;
+	while (level < num_levels - 1 && (x1 - x0 > 1 || y1 - y0 > 1)) {
+		x0 >>= 1;
+		y0 >>= 1;
+		x1 >>= 1;
+		y1 >>= 1;
+		level++;
+	}
+
+	const float* depths = &occlusion_depths[level_offset[level]];
+	for (int y = y0; y <= y1; y++) {
+		for (int x = x0; x <= x1; x++) {
+			if (depths[y * level_width[level] + x] >= nearest_depth) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test a view space bounding sphere, its screen rectangle is the projection of
+// the box around it; spheres reaching the near plane are always visible
+///////////////////////////////////////////////////////////////////////////////
+bool sphere_occluded(vec3_t center, float radius) {
+	float nearest_depth = center.z - radius;
+	float farthest_depth = center.z + radius;
+	if (nearest_depth <= near_z) {
+		return false;
+	}
+
+	// each side of the box projects widest from the depth closest to the camera
+	// when it is on the positive side of the axis, and from the farthest otherwise
+	float max_x = center.x + radius, min_x = center.x - radius;
+	float max_y = center.y + radius, min_y = center.y - radius;
+	max_x = projection_scale_x * max_x / (max_x > 0 ? nearest_depth : farthest_depth);
+	min_x = projection_scale_x * min_x / (min_x < 0 ? nearest_depth : farthest_depth);
+	max_y = projection_scale_y * max_y / (max_y > 0 ? nearest_depth : farthest_depth);
+	min_y = projection_scale_y * min_y / (min_y < 0 ? nearest_depth : farthest_depth);
+
+	return rect_occluded(min_x, min_y, max_x, max_y, nearest_depth);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test a model space bounding box, the corners are moved into view space and
+// projected; boxes reaching the near plane are always visible
+///////////////////////////////////////////////////////////////////////////////
+bool box_occluded(vec3_t box_min, vec3_t box_max, const mat3x4_t* model_view_matrix) {
+	float min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+	float nearest_depth = FLT_MAX;
+
+	for (int i = 0; i < 8; i++) {
+		vec3_t corner = {
+			(i & 1) ? box_max.x : box_min.x,
+			(i & 2) ? box_max.y : box_min.y,
+			(i & 4) ? box_max.z : box_min.z
+		};
+		vec4_t view_corner = mat3x4_mul_point(model_view_matrix, corner);
+		if (view_corner.z <= near_z) {
+			return false;
+		}
+		float x = projection_scale_x * view_corner.x / view_corner.z;
+		float y = projection_scale_y * view_corner.y / view_corner.z;
+		min_x = fmin(min_x, x);
+		min_y = fmin(min_y, y);
+		max_x = fmax(max_x, x);
+		max_y = fmax(max_y, y);
+		nearest_depth = fmin(nearest_depth, view_corner.z);
+	}
+
+	return rect_occluded(min_x, min_y, max_x, max_y, nearest_depth);
+}
@@ -0,0 +1,26 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <stdbool.h>
+#include "vector.h"
+#include "matrix.h"
+
+// the finest level of the depth pyramid has one cell per 8x8 pixels
+#define OCCLUSION_CELL_SHIFT 3
+#define OCCLUSION_MAX_LEVELS 16
+
+// most clusters drawn into the pyramid each frame, the nearest ones are picked
+#define OCCLUSION_MAX_OCCLUDERS 16
+
+extern bool occlusion_culling;
+
+void init_occlusion_culling(mat4_t proj_matrix, float z_near);
+void allocate_occlusion_buffer(void);
+void free_occlusion_buffer(void);
+void clear_occlusion_buffer(void);
+void draw_occluder_triangle(vec4_t a, vec4_t b, vec4_t c, float depth);
+void build_occlusion_pyramid(void);
+bool sphere_occluded(vec3_t center, float radius);
+bool box_occluded(vec3_t box_min, vec3_t box_max, const mat3x4_t* model_view_matrix);
+
+#endif
@@ -0,0 +1,362 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <float.h>
+#include <SDL2/SDL.h>
+#include "points.h"
+#include "array.h"
+#include "mesh.h"
+#include "stream.h"
+#include "light.h"
+#include "display.h"
+#include "stats.h"
+#include "profile.h"
+#include "thread_local.h"
+
+bool points_use_thread_pool = true;
+
+// the pixel a point lands on and its view space depth
+typedef struct {
+	uint16_t x;
+	uint16_t y;
+	float depth;
+} projected_point_t;
+
+// points off screen or behind the camera are marked with this y
+#define POINT_CLIPPED 0xFFFF
+
+enum point_phase {
+	PHASE_PROJECT,	// project the chunks and count their points per band
+	PHASE_BIN,	// copy the points of every chunk into the bins of their bands
+	PHASE_SPLAT	// clear the depth of a band and splat its bin
+};
+
+// everything the threads need to draw a frame of points, the thread locals of
+// the thread that asked for it aren't visible to the others so they are copied here
+typedef struct {
+	enum point_phase phase;
+	const vec3_t* points;
+	int num_points;
+	mat4_t matrix;
+	int width;
+	int height;
+	uint32_t* pixels;
+	float* depths;
+	projected_point_t* projected;	// parallel to points
+	projected_point_t* binned;	// the points of every band one after the other, by band
+	int* bin_offsets;		// where the points of each chunk go in each band, num_chunks * num_bands
+	int* band_starts;		// num_bands + 1
+	int num_chunks;
+	int num_bands;
+	float near_depth;	// the depth cue fades from the nearest to the farthest corner of the bounds
+	float inverse_depth_range;
+	SDL_atomic_t next_item;
+	SDL_atomic_t points_projected;
+} points_job_t;
+
+// scratch space of the calling thread, grown to the largest frame drawn so far
+static THREAD_LOCAL float* depth_buffer = NULL;
+static THREAD_LOCAL int depth_buffer_size = 0;
+static THREAD_LOCAL projected_point_t* projected_points = NULL;
+static THREAD_LOCAL int projected_capacity = 0;
+static THREAD_LOCAL projected_point_t* binned_points = NULL;
+static THREAD_LOCAL int binned_capacity = 0;
+static THREAD_LOCAL int* bin_offsets = NULL;
+static THREAD_LOCAL int bin_offsets_capacity = 0;
+static THREAD_LOCAL int* band_starts = NULL;
+static THREAD_LOCAL int band_starts_capacity = 0;
+
+// persistent workers, the thread that calls render_points() works through the phases too
+static SDL_Thread** pool_threads = NULL;
+static int num_pool_threads = 0;
+static SDL_sem* work_ready = NULL;
+static SDL_sem* work_done = NULL;
+static points_job_t* pool_job = NULL;
+static bool pool_quit = false;
+
+static void* reserve(void* buffer, int* capacity, int count, int item_size) {
+	if (count <= *capacity) {
+		return buffer;
+	}
+	*capacity = count;
+	return realloc(buffer, (size_t)item_size * count);
+}
+
+void free_point_buffers(void) {
+	free(depth_buffer);
+	free(projected_points);
+	free(binned_points);
+	free(bin_offsets);
+	free(band_starts);
+	depth_buffer = NULL;
+	projected_points = binned_points = NULL;
+	bin_offsets = band_starts = NULL;
+	depth_buffer_size = projected_capacity = binned_capacity = bin_offsets_capacity = band_starts_capacity = 0;
+}
+
+// the bands the rows of a splat touch, a splat is never taller than a band so it's at most two
+static void point_bands(const points_job_t* job, int y, int* first_band, int* last_band) {
+	int top = y - POINT_SPLAT_RADIUS > 0 ? y - POINT_SPLAT_RADIUS : 0;
+	int bottom = y + POINT_SPLAT_RADIUS < job->height - 1 ? y + POINT_SPLAT_RADIUS : job->height - 1;
+	*first_band = top / POINT_BAND_HEIGHT;
+	*last_band = bottom / POINT_BAND_HEIGHT;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Project every point of a chunk once, only the x, y and w rows of the matrix
+// are needed; w is the view space depth under a perspective projection
+///////////////////////////////////////////////////////////////////////////////
+static void project_chunk(points_job_t* job, int chunk) {
+	int start = chunk * POINT_CHUNK_SIZE;
+	int end = start + POINT_CHUNK_SIZE < job->num_points ? start + POINT_CHUNK_SIZE : job->num_points;
+	const float (*m)[4] = job->matrix.m;
+	float half_width = job->width * 0.5f;
+	float half_height = job->height * 0.5f;
+	int* counts = &job->bin_offsets[chunk * job->num_bands];
+	for (int b = 0; b < job->num_bands; b++) {
+		counts[b] = 0;
+	}
+
+	int projected = 0;
+	for (int i = start; i < end; i++) {
+		vec3_t p = job->points[i];
+		float x = m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3];
+		float y = m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3];
+		float w = m[3][0] * p.x + m[3][1] * p.y + m[3][2] * p.z + m[3][3];
+		job->projected[i].y = POINT_CLIPPED;
+		if (!(w > 0)) {
+			continue;
+		}
+		float inverse_w = 1.0f / w;
+		float screen_x = x * inverse_w * half_width + half_width;
+		float screen_y = -y * inverse_w * half_height + half_height;
+		if (!(screen_x >= 0 && screen_x < job->width && screen_y >= 0 && screen_y < job->height)) {
+			continue;
+		}
+		int px = (int)screen_x;
+		int py = (int)screen_y;
+		job->projected[i] = (projected_point_t){ (uint16_t)px, (uint16_t)py, w };
+		int first_band, last_band;
+		point_bands(job, py, &first_band, &last_band);
+		counts[first_band]++;
+		if (last_band != first_band) {
+			counts[last_band]++;
+		}
+		projected++;
+	}
+	SDL_AtomicAdd(&job->points_projected, projected);
+}
+
+// the bins hold the points in the order of the mesh whatever the number of threads
+static void bin_chunk(points_job_t* job, int chunk) {
+	int start = chunk * POINT_CHUNK_SIZE;
+	int end = start + POINT_CHUNK_SIZE < job->num_points ? start + POINT_CHUNK_SIZE : job->num_points;
+	int* offsets = &job->bin_offsets[chunk * job->num_bands];
+	for (int i = start; i < end; i++) {
+		projected_point_t point = job->projected[i];
+		if (point.y == POINT_CLIPPED) {
+			continue;
+		}
+		int first_band, last_band;
+		point_bands(job, point.y, &first_band, &last_band);
+		job->binned[offsets[first_band]++] = point;
+		if (last_band != first_band) {
+			job->binned[offsets[last_band]++] = point;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Splat the points of a band with spans clipped to the band and the screen,
+// the nearest point wins each pixel; no other thread writes to these rows
+///////////////////////////////////////////////////////////////////////////////
+static void splat_band(points_job_t* job, int band) {
+	int band_top = band * POINT_BAND_HEIGHT;
+	int band_bottom = band_top + POINT_BAND_HEIGHT < job->height ? band_top + POINT_BAND_HEIGHT : job->height;
+	float* depths = job->depths;
+	uint32_t* pixels = job->pixels;
+	int width = job->width;
+
+	for (int i = band_top * width; i < band_bottom * width; i++) {
+		depths[i] = FLT_MAX;
+	}
+
+	for (int i = job->band_starts[band]; i < job->band_starts[band + 1]; i++) {
+		projected_point_t point = job->binned[i];
+		float fade = (point.depth - job->near_depth) * job->inverse_depth_range;
+		float intensity = 1 - 0.75f * (fade < 0 ? 0 : (fade > 1 ? 1 : fade));
+		uint32_t color = light_apply_intensity(0xFFFFFFFF, intensity);
+
+		int x0 = point.x - POINT_SPLAT_RADIUS > 0 ? point.x - POINT_SPLAT_RADIUS : 0;
+		int x1 = point.x + POINT_SPLAT_RADIUS < width - 1 ? point.x + POINT_SPLAT_RADIUS : width - 1;
+		int y0 = point.y - POINT_SPLAT_RADIUS > band_top ? point.y - POINT_SPLAT_RADIUS : band_top;
+		int y1 = point.y + POINT_SPLAT_RADIUS < band_bottom - 1 ? point.y + POINT_SPLAT_RADIUS : band_bottom - 1;
+		for (int y = y0; y <= y1; y++) {
+			float* depth_row = &depths[y * width];
+			uint32_t* pixel_row = &pixels[y * width];
+			for (int x = x0; x <= x1; x++) {
+				if (point.depth < depth_row[x]) {
+					depth_row[x] = point.depth;
+					pixel_row[x] = color;
+				}
+			}
+		}
+	}
+}
+
+// claim chunks or bands of the current phase until there are none left
+static void run_phase(points_job_t* job) {
+	int num_items = job->phase == PHASE_SPLAT ? job->num_bands : job->num_chunks;
+	while (true) {
+		int item = SDL_AtomicAdd(&job->next_item, 1);
+		if (item >= num_items) {
+			break;
+		}
+		if (job->phase == PHASE_PROJECT) {
+			project_chunk(job, item);
+		} else if (job->phase == PHASE_BIN) {
+			bin_chunk(job, item);
+		} else {
+			splat_band(job, item);
+		}
+	}
+}
+
+static int points_worker(void* data) {
+	(void)data;
+	profile_set_thread_name("points worker");
+	while (true) {
+		SDL_SemWait(work_ready);
+		if (pool_quit) {
+			break;
+		}
+		run_phase(pool_job);
+		SDL_SemPost(work_done);
+	}
+	return 0;
+}
+
+// one worker less than there are cores, the thread that hands out the work is the last one
+static void start_thread_pool(void) {
+	work_ready = SDL_CreateSemaphore(0);
+	work_done = SDL_CreateSemaphore(0);
+	num_pool_threads = SDL_GetCPUCount() - 1;
+	num_pool_threads = num_pool_threads > 0 ? num_pool_threads : 0;
+	pool_threads = (SDL_Thread**) malloc(sizeof(SDL_Thread*) * (num_pool_threads > 0 ? num_pool_threads : 1));
+	for (int i = 0; i < num_pool_threads; i++) {
+		pool_threads[i] = SDL_CreateThread(points_worker, "points", NULL);
+	}
+}
+
+void points_shutdown_thread_pool(void) {
+	if (pool_threads == NULL) {
+		return;
+	}
+	pool_quit = true;
+	for (int i = 0; i < num_pool_threads; i++) {
+		SDL_SemPost(work_ready);
+	}
+	for (int i = 0; i < num_pool_threads; i++) {
+		SDL_WaitThread(pool_threads[i], NULL);
+	}
+	free(pool_threads);
+	pool_threads = NULL;
+	SDL_DestroySemaphore(work_ready);
+	SDL_DestroySemaphore(work_done);
+	pool_quit = false;
+}
+
+static void run_phase_on_pool(points_job_t* job, enum point_phase phase) {
+	job->phase = phase;
+	SDL_AtomicSet(&job->next_item, 0);
+	int num_helpers = points_use_thread_pool ? num_pool_threads : 0;
+	pool_job = job;
+	for (int i = 0; i < num_helpers; i++) {
+		SDL_SemPost(work_ready);
+	}
+	run_phase(job);
+	for (int i = 0; i < num_helpers; i++) {
+		SDL_SemWait(work_done);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw every vertex of the mesh as a depth tested splat
+// The vertices are projected once, in chunks spread over the threads, and
+// counted per band of rows; the counts give each chunk its place in the bin of
+// every band, so the points are copied into the bins without any locking,
+// then each band is splatted by one thread. Points with no faces at all, like
+// a lidar scan, are drawn the same way
+///////////////////////////////////////////////////////////////////////////////
+void render_points(const mat4_t* world_view_projection_matrix) {
+	int num_points = array_length(mesh.vertices);
+	frame_stats.points_drawn = 0;
+	// the vertices of a paged mesh are spread over its pages, only some of them resident
+	if (num_points == 0 || stream_is_open()) {
+		return;
+	}
+	PROFILE_BEGIN("render_points");
+
+	int num_pixels = window_width * window_height;
+	depth_buffer = (float*) reserve(depth_buffer, &depth_buffer_size, num_pixels, sizeof(float));
+	projected_points = (projected_point_t*) reserve(projected_points, &projected_capacity, num_points, sizeof(projected_point_t));
+
+	points_job_t job = {
+		.points = mesh.vertices,
+		.num_points = num_points,
+		.matrix = *world_view_projection_matrix,
+		.width = window_width,
+		.height = window_height,
+		.pixels = color_buffer,
+		.depths = depth_buffer,
+		.projected = projected_points,
+		.num_chunks = (num_points + POINT_CHUNK_SIZE - 1) / POINT_CHUNK_SIZE,
+		.num_bands = (window_height + POINT_BAND_HEIGHT - 1) / POINT_BAND_HEIGHT
+	};
+	SDL_AtomicSet(&job.points_projected, 0);
+	bin_offsets = (int*) reserve(bin_offsets, &bin_offsets_capacity, job.num_chunks * job.num_bands, sizeof(int));
+	band_starts = (int*) reserve(band_starts, &band_starts_capacity, job.num_bands + 1, sizeof(int));
+	job.bin_offsets = bin_offsets;
+	job.band_starts = band_starts;
+
+	// the depth cue spans the bounds of the mesh
+	const float (*m)[4] = job.matrix.m;
+	float near_depth = FLT_MAX, far_depth = -FLT_MAX;
+	for (int corner = 0; corner < 8; corner++) {
+		vec3_t p = {
+			corner & 1 ? mesh.bounds_max.x : mesh.bounds_min.x,
+			corner & 2 ? mesh.bounds_max.y : mesh.bounds_min.y,
+			corner & 4 ? mesh.bounds_max.z : mesh.bounds_min.z
+		};
+		float w = m[3][0] * p.x + m[3][1] * p.y + m[3][2] * p.z + m[3][3];
+		near_depth = w < near_depth ? w : near_depth;
+		far_depth = w > far_depth ? w : far_depth;
+	}
+	job.near_depth = near_depth;
+	job.inverse_depth_range = far_depth > near_depth ? 1.0f / (far_depth - near_depth) : 0;
+
+	if (points_use_thread_pool && pool_threads == NULL) {
+		start_thread_pool();
+	}
+
+	run_phase_on_pool(&job, PHASE_PROJECT);
+
+	// turn the counts into offsets, band by band and chunk by chunk within a band
+	int total = 0;
+	for (int b = 0; b < job.num_bands; b++) {
+		band_starts[b] = total;
+		for (int c = 0; c < job.num_chunks; c++) {
+			int count = bin_offsets[c * job.num_bands + b];
+			bin_offsets[c * job.num_bands + b] = total;
+			total += count;
+		}
+	}
+	band_starts[job.num_bands] = total;
+	binned_points = (projected_point_t*) reserve(binned_points, &binned_capacity, total > 0 ? total : 1, sizeof(projected_point_t));
+	job.binned = binned_points;
+
+	run_phase_on_pool(&job, PHASE_BIN);
+	run_phase_on_pool(&job, PHASE_SPLAT);
+
+	frame_stats.points_drawn = SDL_AtomicGet(&job.points_projected);
+	PROFILE_END();
+}
@@ -0,0 +1,21 @@
+#ifndef POINTS_H
+#define POINTS_H
+
+#include <stdbool.h>
+#include "matrix.h"
+
+// every point is a square splat of 2 * POINT_SPLAT_RADIUS + 1 pixels on a side
+#define POINT_SPLAT_RADIUS 1
+// the screen is split into bands of rows that the render threads splat one at a time
+#define POINT_BAND_HEIGHT 32
+// points are projected and binned in chunks of this many
+#define POINT_CHUNK_SIZE 65536
+
+// false draws every point on the calling thread, the turntable already runs a thread per frame
+extern bool points_use_thread_pool;
+
+void render_points(const mat4_t* world_view_projection_matrix);
+void free_point_buffers(void);
+void points_shutdown_thread_pool(void);
+
+#endif
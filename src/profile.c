@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "profile.h"
+#include "thread_local.h"
+
+typedef struct {
+	const char* name;
+	uint64_t start;		// performance counter ticks
+	uint64_t duration;
+} profile_event_t;
+
+// only the owning thread writes a ring, the count of events ever written is
+// published with an atomic store after the event so a reader never sees a
+// half written entry (it can still lose events the writer laps meanwhile)
+typedef struct {
+	const char* thread_name;
+	SDL_atomic_t num_events;
+	profile_event_t events[PROFILE_RING_SIZE];
+} profile_ring_t;
+
+static profile_ring_t* profile_rings[PROFILE_MAX_THREADS];
+static SDL_atomic_t profile_num_rings;
+
+static THREAD_LOCAL profile_ring_t* thread_ring = NULL;
+static THREAD_LOCAL bool thread_ring_unavailable = false;
+static THREAD_LOCAL uint64_t open_starts[PROFILE_MAX_DEPTH];
+static THREAD_LOCAL const char* open_names[PROFILE_MAX_DEPTH];
+static THREAD_LOCAL int open_depth = 0;
+
+// the ring of the calling thread, registered on first use without a lock,
+// rings outlive their thread so the events of finished workers can be exported
+static profile_ring_t* get_thread_ring(void) {
+	if (thread_ring || thread_ring_unavailable) {
+		return thread_ring;
+	}
+	int index = SDL_AtomicAdd(&profile_num_rings, 1);
+	if (index >= PROFILE_MAX_THREADS) {
+		thread_ring_unavailable = true;
+		return NULL;
+	}
+	profile_ring_t* ring = (profile_ring_t*) calloc(1, sizeof(profile_ring_t));
+	thread_ring_unavailable = !ring;
+	thread_ring = ring;
+	SDL_MemoryBarrierRelease();
+	profile_rings[index] = ring;
+	return ring;
+}
+
+void profile_set_thread_name(const char* name) {
+	profile_ring_t* ring = get_thread_ring();
+	if (ring) {
+		ring->thread_name = name;
+	}
+}
+
+void profile_begin(const char* name) {
+	if (open_depth < PROFILE_MAX_DEPTH) {
+		open_names[open_depth] = name;
+		open_starts[open_depth] = SDL_GetPerformanceCounter();
+	}
+	open_depth++;
+}
+
+void profile_end(void) {
+	uint64_t end = SDL_GetPerformanceCounter();
+	open_depth--;
+	if (open_depth < 0) {
+		open_depth = 0;
+		return;
+	}
+	if (open_depth >= PROFILE_MAX_DEPTH) {
+		return;
+	}
+
+	profile_ring_t* ring = get_thread_ring();
+	if (!ring) {
+		return;
+	}
+	int count = SDL_AtomicGet(&ring->num_events);
+	profile_event_t* event = &ring->events[count & (PROFILE_RING_SIZE - 1)];
+	event->name = open_names[open_depth];
+	event->start = open_starts[open_depth];
+	event->duration = end - open_starts[open_depth];
+	SDL_AtomicSet(&ring->num_events, count + 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Write the events of every thread as Chrome trace_event JSON, complete ("X")
+// events in microseconds, open it in https://ui.perfetto.dev or chrome://tracing
+// Threads that are still recording may lap the oldest events while they are read
+///////////////////////////////////////////////////////////////////////////////
+
+bool profile_write_chrome_trace(const char* filename) {
+	FILE* file = fopen(filename, "w");
+	if (!file) {
+		fprintf(stderr, "Error opening %s.\n", filename);
+		return false;
+	}
+
+	double ticks_per_us = SDL_GetPerformanceFrequency() / 1e6;
+	int num_rings = SDL_AtomicGet(&profile_num_rings);
+	if (num_rings > PROFILE_MAX_THREADS) {
+		num_rings = PROFILE_MAX_THREADS;
+	}
+	SDL_MemoryBarrierAcquire();
+
+	// timestamps start at the oldest event kept
+	uint64_t origin = UINT64_MAX;
+	for (int i = 0; i < num_rings; i++) {
+		profile_ring_t* ring = profile_rings[i];
+		int count = ring ? SDL_AtomicGet(&ring->num_events) : 0;
+		int first = count > PROFILE_RING_SIZE ? count - PROFILE_RING_SIZE : 0;
+		for (int j = first; j < count; j++) {
+			uint64_t start = ring->events[j & (PROFILE_RING_SIZE - 1)].start;
+			if (start < origin) origin = start;
+		}
+	}
+
+	fprintf(file, "{\"traceEvents\":[\n");
+	bool first_entry = true;
+	for (int i = 0; i < num_rings; i++) {
+		profile_ring_t* ring = profile_rings[i];
+		if (!ring) {
+			continue;
+		}
+		if (ring->thread_name) {
+			fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+				first_entry ? "" : ",\n", i, ring->thread_name);
+			first_entry = false;
+		}
+		int count = SDL_AtomicGet(&ring->num_events);
+		int first = count > PROFILE_RING_SIZE ? count - PROFILE_RING_SIZE : 0;
+		for (int j = first; j < count; j++) {
+			profile_event_t* event = &ring->events[j & (PROFILE_RING_SIZE - 1)];
+			fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				first_entry ? "" : ",\n", event->name, i,
+				(event->start - origin) / ticks_per_us, event->duration / ticks_per_us);
+			first_entry = false;
+		}
+	}
+	fprintf(file, "\n]}\n");
+
+	bool ok = !ferror(file);
+	fclose(file);
+	if (!ok) {
+		fprintf(stderr, "Error writing %s.\n", filename);
+	}
+	return ok;
+}
@@ -0,0 +1,30 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+
+// scoped timing markers, PROFILE_BEGIN("name") ... PROFILE_END() around a
+// stage records one event with its start and duration in a ring buffer of the
+// calling thread; the names must be string literals, only the pointer is kept
+// building with -DNO_PROFILING compiles the markers out entirely
+#ifndef NO_PROFILING
+#define PROFILE_BEGIN(name) profile_begin(name)
+#define PROFILE_END() profile_end()
+#else
+#define PROFILE_BEGIN(name) ((void)0)
+#define PROFILE_END() ((void)0)
+#endif
+
+// events kept per thread, older ones are overwritten
+#define PROFILE_RING_SIZE (1 << 16)
+// markers open at the same time on one thread
+#define PROFILE_MAX_DEPTH 32
+// threads that can record events over the life of the program
+#define PROFILE_MAX_THREADS 64
+
+void profile_begin(const char* name);
+void profile_end(void);
+void profile_set_thread_name(const char* name);
+bool profile_write_chrome_trace(const char* filename);
+
+#endif
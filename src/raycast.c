@@ -0,0 +1,281 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <float.h>
+#include <math.h>
+#include <SDL2/SDL.h>
+#include "raycast.h"
+#include "bvh.h"
+#include "mesh.h"
+#include "light.h"
+#include "display.h"
+#include "stats.h"
+#include "profile.h"
+#include "thread_local.h"
+
+bool raycast_use_thread_pool = true;
+
+// the camera of the frame, rays start in view space at the origin and are moved
+// into model space where the hierarchy is, so it never has to be rebuilt
+typedef struct {
+	mat3x4_t view_to_model;	// inverse of the world-view matrix
+	mat3x4_t normal_matrix;	// face normals from model to view space
+	float inverse_scale_x;	// undo the projection of x and y
+	float inverse_scale_y;
+} raycast_camera_t;
+
+static THREAD_LOCAL raycast_camera_t raycast_camera;
+
+// everything the threads need to trace a frame, the thread locals of the thread
+// that asked for it aren't visible to the others so they are copied here
+typedef struct {
+	const bvh_t* bvh;
+	const face_t* faces;
+	const vec3_t* face_normals;
+	uint32_t* pixels;
+	raycast_camera_t camera;
+	light_t lights[MAX_NUM_LIGHTS];	// view space, for the shading
+	vec3_t shadow_vectors[MAX_NUM_LIGHTS];	// model space, toward a directional light or the position of a point light
+	int num_lights;
+	int tiles_x;
+	int num_tiles;
+	SDL_atomic_t next_tile;
+	SDL_atomic_t rays_cast;
+} raycast_job_t;
+
+// persistent workers, the thread that calls render_raycast() traces tiles too
+static SDL_Thread** pool_threads = NULL;
+static int num_pool_threads = 0;
+static SDL_sem* work_ready = NULL;
+static SDL_sem* work_done = NULL;
+static raycast_job_t* pool_job = NULL;
+static bool pool_quit = false;
+
+void raycast_set_camera(const mat3x4_t* world_view_matrix, const mat4_t* proj_matrix) {
+	raycast_camera.view_to_model = mat3x4_inverse(world_view_matrix);
+	raycast_camera.normal_matrix = mat3x4_make_normal_matrix(world_view_matrix);
+	raycast_camera.inverse_scale_x = 1.0f / proj_matrix->m[0][0];
+	raycast_camera.inverse_scale_y = 1.0f / proj_matrix->m[1][1];
+}
+
+// view space direction through the center of a pixel, at depth 1
+static vec3_t pixel_direction(const raycast_camera_t* camera, int x, int y) {
+	float ndc_x = (x + 0.5f) / (window_width / 2.0f) - 1;
+	float ndc_y = 1 - (y + 0.5f) / (window_height / 2.0f);
+	return (vec3_t){ ndc_x * camera->inverse_scale_x, ndc_y * camera->inverse_scale_y, 1 };
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Light a hit like the flat shading of the rasterizer, in view space, except
+// every light first casts a shadow ray from the surface toward it; both sides
+// of a face are lit, the side the camera sees is the front
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t shade_hit(const raycast_job_t* job, vec3_t view_direction, vec3_t model_direction, ray_hit_t hit, int* rays_cast) {
+	vec3_t point = { view_direction.x * hit.t, view_direction.y * hit.t, view_direction.z * hit.t };
+	vec3_t model_normal = job->face_normals[hit.face];
+	vec3_t normal = mat3x4_mul_direction(&job->camera.normal_matrix, model_normal);
+	vec3_normalize(&normal);
+	if (vec3_dot(normal, point) > 0) {
+		normal = (vec3_t){ -normal.x, -normal.y, -normal.z };
+	}
+	if (vec3_dot(model_normal, model_direction) > 0) {
+		model_normal = (vec3_t){ -model_normal.x, -model_normal.y, -model_normal.z };
+	}
+
+	// the point the ray hit in model space, nudged off the surface
+	const mat3x4_t* view_to_model = &job->camera.view_to_model;
+	vec3_t origin = { view_to_model->m[0][3], view_to_model->m[1][3], view_to_model->m[2][3] };
+	vec3_t shadow_origin = {
+		origin.x + model_direction.x * hit.t + model_normal.x * job->bvh->epsilon,
+		origin.y + model_direction.y * hit.t + model_normal.y * job->bvh->epsilon,
+		origin.z + model_direction.z * hit.t + model_normal.z * job->bvh->epsilon
+	};
+
+	float intensity = 0;
+	for (int l = 0; l < job->num_lights; l++) {
+		light_t light = job->lights[l];
+		ray_t shadow_ray = { shadow_origin, job->shadow_vectors[l] };
+		float contribution, t_max;
+		if (light.type == LIGHT_DIRECTIONAL) {
+			float n_dot_l = -vec3_dot(normal, light.direction);
+			contribution = light.intensity * n_dot_l;
+			t_max = FLT_MAX;
+		} else {
+			vec3_t to_light = vec3_subtract(light.position, point);
+			float distance_squared = vec3_dot(to_light, to_light);
+			float n_dot_l = vec3_dot(normal, to_light) / sqrtf(distance_squared + 1e-12f);
+			float attenuation = 1.0f - distance_squared / (light.range * light.range);
+			contribution = n_dot_l > 0 && attenuation > 0 ? light.intensity * n_dot_l * attenuation : 0;
+			// the ray reaches the light at t = 1
+			shadow_ray.direction = vec3_subtract(job->shadow_vectors[l], shadow_origin);
+			t_max = 1;
+		}
+		if (contribution <= 0) {
+			continue;
+		}
+		(*rays_cast)++;
+		if (!bvh_occluded(job->bvh, shadow_ray, t_max)) {
+			intensity += contribution;
+		}
+	}
+	return light_apply_intensity(job->faces[hit.face].color, intensity < 1 ? intensity : 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Claim tiles until there are none left, each one is traced in packets of 2x2
+// pixels; pixels whose ray misses keep what the color buffer had
+///////////////////////////////////////////////////////////////////////////////
+static void trace_tiles(raycast_job_t* job) {
+	const mat3x4_t* view_to_model = &job->camera.view_to_model;
+	vec3_t origin = { view_to_model->m[0][3], view_to_model->m[1][3], view_to_model->m[2][3] };
+
+	while (true) {
+		int tile = SDL_AtomicAdd(&job->next_tile, 1);
+		if (tile >= job->num_tiles) {
+			break;
+		}
+		int tile_x = (tile % job->tiles_x) * RAYCAST_TILE_SIZE;
+		int tile_y = (tile / job->tiles_x) * RAYCAST_TILE_SIZE;
+		int end_x = tile_x + RAYCAST_TILE_SIZE < window_width ? tile_x + RAYCAST_TILE_SIZE : window_width;
+		int end_y = tile_y + RAYCAST_TILE_SIZE < window_height ? tile_y + RAYCAST_TILE_SIZE : window_height;
+		int rays_cast = 0;
+
+		for (int y = tile_y; y < end_y; y += 2) {
+			for (int x = tile_x; x < end_x; x += 2) {
+				// lanes past the right or bottom edge are traced but not written
+				ray_packet_t packet = { .origin = origin };
+				vec3_t view_directions[BVH_PACKET_SIZE];
+				vec3_t model_directions[BVH_PACKET_SIZE];
+				for (int i = 0; i < BVH_PACKET_SIZE; i++) {
+					view_directions[i] = pixel_direction(&job->camera, x + (i & 1), y + (i >> 1));
+					model_directions[i] = mat3x4_mul_direction(view_to_model, view_directions[i]);
+					packet.dx[i] = model_directions[i].x;
+					packet.dy[i] = model_directions[i].y;
+					packet.dz[i] = model_directions[i].z;
+				}
+				ray_hit_t hits[BVH_PACKET_SIZE];
+				bvh_intersect_packet(job->bvh, &packet, FLT_MAX, hits);
+				rays_cast += BVH_PACKET_SIZE;
+
+				for (int i = 0; i < BVH_PACKET_SIZE; i++) {
+					int px = x + (i & 1), py = y + (i >> 1);
+					if (hits[i].face < 0 || px >= end_x || py >= end_y) {
+						continue;
+					}
+					job->pixels[py * window_width + px] = shade_hit(job, view_directions[i], model_directions[i], hits[i], &rays_cast);
+				}
+			}
+		}
+		SDL_AtomicAdd(&job->rays_cast, rays_cast);
+	}
+}
+
+static int raycast_worker(void* data) {
+	(void)data;
+	profile_set_thread_name("raycast worker");
+	while (true) {
+		SDL_SemWait(work_ready);
+		if (pool_quit) {
+			break;
+		}
+		trace_tiles(pool_job);
+		SDL_SemPost(work_done);
+	}
+	return 0;
+}
+
+// one worker less than there are cores, the thread that hands out the work is the last one
+static void start_thread_pool(void) {
+	work_ready = SDL_CreateSemaphore(0);
+	work_done = SDL_CreateSemaphore(0);
+	num_pool_threads = SDL_GetCPUCount() - 1;
+	num_pool_threads = num_pool_threads > 0 ? num_pool_threads : 0;
+	pool_threads = (SDL_Thread**) malloc(sizeof(SDL_Thread*) * (num_pool_threads > 0 ? num_pool_threads : 1));
+	for (int i = 0; i < num_pool_threads; i++) {
+		pool_threads[i] = SDL_CreateThread(raycast_worker, "raycast", NULL);
+	}
+}
+
+void raycast_shutdown_thread_pool(void) {
+	if (pool_threads == NULL) {
+		return;
+	}
+	pool_quit = true;
+	for (int i = 0; i < num_pool_threads; i++) {
+		SDL_SemPost(work_ready);
+	}
+	for (int i = 0; i < num_pool_threads; i++) {
+		SDL_WaitThread(pool_threads[i], NULL);
+	}
+	free(pool_threads);
+	pool_threads = NULL;
+	SDL_DestroySemaphore(work_ready);
+	SDL_DestroySemaphore(work_done);
+	pool_quit = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Ray cast the mesh into the color buffer with the camera of the last
+// raycast_set_camera() call
+///////////////////////////////////////////////////////////////////////////////
+void render_raycast(void) {
+	// a paged mesh has no hierarchy over all of its faces to trace
+	if (mesh.bvh == NULL) {
+		frame_stats.rays_cast = 0;
+		return;
+	}
+	PROFILE_BEGIN("render_raycast");
+	raycast_job_t job = {
+		.bvh = mesh.bvh,
+		.faces = mesh.faces,
+		.face_normals = mesh.face_normals,
+		.pixels = color_buffer,
+		.camera = raycast_camera,
+		.num_lights = num_lights,
+		.tiles_x = (window_width + RAYCAST_TILE_SIZE - 1) / RAYCAST_TILE_SIZE
+	};
+	job.num_tiles = job.tiles_x * ((window_height + RAYCAST_TILE_SIZE - 1) / RAYCAST_TILE_SIZE);
+	SDL_AtomicSet(&job.next_tile, 0);
+	SDL_AtomicSet(&job.rays_cast, 0);
+	for (int l = 0; l < num_lights; l++) {
+		light_t light = view_lights[l];
+		job.lights[l] = light;
+		if (light.type == LIGHT_DIRECTIONAL) {
+			vec3_t to_light = { -light.direction.x, -light.direction.y, -light.direction.z };
+			job.shadow_vectors[l] = mat3x4_mul_direction(&raycast_camera.view_to_model, to_light);
+		} else {
+			job.shadow_vectors[l] = vec3_from_vec4(mat3x4_mul_point(&raycast_camera.view_to_model, light.position));
+		}
+	}
+
+	if (raycast_use_thread_pool && pool_threads == NULL) {
+		start_thread_pool();
+	}
+	int num_helpers = raycast_use_thread_pool ? num_pool_threads : 0;
+	pool_job = &job;
+	for (int i = 0; i < num_helpers; i++) {
+		SDL_SemPost(work_ready);
+	}
+	trace_tiles(&job);
+	for (int i = 0; i < num_helpers; i++) {
+		SDL_SemWait(work_done);
+	}
+
+	frame_stats.rays_cast = SDL_AtomicGet(&job.rays_cast);
+	PROFILE_END();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The face under a pixel, -1 when the ray through it misses the mesh; exact to
+// the pixel whatever the render method draws
+///////////////////////////////////////////////////////////////////////////////
+int raycast_pick(int x, int y) {
+	if (mesh.bvh == NULL || x < 0 || y < 0 || x >= window_width || y >= window_height) {
+		return -1;
+	}
+	const mat3x4_t* view_to_model = &raycast_camera.view_to_model;
+	ray_t ray = {
+		.origin = { view_to_model->m[0][3], view_to_model->m[1][3], view_to_model->m[2][3] },
+		.direction = mat3x4_mul_direction(view_to_model, pixel_direction(&raycast_camera, x, y))
+	};
+	return bvh_intersect(mesh.bvh, ray, FLT_MAX).face;
+}
@@ -0,0 +1,18 @@
+#ifndef RAYCAST_H
+#define RAYCAST_H
+
+#include <stdbool.h>
+#include "matrix.h"
+
+// the screen is split into tiles of 32x32 pixels that the render threads claim one at a time
+#define RAYCAST_TILE_SIZE 32
+
+// false traces every tile on the calling thread, the turntable already runs a thread per frame
+extern bool raycast_use_thread_pool;
+
+void raycast_set_camera(const mat3x4_t* world_view_matrix, const mat4_t* proj_matrix);
+void render_raycast(void);
+int raycast_pick(int x, int y);
+void raycast_shutdown_thread_pool(void);
+
+#endif
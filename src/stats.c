@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "stats.h"
+#include "display.h"
+
+THREAD_LOCAL frame_stats_t frame_stats;
+
+void reset_frame_stats(void) {
+	memset(&frame_stats, 0, sizeof(frame_stats));
+}
+
+// with a depth test and front to back order every covered pixel would be written once
+static void print_overdraw(void) {
+	printf("overdraw: %d pixel writes for %d covered pixels (%.2fx), a z-buffer with front to back order would skip %.0f%%\n",
+		frame_stats.pixels_filled,
+		frame_stats.pixels_covered,
+		(float)frame_stats.pixels_filled / frame_stats.pixels_covered,
+		100.0f * (frame_stats.pixels_filled - frame_stats.pixels_covered) / frame_stats.pixels_filled);
+}
+
+void print_frame_stats(void) {
+	printf(
+		"clusters culled: %d/%d (backface %d, frustum %d, occlusion %d), triangles culled by clusters: %d/%d, objects occluded: %d/%d\n",
+		frame_stats.clusters_culled_backface + frame_stats.clusters_culled_frustum + frame_stats.clusters_culled_occlusion,
+		frame_stats.clusters_total,
+		frame_stats.clusters_culled_backface,
+		frame_stats.clusters_culled_frustum,
+		frame_stats.clusters_culled_occlusion,
+		frame_stats.triangles_culled_by_cluster,
+		frame_stats.triangles_total,
+		frame_stats.objects_culled_occlusion,
+		frame_stats.objects_total);
+	if (frame_stats.triangles_drawn > 0) {
+		if (frame_stats.depth_sort_repaired) {
+			printf("depth sort: order of the last frame repaired in %d moves\n", frame_stats.depth_sort_shifts);
+		} else {
+			printf("depth sort: sorted from scratch\n");
+		}
+	}
+	if (frame_stats.triangles_clipped > 0) {
+		printf("faces cut at the near plane: %d\n", frame_stats.triangles_clipped);
+	}
+	if (frame_stats.pixels_covered > 0) {
+		print_overdraw();
+	}
+	if (frame_stats.rays_cast > 0) {
+		printf("rays cast: %d\n", frame_stats.rays_cast);
+	}
+	if (frame_stats.points_drawn > 0) {
+		printf("points drawn: %d\n", frame_stats.points_drawn);
+	}
+	if (frame_stats.pages_visible > 0 || frame_stats.pages_resident > 0) {
+		printf("pages: %d visible, %d missing, %d resident\n",
+			frame_stats.pages_visible, frame_stats.pages_missing, frame_stats.pages_resident);
+	}
+	if (dynamic_resolution) {
+		printf("resolution: %dx%d of %dx%d (scale %.2f)\n", window_width, window_height, display_width, display_height, resolution_scale);
+	}
+#ifdef VALIDATE_CULLING
+	printf("faces where culling disagrees with the reference test: %d\n", frame_stats.cull_mismatches);
+#endif
+}
+
+frame_time_histogram_t frame_time_histogram;
+
+void reset_frame_time_histogram(void) {
+	memset(&frame_time_histogram, 0, sizeof(frame_time_histogram));
+}
+
+void record_frame_time(double seconds) {
+	int bucket = (int)(seconds / FRAME_TIME_BUCKET_WIDTH);
+	if (bucket >= FRAME_TIME_BUCKETS) {
+		bucket = FRAME_TIME_BUCKETS - 1;
+	}
+	frame_time_histogram.counts[bucket]++;
+	frame_time_histogram.num_frames++;
+	frame_time_histogram.total_time += seconds;
+	frame_time_histogram.last_time = seconds;
+	if (seconds > frame_time_histogram.max_time) {
+		frame_time_histogram.max_time = seconds;
+	}
+}
+
+// upper edge in ms of the bucket that holds the given fraction of the frames
+static double frame_time_percentile(double fraction) {
+	int target = (int)ceil(fraction * frame_time_histogram.num_frames);
+	int count = 0;
+	for (int i = 0; i < FRAME_TIME_BUCKETS; i++) {
+		count += frame_time_histogram.counts[i];
+		if (count >= target) {
+			return (i + 1) * FRAME_TIME_BUCKET_WIDTH * 1000;
+		}
+	}
+	return FRAME_TIME_BUCKETS * FRAME_TIME_BUCKET_WIDTH * 1000;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Print the frame time percentiles and one bar per non empty bucket
+///////////////////////////////////////////////////////////////////////////////
+
+void print_frame_time_histogram(void) {
+	if (frame_time_histogram.num_frames == 0) {
+		return;
+	}
+
+	printf(
+		"frame times over %d frames: mean %.2f ms, p50 <%.1f ms, p95 <%.1f ms, p99 <%.1f ms, max %.2f ms\n",
+		frame_time_histogram.num_frames,
+		frame_time_histogram.total_time * 1000 / frame_time_histogram.num_frames,
+		frame_time_percentile(0.50),
+		frame_time_percentile(0.95),
+		frame_time_percentile(0.99),
+		frame_time_histogram.max_time * 1000);
+
+	int max_count = 0;
+	for (int i = 0; i < FRAME_TIME_BUCKETS; i++) {
+		if (frame_time_histogram.counts[i] > max_count) {
+			max_count = frame_time_histogram.counts[i];
+		}
+	}
+	for (int i = 0; i < FRAME_TIME_BUCKETS; i++) {
+		int count = frame_time_histogram.counts[i];
+		if (count == 0) {
+			continue;
+		}
+		char bar[41];
+		int length = (count * 40 + max_count - 1) / max_count;
+		memset(bar, '#', length);
+		bar[length] = '\0';
+		printf("%5.1f ms%s %7d %s\n",
+			i * FRAME_TIME_BUCKET_WIDTH * 1000,
+			i == FRAME_TIME_BUCKETS - 1 ? "+" : " ",
+			count, bar);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw the histogram into the color buffer, one 3 pixel wide bar per bucket
+// scaled to the fullest bucket, green up to the target frame time and red
+// after it, with a white marker at the target
+///////////////////////////////////////////////////////////////////////////////
+
+void draw_frame_time_histogram(int x, int y, double target_time) {
+	const int bar_width = 3;
+	const int height = 80;
+
+	draw_rect(x, y, FRAME_TIME_BUCKETS * bar_width, height, 0xFF202020);
+
+	int max_count = 0;
+	for (int i = 0; i < FRAME_TIME_BUCKETS; i++) {
+		if (frame_time_histogram.counts[i] > max_count) {
+			max_count = frame_time_histogram.counts[i];
+		}
+	}
+
+	int target_bucket = (int)(target_time / FRAME_TIME_BUCKET_WIDTH);
+	for (int i = 0; i < FRAME_TIME_BUCKETS && max_count > 0; i++) {
+		int bar_height = frame_time_histogram.counts[i] * height / max_count;
+		uint32_t color = i <= target_bucket ? 0xFF00C000 : 0xFFE00000;
+		draw_rect(x + i * bar_width, y + height - bar_height, bar_width - 1, bar_height, color);
+	}
+	if (target_time > 0 && target_bucket < FRAME_TIME_BUCKETS) {
+		draw_rect(x + target_bucket * bar_width + bar_width - 1, y, 1, height, 0xFFFFFFFF);
+	}
+
+	// the last input to photon latency on the same time axis, as a yellow marker
+	if (input_latency_stats.num_inputs > 0) {
+		int latency_bucket = (int)(input_latency_stats.last_ms * 0.001 / FRAME_TIME_BUCKET_WIDTH);
+		if (latency_bucket >= FRAME_TIME_BUCKETS) {
+			latency_bucket = FRAME_TIME_BUCKETS - 1;
+		}
+		draw_rect(x + latency_bucket * bar_width, y, bar_width, 6, 0xFFFFFF00);
+	}
+}
+
+input_latency_stats_t input_latency_stats;
+
+void record_input_latency(int ms) {
+	input_latency_stats.num_inputs++;
+	input_latency_stats.last_ms = ms;
+	input_latency_stats.total_ms += ms;
+	if (ms > input_latency_stats.max_ms) {
+		input_latency_stats.max_ms = ms;
+	}
+}
+
+// prints the latency of all inputs so far, nothing if there was no input since the last call
+void print_input_latency(void) {
+	static int printed_inputs = 0;
+	if (input_latency_stats.num_inputs == printed_inputs) {
+		return;
+	}
+	printed_inputs = input_latency_stats.num_inputs;
+
+	printf("input to photon latency over %d inputs: mean %.1f ms, max %d ms, last %d ms\n",
+		input_latency_stats.num_inputs,
+		(float)input_latency_stats.total_ms / input_latency_stats.num_inputs,
+		input_latency_stats.max_ms,
+		input_latency_stats.last_ms);
+}
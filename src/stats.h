@@ -0,0 +1,71 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include "thread_local.h"
+
+// counters collected while building a frame, reset at the start of every update
+typedef struct {
+	int clusters_total;
+	int clusters_culled_backface;
+	int clusters_culled_frustum;
+	int clusters_culled_occlusion;	// hidden behind the nearest clusters in the depth pyramid
+	int objects_total;
+	int objects_culled_occlusion;
+	int triangles_total;
+	int triangles_culled_by_cluster;
+	int triangles_culled_backface;	// faces of visible clusters rejected one by one
+	int triangles_clipped;		// faces reaching behind the near plane, cut to the part in front of it
+	int triangles_drawn;
+	int depth_sort_shifts;		// places the triangles moved to repair the order of the last frame
+	bool depth_sort_repaired;	// false when the frame was sorted from scratch
+	int pixels_filled;		// pixels written by the triangle fills, drawing a pixel twice counts twice
+	int pixels_covered;		// pixels written at least once, only counted in RENDER_OVERDRAW mode
+	int rays_cast;			// primary and shadow rays of RENDER_RAYCAST
+	int points_drawn;		// vertices splatted by RENDER_POINTS, on screen and in front of the camera
+	int pages_visible;		// pages of a paged mesh in view
+	int pages_missing;		// pages in view not resident at the level of detail they need
+	int pages_resident;
+#ifdef VALIDATE_CULLING
+	int cull_mismatches;	// faces where the cull mode disagrees with the normalized reference test
+#endif
+} frame_stats_t;
+
+extern THREAD_LOCAL frame_stats_t frame_stats;
+
+// frame times of the window loop in half millisecond buckets,
+// the last bucket also counts every frame slower than 50 ms
+#define FRAME_TIME_BUCKETS 100
+#define FRAME_TIME_BUCKET_WIDTH 0.0005
+
+typedef struct {
+	int counts[FRAME_TIME_BUCKETS];
+	int num_frames;
+	double total_time;
+	double max_time;
+	double last_time;
+} frame_time_histogram_t;
+
+extern frame_time_histogram_t frame_time_histogram;
+
+// time from a key press to the present of the frame that reacts to it,
+// SDL event timestamps are whole milliseconds
+typedef struct {
+	int num_inputs;
+	int last_ms;
+	int max_ms;
+	int total_ms;
+} input_latency_stats_t;
+
+extern input_latency_stats_t input_latency_stats;
+
+void reset_frame_stats(void);
+void print_frame_stats(void);
+void reset_frame_time_histogram(void);
+void record_frame_time(double seconds);
+void print_frame_time_histogram(void);
+void draw_frame_time_histogram(int x, int y, double target_time);
+void record_input_latency(int ms);
+void print_input_latency(void);
+
+#endif
@@ -0,0 +1,956 @@
+// mmap and madvise are POSIX and BSD extensions that -std=c99 hides
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <SDL2/SDL.h>
+#include "stream.h"
+#include "mesh.h"
+#include "array.h"
+#include "display.h"
+#include "stats.h"
+#include "profile.h"
+
+int stream_budget_mb = STREAM_DEFAULT_BUDGET_MB;
+bool stream_wait_for_loads = false;
+
+///////////////////////////////////////////////////////////////////////////////
+// File format
+// A header, the page directory, then the data of every level of every page.
+// Everything is written in the layout of the machine that packed it, the file
+// is a cache next to the .obj rather than a format to exchange
+///////////////////////////////////////////////////////////////////////////////
+
+#define PAGED_MESH_MAGIC "MESHPGS2"
+
+typedef struct {
+	char magic[8];
+	uint32_t num_pages;
+	uint32_t unused;
+	vec3_t bounds_min;
+	vec3_t bounds_max;
+} paged_mesh_header_t;
+
+typedef struct {
+	uint64_t offset;	// from the start of the file
+	uint32_t size;
+	uint16_t num_vertices;
+	uint16_t num_faces;
+	uint16_t num_edges;
+	uint16_t unused;
+	vec3_t cone_axis;	// normal cone of the faces of this level, see cluster_t
+	float cone_cutoff;
+	float error;		// farthest the simplification moved the surface, 0 for the finest level
+} page_lod_t;
+
+typedef struct {
+	vec3_t center;		// bounding sphere of the page, the same for every level
+	float radius;
+	page_lod_t lods[STREAM_NUM_LODS];
+} page_entry_t;
+
+// a face of a page, the indices are 0-based into the vertices of the page
+typedef struct {
+	uint16_t a;
+	uint16_t b;
+	uint16_t c;
+	uint16_t unused;
+	uint32_t color;
+} page_face_t;
+
+// one level of a page as it is laid out in the file, each array follows the last:
+// positions, normals, texcoords, faces, face normals and three edge indices per face
+typedef struct {
+	int num_vertices;
+	int num_faces;
+	int num_edges;
+	vec3_t positions[STREAM_PAGE_MAX_VERTICES];
+	vec3_t normals[STREAM_PAGE_MAX_VERTICES];
+	tex2_t texcoords[STREAM_PAGE_MAX_VERTICES];
+	page_face_t faces[STREAM_PAGE_MAX_FACES];
+	vec3_t face_normals[STREAM_PAGE_MAX_FACES];
+	uint16_t face_edges[3 * STREAM_PAGE_MAX_FACES];
+	vec3_t cone_axis;
+	float cone_cutoff;
+} page_lod_data_t;
+
+static size_t page_lod_data_size(int num_vertices, int num_faces) {
+	return (sizeof(vec3_t) * 2 + sizeof(tex2_t)) * num_vertices +
+		(sizeof(page_face_t) + sizeof(vec3_t) + 3 * sizeof(uint16_t)) * num_faces;
+}
+
+// padded to 8 bytes, so the arrays of the next level in the file stay aligned
+static size_t page_lod_size(int num_vertices, int num_faces) {
+	return (page_lod_data_size(num_vertices, num_faces) + 7) & ~(size_t)7;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Packing a loaded mesh
+///////////////////////////////////////////////////////////////////////////////
+
+// local index of an edge, added when the key is new; the page has few enough edges to search them
+static uint16_t page_edge(uint64_t* keys, int* num_edges, uint64_t key) {
+	for (int i = 0; i < *num_edges; i++) {
+		if (keys[i] == key) {
+			return i;
+		}
+	}
+	keys[*num_edges] = key;
+	return (*num_edges)++;
+}
+
+// the finest level is the cluster as it is, with its vertices renumbered from 0
+static void make_fine_lod(page_lod_data_t* lod, cluster_t* cluster, int* local_index) {
+	static uint64_t edge_keys[STREAM_PAGE_MAX_EDGES];
+	int* cluster_vertices = &mesh.cluster_vertices[cluster->first_vertex];
+	lod->num_vertices = cluster->num_vertices;
+	for (int j = 0; j < cluster->num_vertices; j++) {
+		int index = cluster_vertices[j];
+		local_index[index] = j;
+		lod->positions[j] = mesh.vertices[index];
+		lod->normals[j] = mesh.normals[index];
+		lod->texcoords[j] = mesh.texcoords[index];
+	}
+
+	// edges keep the numbering of the mesh, so uv and normal seams don't get drawn twice
+	lod->num_faces = cluster->num_faces;
+	lod->num_edges = 0;
+	for (int i = 0; i < cluster->num_faces; i++) {
+		face_t face = mesh.faces[cluster->first_face + i];
+		lod->faces[i] = (page_face_t){ local_index[face.a - 1], local_index[face.b - 1], local_index[face.c - 1], 0, face.color };
+		lod->face_normals[i] = mesh.face_normals[cluster->first_face + i];
+		for (int s = 0; s < 3; s++) {
+			int edge = mesh.face_edges[3 * (cluster->first_face + i) + s];
+			lod->face_edges[3 * i + s] = page_edge(edge_keys, &lod->num_edges, edge);
+		}
+	}
+	lod->cone_axis = cluster->cone_axis;
+	lod->cone_cutoff = cluster->cone_cutoff;
+}
+
+#define LOD_GRID_CELLS (STREAM_LOD_GRID * STREAM_LOD_GRID * STREAM_LOD_GRID)
+// a collapse is skipped if it turns a face over or by more than 30 degrees, or if it leaves
+// a face thinner than this (twice its area over its longest side squared, 0.87 for equilateral)
+#define COLLAPSE_MIN_COSINE 0.866f
+#define COLLAPSE_MIN_THICKNESS 0.1f
+
+// face normal of the triangle between three points, not normalized
+static vec3_t triangle_normal(vec3_t a, vec3_t b, vec3_t c) {
+	return vec3_cross(vec3_subtract(b, a), vec3_subtract(c, a));
+}
+
+// twice the area of a triangle over its longest side squared, 0 for a sliver
+static float triangle_thickness(vec3_t a, vec3_t b, vec3_t c) {
+	float ab = vec3_length(vec3_subtract(b, a));
+	float bc = vec3_length(vec3_subtract(c, b));
+	float ca = vec3_length(vec3_subtract(a, c));
+	float longest = fmax(ab, fmax(bc, ca));
+	return longest > 0 ? vec3_length(triangle_normal(a, b, c)) / (longest * longest) : 0;
+}
+
+// whether the faces around vertex j still face the way they did with j moved onto representative[j],
+// and none became a sliver; faces left with two corners in one place are dropped and don't count
+static bool collapse_keeps_faces(const page_lod_data_t* fine, const int* representative, int j) {
+	for (int i = 0; i < fine->num_faces; i++) {
+		page_face_t face = fine->faces[i];
+		if (face.a != j && face.b != j && face.c != j) {
+			continue;
+		}
+		int a = representative[face.a], b = representative[face.b], c = representative[face.c];
+		if (a == b || b == c || c == a) {
+			continue;
+		}
+		vec3_t before = triangle_normal(fine->positions[face.a], fine->positions[face.b], fine->positions[face.c]);
+		vec3_t after = triangle_normal(fine->positions[a], fine->positions[b], fine->positions[c]);
+		if (vec3_dot(before, after) <= COLLAPSE_MIN_COSINE * vec3_length(before) * vec3_length(after)) {
+			return false;
+		}
+		// faces that were slivers already may stay as thin
+		float thickness = triangle_thickness(fine->positions[a], fine->positions[b], fine->positions[c]);
+		if (thickness < COLLAPSE_MIN_THICKNESS &&
+			thickness < triangle_thickness(fine->positions[face.a], fine->positions[face.b], fine->positions[face.c])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Simplify a page by vertex clustering: the box around the page is split into
+// a 4x4x4 grid and the vertices of a cell collapse onto the one nearest their
+// mean, faces left with less than three distinct corners are dropped.
+// Vertices on an open edge of the page stay where they are: that is the seam
+// with the next page (at either level), a uv or normal seam or a border of the
+// model. A collapse that would flip a face or squash it flat is skipped.
+// Returns how far the surface moved, the most any vertex did
+///////////////////////////////////////////////////////////////////////////////
+static float make_coarse_lod(page_lod_data_t* coarse, const page_lod_data_t* fine) {
+	static uint64_t edge_keys[STREAM_PAGE_MAX_EDGES];
+	int edge_faces[STREAM_PAGE_MAX_EDGES] = { 0 };
+	bool pinned[STREAM_PAGE_MAX_VERTICES] = { false };
+	int cell_of[STREAM_PAGE_MAX_VERTICES];
+	int representative[STREAM_PAGE_MAX_VERTICES];
+	int coarse_index[STREAM_PAGE_MAX_VERTICES];
+
+	// an edge of the page is open unless exactly two of its faces share it
+	int num_edges = 0;
+	for (int i = 0; i < fine->num_faces; i++) {
+		int corners[3] = { fine->faces[i].a, fine->faces[i].b, fine->faces[i].c };
+		for (int s = 0; s < 3; s++) {
+			int v0 = corners[s], v1 = corners[(s + 1) % 3];
+			uint64_t key = v0 < v1 ? ((uint64_t)v0 << 16) | v1 : ((uint64_t)v1 << 16) | v0;
+			edge_faces[page_edge(edge_keys, &num_edges, key)]++;
+		}
+	}
+	for (int e = 0; e < num_edges; e++) {
+		if (edge_faces[e] != 2) {
+			pinned[edge_keys[e] >> 16] = true;
+			pinned[edge_keys[e] & 0xffff] = true;
+		}
+	}
+
+	vec3_t min = fine->positions[0], max = fine->positions[0];
+	for (int j = 1; j < fine->num_vertices; j++) {
+		vec3_t p = fine->positions[j];
+		min.x = fmin(min.x, p.x); max.x = fmax(max.x, p.x);
+		min.y = fmin(min.y, p.y); max.y = fmax(max.y, p.y);
+		min.z = fmin(min.z, p.z); max.z = fmax(max.z, p.z);
+	}
+	vec3_t extent = vec3_subtract(max, min);
+	float scale[3] = {
+		extent.x > 0 ? STREAM_LOD_GRID / extent.x : 0,
+		extent.y > 0 ? STREAM_LOD_GRID / extent.y : 0,
+		extent.z > 0 ? STREAM_LOD_GRID / extent.z : 0
+	};
+
+	vec3_t cell_sum[LOD_GRID_CELLS];
+	int cell_count[LOD_GRID_CELLS];
+	int cell_target[LOD_GRID_CELLS];
+	float cell_target_distance[LOD_GRID_CELLS];
+	for (int c = 0; c < LOD_GRID_CELLS; c++) {
+		cell_sum[c] = (vec3_t){ 0, 0, 0 };
+		cell_count[c] = 0;
+		cell_target[c] = -1;
+	}
+	for (int j = 0; j < fine->num_vertices; j++) {
+		vec3_t p = fine->positions[j];
+		int x = (int)((p.x - min.x) * scale[0]);
+		int y = (int)((p.y - min.y) * scale[1]);
+		int z = (int)((p.z - min.z) * scale[2]);
+		x = x < STREAM_LOD_GRID ? x : STREAM_LOD_GRID - 1;
+		y = y < STREAM_LOD_GRID ? y : STREAM_LOD_GRID - 1;
+		z = z < STREAM_LOD_GRID ? z : STREAM_LOD_GRID - 1;
+		cell_of[j] = (z * STREAM_LOD_GRID + y) * STREAM_LOD_GRID + x;
+		cell_sum[cell_of[j]] = vec3_add(cell_sum[cell_of[j]], p);
+		cell_count[cell_of[j]]++;
+	}
+
+	// the vertex nearest the mean of its cell stands for the cell, it stays on the surface
+	for (int j = 0; j < fine->num_vertices; j++) {
+		int cell = cell_of[j];
+		vec3_t mean = { cell_sum[cell].x / cell_count[cell], cell_sum[cell].y / cell_count[cell], cell_sum[cell].z / cell_count[cell] };
+		float distance = vec3_length(vec3_subtract(fine->positions[j], mean));
+		if (cell_target[cell] < 0 || distance < cell_target_distance[cell]) {
+			cell_target[cell] = j;
+			cell_target_distance[cell] = distance;
+		}
+		representative[j] = j;
+	}
+
+	// one vertex at a time, each collapse checked against the ones before it
+	float error = 0;
+	for (int j = 0; j < fine->num_vertices; j++) {
+		int target = cell_target[cell_of[j]];
+		if (pinned[j] || target == j) {
+			continue;
+		}
+		representative[j] = target;
+		if (!collapse_keeps_faces(fine, representative, j)) {
+			representative[j] = j;
+			continue;
+		}
+		error = fmax(error, vec3_length(vec3_subtract(fine->positions[j], fine->positions[target])));
+	}
+
+	// the vertices some face still uses, in the order of the fine level
+	for (int j = 0; j < fine->num_vertices; j++) {
+		coarse_index[j] = -1;
+	}
+	coarse->num_vertices = 0;
+	coarse->num_faces = 0;
+	coarse->num_edges = 0;
+	for (int i = 0; i < fine->num_faces; i++) {
+		page_face_t face = fine->faces[i];
+		int corners[3] = { representative[face.a], representative[face.b], representative[face.c] };
+		if (corners[0] == corners[1] || corners[1] == corners[2] || corners[2] == corners[0]) {
+			continue;
+		}
+		// the corners moved, the normal follows them; faces of no area kept theirs in the fine level
+		vec3_t normal = triangle_normal(fine->positions[corners[0]], fine->positions[corners[1]], fine->positions[corners[2]]);
+		if (vec3_length(normal) > 0) {
+			vec3_normalize(&normal);
+		} else {
+			normal = fine->face_normals[i];
+		}
+
+		for (int s = 0; s < 3; s++) {
+			int j = corners[s];
+			if (coarse_index[j] < 0) {
+				int v = coarse->num_vertices++;
+				coarse->positions[v] = fine->positions[j];
+				coarse->normals[v] = fine->normals[j];
+				coarse->texcoords[v] = fine->texcoords[j];
+				coarse_index[j] = v;
+			}
+			corners[s] = coarse_index[j];
+		}
+		int f = coarse->num_faces++;
+		coarse->faces[f] = (page_face_t){ corners[0], corners[1], corners[2], 0, face.color };
+		coarse->face_normals[f] = normal;
+
+		for (int s = 0; s < 3; s++) {
+			int v0 = corners[s], v1 = corners[(s + 1) % 3];
+			uint64_t key = v0 < v1 ? ((uint64_t)v0 << 16) | v1 : ((uint64_t)v1 << 16) | v0;
+			coarse->face_edges[3 * f + s] = page_edge(edge_keys, &coarse->num_edges, key);
+		}
+	}
+
+	// the new normals can lean out of the cone of the fine faces, so it can't be culled
+	coarse->cone_axis = fine->cone_axis;
+	coarse->cone_cutoff = 2;
+	return error;
+}
+
+static bool write_page_lod(FILE* file, const page_lod_data_t* lod) {
+	static const uint8_t padding[8] = { 0 };
+	int nv = lod->num_vertices, nf = lod->num_faces;
+	size_t padding_size = page_lod_size(nv, nf) - page_lod_data_size(nv, nf);
+	return
+		fwrite(lod->positions, sizeof(vec3_t), nv, file) == (size_t)nv &&
+		fwrite(lod->normals, sizeof(vec3_t), nv, file) == (size_t)nv &&
+		fwrite(lod->texcoords, sizeof(tex2_t), nv, file) == (size_t)nv &&
+		fwrite(lod->faces, sizeof(page_face_t), nf, file) == (size_t)nf &&
+		fwrite(lod->face_normals, sizeof(vec3_t), nf, file) == (size_t)nf &&
+		fwrite(lod->face_edges, sizeof(uint16_t), 3 * nf, file) == (size_t)(3 * nf) &&
+		fwrite(padding, 1, padding_size, file) == padding_size;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Write the loaded mesh as a paged mesh, one page per cluster: the clusters are
+// runs of spatially close faces already, with bounds the culling understands
+///////////////////////////////////////////////////////////////////////////////
+bool write_paged_mesh(const char* filename) {
+	FILE* file = fopen(filename, "wb");
+	if (!file) {
+		fprintf(stderr, "Error opening %s.\n", filename);
+		return false;
+	}
+
+	int num_pages = array_length(mesh.clusters);
+	paged_mesh_header_t header = { .num_pages = num_pages, .bounds_min = mesh.bounds_min, .bounds_max = mesh.bounds_max };
+	memcpy(header.magic, PAGED_MESH_MAGIC, sizeof(header.magic));
+	page_entry_t* directory = (page_entry_t*) calloc(num_pages > 0 ? num_pages : 1, sizeof(page_entry_t));
+	int* local_index = (int*) malloc(sizeof(int) * (array_length(mesh.vertices) + 1));
+
+	// the directory is written again at the end, once the offsets are known
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(directory, sizeof(page_entry_t), num_pages, file) == (size_t)num_pages;
+	uint64_t offset = sizeof(header) + sizeof(page_entry_t) * (uint64_t)num_pages;
+
+	static page_lod_data_t lods[STREAM_NUM_LODS];
+	for (int p = 0; p < num_pages && ok; p++) {
+		cluster_t* cluster = &mesh.clusters[p];
+		float errors[STREAM_NUM_LODS] = { 0 };
+		make_fine_lod(&lods[0], cluster, local_index);
+		errors[1] = make_coarse_lod(&lods[1], &lods[0]);
+		// pages too small to lose anything keep the fine faces
+		if (lods[1].num_faces == 0) {
+			lods[1] = lods[0];
+			errors[1] = 0;
+		}
+
+		page_entry_t* entry = &directory[p];
+		entry->center = cluster->center;
+		entry->radius = cluster->radius;
+		for (int l = 0; l < STREAM_NUM_LODS; l++) {
+			page_lod_t* lod = &entry->lods[l];
+			lod->offset = offset;
+			lod->size = page_lod_size(lods[l].num_vertices, lods[l].num_faces);
+			lod->num_vertices = lods[l].num_vertices;
+			lod->num_faces = lods[l].num_faces;
+			lod->num_edges = lods[l].num_edges;
+			lod->cone_axis = lods[l].cone_axis;
+			lod->cone_cutoff = lods[l].cone_cutoff;
+			lod->error = errors[l];
+			ok = ok && write_page_lod(file, &lods[l]);
+			offset += lod->size;
+		}
+	}
+
+	ok = ok && fseek(file, sizeof(header), SEEK_SET) == 0 &&
+		fwrite(directory, sizeof(page_entry_t), num_pages, file) == (size_t)num_pages;
+	ok = (fclose(file) == 0) && ok;
+	if (!ok) {
+		fprintf(stderr, "Error writing %s.\n", filename);
+	}
+
+	free(local_index);
+	free(directory);
+	return ok;
+}
+
+bool is_paged_mesh_file(const char* filename) {
+	FILE* file = fopen(filename, "rb");
+	if (!file) {
+		return false;
+	}
+	char magic[8];
+	bool is_paged = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, PAGED_MESH_MAGIC, sizeof(magic)) == 0;
+	fclose(file);
+	return is_paged;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Residency
+// The file is memory mapped and the pages are copied out of the mapping into
+// the mesh arrays, so the usual cluster pipeline draws them. The arrays are
+// cut into units of a few vertices, faces and edges, as many as the memory
+// budget pays for, and a resident level of a page holds a run of the units
+// it fills, a coarse level fewer than a fine one. A slot is the cluster the
+// pipeline sees for a resident level. A loader thread does the copies (and
+// takes the page faults of reading the file), the render thread decides what
+// to load and evict
+///////////////////////////////////////////////////////////////////////////////
+
+#define UNIT_VERTICES 16
+#define UNIT_FACES 16
+#define UNIT_EDGES 32
+
+enum slot_state {
+	SLOT_FREE,
+	SLOT_LOADING,	// handed to the loader, only it touches the slot
+	SLOT_RESIDENT
+};
+
+typedef struct {
+	enum slot_state state;
+	int page;
+	int lod;
+	int first_unit;
+	int num_units;
+	int last_used;	// frame the slot was last drawn in
+	int prev;	// neighbours in the least recently used list, -1 at the ends
+	int next;
+} stream_slot_t;
+
+typedef struct {
+	int page;
+	int lod;
+	int slot;
+	int first_unit;
+	float depth;	// nearer pages are loaded first
+} load_request_t;
+
+static bool is_open = false;
+static uint8_t* map_data = NULL;
+static size_t map_size = 0;
+static size_t system_page_size = 4096;
+
+static page_entry_t* pages = NULL;
+static int num_pages = 0;
+static int (*page_slots)[STREAM_NUM_LODS] = NULL;	// slot loading or holding each level of each page, -1 if none
+
+static stream_slot_t* slots = NULL;
+static int num_slots = 0;
+static int* free_slots = NULL;
+static int num_free_slots = 0;
+static int num_resident_slots = 0;
+static int lru_head = -1;	// most recently used resident slot
+static int lru_tail = -1;
+static int frame_counter = 0;
+
+static uint64_t* used_units = NULL;	// a bit per unit of the mesh arrays
+static int num_units = 0;
+
+// the mesh arrays, mesh is thread local and the loader thread has its own
+static vec3_t* slot_vertices;
+static vec3_t* slot_normals;
+static tex2_t* slot_texcoords;
+static face_t* slot_faces;
+static vec3_t* slot_face_normals;
+static int* slot_face_edges;
+static cluster_t* slot_clusters;
+
+// requests and completed loads, shared with the loader thread under stream_mutex
+static load_request_t requests[STREAM_MAX_REQUESTS];
+static int num_requests = 0;
+static int next_request = 0;	// requests before it were taken by the loader
+static load_request_t completed[STREAM_MAX_REQUESTS + 1];
+static int num_completed = 0;
+static int loads_in_flight = 0;
+static bool loader_quit = false;
+static SDL_mutex* stream_mutex = NULL;
+static SDL_cond* stream_changed = NULL;
+static SDL_Thread* loader_thread = NULL;
+
+bool stream_is_open(void) {
+	return is_open;
+}
+
+static void lru_remove(int slot) {
+	stream_slot_t* s = &slots[slot];
+	if (s->prev >= 0) slots[s->prev].next = s->next; else lru_head = s->next;
+	if (s->next >= 0) slots[s->next].prev = s->prev; else lru_tail = s->prev;
+	s->prev = s->next = -1;
+}
+
+static void lru_push_front(int slot) {
+	slots[slot].prev = -1;
+	slots[slot].next = lru_head;
+	if (lru_head >= 0) slots[lru_head].prev = slot; else lru_tail = slot;
+	lru_head = slot;
+}
+
+static void touch_slot(int slot) {
+	slots[slot].last_used = frame_counter;
+	lru_remove(slot);
+	lru_push_front(slot);
+}
+
+static void mark_units(int first, int count, bool used) {
+	for (int u = first; u < first + count; u++) {
+		if (used) {
+			used_units[u >> 6] |= (uint64_t)1 << (u & 63);
+		} else {
+			used_units[u >> 6] &= ~((uint64_t)1 << (u & 63));
+		}
+	}
+}
+
+// the first of a run of count free units, -1 if there is none
+static int find_free_units(int count) {
+	int run = 0;
+	for (int u = 0; u < num_units; u++) {
+		// the units are mostly taken, skip whole words of them
+		if ((u & 63) == 0 && used_units[u >> 6] == ~(uint64_t)0) {
+			run = 0;
+			u += 63;
+			continue;
+		}
+		run = (used_units[u >> 6] >> (u & 63)) & 1 ? 0 : run + 1;
+		if (run == count) {
+			return u - count + 1;
+		}
+	}
+	return -1;
+}
+
+// units a level of a page fills, at least one so its slot has a place
+static int page_lod_units(const page_lod_t* lod) {
+	int units = (lod->num_vertices + UNIT_VERTICES - 1) / UNIT_VERTICES;
+	int face_units = (lod->num_faces + UNIT_FACES - 1) / UNIT_FACES;
+	int edge_units = (lod->num_edges + UNIT_EDGES - 1) / UNIT_EDGES;
+	units = face_units > units ? face_units : units;
+	units = edge_units > units ? edge_units : units;
+	return units > 0 ? units : 1;
+}
+
+static void release_slot(int slot) {
+	page_slots[slots[slot].page][slots[slot].lod] = -1;
+	slots[slot].state = SLOT_FREE;
+	mark_units(slots[slot].first_unit, slots[slot].num_units, false);
+	free_slots[num_free_slots++] = slot;
+}
+
+// a slot with a run of units free for a level of a page, the least recently used pages are
+// evicted until there is one unless they are drawn this frame; -1 if there is no room
+static int take_slot(int units) {
+	int first = num_free_slots > 0 ? find_free_units(units) : -1;
+	while (first < 0) {
+		int slot = lru_tail;
+		if (slot < 0 || slots[slot].last_used == frame_counter) {
+			return -1;
+		}
+		lru_remove(slot);
+		num_resident_slots--;
+		release_slot(slot);
+		first = find_free_units(units);
+	}
+	int slot = free_slots[--num_free_slots];
+	slots[slot].first_unit = first;
+	slots[slot].num_units = units;
+	mark_units(first, units, true);
+	return slot;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Copy a level of a page from the mapping into its slot, the indices become
+// indices into the mesh arrays; the mapped file pages are dropped after, the
+// copy is what counts against the budget
+///////////////////////////////////////////////////////////////////////////////
+static void load_page(load_request_t request) {
+	const page_lod_t* lod = &pages[request.page].lods[request.lod];
+	const uint8_t* data = map_data + lod->offset;
+	int nv = lod->num_vertices, nf = lod->num_faces;
+	int first_vertex = request.first_unit * UNIT_VERTICES;
+	int first_face = request.first_unit * UNIT_FACES;
+	int first_edge = request.first_unit * UNIT_EDGES;
+
+	memcpy(&slot_vertices[first_vertex], data, sizeof(vec3_t) * nv);
+	data += sizeof(vec3_t) * nv;
+	memcpy(&slot_normals[first_vertex], data, sizeof(vec3_t) * nv);
+	data += sizeof(vec3_t) * nv;
+	memcpy(&slot_texcoords[first_vertex], data, sizeof(tex2_t) * nv);
+	data += sizeof(tex2_t) * nv;
+
+	const page_face_t* faces = (const page_face_t*) data;
+	for (int i = 0; i < nf; i++) {
+		slot_faces[first_face + i] = (face_t){
+			.a = first_vertex + faces[i].a + 1,
+			.b = first_vertex + faces[i].b + 1,
+			.c = first_vertex + faces[i].c + 1,
+			.color = faces[i].color
+		};
+	}
+	data += sizeof(page_face_t) * nf;
+	memcpy(&slot_face_normals[first_face], data, sizeof(vec3_t) * nf);
+	data += sizeof(vec3_t) * nf;
+
+	const uint16_t* face_edges = (const uint16_t*) data;
+	for (int i = 0; i < 3 * nf; i++) {
+		slot_face_edges[3 * first_face + i] = first_edge + face_edges[i];
+	}
+
+	uintptr_t start = (uintptr_t)(map_data + lod->offset) & ~(uintptr_t)(system_page_size - 1);
+	uintptr_t end = (uintptr_t)(map_data + lod->offset + lod->size);
+	madvise((void*)start, end - start, MADV_DONTNEED);
+}
+
+static int stream_loader(void* data) {
+	(void)data;
+	profile_set_thread_name("stream loader");
+	SDL_LockMutex(stream_mutex);
+	while (true) {
+		while (next_request == num_requests && !loader_quit) {
+			SDL_CondWait(stream_changed, stream_mutex);
+		}
+		if (loader_quit) {
+			break;
+		}
+		load_request_t request = requests[next_request++];
+		loads_in_flight++;
+		SDL_UnlockMutex(stream_mutex);
+
+		PROFILE_BEGIN("load page");
+		load_page(request);
+		PROFILE_END();
+
+		SDL_LockMutex(stream_mutex);
+		loads_in_flight--;
+		completed[num_completed++] = request;
+		SDL_CondBroadcast(stream_changed);
+	}
+	SDL_UnlockMutex(stream_mutex);
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Open a paged mesh: map the file, keep a copy of the directory and point the
+// mesh arrays at the slots, all empty until the first frame asks for pages
+///////////////////////////////////////////////////////////////////////////////
+bool open_paged_mesh(const char* filename) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Error opening %s.\n", filename);
+		return false;
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(paged_mesh_header_t)) {
+		fprintf(stderr, "Error reading %s.\n", filename);
+		close(fd);
+		return false;
+	}
+	map_size = file_stat.st_size;
+	map_data = (uint8_t*) mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map_data == MAP_FAILED) {
+		fprintf(stderr, "Error mapping %s.\n", filename);
+		map_data = NULL;
+		return false;
+	}
+	system_page_size = sysconf(_SC_PAGESIZE);
+
+	paged_mesh_header_t header;
+	memcpy(&header, map_data, sizeof(header));
+	uint64_t directory_end = sizeof(header) + sizeof(page_entry_t) * (uint64_t)header.num_pages;
+	if (memcmp(header.magic, PAGED_MESH_MAGIC, sizeof(header.magic)) != 0 || directory_end > map_size) {
+		fprintf(stderr, "Error: %s is not a paged mesh.\n", filename);
+		munmap(map_data, map_size);
+		map_data = NULL;
+		return false;
+	}
+	num_pages = header.num_pages;
+	pages = (page_entry_t*) malloc(sizeof(page_entry_t) * (num_pages > 0 ? num_pages : 1));
+	memcpy(pages, map_data + sizeof(header), sizeof(page_entry_t) * num_pages);
+	for (int p = 0; p < num_pages; p++) {
+		for (int l = 0; l < STREAM_NUM_LODS; l++) {
+			page_lod_t* lod = &pages[p].lods[l];
+			if (lod->num_vertices > STREAM_PAGE_MAX_VERTICES || lod->num_faces > STREAM_PAGE_MAX_FACES ||
+				lod->num_edges > STREAM_PAGE_MAX_EDGES || lod->size != page_lod_size(lod->num_vertices, lod->num_faces) ||
+				lod->offset < directory_end || lod->offset + lod->size > map_size) {
+				fprintf(stderr, "Error: page %d of %s is corrupt.\n", p, filename);
+				free(pages);
+				munmap(map_data, map_size);
+				map_data = NULL;
+				return false;
+			}
+		}
+	}
+
+	// everything a unit costs, its share of the mesh arrays and of the vertex stage buffers, and
+	// of the slots: there are as many as units at most, one per level of a page past that
+	size_t unit_size =
+		UNIT_VERTICES * (2 * sizeof(vec3_t) + sizeof(tex2_t) + sizeof(int) + 2 * sizeof(vec4_t) + sizeof(float)) +
+		UNIT_FACES * (sizeof(face_t) + sizeof(vec3_t) + 6 * sizeof(int)) +
+		UNIT_EDGES * (sizeof(edge_t) + sizeof(int)) +
+		sizeof(cluster_t) + sizeof(stream_slot_t) + sizeof(int) * 2 + sizeof(bool);
+	num_units = (int)((size_t)stream_budget_mb * 1024 * 1024 / unit_size);
+	// room for the largest level of a page at least, however small the budget
+	int fine_units = 0;
+	for (int p = 0; p < num_pages; p++) {
+		for (int l = 0; l < STREAM_NUM_LODS; l++) {
+			int units = page_lod_units(&pages[p].lods[l]);
+			num_units = units > num_units ? units : num_units;
+		}
+		fine_units += page_lod_units(&pages[p].lods[0]);
+	}
+	num_units = num_units > 0 ? num_units : 1;
+	num_slots = num_pages * STREAM_NUM_LODS < num_units ? num_pages * STREAM_NUM_LODS : num_units;
+	num_slots = num_slots > 0 ? num_slots : 1;
+
+	int num_vertices = num_units * UNIT_VERTICES;
+	int num_faces = num_units * UNIT_FACES;
+	int num_edges = num_units * UNIT_EDGES;
+	mesh.vertices = slot_vertices = array_hold(NULL, num_vertices, sizeof(vec3_t));
+	mesh.normals = slot_normals = array_hold(NULL, num_vertices, sizeof(vec3_t));
+	mesh.texcoords = slot_texcoords = array_hold(NULL, num_vertices, sizeof(tex2_t));
+	mesh.faces = slot_faces = array_hold(NULL, num_faces, sizeof(face_t));
+	mesh.face_normals = slot_face_normals = array_hold(NULL, num_faces, sizeof(vec3_t));
+	mesh.face_edges = slot_face_edges = array_hold(NULL, 3 * num_faces, sizeof(int));
+	mesh.edges = array_hold(NULL, num_edges, sizeof(edge_t));
+	memset(mesh.edges, 0, sizeof(edge_t) * num_edges);
+	mesh.clusters = slot_clusters = array_hold(NULL, num_slots, sizeof(cluster_t));
+	memset(mesh.clusters, 0, sizeof(cluster_t) * num_slots);
+	mesh.cluster_vertices = array_hold(NULL, num_vertices, sizeof(int));
+	for (int i = 0; i < num_vertices; i++) {
+		mesh.cluster_vertices[i] = i;
+	}
+	mesh.bounds_min = header.bounds_min;
+	mesh.bounds_max = header.bounds_max;
+
+	slots = (stream_slot_t*) malloc(sizeof(stream_slot_t) * num_slots);
+	free_slots = (int*) malloc(sizeof(int) * num_slots);
+	for (int s = 0; s < num_slots; s++) {
+		slots[s] = (stream_slot_t){ .state = SLOT_FREE, .page = -1, .lod = -1, .last_used = -1, .prev = -1, .next = -1 };
+		free_slots[s] = num_slots - 1 - s;
+	}
+	num_free_slots = num_slots;
+	// the bits past the last unit stay set, so they are never free
+	int num_unit_words = (num_units + 63) / 64;
+	used_units = (uint64_t*) malloc(sizeof(uint64_t) * num_unit_words);
+	memset(used_units, 0, sizeof(uint64_t) * num_unit_words);
+	for (int u = num_units; u < 64 * num_unit_words; u++) {
+		used_units[u >> 6] |= (uint64_t)1 << (u & 63);
+	}
+	page_slots = malloc(sizeof(*page_slots) * (num_pages > 0 ? num_pages : 1));
+	for (int p = 0; p < num_pages; p++) {
+		for (int l = 0; l < STREAM_NUM_LODS; l++) {
+			page_slots[p][l] = -1;
+		}
+	}
+
+	stream_mutex = SDL_CreateMutex();
+	stream_changed = SDL_CreateCond();
+	loader_quit = false;
+	loader_thread = SDL_CreateThread(stream_loader, "stream loader", NULL);
+	is_open = true;
+	// stderr, the turntable can be writing raw frames to stdout
+	int mean_fine_units = num_pages > 0 ? (fine_units + num_pages - 1) / num_pages : 1;
+	fprintf(stderr, "%d pages, about %d resident at full detail (%d MB)\n", num_pages, num_units / mean_fine_units, stream_budget_mb);
+	return true;
+}
+
+// the cluster the pipeline sees for a resident slot
+static cluster_t slot_cluster(int slot) {
+	const page_entry_t* page = &pages[slots[slot].page];
+	const page_lod_t* lod = &page->lods[slots[slot].lod];
+	return (cluster_t){
+		.first_face = slots[slot].first_unit * UNIT_FACES,
+		.num_faces = lod->num_faces,
+		.first_vertex = slots[slot].first_unit * UNIT_VERTICES,
+		.num_vertices = lod->num_vertices,
+		.center = page->center,
+		.radius = page->radius,
+		.cone_axis = lod->cone_axis,
+		.cone_cutoff = lod->cone_cutoff
+	};
+}
+
+// take in the loads the loader finished, and take back the requests it didn't get to,
+// the new frame asks again for the pages it still needs
+static void collect_loads(void) {
+	SDL_LockMutex(stream_mutex);
+	for (int r = next_request; r < num_requests; r++) {
+		release_slot(requests[r].slot);
+	}
+	num_requests = next_request = 0;
+	for (int c = 0; c < num_completed; c++) {
+		int slot = completed[c].slot;
+		slots[slot].state = SLOT_RESIDENT;
+		slots[slot].last_used = -1;
+		lru_push_front(slot);
+		num_resident_slots++;
+	}
+	num_completed = 0;
+	SDL_UnlockMutex(stream_mutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Find the pages in view and their level of detail, show the resident ones to
+// the pipeline (a page with only the other level in draws that meanwhile) and
+// hand the nearest missing ones to the loader; returns the number requested
+///////////////////////////////////////////////////////////////////////////////
+static int request_pages(const mat3x4_t* world_view_matrix, const mat4_t* proj_matrix, float max_scale, bool test_backface) {
+	// nothing is drawn from a slot unless it is picked below
+	for (int s = 0; s < num_slots; s++) {
+		slot_clusters[s].num_faces = 0;
+	}
+
+	load_request_t wanted[STREAM_MAX_REQUESTS];
+	int num_wanted = 0;
+	int num_visible = 0, num_missing = 0;
+	float pixels_per_unit = proj_matrix->m[1][1] * window_height / 2.0f;
+
+	for (int p = 0; p < num_pages; p++) {
+		page_entry_t* page = &pages[p];
+		cluster_t bounds = { .center = page->center, .radius = page->radius, .cone_axis = page->lods[0].cone_axis, .cone_cutoff = page->lods[0].cone_cutoff };
+		if (cull_cluster(&bounds, world_view_matrix, max_scale, test_backface) != CLUSTER_VISIBLE) {
+			continue;
+		}
+		num_visible++;
+
+		// the coarse level while it moves the surface by less than a pixel at the near side of
+		// the page, so it covers the pixels the fine level does; pages reaching the camera plane are fine
+		float radius = page->radius * max_scale;
+		float depth = mat3x4_mul_point(world_view_matrix, page->center).z;
+		float error = page->lods[1].error * max_scale;
+		int lod = (depth - radius <= 0 || error * pixels_per_unit / (depth - radius) >= STREAM_LOD_ERROR_PIXELS) ? 0 : 1;
+
+		int slot = page_slots[p][lod];
+		if (slot < 0 || slots[slot].state != SLOT_RESIDENT) {
+			num_missing++;
+			// keep the nearest requests, sorted by depth
+			if (slot < 0 && (num_wanted < STREAM_MAX_REQUESTS || depth < wanted[num_wanted - 1].depth)) {
+				int w = num_wanted < STREAM_MAX_REQUESTS ? num_wanted++ : num_wanted - 1;
+				while (w > 0 && wanted[w - 1].depth > depth) {
+					wanted[w] = wanted[w - 1];
+					w--;
+				}
+				wanted[w] = (load_request_t){ .page = p, .lod = lod, .depth = depth };
+			}
+			slot = page_slots[p][1 - lod];
+		}
+		if (slot >= 0 && slots[slot].state == SLOT_RESIDENT) {
+			slot_clusters[slot] = slot_cluster(slot);
+			touch_slot(slot);
+		}
+	}
+
+	int num_requested = 0;
+	SDL_LockMutex(stream_mutex);
+	for (int w = 0; w < num_wanted; w++) {
+		int slot = take_slot(page_lod_units(&pages[wanted[w].page].lods[wanted[w].lod]));
+		if (slot < 0) {
+			break;
+		}
+		slots[slot].state = SLOT_LOADING;
+		slots[slot].page = wanted[w].page;
+		slots[slot].lod = wanted[w].lod;
+		slots[slot].last_used = -1;
+		page_slots[wanted[w].page][wanted[w].lod] = slot;
+		wanted[w].slot = slot;
+		wanted[w].first_unit = slots[slot].first_unit;
+		requests[num_requests++] = wanted[w];
+		num_requested++;
+	}
+	SDL_CondBroadcast(stream_changed);
+	SDL_UnlockMutex(stream_mutex);
+
+	frame_stats.pages_visible = num_visible;
+	frame_stats.pages_missing = num_missing;
+	frame_stats.pages_resident = num_resident_slots;
+	return num_requested;
+}
+
+static void wait_for_loads(void) {
+	SDL_LockMutex(stream_mutex);
+	while (next_request < num_requests || loads_in_flight > 0) {
+		SDL_CondWait(stream_changed, stream_mutex);
+	}
+	SDL_UnlockMutex(stream_mutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Called every frame before the clusters are culled, the frame draws what is
+// resident and never waits on the disk, unless stream_wait_for_loads is set
+///////////////////////////////////////////////////////////////////////////////
+void stream_update(const mat3x4_t* world_view_matrix, const mat4_t* proj_matrix, float max_scale, bool test_backface) {
+	PROFILE_BEGIN("stream pages");
+	frame_counter++;
+	while (true) {
+		collect_loads();
+		int num_requested = request_pages(world_view_matrix, proj_matrix, max_scale, test_backface);
+		if (!stream_wait_for_loads || num_requested == 0) {
+			break;
+		}
+		wait_for_loads();
+	}
+	PROFILE_END();
+}
+
+// stops the loader and unmaps the file, the mesh arrays are freed with the mesh
+void close_paged_mesh(void) {
+	if (!is_open) {
+		return;
+	}
+	SDL_LockMutex(stream_mutex);
+	loader_quit = true;
+	SDL_CondBroadcast(stream_changed);
+	SDL_UnlockMutex(stream_mutex);
+	SDL_WaitThread(loader_thread, NULL);
+	SDL_DestroyCond(stream_changed);
+	SDL_DestroyMutex(stream_mutex);
+
+	munmap(map_data, map_size);
+	map_data = NULL;
+	free(pages);
+	free(page_slots);
+	free(slots);
+	free(free_slots);
+	free(used_units);
+	pages = NULL;
+	page_slots = NULL;
+	slots = NULL;
+	free_slots = NULL;
+	used_units = NULL;
+	num_requests = next_request = num_completed = loads_in_flight = 0;
+	lru_head = lru_tail = -1;
+	num_resident_slots = 0;
+	is_open = false;
+}
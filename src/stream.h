@@ -0,0 +1,36 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdbool.h>
+#include "matrix.h"
+#include "cluster.h"
+
+// a paged mesh is stored as one page per cluster, each page holds every level of
+// detail of its faces, the finest first
+#define STREAM_NUM_LODS 2
+#define STREAM_PAGE_MAX_VERTICES CLUSTER_MAX_VERTICES
+#define STREAM_PAGE_MAX_FACES CLUSTER_MAX_FACES
+#define STREAM_PAGE_MAX_EDGES (3 * CLUSTER_MAX_FACES)
+
+// the coarse level keeps about one vertex per cell of a 4x4x4 grid over the page
+#define STREAM_LOD_GRID 4
+// pages use the coarse level while it moves their surface by less than this many pixels on screen
+#define STREAM_LOD_ERROR_PIXELS 0.5f
+
+// memory for the resident pages and their vertex stage output, in MB
+#define STREAM_DEFAULT_BUDGET_MB 256
+// most pages handed to the loader each frame, the nearest missing ones
+#define STREAM_MAX_REQUESTS 32
+
+extern int stream_budget_mb;
+// draw a frame only once the pages it needs are in, for batch rendering
+extern bool stream_wait_for_loads;
+
+bool write_paged_mesh(const char* filename);
+bool is_paged_mesh_file(const char* filename);
+bool open_paged_mesh(const char* filename);
+bool stream_is_open(void);
+void stream_update(const mat3x4_t* world_view_matrix, const mat4_t* proj_matrix, float max_scale, bool test_backface);
+void close_paged_mesh(void);
+
+#endif
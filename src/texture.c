@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "texture.h"
+#include "image.h"
+
+static int next_power_of_two(int n) {
+	int power = 1;
+	while (power < n) power <<= 1;
+	return power;
+}
+
+static int log2_int(int n) {
+	int log = 0;
+	while ((1 << log) < n) log++;
+	return log;
+}
+
+// copy a row major image into the tiled layout of a level
+static void store_level(texture_level_t* level, const uint32_t* pixels, int width, int height) {
+	int padded_width = width > TEXTURE_TILE_SIZE ? width : TEXTURE_TILE_SIZE;
+	int padded_height = height > TEXTURE_TILE_SIZE ? height : TEXTURE_TILE_SIZE;
+
+	level->width = width;
+	level->height = height;
+	level->tiles_per_row_shift = log2_int(padded_width) - TEXTURE_TILE_SHIFT;
+	level->texels = (uint32_t*) calloc(padded_width * padded_height, sizeof(uint32_t));
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			int tile = ((y >> TEXTURE_TILE_SHIFT) << level->tiles_per_row_shift) + (x >> TEXTURE_TILE_SHIFT);
+			int offset = texture_morton_table[x & (TEXTURE_TILE_SIZE - 1)] | (texture_morton_table[y & (TEXTURE_TILE_SIZE - 1)] << 1);
+			level->texels[(tile << (2 * TEXTURE_TILE_SHIFT)) + offset] = pixels[y * width + x];
+		}
+	}
+}
+
+// average a 2x2 block of texels per channel (box filter)
+static uint32_t average_texels(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+	uint32_t result = 0;
+	for (int shift = 0; shift < 32; shift += 8) {
+		uint32_t sum = ((a >> shift) & 0xFF) + ((b >> shift) & 0xFF) + ((c >> shift) & 0xFF) + ((d >> shift) & 0xFF);
+		result |= ((sum + 2) / 4) << shift;
+	}
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build a tiled, mipmapped texture from row major ARGB pixels
+// Images that aren't a power of two in size are resampled (nearest) up to the
+// next power of two so every level can wrap with a mask and halve exactly
+///////////////////////////////////////////////////////////////////////////////
+texture_t* make_texture(const uint32_t* pixels, int width, int height) {
+	texture_t* texture = (texture_t*) malloc(sizeof(texture_t));
+	texture->num_levels = 0;
+
+	int level_width = next_power_of_two(width);
+	int level_height = next_power_of_two(height);
+	uint32_t* level_pixels = (uint32_t*) malloc(sizeof(uint32_t) * level_width * level_height);
+	for (int y = 0; y < level_height; y++) {
+		for (int x = 0; x < level_width; x++) {
+			level_pixels[y * level_width + x] = pixels[(y * height / level_height) * width + (x * width / level_width)];
+		}
+	}
+
+	while (texture->num_levels < TEXTURE_MAX_LEVELS) {
+		store_level(&texture->levels[texture->num_levels++], level_pixels, level_width, level_height);
+		if (level_width == 1 && level_height == 1) {
+			break;
+		}
+
+		// the next level halves each side that is still longer than one texel
+		int next_width = level_width > 1 ? level_width / 2 : 1;
+		int next_height = level_height > 1 ? level_height / 2 : 1;
+		uint32_t* next_pixels = (uint32_t*) malloc(sizeof(uint32_t) * next_width * next_height);
+		for (int y = 0; y < next_height; y++) {
+			int y0 = y * level_height / next_height;
+			int y1 = level_height > 1 ? y0 + 1 : y0;
+			for (int x = 0; x < next_width; x++) {
+				int x0 = x * level_width / next_width;
+				int x1 = level_width > 1 ? x0 + 1 : x0;
+				next_pixels[y * next_width + x] = average_texels(
+					level_pixels[y0 * level_width + x0], level_pixels[y0 * level_width + x1],
+					level_pixels[y1 * level_width + x0], level_pixels[y1 * level_width + x1]);
+			}
+		}
+
+		free(level_pixels);
+		level_pixels = next_pixels;
+		level_width = next_width;
+		level_height = next_height;
+	}
+
+	free(level_pixels);
+	return texture;
+}
+
+texture_t* load_texture(const char* filename) {
+	image_t image;
+	if (!load_image(filename, &image)) {
+		return NULL;
+	}
+	texture_t* texture = make_texture(image.pixels, image.width, image.height);
+	free_image(&image);
+	return texture;
+}
+
+void free_texture(texture_t* texture) {
+	if (!texture) {
+		return;
+	}
+	for (int i = 0; i < texture->num_levels; i++) {
+		free(texture->levels[i].texels);
+	}
+	free(texture);
+}
@@ -0,0 +1,50 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <stdint.h>
+
+typedef struct {
+	float u;
+	float v;
+} tex2_t;
+
+#define TEXTURE_MAX_LEVELS 16
+
+// texels are stored in 8x8 tiles (64 texels, 256 bytes, four cache lines),
+// tiles in row major order and texels in Morton (Z) order inside each tile,
+// so texels that are close in u and v are also close in memory
+#define TEXTURE_TILE_SHIFT 3
+#define TEXTURE_TILE_SIZE (1 << TEXTURE_TILE_SHIFT)
+
+// one mip level, width and height are powers of two
+typedef struct {
+	int width;
+	int height;
+	int tiles_per_row_shift;	// log2 of the number of tiles in a row of the level
+	uint32_t* texels;		// tiled, levels smaller than a tile are padded to one tile
+} texture_level_t;
+
+// a mip chain down to 1x1, level 0 is the full resolution image
+typedef struct {
+	int num_levels;
+	texture_level_t levels[TEXTURE_MAX_LEVELS];
+} texture_t;
+
+// interleaves the 3 bits of a tile coordinate with zeros, x bits go to the
+// even positions of the Morton offset and y bits to the odd ones
+static const uint8_t texture_morton_table[TEXTURE_TILE_SIZE] = { 0, 1, 4, 5, 16, 17, 20, 21 };
+
+// fetch a texel with repeat wrapping, the coordinates are in texels of the level
+static inline uint32_t texture_fetch(const texture_level_t* level, int x, int y) {
+	x &= level->width - 1;
+	y &= level->height - 1;
+	int tile = ((y >> TEXTURE_TILE_SHIFT) << level->tiles_per_row_shift) + (x >> TEXTURE_TILE_SHIFT);
+	int offset = texture_morton_table[x & (TEXTURE_TILE_SIZE - 1)] | (texture_morton_table[y & (TEXTURE_TILE_SIZE - 1)] << 1);
+	return level->texels[(tile << (2 * TEXTURE_TILE_SHIFT)) + offset];
+}
+
+texture_t* load_texture(const char* filename);
+texture_t* make_texture(const uint32_t* pixels, int width, int height);
+void free_texture(texture_t* texture);
+
+#endif
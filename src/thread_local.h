@@ -0,0 +1,8 @@
+#ifndef THREAD_LOCAL_H
+#define THREAD_LOCAL_H
+
+// globals marked THREAD_LOCAL hold per-frame render state, every thread gets
+// its own copy so the batch renderer can draw several frames at once
+#define THREAD_LOCAL __thread
+
+#endif
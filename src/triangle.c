@@ -1,5 +1,8 @@
+#include <math.h>
 #include "triangle.h"
 #include "display.h"
+#include "light.h"
+#include "stats.h"
 
 void int_swap(int* a, int* b) {
 	int tmp = *a;
@@ -7,6 +10,54 @@ void int_swap(int* a, int* b) {
 	*b = tmp;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Fill one scanline with a solid color, clipped to the color buffer
+// In RENDER_OVERDRAW mode the span counts its writes in overdraw_buffer instead
+///////////////////////////////////////////////////////////////////////////////
+void draw_flat_span(int y, int x_start, int x_end, uint32_t color) {
+	if (x_start > x_end) {
+		int_swap(&x_start, &x_end);
+	}
+	if (y < band_top || y >= band_bottom || y >= window_height) {
+		return;
+	}
+	if (x_start < 0) {
+		x_start = 0;
+	}
+	if (x_end > window_width - 1) {
+		x_end = window_width - 1;
+	}
+
+	if (render_method == RENDER_OVERDRAW) {
+		uint16_t* counts = &overdraw_buffer[window_width * (y - band_top)];
+		for (int x = x_start; x <= x_end; x++) {
+			counts[x]++;
+		}
+	} else {
+		uint32_t* row = &color_buffer[window_width * (y - band_top)];
+		for (int x = x_start; x <= x_end; x++) {
+			row[x] = color;
+		}
+	}
+	if (x_end >= x_start) {
+		frame_stats.pixels_filled += x_end - x_start + 1;
+	}
+}
+
+// narrow the scanlines first..last of a triangle to the ones in the band being
+// drawn and on screen, so a triangle tall in a short band isn't walked row by row
+static void clamp_rows_to_band(int* first, int* last) {
+	if (*first < band_top) {
+		*first = band_top;
+	}
+	if (*last > band_bottom - 1) {
+		*last = band_bottom - 1;
+	}
+	if (*last > window_height - 1) {
+		*last = window_height - 1;
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Draw a filled a triangle with a flat bottom
 ///////////////////////////////////////////////////////////////////////////////
@@ -23,19 +74,21 @@ void int_swap(int* a, int* b) {
 void fill_flat_bottom_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color) {
 	// Find two slops (two triangle legs)
 	// SCAN LINES ARE INDEPENDENT IN X, so we are looking for dX/dY
-	float inv_slope_1 = (float)(x1 - x0)/ (y1 - y0);
-	float inv_slope_2 = (float)(x2 - x0)/ (y2 - y0);
+	// a triangle collapsed to a line has no slope, it's the one span at y0
+	float inv_slope_1 = (y1 != y0) ? (float)(x1 - x0)/ (y1 - y0) : 0;
+	float inv_slope_2 = (y2 != y0) ? (float)(x2 - x0)/ (y2 - y0) : 0;
 
-	// start x_start and x_end from the top vertex (x0, y0)
-	float x_start = x0;
-	float x_end = x0;
+	// only the scanlines inside the band being drawn
+	int y_first = y0;
+	int y_last = y2;
+	clamp_rows_to_band(&y_first, &y_last);
 
-	// loop all the scanlines from top to bottom
-	for (int y = y0; y <= y2; y ++) {
+	// loop the scanlines from top to bottom, x_start and x_end measured from the top vertex (x0, y0)
+	for (int y = y_first; y <= y_last; y ++) {
 
-		draw_line(x_start, y, x_end, y, color);
-		x_start += inv_slope_1;
-		x_end += inv_slope_2;
+		float x_start = x0 + inv_slope_1 * (y - y0);
+		float x_end = x0 + inv_slope_2 * (y - y0);
+		draw_flat_span(y, x_start, x_end, color);
 
 	}
 
@@ -56,17 +109,18 @@ void fill_flat_bottom_triangle(int x0, int y0, int x1, int y1, int x2, int y2, u
 ///////////////////////////////////////////////////////////////////////////////
 void fill_flat_top_triangle(int x1, int y1, int x0, int y0, int x2, int y2, uint32_t color) {
 	//START FROM BOTTOM
-	float inv_slope_1 = (float)(x2 - x0)/(y2 - y0);
-	float inv_slope_2 = (float)(x2 - x1)/(y2 - y1);
+	float inv_slope_1 = (y2 != y0) ? (float)(x2 - x0)/(y2 - y0) : 0;
+	float inv_slope_2 = (y2 != y1) ? (float)(x2 - x1)/(y2 - y1) : 0;
 
-	float x_start = x2;
-	float x_end = x2;
+	int y_first = y0;
+	int y_last = y2;
+	clamp_rows_to_band(&y_first, &y_last);
 
-	for (int y=y2; y>= y0; y--) {
+	for (int y=y_last; y>= y_first; y--) {
 
-		draw_line(x_start, y, x_end, y, color);
-		x_start -= inv_slope_1;
-		x_end -= inv_slope_2;
+		float x_start = x2 - inv_slope_1 * (y2 - y);
+		float x_end = x2 - inv_slope_2 * (y2 - y);
+		draw_flat_span(y, x_start, x_end, color);
 
 	}
 }
@@ -130,4 +184,279 @@ void draw_filled_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32
 
 
 
-}
\ No newline at end of file
+}
+void float_swap(float* a, float* b) {
+	float tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+// spans are shaded in chunks of this many pixels by light_modulate_colors()
+#define SPAN_CHUNK 64
+
+// round a 8.16 fixed point intensity to a 1.15 color factor and clamp it
+static uint16_t span_factor(int32_t intensity) {
+	intensity = (intensity + 1) >> 1;
+	intensity = intensity > 0 ? intensity : 0;
+	return intensity < LIGHT_FIXED_ONE ? intensity : LIGHT_FIXED_ONE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Fill one scanline with a color scaled by an intensity interpolated from
+// x_start to x_end; the intensity is stepped in 8.16 fixed point and the
+// pixels are shaded a chunk at a time by the batched color kernel
+///////////////////////////////////////////////////////////////////////////////
+void draw_shaded_span(int y, float x_start, float i_start, float x_end, float i_end, uint32_t color) {
+	if (x_start > x_end) {
+		float_swap(&x_start, &x_end);
+		float_swap(&i_start, &i_end);
+	}
+	if (y < band_top || y >= band_bottom || y >= window_height) {
+		return;
+	}
+
+	int x0 = x_start;
+	int x1 = x_end;
+	float length = (x1 > x0) ? (x1 - x0) : 1;
+	int32_t intensity = i_start * 65536;
+	int32_t intensity_step = (i_end - i_start) * 65536 / length;
+
+	// clip the span to the color buffer
+	if (x0 < 0) {
+		intensity += intensity_step * -x0;
+		x0 = 0;
+	}
+	if (x1 > window_width - 1) {
+		x1 = window_width - 1;
+	}
+	if (x1 >= x0) {
+		frame_stats.pixels_filled += x1 - x0 + 1;
+	}
+
+	uint32_t colors[SPAN_CHUNK];
+	uint16_t factors[SPAN_CHUNK];
+	for (int i = 0; i < SPAN_CHUNK; i++) {
+		colors[i] = color;
+	}
+
+	for (int x = x0; x <= x1; x += SPAN_CHUNK) {
+		int count = (x1 - x + 1 < SPAN_CHUNK) ? x1 - x + 1 : SPAN_CHUNK;
+		for (int i = 0; i < count; i++) {
+			factors[i] = span_factor(intensity);
+			intensity += intensity_step;
+		}
+		light_modulate_colors(&color_buffer[(window_width * (y - band_top)) + x], colors, factors, count);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw a filled triangle with the vertex intensities interpolated (Gouraud shading)
+// Every scanline runs between the long edge (v0-v2) and one of the two short
+// edges (v0-v1 above y1, v1-v2 below it)
+///////////////////////////////////////////////////////////////////////////////
+//
+//                  (x0,y0)
+//                    /  |
+//                   /   |
+//                  /    |
+//                 /     |
+//                /   (x1,y1)
+//               /      /
+//              /     /
+//             /    /
+//            /   /
+//           /  /
+//          / /
+//     (x2,y2)
+//
+///////////////////////////////////////////////////////////////////////////////
+void draw_shaded_triangle(int x0, int y0, float i0, int x1, int y1, float i1, int x2, int y2, float i2, uint32_t color) {
+	//sort the vertices by y-coordinate, y0 < y1 < y2
+	if (y0 > y1) {
+		int_swap(&y0, &y1);
+		int_swap(&x0, &x1);
+		float_swap(&i0, &i1);
+	}
+	if (y1 > y2) {
+		int_swap(&y1, &y2);
+		int_swap(&x1, &x2);
+		float_swap(&i1, &i2);
+	}
+	if (y0 > y1) {
+		int_swap(&y0, &y1);
+		int_swap(&x0, &x1);
+		float_swap(&i0, &i1);
+	}
+
+	int y_first = y0;
+	int y_last = y2;
+	clamp_rows_to_band(&y_first, &y_last);
+
+	for (int y = y_first; y <= y_last; y++) {
+		// position along the long edge
+		float t_long = (y2 != y0) ? (float)(y - y0) / (y2 - y0) : 0;
+		float x_long = x0 + (x2 - x0) * t_long;
+		float i_long = i0 + (i2 - i0) * t_long;
+
+		// position along the short edge that covers this scanline
+		float x_short, i_short;
+		if (y < y1) {
+			float t = (float)(y - y0) / (y1 - y0);
+			x_short = x0 + (x1 - x0) * t;
+			i_short = i0 + (i1 - i0) * t;
+		} else {
+			float t = (y2 != y1) ? (float)(y - y1) / (y2 - y1) : 0;
+			x_short = x1 + (x2 - x1) * t;
+			i_short = i1 + (i2 - i1) * t;
+		}
+
+		draw_shaded_span(y, x_long, i_long, x_short, i_short, color);
+	}
+}
+
+// the attributes of a textured triangle that are linear in screen space
+typedef struct {
+	float x;
+	float u_over_w;	// texture coordinates already scaled to texels of the mip level
+	float v_over_w;
+	float one_over_w;
+	float intensity;
+} textured_point_t;
+
+static textured_point_t lerp_textured_point(textured_point_t a, textured_point_t b, float t) {
+	textured_point_t result = {
+		.x = a.x + (b.x - a.x) * t,
+		.u_over_w = a.u_over_w + (b.u_over_w - a.u_over_w) * t,
+		.v_over_w = a.v_over_w + (b.v_over_w - a.v_over_w) * t,
+		.one_over_w = a.one_over_w + (b.one_over_w - a.one_over_w) * t,
+		.intensity = a.intensity + (b.intensity - a.intensity) * t
+	};
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Fill one scanline of a textured triangle
+// u/w, v/w and 1/w are stepped across the span and divided back per pixel,
+// which gives perspective correct texture coordinates; the texels are then lit
+// a chunk at a time by the same color kernel as the shaded spans
+///////////////////////////////////////////////////////////////////////////////
+void draw_textured_span(int y, textured_point_t start, textured_point_t end, const texture_level_t* level) {
+	if (start.x > end.x) {
+		textured_point_t tmp = start;
+		start = end;
+		end = tmp;
+	}
+	if (y < band_top || y >= band_bottom || y >= window_height) {
+		return;
+	}
+
+	int x0 = start.x;
+	int x1 = end.x;
+	float length = (x1 > x0) ? (x1 - x0) : 1;
+	float u_step = (end.u_over_w - start.u_over_w) / length;
+	float v_step = (end.v_over_w - start.v_over_w) / length;
+	float w_step = (end.one_over_w - start.one_over_w) / length;
+	int32_t intensity_step = (end.intensity - start.intensity) * 65536 / length;
+
+	// clip the span to the color buffer
+	int skipped = (x0 < 0) ? -x0 : 0;
+	x0 += skipped;
+	if (x1 > window_width - 1) {
+		x1 = window_width - 1;
+	}
+	if (x1 >= x0) {
+		frame_stats.pixels_filled += x1 - x0 + 1;
+	}
+
+	float u_over_w = start.u_over_w + u_step * skipped;
+	float v_over_w = start.v_over_w + v_step * skipped;
+	float one_over_w = start.one_over_w + w_step * skipped;
+	int32_t intensity = start.intensity * 65536 + intensity_step * skipped;
+
+	uint32_t texels[SPAN_CHUNK];
+	uint16_t factors[SPAN_CHUNK];
+	for (int x = x0; x <= x1; x += SPAN_CHUNK) {
+		int count = (x1 - x + 1 < SPAN_CHUNK) ? x1 - x + 1 : SPAN_CHUNK;
+		for (int i = 0; i < count; i++) {
+			float w = 1 / one_over_w;
+			texels[i] = texture_fetch(level, (int)(u_over_w * w), (int)(v_over_w * w));
+			factors[i] = span_factor(intensity);
+			u_over_w += u_step;
+			v_over_w += v_step;
+			one_over_w += w_step;
+			intensity += intensity_step;
+		}
+		light_modulate_colors(&color_buffer[(window_width * (y - band_top)) + x], texels, factors, count);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw a textured triangle, scanlines run between the long edge and one of
+// the short edges like in draw_shaded_triangle
+// One mip level is picked per triangle from the ratio of the texels it covers
+// to the pixels it covers, so minified triangles read a small level instead of
+// skipping across the full size texture
+///////////////////////////////////////////////////////////////////////////////
+void draw_textured_triangle(triangle_t* triangle, texture_t* texture) {
+	//sort the vertices by y-coordinate, y0 < y1 < y2
+	int order[3] = { 0, 1, 2 };
+	if (triangle->points[order[0]].y > triangle->points[order[1]].y) int_swap(&order[0], &order[1]);
+	if (triangle->points[order[1]].y > triangle->points[order[2]].y) int_swap(&order[1], &order[2]);
+	if (triangle->points[order[0]].y > triangle->points[order[1]].y) int_swap(&order[0], &order[1]);
+
+	int x[3], y[3];
+	float w[3];
+	for (int i = 0; i < 3; i++) {
+		x[i] = triangle->points[order[i]].x;
+		y[i] = triangle->points[order[i]].y;
+		// positive, the vertex stage cut the triangle at the near plane
+		w[i] = triangle->points[order[i]].w;
+	}
+	tex2_t uv[3] = { triangle->texcoords[order[0]], triangle->texcoords[order[1]], triangle->texcoords[order[2]] };
+
+	// level of detail: half the log2 of the texels per pixel of the whole triangle
+	float screen_area = fabs((float)(x[1] - x[0]) * (y[2] - y[0]) - (float)(y[1] - y[0]) * (x[2] - x[0]));
+	if (screen_area == 0) {
+		return;
+	}
+	float uv_area = fabs((uv[1].u - uv[0].u) * (uv[2].v - uv[0].v) - (uv[1].v - uv[0].v) * (uv[2].u - uv[0].u));
+	float texel_area = uv_area * texture->levels[0].width * texture->levels[0].height;
+	int lod = 0;
+	if (texel_area > screen_area) {
+		lod = (int)(0.5f * log2f(texel_area / screen_area) + 0.5f);
+		if (lod > texture->num_levels - 1) lod = texture->num_levels - 1;
+	}
+	const texture_level_t* level = &texture->levels[lod];
+
+	textured_point_t points[3];
+	for (int i = 0; i < 3; i++) {
+		points[i] = (textured_point_t){
+			.x = x[i],
+			.u_over_w = uv[i].u * level->width / w[i],
+			.v_over_w = uv[i].v * level->height / w[i],
+			.one_over_w = 1 / w[i],
+			.intensity = triangle->intensities[order[i]]
+		};
+	}
+
+	int row_first = y[0];
+	int row_last = y[2];
+	clamp_rows_to_band(&row_first, &row_last);
+
+	for (int row = row_first; row <= row_last; row++) {
+		// position along the long edge
+		float t_long = (y[2] != y[0]) ? (float)(row - y[0]) / (y[2] - y[0]) : 0;
+		textured_point_t long_point = lerp_textured_point(points[0], points[2], t_long);
+
+		// position along the short edge that covers this scanline
+		textured_point_t short_point;
+		if (row < y[1]) {
+			short_point = lerp_textured_point(points[0], points[1], (float)(row - y[0]) / (y[1] - y[0]));
+		} else {
+			float t = (y[2] != y[1]) ? (float)(row - y[1]) / (y[2] - y[1]) : 0;
+			short_point = lerp_textured_point(points[1], points[2], t);
+		}
+
+		draw_textured_span(row, long_point, short_point, level);
+	}
+}
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include "vector.h"
+#include "texture.h"
 
 // Declare a new type to hold face information
 typedef struct {
@@ -13,11 +14,18 @@ typedef struct {
 } face_t;
 
 typedef struct {
-	vec2_t points[3];
+	vec4_t points[3];	// screen x and y, w keeps the view depth for perspective correction
+	tex2_t texcoords[3];
 	uint32_t color;
+	float intensities[3];	// light reaching each vertex, interpolated by Gouraud and textured shading
 	float avg_depth;
+	int face_index;		// index of the face in mesh.faces
+	int edge_mask;		// sides drawn in wireframe modes, see draw_triangle_edges()
+	int8_t sides[3];	// side of the face (0 ab, 1 bc, 2 ca) each side lies on, -1 for a near plane cut
 } triangle_t;
 
 void draw_filled_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color);
+void draw_shaded_triangle(int x0, int y0, float i0, int x1, int y1, float i1, int x2, int y2, float i2, uint32_t color);
+void draw_textured_triangle(triangle_t* triangle, texture_t* texture);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "test.h"
+#include "../src/array.h"
+#include "../src/mesh.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Tests of the renderer modules, run with 'make test'
+// Every test compares a module against a plain reference it has to agree with
+///////////////////////////////////////////////////////////////////////////////
+
+static int num_checks = 0;
+static int num_failed = 0;
+
+bool test_check(bool ok, const char* expression, const char* file, int line) {
+	num_checks++;
+	if (!ok) {
+		num_failed++;
+		fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+	}
+	return ok;
+}
+
+void test_free_mesh(void) {
+	array_free(mesh.vertices);
+	array_free(mesh.normals);
+	array_free(mesh.texcoords);
+	array_free(mesh.faces);
+	array_free(mesh.face_normals);
+	array_free(mesh.edges);
+	array_free(mesh.face_edges);
+	array_free(mesh.clusters);
+	array_free(mesh.cluster_vertices);
+	free_bvh(mesh.bvh);
+	free_compressed_mesh(mesh.compressed);
+	mesh.vertices = mesh.normals = mesh.face_normals = NULL;
+	mesh.texcoords = NULL;
+	mesh.faces = NULL;
+	mesh.edges = NULL;
+	mesh.face_edges = NULL;
+	mesh.clusters = NULL;
+	mesh.cluster_vertices = NULL;
+	mesh.bvh = NULL;
+	mesh.compressed = NULL;
+}
+
+int main(void) {
+	test_cluster();
+	test_frustum();
+	test_light();
+	test_image();
+	test_compress();
+	test_depth_sort();
+
+	printf("%d checks, %d failed\n", num_checks, num_failed);
+	return num_failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,21 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdbool.h>
+
+// count a check, and print the failed ones with where they are; the test goes on
+#define CHECK(condition) test_check((condition), #condition, __FILE__, __LINE__)
+
+bool test_check(bool ok, const char* expression, const char* file, int line);
+
+// free the arrays of a mesh loaded with load_obj_file_data()
+void test_free_mesh(void);
+
+void test_cluster(void);
+void test_frustum(void);
+void test_light(void);
+void test_image(void);
+void test_compress(void);
+void test_depth_sort(void);
+
+#endif
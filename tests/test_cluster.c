@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "test.h"
+#include "../src/array.h"
+#include "../src/mesh.h"
+#include "../src/frustum.h"
+
+#define CULL_VIEWS 500
+
+static const char* assets[] = { "./assets/f22.obj", "./assets/dog.obj" };
+
+static float random_unit(void) {
+	return (float)rand() / RAND_MAX * 2 - 1;
+}
+
+static vec3_t transform(const mat3x4_t* world_view_matrix, int vertex_index) {
+	return vec3_from_vec4(mat3x4_mul_point(world_view_matrix, mesh.vertices[vertex_index - 1]));
+}
+
+// whether every vertex of the faces of the cluster is outside one and the same frustum plane
+static bool cluster_outside_a_plane(const cluster_t* cluster, const mat3x4_t* world_view_matrix) {
+	for (int p = 0; p < NUM_FRUSTUM_PLANES; p++) {
+		bool outside = true;
+		for (int i = cluster->first_face; i < cluster->first_face + cluster->num_faces && outside; i++) {
+			int indices[3] = { mesh.faces[i].a, mesh.faces[i].b, mesh.faces[i].c };
+			for (int j = 0; j < 3; j++) {
+				vec3_t v = transform(world_view_matrix, indices[j]);
+				if (vec3_dot(vec3_subtract(v, frustum_planes[p].point), frustum_planes[p].normal) >= 0) {
+					outside = false;
+				}
+			}
+		}
+		if (outside) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// whether every face of the cluster looks away from the camera, the test update() does per face
+static bool cluster_all_backfaces(const cluster_t* cluster, const mat3x4_t* world_view_matrix) {
+	for (int i = cluster->first_face; i < cluster->first_face + cluster->num_faces; i++) {
+		vec3_t a = transform(world_view_matrix, mesh.faces[i].a);
+		vec3_t b = transform(world_view_matrix, mesh.faces[i].b);
+		vec3_t c = transform(world_view_matrix, mesh.faces[i].c);
+		vec3_t normal = vec3_cross(vec3_subtract(b, a), vec3_subtract(c, a));
+		if (vec3_dot(normal, a) < 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A cluster is culled only if testing its faces one by one would have dropped
+// all of them, from views all around the models near and far
+///////////////////////////////////////////////////////////////////////////////
+void test_cluster(void) {
+	init_frustum_planes(atan(tan(3.14159265f / 6) * 800 / 600) * 2, 3.14159265f / 3, 0.1, 100);
+	srand(1);
+	int num_assets = sizeof(assets) / sizeof(assets[0]);
+	int num_culled[3] = { 0 };
+	for (int a = 0; a < num_assets; a++) {
+		load_obj_file_data((char*)assets[a]);
+		for (int view = 0; view < CULL_VIEWS; view++) {
+			vec3_t rotation = { 3.14159265f * random_unit(), 3.14159265f * random_unit(), 3.14159265f * random_unit() };
+			vec3_t translation = { 3 * random_unit(), 3 * random_unit(), 4 + 4 * random_unit() };
+			// the camera sits at the origin looking down z
+			mat3x4_t world_view_matrix = mat3x4_make_trs((vec3_t){ 1, 1, 1 }, rotation, translation);
+			for (int k = 0; k < array_length(mesh.clusters); k++) {
+				cluster_t* cluster = &mesh.clusters[k];
+				enum cluster_cull_result result = cull_cluster(cluster, &world_view_matrix, 1, true);
+				num_culled[result]++;
+				if (result == CLUSTER_CULLED_FRUSTUM) {
+					CHECK(cluster_outside_a_plane(cluster, &world_view_matrix));
+				} else if (result == CLUSTER_CULLED_BACKFACE) {
+					CHECK(cluster_all_backfaces(cluster, &world_view_matrix));
+				}
+			}
+		}
+		test_free_mesh();
+	}
+	// the views have to exercise both tests
+	CHECK(num_culled[CLUSTER_CULLED_FRUSTUM] > 0);
+	CHECK(num_culled[CLUSTER_CULLED_BACKFACE] > 0);
+	CHECK(num_culled[CLUSTER_VISIBLE] > 0);
+}
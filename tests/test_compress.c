@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "test.h"
+#include "../src/array.h"
+#include "../src/mesh.h"
+#include "../src/compress.h"
+
+static const char* assets[] = { "./assets/f22.obj", "./assets/dog.obj", "./assets/cube2.obj" };
+
+// octahedral normals of 16 bits per coordinate are off by a few thousandths of a radian at most
+#define NORMAL_MAX_ERROR 1e-3f
+
+///////////////////////////////////////////////////////////////////////////////
+// The compressed mesh is only built when asked for, decodes to within half a
+// quantization step of every position and close to every normal, for every
+// vertex of every cluster, and frees the float normals it stands in for when
+// the floats aren't kept
+///////////////////////////////////////////////////////////////////////////////
+void test_compress(void) {
+	int num_assets = sizeof(assets) / sizeof(assets[0]);
+	float x[CLUSTER_MAX_VERTICES], y[CLUSTER_MAX_VERTICES], z[CLUSTER_MAX_VERTICES];
+	for (int a = 0; a < num_assets; a++) {
+		load_obj_file_data((char*)assets[a]);
+		CHECK(mesh.compressed == NULL);
+		compress_loaded_mesh(false);
+		compressed_mesh_t* compressed = mesh.compressed;
+		if (!CHECK(compressed != NULL)) {
+			test_free_mesh();
+			continue;
+		}
+		vec3_t offset = compressed->quantization_offset;
+		vec3_t scale = compressed->quantization_scale;
+		// half a step, and the rounding of the float multiply and add
+		vec3_t max_error = {
+			scale.x / 2 + 1e-5f * fabs(offset.x) + 1e-6f,
+			scale.y / 2 + 1e-5f * fabs(offset.y) + 1e-6f,
+			scale.z / 2 + 1e-5f * fabs(offset.z) + 1e-6f
+		};
+
+		bool positions_close = true, normals_close = true, face_normals_close = true;
+		for (int k = 0; k < array_length(mesh.clusters); k++) {
+			cluster_t* cluster = &mesh.clusters[k];
+			int* cluster_vertices = &mesh.cluster_vertices[cluster->first_vertex];
+
+			decode_positions(&compressed->positions[cluster->first_vertex], cluster->num_vertices, x, y, z);
+			for (int j = 0; j < cluster->num_vertices; j++) {
+				vec3_t v = mesh.vertices[cluster_vertices[j]];
+				positions_close = positions_close &&
+					fabs(offset.x + x[j] * scale.x - v.x) <= max_error.x &&
+					fabs(offset.y + y[j] * scale.y - v.y) <= max_error.y &&
+					fabs(offset.z + z[j] * scale.z - v.z) <= max_error.z;
+			}
+
+			decode_normals(&compressed->normals[cluster->first_vertex], cluster->num_vertices, x, y, z);
+			for (int j = 0; j < cluster->num_vertices; j++) {
+				vec3_t n = mesh.normals[cluster_vertices[j]];
+				vec3_t decoded = { x[j], y[j], z[j] };
+				normals_close = normals_close && vec3_length(vec3_subtract(decoded, n)) <= NORMAL_MAX_ERROR;
+			}
+
+			decode_normals(&compressed->face_normals[cluster->first_face], cluster->num_faces, x, y, z);
+			for (int i = 0; i < cluster->num_faces; i++) {
+				vec3_t n = mesh.face_normals[cluster->first_face + i];
+				vec3_t decoded = { x[i], y[i], z[i] };
+				// degenerate faces have no normal to keep
+				face_normals_close = face_normals_close && (vec3_length(n) == 0 || vec3_length(vec3_subtract(decoded, n)) <= NORMAL_MAX_ERROR);
+			}
+		}
+		CHECK(positions_close);
+		CHECK(normals_close);
+		CHECK(face_normals_close);
+
+		// the second call keeps the same copy and lets the normals go
+		size_t float_bytes = vertex_stage_float_bytes();
+		compress_loaded_mesh(true);
+		CHECK(mesh.compressed == compressed);
+		CHECK(mesh.normals == NULL && mesh.face_normals == NULL);
+		CHECK(vertex_stage_float_bytes() == float_bytes - sizeof(vec3_t) * (array_length(mesh.vertices) + array_length(mesh.faces)));
+		test_free_mesh();
+	}
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "../src/array.h"
+#include "../src/matrix.h"
+#include "../src/depth_sort.h"
+
+#define CLOUD_TRIANGLES 3000
+#define SORT_FRAMES 120
+#define SLOW_TURN 0.01f
+
+static float random_unit(void) {
+	return (float)rand() / RAND_MAX * 2 - 1;
+}
+
+// the triangles of the faces in view at this rotation, in mesh order like prepare_triangles() makes them;
+// every face is in view with a chance of one in drop_chance, all of them when it is 0, and is cut in
+// two at the near plane with a chance of one in split_chance, never when it is 0
+static int make_triangles(triangle_t* triangles, const vec3_t* centers, vec3_t rotation, int drop_chance, int split_chance) {
+	mat3x4_t matrix = mat3x4_make_trs((vec3_t){ 1, 1, 1 }, rotation, (vec3_t){ 0, 0, 5 });
+	int count = 0;
+	for (int i = 0; i < CLOUD_TRIANGLES; i++) {
+		if (drop_chance > 0 && rand() % drop_chance == 0) {
+			continue;
+		}
+		triangles[count].avg_depth = mat3x4_mul_point(&matrix, centers[i]).z;
+		triangles[count].face_index = i;
+		count++;
+		if (split_chance > 0 && rand() % split_chance == 0) {
+			triangles[count] = triangles[count - 1];
+			triangles[count].avg_depth -= 0.001f;
+			count++;
+		}
+	}
+	return count;
+}
+
+static void sort_frames(const vec3_t* centers, bool random_turns, int drop_chance, int split_chance) {
+	triangle_t* coherent = (triangle_t*) calloc(2 * CLOUD_TRIANGLES, sizeof(triangle_t));
+	triangle_t* scratch = (triangle_t*) calloc(2 * CLOUD_TRIANGLES, sizeof(triangle_t));
+	allocate_depth_sort_buffer(CLOUD_TRIANGLES);
+	vec3_t rotation = { 0, 0, 0 };
+	for (int frame = 0; frame < SORT_FRAMES; frame++) {
+		if (random_turns) {
+			rotation = (vec3_t){ 3.14159265f * random_unit(), 3.14159265f * random_unit(), 3.14159265f * random_unit() };
+		} else {
+			rotation.x += SLOW_TURN;
+			rotation.y += SLOW_TURN;
+		}
+		// now and then nothing is in view, with no triangle buffer to sort
+		if (frame % 40 == 20) {
+			coherent_depth_sort = true;
+			sort_triangles_by_depth(NULL, 0);
+			coherent_depth_sort = false;
+			sort_triangles_by_depth(NULL, 0);
+			continue;
+		}
+		int count = make_triangles(coherent, centers, rotation, drop_chance, split_chance);
+		memcpy(scratch, coherent, sizeof(triangle_t) * count);
+
+		// both sorts record the order for the next frame, the same order when they agree
+		coherent_depth_sort = true;
+		sort_triangles_by_depth(coherent, count);
+		coherent_depth_sort = false;
+		sort_triangles_by_depth(scratch, count);
+
+		bool same = true, ordered = true;
+		for (int i = 0; i < count; i++) {
+			same = same && coherent[i].face_index == scratch[i].face_index && coherent[i].avg_depth == scratch[i].avg_depth;
+			if (i > 0) {
+				const triangle_t* a = &scratch[i - 1];
+				const triangle_t* b = &scratch[i];
+				ordered = ordered && (a->avg_depth > b->avg_depth || (a->avg_depth == b->avg_depth && a->face_index < b->face_index));
+			}
+		}
+		CHECK(same);
+		CHECK(ordered);
+	}
+	free_depth_sort_buffer();
+	free(coherent);
+	free(scratch);
+	coherent_depth_sort = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The order repaired from the last frame is the order sorted from scratch,
+// turning slowly or jumping, with faces going in and out of view, faces cut
+// in two pieces, frames with nothing in view, and ties on depth
+///////////////////////////////////////////////////////////////////////////////
+void test_depth_sort(void) {
+	srand(1);
+	vec3_t* centers = NULL;
+	for (int i = 0; i < CLOUD_TRIANGLES; i++) {
+		vec3_t center = { random_unit(), random_unit(), random_unit() };
+		// every tenth face shares the place of the one before it, so some depths tie
+		if (i % 10 == 9) {
+			center = centers[i - 1];
+		}
+		array_push(centers, center);
+	}
+	for (int random_turns = 0; random_turns < 2; random_turns++) {
+		sort_frames(centers, random_turns, 0, 0);
+		sort_frames(centers, random_turns, 5, 0);
+		sort_frames(centers, random_turns, 5, 7);
+	}
+	array_free(centers);
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "test.h"
+#include "../src/frustum.h"
+
+#define CLIP_TRIANGLES 10000
+#define CLIP_EPSILON 1e-4f
+
+static float random_unit(void) {
+	return (float)rand() / RAND_MAX * 2 - 1;
+}
+
+// texture coordinates and intensity made affine in the position, so they stay on it when cut
+static clip_vertex_t make_corner(vec3_t position, int side) {
+	return (clip_vertex_t){
+		position,
+		{ 0.5f + 0.25f * position.x - 0.125f * position.z, 0.5f + 0.25f * position.y },
+		0.5f + 0.5f * position.z,
+		side
+	};
+}
+
+static bool same_attributes(const clip_vertex_t* v) {
+	clip_vertex_t expected = make_corner(v->position, v->side);
+	return fabs(v->texcoord.u - expected.texcoord.u) < CLIP_EPSILON &&
+		fabs(v->texcoord.v - expected.texcoord.v) < CLIP_EPSILON &&
+		fabs(v->intensity - expected.intensity) < CLIP_EPSILON;
+}
+
+// distance from p to the line through a and b
+static float line_distance(vec3_t p, vec3_t a, vec3_t b) {
+	vec3_t ab = vec3_subtract(b, a);
+	return vec3_length(vec3_cross(vec3_subtract(p, a), ab)) / vec3_length(ab);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Triangles cut at the near plane keep the part in front of it: the corners
+// in front and one corner per side crossing the plane, with texture
+// coordinates and intensities interpolated, and every edge either on a side
+// of the face it says or on the plane
+///////////////////////////////////////////////////////////////////////////////
+void test_frustum(void) {
+	init_frustum_planes(atan(tan(3.14159265f / 6) * 800 / 600) * 2, 3.14159265f / 3, 0.1, 100);
+	float z_near = frustum_planes[NEAR_FRUSTUM_PLANE].point.z;
+	srand(1);
+	bool counts_right = true, in_front = true, attributes_right = true, sides_right = true;
+	int num_cut[5] = { 0 };
+	for (int n = 0; n < CLIP_TRIANGLES; n++) {
+		clip_vertex_t triangle[3], clipped[4];
+		int num_inside = 0;
+		for (int j = 0; j < 3; j++) {
+			triangle[j] = make_corner((vec3_t){ random_unit(), random_unit(), z_near + random_unit() }, j);
+			num_inside += triangle[j].position.z >= z_near;
+		}
+		int count = clip_triangle_to_near_plane(triangle, clipped);
+		num_cut[count]++;
+		static const int expected_counts[4] = { 0, 3, 4, 3 };
+		counts_right = counts_right && count == expected_counts[num_inside];
+
+		for (int k = 0; k < count; k++) {
+			const clip_vertex_t* from = &clipped[k];
+			const clip_vertex_t* to = &clipped[(k + 1) % count];
+			in_front = in_front && from->position.z >= z_near;
+			attributes_right = attributes_right && same_attributes(from);
+			if (from->side < 0) {
+				sides_right = sides_right && from->position.z == z_near && to->position.z == z_near;
+			} else {
+				vec3_t a = triangle[from->side].position;
+				vec3_t b = triangle[(from->side + 1) % 3].position;
+				sides_right = sides_right &&
+					line_distance(from->position, a, b) < CLIP_EPSILON && line_distance(to->position, a, b) < CLIP_EPSILON;
+			}
+		}
+	}
+	CHECK(counts_right);
+	CHECK(in_front);
+	CHECK(attributes_right);
+	CHECK(sides_right);
+	// every case happened
+	CHECK(num_cut[0] > 0 && num_cut[3] > 0 && num_cut[4] > 0);
+}
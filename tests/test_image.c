@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "../src/image.h"
+
+// 5x5 RGB, one row per filter type: none, sub, up, average, paeth
+static const uint8_t rgb_png[] = {
+	0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a, 0x00, 0x00, 0x00, 0x0d, 0x49, 0x48, 0x44, 0x52,
+	0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x05, 0x08, 0x02, 0x00, 0x00, 0x00, 0x02, 0x0d, 0xb1,
+	0xb2, 0x00, 0x00, 0x00, 0x4c, 0x49, 0x44, 0x41, 0x54, 0x78, 0xda, 0x63, 0x60, 0x60, 0x60, 0x30,
+	0x62, 0x66, 0x48, 0x61, 0x63, 0x98, 0xc6, 0xc9, 0x70, 0x82, 0x87, 0x81, 0x91, 0x5d, 0x03, 0xc8,
+	0xe7, 0x85, 0x23, 0x26, 0x20, 0x9f, 0x5d, 0x83, 0x97, 0x5d, 0x43, 0x8a, 0x5d, 0x43, 0x9d, 0x5d,
+	0xc3, 0x84, 0x99, 0x2f, 0x80, 0x41, 0x56, 0x4c, 0x4a, 0x56, 0x4c, 0x51, 0x56, 0x4c, 0x5d, 0x56,
+	0x4c, 0x8f, 0x05, 0x24, 0xcf, 0xcc, 0xcb, 0xce, 0x2c, 0xc5, 0xce, 0xac, 0xce, 0xce, 0x6c, 0x02,
+	0x00, 0x3c, 0xab, 0x07, 0x54, 0xdb, 0x28, 0xf2, 0xc1, 0x00, 0x00, 0x00, 0x00, 0x49, 0x45, 0x4e,
+	0x44, 0xae, 0x42, 0x60, 0x82,
+};
+
+// 6x2, 2 bits per pixel into a palette of four colors, index (x + y) % 4
+static const uint8_t palette_png[] = {
+	0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a, 0x00, 0x00, 0x00, 0x0d, 0x49, 0x48, 0x44, 0x52,
+	0x00, 0x00, 0x00, 0x06, 0x00, 0x00, 0x00, 0x02, 0x02, 0x03, 0x00, 0x00, 0x00, 0x06, 0x33, 0x45,
+	0xcd, 0x00, 0x00, 0x00, 0x0c, 0x50, 0x4c, 0x54, 0x45, 0xff, 0x00, 0x00, 0x00, 0xff, 0x00, 0x00,
+	0x00, 0xff, 0x09, 0x63, 0xc7, 0xbf, 0xbf, 0x12, 0x1c, 0x00, 0x00, 0x00, 0x0e, 0x49, 0x44, 0x41,
+	0x54, 0x78, 0xda, 0x63, 0x90, 0x16, 0x60, 0xc8, 0x49, 0x00, 0x00, 0x02, 0x05, 0x00, 0xf8, 0x52,
+	0xdd, 0xf9, 0x33, 0x00, 0x00, 0x00, 0x00, 0x49, 0x45, 0x4e, 0x44, 0xae, 0x42, 0x60, 0x82,
+};
+
+// odd sizes, so rows don't line up with anything
+#define IMAGE_WIDTH 97
+#define IMAGE_HEIGHT 61
+
+static const uint32_t palette[4] = { 0xFFFF0000, 0xFF00FF00, 0xFF0000FF, 0xFF0963C7 };
+
+// the pixels rgb_png was written with, and the P6 and P3 files below
+static uint32_t rgb_pixel(int x, int y) {
+	return 0xFF000000 | ((x * 50 + y * 7) & 0xFF) << 16 | ((y * 40 + x * 3) & 0xFF) << 8 | ((x * y * 13) & 0xFF);
+}
+
+static bool has_rgb_pixels(const image_t* image, int width, int height) {
+	if (image->width != width || image->height != height) {
+		return false;
+	}
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			if (image->pixels[y * width + x] != rgb_pixel(x, y)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// noise on the left half for the literals, smooth gradients on the right for the filters and matches
+static image_t make_image(void) {
+	image_t image = { IMAGE_WIDTH, IMAGE_HEIGHT, (uint32_t*) malloc(sizeof(uint32_t) * IMAGE_WIDTH * IMAGE_HEIGHT) };
+	srand(1);
+	for (int y = 0; y < IMAGE_HEIGHT; y++) {
+		for (int x = 0; x < IMAGE_WIDTH; x++) {
+			uint32_t rgb = x < IMAGE_WIDTH / 2 ? (uint32_t)rand() & 0xFFFFFF : (uint32_t)((x * 2) << 16 | (y * 4) << 8 | (x + y));
+			image.pixels[y * IMAGE_WIDTH + x] = 0xFF000000 | rgb;
+		}
+	}
+	return image;
+}
+
+static bool same_pixels(const image_t* a, const image_t* b) {
+	return a->width == b->width && a->height == b->height &&
+		memcmp(a->pixels, b->pixels, sizeof(uint32_t) * a->width * a->height) == 0;
+}
+
+// the whole of a file written with the image writer, decoded
+static bool decode_file(FILE* file, bool is_png, image_t* image) {
+	long size = ftell(file);
+	uint8_t* data = (uint8_t*) malloc(size > 0 ? size : 1);
+	rewind(file);
+	bool ok = size > 0 && fread(data, 1, size, file) == (size_t)size &&
+		(is_png ? decode_png(data, size, image) : decode_ppm(data, size, image));
+	free(data);
+	return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The decoders give back the pixels the files were written with, through
+// every PNG row filter, a packed palette and both PPM flavors, and get back
+// what the encoders wrote, whole or a band of rows at a time; headers asking
+// for more than the decoders take are refused
+///////////////////////////////////////////////////////////////////////////////
+void test_image(void) {
+	image_t image = { 0 };
+	CHECK(decode_png(rgb_png, sizeof(rgb_png), &image));
+	CHECK(has_rgb_pixels(&image, 5, 5));
+	free_image(&image);
+
+	CHECK(decode_png(palette_png, sizeof(palette_png), &image));
+	bool same = image.width == 6 && image.height == 2;
+	for (int i = 0; same && i < 12; i++) {
+		same = image.pixels[i] == palette[(i % 6 + i / 6) % 4];
+	}
+	CHECK(same);
+	free_image(&image);
+
+	// 3x2 in binary and in text with a comment
+	uint8_t p6[64];
+	int size = sprintf((char*)p6, "P6\n3 2\n255\n");
+	for (int y = 0; y < 2; y++) {
+		for (int x = 0; x < 3; x++) {
+			uint32_t c = rgb_pixel(x, y);
+			p6[size++] = c >> 16;
+			p6[size++] = c >> 8;
+			p6[size++] = c;
+		}
+	}
+	CHECK(decode_ppm(p6, size, &image));
+	CHECK(has_rgb_pixels(&image, 3, 2));
+	free_image(&image);
+
+	char p3[256];
+	int length = sprintf(p3, "P3\n# a comment\n3 2\n255\n");
+	for (int y = 0; y < 2; y++) {
+		for (int x = 0; x < 3; x++) {
+			uint32_t c = rgb_pixel(x, y);
+			length += sprintf(p3 + length, "%d %d %d\n", (int)(c >> 16 & 0xFF), (int)(c >> 8 & 0xFF), (int)(c & 0xFF));
+		}
+	}
+	CHECK(decode_ppm((const uint8_t*)p3, length, &image));
+	CHECK(has_rgb_pixels(&image, 3, 2));
+	free_image(&image);
+
+	// cut short, the decoders refuse rather than read past the end
+	CHECK(!decode_png(rgb_png, sizeof(rgb_png) / 2, &image));
+	CHECK(!decode_ppm(p6, size - 1, &image));
+
+	image_t original = make_image();
+	for (int is_png = 0; is_png < 2; is_png++) {
+		uint8_t* data = is_png ? encode_png(&original, &size) : encode_ppm(&original, &size);
+		CHECK(data && (is_png ? decode_png(data, size, &image) : decode_ppm(data, size, &image)));
+		CHECK(same_pixels(&original, &image));
+		free_image(&image);
+		free(data);
+
+		// bands of one row, of a few rows that don't divide the height, and of the whole image
+		static const int band_rows[] = { 1, 7, IMAGE_HEIGHT };
+		for (int b = 0; b < 3; b++) {
+			FILE* file = tmpfile();
+			if (!CHECK(file != NULL)) {
+				continue;
+			}
+			image_writer_t* writer = open_image_writer(file, is_png, IMAGE_WIDTH, IMAGE_HEIGHT);
+			bool ok = true;
+			for (int y = 0; y < IMAGE_HEIGHT; y += band_rows[b]) {
+				int rows = IMAGE_HEIGHT - y < band_rows[b] ? IMAGE_HEIGHT - y : band_rows[b];
+				ok = write_image_rows(writer, &original.pixels[y * IMAGE_WIDTH], rows) && ok;
+			}
+			CHECK(close_image_writer(writer) && ok);
+			CHECK(decode_file(file, is_png, &image));
+			CHECK(same_pixels(&original, &image));
+			free_image(&image);
+			fclose(file);
+		}
+	}
+	free_image(&original);
+
+	// a PNG header of 32768x32768, the decoded rows would take 4 GB
+	uint8_t huge_png[sizeof(rgb_png)];
+	memcpy(huge_png, rgb_png, sizeof(rgb_png));
+	static const uint8_t huge_size[8] = { 0, 0, 0x80, 0, 0, 0, 0x80, 0 };
+	memcpy(huge_png + 16, huge_size, sizeof(huge_size));
+	CHECK(!decode_png(huge_png, sizeof(huge_png), &image));
+
+	// PPM sizes past the limit, and past an int
+	static const char* huge_ppms[] = { "P6\n65536 65536\n255\n", "P6\n99999999999 2\n255\n" };
+	for (int i = 0; i < 2; i++) {
+		CHECK(!decode_ppm((const uint8_t*)huge_ppms[i], strlen(huge_ppms[i]), &image));
+	}
+}
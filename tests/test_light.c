@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <math.h>
+#include "test.h"
+#include "../src/light.h"
+
+// intensities swept in steps of 1/SWEEP_STEPS from 0 to 1
+#define SWEEP_STEPS 65536
+// every channel value once, three to a color, the last one left over for the scalar tail of the kernel
+#define SWEEP_COLORS 86
+#define SWEEP_ALPHA 0xAB000000
+
+// the float product the fixed point factors stand in for
+static uint32_t float_channel(uint32_t channel, float intensity) {
+	return (uint32_t)(channel * intensity);
+}
+
+// the fixed point result has to be the float one, but may round down the other way when
+// the float product is within a hair of a whole number
+static bool close_to_float(uint32_t fixed, uint32_t channel, float intensity) {
+	float product = channel * intensity;
+	uint32_t expected = float_channel(channel, intensity);
+	return fixed == expected || ((fixed + 1 == expected || fixed == expected + 1) && fabsf(product - roundf(product)) < 1.0f / 128);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Colors lit with the fixed point factors, one at a time and in batches, come
+// out as the float product of every channel value and a dense sweep of
+// intensities, exactly at multiples of 1/256, and alpha is kept
+///////////////////////////////////////////////////////////////////////////////
+void test_light(void) {
+	uint32_t colors[SWEEP_COLORS], batch[SWEEP_COLORS];
+	uint16_t factors[SWEEP_COLORS];
+	for (int k = 0; k < SWEEP_COLORS; k++) {
+		colors[k] = SWEEP_ALPHA | ((3 * k) % 256) << 16 | ((3 * k + 1) % 256) << 8 | ((3 * k + 2) % 256);
+	}
+
+	bool single_right = true, batch_right = true, exact_right = true, alpha_kept = true;
+	int num_off = 0;
+	for (int step = 0; step <= SWEEP_STEPS; step++) {
+		float intensity = (float)step / SWEEP_STEPS;
+		for (int k = 0; k < SWEEP_COLORS; k++) {
+			factors[k] = light_intensity_to_fixed(intensity);
+		}
+		light_modulate_colors(batch, colors, factors, SWEEP_COLORS);
+		for (int k = 0; k < SWEEP_COLORS; k++) {
+			uint32_t single = light_apply_intensity(colors[k], intensity);
+			for (int shift = 0; shift < 24; shift += 8) {
+				uint32_t channel = colors[k] >> shift & 0xFF;
+				uint32_t single_channel = single >> shift & 0xFF;
+				uint32_t batch_channel = batch[k] >> shift & 0xFF;
+				single_right = single_right && close_to_float(single_channel, channel, intensity);
+				batch_right = batch_right && batch_channel == single_channel;
+				if (step % (SWEEP_STEPS / 256) == 0) {
+					exact_right = exact_right && single_channel == float_channel(channel, intensity);
+				}
+				num_off += single_channel != float_channel(channel, intensity);
+			}
+			alpha_kept = alpha_kept && (single & 0xFF000000) == SWEEP_ALPHA && (batch[k] & 0xFF000000) == SWEEP_ALPHA;
+		}
+	}
+	CHECK(single_right);
+	CHECK(batch_right);
+	CHECK(exact_right);
+	CHECK(alpha_kept);
+	// rounding down the other way is rare, not a bias
+	CHECK(num_off < (SWEEP_STEPS + 1) * 256 / 100);
+
+	// out of range intensities clamp
+	CHECK(light_apply_intensity(0xFF808080, -0.5f) == 0xFF000000);
+	CHECK(light_apply_intensity(0xFF808080, 1.5f) == 0xFF808080);
+}